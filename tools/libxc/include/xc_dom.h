@@ -265,6 +265,14 @@ int xc_dom_devicetree_file(struct xc_dom_image *dom, const char *filename);
 int xc_dom_devicetree_mem(struct xc_dom_image *dom, const void *mem,
                           size_t memsize);
 
+/*
+ * Find a loader for the kernel image, which decompresses it if need be,
+ * and return the image the loader will actually be run on.  The image
+ * stays owned by dom.  Handing it to xc_dom_kernel_mem for another
+ * domain skips all the decompression.
+ */
+int xc_dom_kernel_probe(struct xc_dom_image *dom, const void **blob,
+                        size_t *size);
 int xc_dom_parse_image(struct xc_dom_image *dom);
 struct xc_dom_arch *xc_dom_find_arch_hooks(xc_interface *xch, char *guest_type);
 int xc_dom_build_image(struct xc_dom_image *dom);
@@ -2032,6 +2032,41 @@ int xc_hvm_unmap_io_range_from_ioreq_server(xc_interface *xch,
                                             uint64_t start,
                                             uint64_t end);
 
+/**
+ * This function marks a range of memory, already registered for emulation
+ * by the IOREQ Server, as taking posted writes: writes within it are sent
+ * through the buffered ioreq ring where possible, without waiting for the
+ * emulator to complete them.
+ *
+ * @parm xch a handle to an open hypervisor interface.
+ * @parm domid the domain id to be serviced
+ * @parm id the IOREQ Server id.
+ * @parm start start of range
+ * @parm end end of range (inclusive).
+ * @return 0 on success, -1 on failure.
+ */
+int xc_hvm_map_posted_range_to_ioreq_server(xc_interface *xch,
+                                            domid_t domid,
+                                            ioservid_t id,
+                                            uint64_t start,
+                                            uint64_t end);
+
+/**
+ * This function removes a posted write range.
+ *
+ * @parm xch a handle to an open hypervisor interface.
+ * @parm domid the domain id to be serviced
+ * @parm id the IOREQ Server id.
+ * @parm start start of range
+ * @parm end end of range (inclusive).
+ * @return 0 on success, -1 on failure.
+ */
+int xc_hvm_unmap_posted_range_from_ioreq_server(xc_interface *xch,
+                                                domid_t domid,
+                                                ioservid_t id,
+                                                uint64_t start,
+                                                uint64_t end);
+
 /**
  * This function registers a PCI device for config space emulation.
  *
@@ -2566,6 +2601,46 @@ int xc_memshr_share_grefs(xc_interface *xch,
                     grant_ref_t client_gref,
                     uint64_t client_handle);
 
+/* Nominate both sides of a batch of gfn pairs, all with source_domain as the
+ * source, in one hypercall.  The handles of each entry are filled in (0 for a
+ * side which could not be nominated), its rc is set to the first failure as
+ * xc_memshr_nominate_gfn() would report it (as a negative errno value), and
+ * nr_nominated to the number of pairs with both sides nominated.
+ */
+int xc_memshr_nominate_batch(xc_interface *xch,
+                             domid_t source_domain,
+                             xen_mem_sharing_batch_entry_t *entries,
+                             uint32_t nr,
+                             uint32_t *nr_nominated);
+
+/* Share a batch of nominated gfn pairs, all with source_domain as the
+ * source, in one hypercall.  Each entry's rc is set to the result for that
+ * pair as xc_memshr_share_gfns() would return it (as a negative value), and
+ * nr_shared to the number of pairs shared.
+ */
+int xc_memshr_share_batch(xc_interface *xch,
+                          domid_t source_domain,
+                          xen_mem_sharing_batch_entry_t *entries,
+                          uint32_t nr,
+                          uint32_t *nr_shared);
+
+/* Nominate and share every gfn in [first_gfn, last_gfn] of source_domain
+ * with the same gfn of client_domain, without comparing contents: this is
+ * meant for domains started from the same memory image.  Both domains must
+ * be paused.  Pages which cannot be shared are skipped, and nr_shared is set
+ * to the number of pages shared.
+ *
+ * May fail with
+ *  EINVAL if either domain is running or the range is invalid.
+ *  ENOMEM if internal data structures cannot be allocated.
+ */
+int xc_memshr_range_share(xc_interface *xch,
+                          domid_t source_domain,
+                          domid_t client_domain,
+                          uint64_t first_gfn,
+                          uint64_t last_gfn,
+                          uint64_t *nr_shared);
+
 /* Allows to add to the guest physmap of the client domain a shared frame
  * directly.
  *
@@ -836,6 +836,21 @@ int xc_dom_devicetree_mem(struct xc_dom_image *dom, const void *mem,
     return 0;
 }
 
+int xc_dom_kernel_probe(struct xc_dom_image *dom, const void **blob,
+                        size_t *size)
+{
+    DOMPRINTF_CALLED(dom->xch);
+
+    if ( dom->kernel_loader == NULL )
+        dom->kernel_loader = xc_dom_find_loader(dom);
+    if ( dom->kernel_loader == NULL )
+        return -1;
+
+    *blob = dom->kernel_blob;
+    *size = dom->kernel_size;
+    return 0;
+}
+
 int xc_dom_parse_image(struct xc_dom_image *dom)
 {
     int i;
@@ -1496,9 +1496,9 @@ done:
     return rc;
 }
 
-int xc_hvm_map_io_range_to_ioreq_server(xc_interface *xch, domid_t domid,
-                                        ioservid_t id, int is_mmio,
-                                        uint64_t start, uint64_t end)
+static int xc_hvm_io_range_op(xc_interface *xch, unsigned int op,
+                              domid_t domid, ioservid_t id, uint32_t type,
+                              uint64_t start, uint64_t end)
 {
     DECLARE_HYPERCALL;
     DECLARE_HYPERCALL_BUFFER(xen_hvm_io_range_t, arg);
@@ -1509,12 +1509,12 @@ int xc_hvm_map_io_range_to_ioreq_server(xc_interface *xch, domid_t domid,
         return -1;
 
     hypercall.op     = __HYPERVISOR_hvm_op;
-    hypercall.arg[0] = HVMOP_map_io_range_to_ioreq_server;
+    hypercall.arg[0] = op;
     hypercall.arg[1] = HYPERCALL_BUFFER_AS_ARG(arg);
 
     arg->domid = domid;
     arg->id = id;
-    arg->type = is_mmio ? HVMOP_IO_RANGE_MEMORY : HVMOP_IO_RANGE_PORT;
+    arg->type = type;
     arg->start = start;
     arg->end = end;
 
@@ -1524,32 +1524,42 @@ int xc_hvm_map_io_range_to_ioreq_server(xc_interface *xch, domid_t domid,
     return rc;
 }
 
+int xc_hvm_map_io_range_to_ioreq_server(xc_interface *xch, domid_t domid,
+                                        ioservid_t id, int is_mmio,
+                                        uint64_t start, uint64_t end)
+{
+    return xc_hvm_io_range_op(xch, HVMOP_map_io_range_to_ioreq_server,
+                              domid, id,
+                              is_mmio ? HVMOP_IO_RANGE_MEMORY
+                                      : HVMOP_IO_RANGE_PORT,
+                              start, end);
+}
+
 int xc_hvm_unmap_io_range_from_ioreq_server(xc_interface *xch, domid_t domid,
                                             ioservid_t id, int is_mmio,
                                             uint64_t start, uint64_t end)
 {
-    DECLARE_HYPERCALL;
-    DECLARE_HYPERCALL_BUFFER(xen_hvm_io_range_t, arg);
-    int rc;
-
-    arg = xc_hypercall_buffer_alloc(xch, arg, sizeof(*arg));
-    if ( arg == NULL )
-        return -1;
-
-    hypercall.op     = __HYPERVISOR_hvm_op;
-    hypercall.arg[0] = HVMOP_unmap_io_range_from_ioreq_server;
-    hypercall.arg[1] = HYPERCALL_BUFFER_AS_ARG(arg);
-
-    arg->domid = domid;
-    arg->id = id;
-    arg->type = is_mmio ? HVMOP_IO_RANGE_MEMORY : HVMOP_IO_RANGE_PORT;
-    arg->start = start;
-    arg->end = end;
+    return xc_hvm_io_range_op(xch, HVMOP_unmap_io_range_from_ioreq_server,
+                              domid, id,
+                              is_mmio ? HVMOP_IO_RANGE_MEMORY
+                                      : HVMOP_IO_RANGE_PORT,
+                              start, end);
+}
 
-    rc = do_xen_hypercall(xch, &hypercall);
+int xc_hvm_map_posted_range_to_ioreq_server(xc_interface *xch, domid_t domid,
+                                            ioservid_t id, uint64_t start,
+                                            uint64_t end)
+{
+    return xc_hvm_io_range_op(xch, HVMOP_map_io_range_to_ioreq_server,
+                              domid, id, HVMOP_IO_RANGE_POSTED, start, end);
+}
 
-    xc_hypercall_buffer_free(xch, arg);
-    return rc;
+int xc_hvm_unmap_posted_range_from_ioreq_server(xc_interface *xch,
+                                                domid_t domid, ioservid_t id,
+                                                uint64_t start, uint64_t end)
+{
+    return xc_hvm_io_range_op(xch, HVMOP_unmap_io_range_from_ioreq_server,
+                              domid, id, HVMOP_IO_RANGE_POSTED, start, end);
 }
 
 int xc_hvm_map_pcidev_to_ioreq_server(xc_interface *xch, domid_t domid,
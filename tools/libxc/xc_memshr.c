@@ -160,6 +160,84 @@ int xc_memshr_share_grefs(xc_interface *xch,
     return xc_memshr_memop(xch, source_domain, &mso);
 }
 
+static int xc_memshr_batch(xc_interface *xch,
+                           domid_t source_domain,
+                           uint8_t op,
+                           xen_mem_sharing_batch_entry_t *entries,
+                           uint32_t nr,
+                           uint32_t *nr_done)
+{
+    int rc;
+    xen_mem_sharing_op_t mso;
+    DECLARE_HYPERCALL_BOUNCE(entries, nr * sizeof(*entries),
+                             XC_HYPERCALL_BUFFER_BOUNCE_BOTH);
+
+    if ( xc_hypercall_bounce_pre(xch, entries) )
+        return -1;
+
+    memset(&mso, 0, sizeof(mso));
+
+    mso.op = op;
+    mso.u.batch.nr = nr;
+    set_xen_guest_handle(mso.u.batch.entries, entries);
+
+    rc = xc_memshr_memop(xch, source_domain, &mso);
+
+    xc_hypercall_bounce_post(xch, entries);
+
+    if ( !rc && nr_done )
+        *nr_done = mso.u.batch.nr_shared;
+
+    return rc;
+}
+
+int xc_memshr_nominate_batch(xc_interface *xch,
+                             domid_t source_domain,
+                             xen_mem_sharing_batch_entry_t *entries,
+                             uint32_t nr,
+                             uint32_t *nr_nominated)
+{
+    return xc_memshr_batch(xch, source_domain,
+                           XENMEM_sharing_op_nominate_batch,
+                           entries, nr, nr_nominated);
+}
+
+int xc_memshr_share_batch(xc_interface *xch,
+                          domid_t source_domain,
+                          xen_mem_sharing_batch_entry_t *entries,
+                          uint32_t nr,
+                          uint32_t *nr_shared)
+{
+    return xc_memshr_batch(xch, source_domain,
+                           XENMEM_sharing_op_share_batch,
+                           entries, nr, nr_shared);
+}
+
+int xc_memshr_range_share(xc_interface *xch,
+                          domid_t source_domain,
+                          domid_t client_domain,
+                          uint64_t first_gfn,
+                          uint64_t last_gfn,
+                          uint64_t *nr_shared)
+{
+    int rc;
+    xen_mem_sharing_op_t mso;
+
+    memset(&mso, 0, sizeof(mso));
+
+    mso.op = XENMEM_sharing_op_range_share;
+    mso.u.range.client_domain = client_domain;
+    mso.u.range.first_gfn = first_gfn;
+    mso.u.range.last_gfn = last_gfn;
+
+    rc = xc_memshr_memop(xch, source_domain, &mso);
+
+    if ( !rc && nr_shared )
+        *nr_shared = mso.u.range.nr_shared;
+
+    return rc;
+}
+
 int xc_memshr_add_to_physmap(xc_interface *xch,
                     domid_t source_domain,
                     unsigned long source_gfn,
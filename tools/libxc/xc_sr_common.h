@@ -194,6 +194,10 @@ struct xc_sr_context
             unsigned long *deferred_pages;
             unsigned long nr_deferred_pages;
             xc_hypercall_buffer_t dirty_bitmap_hbuf;
+
+            /* Fetch dirty pfns from Xen's dirty ring rather than a bitmap. */
+            bool dirty_ring;
+            xc_hypercall_buffer_t dirty_ring_hbuf;
         } save;
 
         struct /* Restore data. */
@@ -397,6 +397,104 @@ static int send_dirty_pages(struct xc_sr_context *ctx,
     return 0;
 }
 
+/*
+ * Most ring entries asked of Xen.  The drain buffer is as large as the ring,
+ * so that each round pauses the guest once (barring preemption) to flush
+ * PML and empty the ring.
+ */
+#define DIRTY_RING_ENTRIES (1UL << 18)
+
+static unsigned long dirty_ring_size(const struct xc_sr_context *ctx)
+{
+    return min(ctx->save.p2m_size, DIRTY_RING_ENTRIES);
+}
+
+/*
+ * Send the pages queued on Xen's dirty ring.  Rounds which only dirty a
+ * small part of a large guest then cost in proportion to the dirty pages,
+ * rather than to the size of the p2m.
+ *
+ * Returns 0 and the number of pages sent via @sent, or -1.  errno is
+ * EOVERFLOW if the ring has dropped pfns, in which case the caller must
+ * fall back to a CLEAN of the bitmap for this round.
+ */
+static int send_dirty_ring(struct xc_sr_context *ctx, unsigned long *sent)
+{
+    xc_interface *xch = ctx->xch;
+    xc_shadow_op_stats_t stats;
+    unsigned long entries = 0, drained = 0, written = 0;
+    int i, nr, rc;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, pfns,
+                                    &ctx->save.dirty_ring_hbuf);
+
+    do {
+        nr = xc_shadow_control(xch, ctx->domid,
+                               XEN_DOMCTL_SHADOW_OP_DIRTY_RING_DRAIN,
+                               &ctx->save.dirty_ring_hbuf,
+                               dirty_ring_size(ctx),
+                               NULL, 0, &stats);
+        if ( nr < 0 )
+        {
+            if ( errno != EOVERFLOW )
+                PERROR("Failed to drain dirty ring");
+            return -1;
+        }
+
+        /*
+         * A drain comes back short only when Xen was preempted.  Only
+         * drain what was queued when we started: a running guest keeps
+         * adding to the ring, and the next round will pick that up.
+         */
+        if ( drained == 0 )
+            entries = nr + stats.dirty_count;
+        drained += nr;
+
+        for ( i = 0; i < nr; ++i )
+        {
+            if ( pfns[i] >= ctx->save.p2m_size )
+                continue;
+
+            rc = add_to_batch(ctx, pfns[i]);
+            if ( rc )
+                return rc;
+
+            /* Update progress every 4MB worth of memory sent. */
+            if ( (written & ((1U << (22 - 12)) - 1)) == 0 )
+                xc_report_progress_step(xch, written, entries);
+
+            ++written;
+        }
+    } while ( nr && drained < entries );
+
+    rc = flush_batch(ctx);
+    if ( rc )
+        return rc;
+
+    xc_report_progress_step(xch, entries, entries);
+    *sent = written;
+    return 0;
+}
+
+/*
+ * Ask Xen to queue newly dirtied pfns on a ring, for send_dirty_ring().  Not
+ * all guests support this, in which case the bitmap is used throughout.
+ */
+static void setup_dirty_ring(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+
+    if ( xc_shadow_control(xch, ctx->domid,
+                           XEN_DOMCTL_SHADOW_OP_DIRTY_RING_SETUP, NULL,
+                           dirty_ring_size(ctx),
+                           NULL, 0, NULL) < 0 )
+    {
+        DPRINTF("No dirty ring (errno %d), using the logdirty bitmap", errno);
+        return;
+    }
+
+    ctx->save.dirty_ring = true;
+}
+
 /*
  * Send all pages in the guests p2m.  Used as the first iteration of the live
  * migration loop, and for a non-live save.
@@ -473,6 +571,7 @@ static int send_memory_live(struct xc_sr_context *ctx)
     xc_interface *xch = ctx->xch;
     xc_shadow_op_stats_t stats = { 0, ctx->save.p2m_size };
     char *progress_str = NULL;
+    unsigned long sent;
     unsigned x;
     int rc;
 
@@ -488,6 +587,26 @@ static int send_memory_live(struct xc_sr_context *ctx)
           ((x < ctx->save.max_iterations) &&
            (stats.dirty_count > ctx->save.dirty_threshold)); ++x )
     {
+        if ( ctx->save.dirty_ring )
+        {
+            rc = update_progress_string(ctx, &progress_str, x);
+            if ( rc )
+                goto out;
+
+            rc = send_dirty_ring(ctx, &sent);
+            if ( rc == 0 )
+            {
+                stats.dirty_count = sent;
+                if ( stats.dirty_count == 0 )
+                    break;
+                continue;
+            }
+            if ( errno != EOVERFLOW )
+                goto out;
+
+            /* The ring dropped pfns.  This round uses the bitmap instead. */
+        }
+
         if ( xc_shadow_control(
                  xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
                  &ctx->save.dirty_bitmap_hbuf, ctx->save.p2m_size,
@@ -526,6 +645,8 @@ static int suspend_and_send_dirty(struct xc_sr_context *ctx)
     xc_interface *xch = ctx->xch;
     xc_shadow_op_stats_t stats = { 0, ctx->save.p2m_size };
     char *progress_str = NULL;
+    unsigned long sent;
+    bool ring_sent = false;
     int rc;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
@@ -534,16 +655,6 @@ static int suspend_and_send_dirty(struct xc_sr_context *ctx)
     if ( rc )
         goto out;
 
-    if ( xc_shadow_control(
-             xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
-             HYPERCALL_BUFFER(dirty_bitmap), ctx->save.p2m_size,
-             NULL, 0, &stats) != ctx->save.p2m_size )
-    {
-        PERROR("Failed to retrieve logdirty bitmap");
-        rc = -1;
-        goto out;
-    }
-
     if ( ctx->save.live )
     {
         rc = update_progress_string(ctx, &progress_str,
@@ -554,6 +665,36 @@ static int suspend_and_send_dirty(struct xc_sr_context *ctx)
     else
         xc_set_progress_prefix(xch, "Checkpointed save");
 
+    /*
+     * The guest is paused from here on, so draining the ring once picks
+     * up everything and keeps the bitmap walk out of the downtime.
+     */
+    if ( ctx->save.dirty_ring )
+    {
+        rc = send_dirty_ring(ctx, &sent);
+        if ( rc && errno != EOVERFLOW )
+            goto out;
+        ring_sent = !rc;
+    }
+
+    if ( ring_sent )
+    {
+        /* Only deferred pages are left to send. */
+        if ( ctx->save.nr_deferred_pages == 0 )
+            goto out;
+        bitmap_clear(dirty_bitmap, ctx->save.p2m_size);
+        stats.dirty_count = 0;
+    }
+    else if ( xc_shadow_control(
+                  xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
+                  HYPERCALL_BUFFER(dirty_bitmap), ctx->save.p2m_size,
+                  NULL, 0, &stats) != ctx->save.p2m_size )
+    {
+        PERROR("Failed to retrieve logdirty bitmap");
+        rc = -1;
+        goto out;
+    }
+
     bitmap_or(dirty_bitmap, ctx->save.deferred_pages, ctx->save.p2m_size);
 
     rc = send_dirty_pages(ctx, stats.dirty_count + ctx->save.nr_deferred_pages);
@@ -619,6 +760,8 @@ static int send_domain_memory_live(struct xc_sr_context *ctx)
     if ( rc )
         goto out;
 
+    setup_dirty_ring(ctx);
+
     rc = send_memory_live(ctx);
     if ( rc )
         goto out;
@@ -675,14 +818,20 @@ static int setup(struct xc_sr_context *ctx)
     int rc;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_ring,
+                                    &ctx->save.dirty_ring_hbuf);
 
     dirty_bitmap = xc_hypercall_buffer_alloc_pages(
                    xch, dirty_bitmap, NRPAGES(bitmap_size(ctx->save.p2m_size)));
+    dirty_ring = xc_hypercall_buffer_alloc_pages(
+                 xch, dirty_ring,
+                 NRPAGES(dirty_ring_size(ctx) * sizeof(*dirty_ring)));
     ctx->save.batch_pfns = malloc(MAX_BATCH_SIZE *
                                   sizeof(*ctx->save.batch_pfns));
     ctx->save.deferred_pages = calloc(1, bitmap_size(ctx->save.p2m_size));
 
-    if ( !ctx->save.batch_pfns || !dirty_bitmap || !ctx->save.deferred_pages )
+    if ( !ctx->save.batch_pfns || !dirty_bitmap || !dirty_ring ||
+         !ctx->save.deferred_pages )
     {
         ERROR("Unable to allocate memory for dirty bitmaps, batch pfns and"
               " deferred pages");
@@ -706,8 +855,11 @@ static void cleanup(struct xc_sr_context *ctx)
     xc_interface *xch = ctx->xch;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_ring,
+                                    &ctx->save.dirty_ring_hbuf);
 
 
+    /* Also tears down the dirty ring. */
     xc_shadow_control(xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_OFF,
                       NULL, 0, NULL, 0, NULL);
 
@@ -716,6 +868,9 @@ static void cleanup(struct xc_sr_context *ctx)
 
     xc_hypercall_buffer_free_pages(xch, dirty_bitmap,
                                    NRPAGES(bitmap_size(ctx->save.p2m_size)));
+    xc_hypercall_buffer_free_pages(xch, dirty_ring,
+                                   NRPAGES(dirty_ring_size(ctx) *
+                                           sizeof(*dirty_ring)));
     free(ctx->save.deferred_pages);
     free(ctx->save.batch_pfns);
 }
@@ -476,6 +476,119 @@ def libxl_C_type_from_json(ty, v, w, indent = "    "):
         s = indent + s
     return s.replace("\n", "\n%s" % indent).rstrip(indent)
 
+def libxl_C_type_has_sax(ty):
+    return isinstance(ty, idl.Struct) and ty.typename is not None and \
+           ty.autogenerate_json and ty.json_parse_fn is not None
+
+def libxl_C_sax_name(ty):
+    return "%s_%s_sax" % (ty.namespace, ty.rawname)
+
+def libxl_C_sax_offset(ctype, path, member):
+    if path == "":
+        return "offsetof(%s, %s)" % (ctype, member)
+    return "offsetof(%s, %s%s) - offsetof(%s, %s)" % \
+           (ctype, path, member, ctype, path[:-1])
+
+def libxl_C_type_sax_ref(ty, ctype, path, cname, out, leaves):
+    """Returns a reference to the streaming parse descriptor for a member
+    of type ty at path within ctype, appending to out the definitions of
+    any anonymous descriptors this needs and to leaves the leaf parse
+    functions it uses.  None means the member is not parsed at all."""
+    if isinstance(ty, idl.Struct) and ty.typename is None:
+        libxl_C_type_sax(ty, ctype, path, cname, out, leaves)
+        return "&" + cname
+    if libxl_C_type_has_sax(ty):
+        return "&" + libxl_C_sax_name(ty)
+    if isinstance(ty, idl.Aggregate):
+        raise Exception("No streaming parse of %s" % ty.kind)
+    if ty.json_parse_fn is not None:
+        if ty.json_parse_fn not in leaves:
+            leaves.append(ty.json_parse_fn)
+        return "&sax_leaf_%s" % ty.json_parse_fn
+    return None
+
+def libxl_C_sax_field(name, json_type, offset, ref, extra = []):
+    s = "    { .name = \"%s\", .name_len = sizeof(\"%s\")-1,\n" % (name, name)
+    s += "      .json_type = %s,\n" % json_type
+    if offset is not None:
+        s += "      .offset = %s,\n" % offset
+    for e in extra:
+        s += "      %s,\n" % e
+    s += "      .type = %s },\n" % ref
+    return s
+
+def libxl_C_type_sax(ty, ctype, path, cname, out, leaves, static = True):
+    """Appends to out the descriptor cname, which says how to fill the
+    struct ty, at path within ctype, from JSON as it streams past."""
+    fields = ""
+    for f in [f for f in ty.fields if not f.const and not f.type.private]:
+        if isinstance(f.type, idl.KeyedUnion):
+            ku = f.type
+            if path != "":
+                raise Exception("KeyedUnion must be a member of a named type")
+            for x in ku.fields:
+                select = "%s_%s_%s" % (cname, ku.keyvar.name, x.name)
+                out.append("static void %s(void *p)\n{\n"
+                           "    %s_init_%s(p, %s);\n}\n" %
+                           (select, ty.typename, ku.keyvar.name, x.enumname))
+                member = "%s.%s" % (f.name, x.name)
+                if x.type is None:
+                    ref = "NULL"
+                    offset = None
+                else:
+                    ref = libxl_C_type_sax_ref(x.type, ctype,
+                                               path + member + ".",
+                                               cname + "_" + x.name,
+                                               out, leaves)
+                    offset = libxl_C_sax_offset(ctype, path, member)
+                fields += libxl_C_sax_field(ku.keyvar.name + "." + x.name,
+                                            "JSON_MAP", offset,
+                                            ref, [".select = " + select])
+        elif isinstance(f.type, idl.Array):
+            elem = f.type.elem_type
+            if isinstance(elem, idl.Aggregate) and elem.typename is None:
+                raise Exception("Array of anonymous %s" % elem.kind)
+            ref = libxl_C_type_sax_ref(elem, ctype, None, None, out, leaves)
+            if ref is None:
+                continue
+            extra = [".elem_size = sizeof(*((%s *)0)->%s%s)" % (ctype, path, f.name),
+                     ".len_offset = " +
+                     libxl_C_sax_offset(ctype, path, f.type.lenvar.name)]
+            fields += libxl_C_sax_field(f.name, f.type.json_parse_type,
+                                        libxl_C_sax_offset(ctype, path, f.name),
+                                        ref, extra)
+        else:
+            ref = libxl_C_type_sax_ref(f.type, ctype, path + f.name + ".",
+                                       cname + "_" + f.name, out, leaves)
+            if ref is None:
+                continue
+            fields += libxl_C_sax_field(f.name, f.type.json_parse_type,
+                                        libxl_C_sax_offset(ctype, path, f.name),
+                                        ref)
+
+    s = ""
+    if fields != "":
+        s += "static const libxl__json_sax_field %s_fields[] = {\n" % cname
+        s += fields
+        s += "};\n"
+    if static:
+        s += "static "
+    s += "const libxl__json_sax_type %s = {\n" % cname
+    if fields != "":
+        s += "    .fields = %s_fields,\n" % cname
+        s += "    .nr_fields = ARRAY_SIZE(%s_fields),\n" % cname
+    s += "};\n"
+    out.append(s)
+
+def libxl_C_type_from_json_sax(ty, v, w, indent = "    "):
+    s = ""
+    s += "return libxl__object_from_json_sax(ctx, \"%s\", &%s, %s, %s);\n" % \
+         (ty.typename, libxl_C_sax_name(ty), v, w)
+
+    if s != "":
+        s = indent + s
+    return s.replace("\n", "\n%s" % indent).rstrip(indent)
+
 def libxl_C_enum_to_string(ty, e, indent = "    "):
     s = ""
     s += "switch(%s) {\n" % e
@@ -614,6 +727,10 @@ if __name__ == '__main__':
                 (ty.hidden(), ty.namespace + "_" + ty.rawname,
                  ty.make_arg("p", passby=idl.PASS_BY_REFERENCE)))
 
+    for ty in [ty for ty in types if libxl_C_type_has_sax(ty)]:
+        f.write("_hidden extern const libxl__json_sax_type %s;\n" % \
+                libxl_C_sax_name(ty))
+
     f.write("\n")
     f.write("""#endif /* %s */\n""" % header_json_define)
     f.close()
@@ -702,8 +819,27 @@ if __name__ == '__main__':
         f.write("{\n")
         if not isinstance(ty, idl.Enumeration):
             f.write("    %s_init(p);\n" % ty.typename)
-        f.write(libxl_C_type_from_json(ty, "p", "s"))
+        if libxl_C_type_has_sax(ty):
+            f.write(libxl_C_type_from_json_sax(ty, "p", "s"))
+        else:
+            f.write(libxl_C_type_from_json(ty, "p", "s"))
         f.write("}\n")
         f.write("\n")
 
+    sax = []
+    leaves = []
+    for ty in [t for t in types if libxl_C_type_has_sax(t)]:
+        libxl_C_type_sax(ty, ty.typename, "", libxl_C_sax_name(ty),
+                         sax, leaves, static = False)
+
+    for fn in leaves:
+        f.write("static const libxl__json_sax_type sax_leaf_%s = {\n" % fn)
+        f.write("    .parse = (libxl__json_parse_callback)&%s,\n" % fn)
+        f.write("};\n")
+        f.write("\n")
+
+    for s in sax:
+        f.write(s)
+        f.write("\n")
+
     f.close()
@@ -65,7 +65,11 @@ int libxl_ctx_alloc(libxl_ctx **pctx, int version,
     LIBXL_LIST_INIT(&ctx->pollers_fds_changed);
 
     LIBXL_LIST_INIT(&ctx->efds);
-    LIBXL_TAILQ_INIT(&ctx->etimes);
+    ctx->etimes = NULL;
+    ctx->etimes_used = ctx->etimes_allocd = 0;
+    ctx->efds_set = -1;
+    ctx->efd_slots = NULL;
+    ctx->efd_slots_allocd = 0;
 
     ctx->watch_slots = 0;
     LIBXL_SLIST_INIT(&ctx->watch_freeslots);
@@ -105,6 +109,14 @@ int libxl_ctx_alloc(libxl_ctx **pctx, int version,
     rc = libxl__atfork_init(ctx);
     if (rc) goto out;
 
+    const char *hotplug_concurrency = getenv("LIBXL_HOTPLUG_CONCURRENCY");
+    ctx->hotplug_gate = libxl__zalloc(NOGC, sizeof(*ctx->hotplug_gate));
+    libxl__gate_init(ctx->hotplug_gate,
+                     hotplug_concurrency ? atoi(hotplug_concurrency)
+                                         : LIBXL_HOTPLUG_CONCURRENCY);
+
+    libxl__ev_fdset_setup(gc);
+
     ctx->poller_app = libxl__poller_get(gc);
     if (!ctx->poller_app) {
         rc = ERROR_FAIL;
@@ -179,9 +191,12 @@ int libxl_ctx_free(libxl_ctx *ctx)
     /* Now there should be no more events requested from the application: */
 
     assert(LIBXL_LIST_EMPTY(&ctx->efds));
-    assert(LIBXL_TAILQ_EMPTY(&ctx->etimes));
+    assert(!ctx->etimes_used);
     assert(LIBXL_LIST_EMPTY(&ctx->evtchns_waiting));
     assert(LIBXL_LIST_EMPTY(&ctx->aos_inprogress));
+    if (ctx->hotplug_gate)
+        assert(!ctx->hotplug_gate->active);
+    free(ctx->hotplug_gate);
 
     if (ctx->xch) xc_interface_close(ctx->xch);
     libxl_version_info_dispose(&ctx->version_info);
@@ -199,6 +214,9 @@ int libxl_ctx_free(libxl_ctx *ctx)
     }
 
     free(ctx->watch_slots);
+    free(ctx->etimes);
+    if (ctx->efds_set >= 0) close(ctx->efds_set);
+    free(ctx->efd_slots);
 
     discard_events(&ctx->occurred);
 
@@ -603,16 +621,20 @@ int libxl_domain_preserve(libxl_ctx *ctx, uint32_t domid,
 
 static void xcinfo2xlinfo(libxl_ctx *ctx,
                           const xc_domaininfo_t *xcinfo,
-                          libxl_dominfo *xlinfo)
+                          libxl_dominfo *xlinfo,
+                          unsigned int fields)
 {
     size_t size;
 
     memcpy(&(xlinfo->uuid), xcinfo->handle, sizeof(xen_domain_handle_t));
     xlinfo->domid = xcinfo->domain;
     xlinfo->ssidref = xcinfo->ssidref;
-    if (libxl_flask_sid_to_context(ctx, xlinfo->ssidref,
+    if (!(fields & LIBXL_DOMINFO_SSID_LABEL) ||
+        libxl_flask_sid_to_context(ctx, xlinfo->ssidref,
                                    &xlinfo->ssid_label, &size) < 0)
         xlinfo->ssid_label = NULL;
+    if (fields & LIBXL_DOMINFO_NAME)
+        xlinfo->name = libxl_domid_to_name(ctx, xlinfo->domid);
 
     xlinfo->dying    = !!(xcinfo->flags&XEN_DOMINF_dying);
     xlinfo->shutdown = !!(xcinfo->flags&XEN_DOMINF_shutdown);
@@ -638,30 +660,81 @@ static void xcinfo2xlinfo(libxl_ctx *ctx,
         LIBXL_DOMAIN_TYPE_HVM : LIBXL_DOMAIN_TYPE_PV;
 }
 
-libxl_dominfo * libxl_list_domain(libxl_ctx *ctx, int *nb_domain_out)
+/* How many domains' info to fetch from Xen at a time */
+#define LIST_DOMAIN_BATCH 64
+
+int libxl_list_domain_paged(libxl_ctx *ctx, uint32_t *next_domid,
+                            unsigned int fields,
+                            libxl_dominfo *info, int max, int *nb_out)
 {
-    libxl_dominfo *ptr;
-    int i, ret;
-    xc_domaininfo_t info[1024];
-    int size = 1024;
+    xc_domaininfo_t xcinfo[LIST_DOMAIN_BATCH];
+    uint32_t domid = *next_domid;
+    int nb = 0, i, ret;
 
-    ptr = calloc(size, sizeof(libxl_dominfo));
-    if (!ptr) {
-        LIBXL__LOG_ERRNO(ctx, LIBXL__LOG_ERROR, "allocating domain info");
-        return NULL;
-    }
+    if (max < 0)
+        return ERROR_INVAL;
 
-    ret = xc_domain_getinfolist(ctx->xch, 0, 1024, info);
-    if (ret<0) {
-        LIBXL__LOG_ERRNO(ctx, LIBXL__LOG_ERROR, "getting domain info list");
-        free(ptr);
-        return NULL;
-    }
+    while (nb < max && domid < DOMID_FIRST_RESERVED) {
+        int want = max - nb;
+
+        if (want > LIST_DOMAIN_BATCH)
+            want = LIST_DOMAIN_BATCH;
+
+        ret = xc_domain_getinfolist(ctx->xch, domid, want, xcinfo);
+        if (ret < 0) {
+            LIBXL__LOG_ERRNO(ctx, LIBXL__LOG_ERROR,
+                             "getting domain info list");
+            return ERROR_FAIL;
+        }
 
-    for (i = 0; i < ret; i++) {
-        xcinfo2xlinfo(ctx, &info[i], &ptr[i]);
+        for (i = 0; i < ret; i++, nb++) {
+            libxl_dominfo_dispose(&info[nb]);
+            libxl_dominfo_init(&info[nb]);
+            xcinfo2xlinfo(ctx, &xcinfo[i], &info[nb], fields);
+        }
+
+        if (ret < want) {
+            /* That was the last of them. */
+            domid = DOMID_FIRST_RESERVED;
+            break;
+        }
+        domid = xcinfo[ret - 1].domain + 1;
     }
-    *nb_domain_out = ret;
+
+    *next_domid = domid;
+    *nb_out = nb;
+    return 0;
+}
+
+libxl_dominfo * libxl_list_domain(libxl_ctx *ctx, int *nb_domain_out)
+{
+    GC_INIT(ctx);
+    libxl_dominfo *ptr = NULL;
+    uint32_t next_domid = 0;
+    int nb = 0, size = 0, got, i, rc;
+
+    do {
+        ptr = libxl__realloc(NOGC, ptr,
+                             (size + LIST_DOMAIN_BATCH) * sizeof(*ptr));
+        for (i = size; i < size + LIST_DOMAIN_BATCH; i++)
+            libxl_dominfo_init(&ptr[i]);
+        size += LIST_DOMAIN_BATCH;
+
+        rc = libxl_list_domain_paged(ctx, &next_domid,
+                                     LIBXL_DOMINFO_SSID_LABEL,
+                                     ptr + nb, size - nb, &got);
+        if (rc) {
+            libxl_dominfo_list_free(ptr, size);
+            ptr = NULL;
+            goto out;
+        }
+        nb += got;
+    } while (nb == size);
+
+    *nb_domain_out = nb;
+
+ out:
+    GC_FREE;
     return ptr;
 }
 
@@ -678,7 +751,7 @@ int libxl_domain_info(libxl_ctx *ctx, libxl_dominfo *info_r,
     if (ret==0 || xcinfo.domain != domid) return ERROR_DOMAIN_NOTFOUND;
 
     if (info_r)
-        xcinfo2xlinfo(ctx, &xcinfo, info_r);
+        xcinfo2xlinfo(ctx, &xcinfo, info_r, LIBXL_DOMINFO_SSID_LABEL);
     return 0;
 }
 
@@ -1478,6 +1551,119 @@ static void domain_destroy_cb(libxl__egc *egc, libxl__domain_destroy_state *dds,
     libxl__ao_complete(egc, ao, rc);
 }
 
+/* Callbacks for libxl_domain_destroy_fast */
+
+/* How often the memory of a released domain is looked at. */
+#define DESTROY_PROGRESS_INTERVAL_MS 250
+
+typedef struct {
+    libxl__domain_destroy_state dds;
+    libxl_asyncprogress_how aop_progress_how;
+    libxl__ev_time poll;
+    uint64_t memkb; /* as last reported */
+} destroy_fast_state;
+
+static void destroy_fast_released(libxl__egc *egc,
+                                  libxl__domain_destroy_state *dds, int rc);
+static void destroy_fast_poll(libxl__egc *egc, libxl__ev_time *ev,
+                              const struct timeval *requested_abs, int rc);
+static void destroy_fast_cb(libxl__egc *egc,
+                            libxl__domain_destroy_state *dds, int rc);
+
+int libxl_domain_destroy_fast(libxl_ctx *ctx, uint32_t domid,
+                              const libxl_asyncop_how *ao_how,
+                              const libxl_asyncprogress_how *aop_progress_how)
+{
+    AO_CREATE(ctx, domid, ao_how);
+    destroy_fast_state *dfs;
+
+    GCNEW(dfs);
+    libxl__ao_progress_gethow(&dfs->aop_progress_how, aop_progress_how);
+    libxl__ev_time_init(&dfs->poll);
+    dfs->dds.ao = ao;
+    dfs->dds.domid = domid;
+    dfs->dds.callback = destroy_fast_cb;
+    dfs->dds.released = destroy_fast_released;
+    libxl__domain_destroy(egc, &dfs->dds);
+
+    return AO_INPROGRESS;
+}
+
+/* Reports phase if it is new or the domain's memory has shrunk. */
+static void destroy_fast_report(libxl__egc *egc, destroy_fast_state *dfs,
+                                libxl_domain_destroy_phase phase)
+{
+    STATE_AO_GC(dfs->dds.ao);
+    xc_domaininfo_t xcinfo;
+    libxl_event *ev;
+    uint64_t memkb = 0;
+    int r;
+
+    r = xc_domain_getinfolist(CTX->xch, dfs->dds.domid, 1, &xcinfo);
+    if (r == 1 && xcinfo.domain == dfs->dds.domid)
+        memkb = PAGE_TO_MEMKB(xcinfo.tot_pages);
+
+    if (phase == LIBXL_DOMAIN_DESTROY_PHASE_RELINQUISHING &&
+        memkb == dfs->memkb)
+        return;
+    dfs->memkb = memkb;
+
+    ev = NEW_EVENT(egc, DOMAIN_DESTROY_PROGRESS, dfs->dds.domid,
+                   dfs->aop_progress_how.for_event);
+    ev->u.domain_destroy_progress.phase = phase;
+    ev->u.domain_destroy_progress.memkb = memkb;
+    libxl__ao_progress_report(egc, ao, &dfs->aop_progress_how, ev);
+}
+
+static void destroy_fast_released(libxl__egc *egc,
+                                  libxl__domain_destroy_state *dds, int rc)
+{
+    destroy_fast_state *dfs = CONTAINER_OF(dds, *dfs, dds);
+    STATE_AO_GC(dds->ao);
+
+    destroy_fast_report(egc, dfs, LIBXL_DOMAIN_DESTROY_PHASE_RELEASED);
+
+    rc = libxl__ev_time_register_rel(ao, &dfs->poll, destroy_fast_poll,
+                                     DESTROY_PROGRESS_INTERVAL_MS);
+    if (rc)
+        LOG(WARN, "domain %u: cannot follow the release of its memory",
+            dds->domid);
+}
+
+static void destroy_fast_poll(libxl__egc *egc, libxl__ev_time *ev,
+                              const struct timeval *requested_abs, int rc)
+{
+    destroy_fast_state *dfs = CONTAINER_OF(ev, *dfs, poll);
+    STATE_AO_GC(dfs->dds.ao);
+
+    libxl__ev_time_deregister(gc, &dfs->poll);
+    /* An abort stops the reports, but not the destruction. */
+    if (rc != ERROR_TIMEDOUT)
+        return;
+
+    destroy_fast_report(egc, dfs, LIBXL_DOMAIN_DESTROY_PHASE_RELINQUISHING);
+
+    rc = libxl__ev_time_register_rel(ao, &dfs->poll, destroy_fast_poll,
+                                     DESTROY_PROGRESS_INTERVAL_MS);
+    if (rc)
+        LOG(WARN, "domain %u: cannot follow the release of its memory",
+            dfs->dds.domid);
+}
+
+static void destroy_fast_cb(libxl__egc *egc,
+                            libxl__domain_destroy_state *dds, int rc)
+{
+    destroy_fast_state *dfs = CONTAINER_OF(dds, *dfs, dds);
+    STATE_AO_GC(dds->ao);
+
+    libxl__ev_time_deregister(gc, &dfs->poll);
+
+    if (rc)
+        LOG(ERROR, "destruction of domain %u failed", dds->domid);
+
+    libxl__ao_complete(egc, ao, rc);
+}
+
 /* Callbacks for libxl__domain_destroy */
 
 static void stubdom_destroy_callback(libxl__egc *egc,
@@ -1488,6 +1674,17 @@ static void domain_destroy_callback(libxl__egc *egc,
                                     libxl__destroy_domid_state *dis,
                                     int rc);
 
+static void stubdom_destroy_released(libxl__egc *egc,
+                                     libxl__destroy_domid_state *dis,
+                                     int rc);
+
+static void domain_destroy_released(libxl__egc *egc,
+                                    libxl__destroy_domid_state *dis,
+                                    int rc);
+
+static void destroy_released_check(libxl__egc *egc,
+                                   libxl__domain_destroy_state *dds);
+
 static void destroy_finish_check(libxl__egc *egc,
                                  libxl__domain_destroy_state *dds);
 
@@ -1500,17 +1697,52 @@ void libxl__domain_destroy(libxl__egc *egc, libxl__domain_destroy_state *dds)
         dds->stubdom.ao = ao;
         dds->stubdom.domid = stubdomid;
         dds->stubdom.callback = stubdom_destroy_callback;
+        dds->stubdom.released = dds->released ? stubdom_destroy_released
+                                              : NULL;
         libxl__destroy_domid(egc, &dds->stubdom);
     } else {
         dds->stubdom_finished = 1;
+        dds->stubdom_released = 1;
     }
 
     dds->domain.ao = ao;
     dds->domain.domid = dds->domid;
     dds->domain.callback = domain_destroy_callback;
+    dds->domain.released = dds->released ? domain_destroy_released : NULL;
     libxl__destroy_domid(egc, &dds->domain);
 }
 
+static void stubdom_destroy_released(libxl__egc *egc,
+                                     libxl__destroy_domid_state *dis,
+                                     int rc)
+{
+    libxl__domain_destroy_state *dds = CONTAINER_OF(dis, *dds, stubdom);
+
+    dds->stubdom_released = 1;
+    destroy_released_check(egc, dds);
+}
+
+static void domain_destroy_released(libxl__egc *egc,
+                                    libxl__destroy_domid_state *dis,
+                                    int rc)
+{
+    libxl__domain_destroy_state *dds = CONTAINER_OF(dis, *dds, domain);
+
+    dds->domain_released = 1;
+    destroy_released_check(egc, dds);
+}
+
+static void destroy_released_check(libxl__egc *egc,
+                                   libxl__domain_destroy_state *dds)
+{
+    /* A stubdom which failed before being released holds nothing up. */
+    if (!(dds->domain_released &&
+          (dds->stubdom_released || dds->stubdom_finished)))
+        return;
+
+    dds->released(egc, dds, 0);
+}
+
 static void stubdom_destroy_callback(libxl__egc *egc,
                                      libxl__destroy_domid_state *dis,
                                      int rc)
@@ -1525,6 +1757,8 @@ static void stubdom_destroy_callback(libxl__egc *egc,
     }
 
     dds->stubdom_finished = 1;
+    if (!dds->stubdom_released && dds->domain_released)
+        destroy_released_check(egc, dds);
     savefile = libxl__device_model_savefile(gc, dis->domid);
     rc = libxl__remove_file(gc, savefile);
     /*
@@ -1568,10 +1802,18 @@ static void devices_destroy_cb(libxl__egc *egc,
                                libxl__devices_remove_state *drs,
                                int rc);
 
+static int destroy_domid_files(libxl__gc *gc, uint32_t domid);
+
+static void destroy_domid_fork(libxl__egc *egc,
+                               libxl__destroy_domid_state *dis);
+
 static void domain_destroy_domid_cb(libxl__egc *egc,
                                     libxl__ev_child *destroyer,
                                     pid_t pid, int status);
 
+static void destroy_domid_check(libxl__egc *egc,
+                                libxl__destroy_domid_state *dis);
+
 void libxl__destroy_domid(libxl__egc *egc, libxl__destroy_domid_state *dis)
 {
     STATE_AO_GC(dis->ao);
@@ -1582,6 +1824,10 @@ void libxl__destroy_domid(libxl__egc *egc, libxl__destroy_domid_state *dis)
     int rc, dm_present;
 
     libxl__ev_child_init(&dis->destroyer);
+    dis->rc = 0;
+    dis->devices_done = false;
+    dis->destroyer_started = false;
+    dis->destroyer_done = false;
 
     rc = libxl_domain_info(ctx, NULL, domid);
     switch(rc) {
@@ -1629,11 +1875,32 @@ void libxl__destroy_domid(libxl__egc *egc, libxl__destroy_domid_state *dis)
 
         libxl__qmp_cleanup(gc, domid);
     }
+
+    /*
+     * With the pipeline, the destroyer may have finished before the
+     * devices have, and the userdata lock refuses a domain which no
+     * longer exists: drop the files now, while it is still paused.
+     */
+    if (dis->released) {
+        rc = destroy_domid_files(gc, domid);
+        if (rc)
+            dis->rc = rc;
+    }
+
     dis->drs.ao = ao;
     dis->drs.domid = domid;
     dis->drs.callback = devices_destroy_cb;
     dis->drs.force = 1;
     libxl__devices_destroy(egc, &dis->drs);
+
+    /*
+     * Removal has been initiated for every device, so nothing needs
+     * the domain to be around any more: let the hypervisor start
+     * relinquishing its memory while the backends wind down.  (If
+     * there were no devices, devices_destroy_cb has already done so.)
+     */
+    if (dis->released && !dis->destroyer_started)
+        destroy_domid_fork(egc, dis);
     return;
 
 out:
@@ -1652,7 +1919,8 @@ static void devices_destroy_cb(libxl__egc *egc,
     uint32_t domid = dis->domid;
     char *dom_path;
     char *vm_path;
-    libxl__domain_userdata_lock *lock;
+
+    dis->devices_done = true;
 
     dom_path = libxl__xs_get_dompath(gc, domid);
     if (!dom_path) {
@@ -1676,12 +1944,42 @@ static void devices_destroy_cb(libxl__egc *egc,
     xs_rm(ctx->xsh, XBT_NULL, libxl__sprintf(gc,
                                 "/local/domain/%d/hvmloader", domid));
 
+    if (!dis->released) {
+        rc = destroy_domid_files(gc, domid);
+        if (rc) goto out;
+    }
+
+    if (!dis->destroyer_started)
+        destroy_domid_fork(egc, dis);
+    /* Even if the destroyer has already finished, so that callers always
+     * hear about the release before the operation completes. */
+    if (dis->released)
+        dis->released(egc, dis, 0);
+    destroy_domid_check(egc, dis);
+    return;
+
+out:
+    /* Without the pipeline, the domain is left alone on failure. */
+    if (!dis->destroyer_started) {
+        dis->destroyer_started = true;
+        dis->destroyer_done = true;
+    }
+    if (!dis->rc)
+        dis->rc = rc;
+    destroy_domid_check(egc, dis);
+    return;
+}
+
+/* Removes the domain's userdata, and the qemu-save and qemu-resume files. */
+static int destroy_domid_files(libxl__gc *gc, uint32_t domid)
+{
+    libxl__domain_userdata_lock *lock;
+    int rc;
+
     /* This is async operation, we already hold CTX lock */
     lock = libxl__lock_domain_userdata(gc, domid);
-    if (!lock) {
-        rc = ERROR_LOCK_FAIL;
-        goto out;
-    }
+    if (!lock)
+        return ERROR_LOCK_FAIL;
     libxl__userdata_destroyall(gc, domid);
 
     libxl__unlock_domain_userdata(lock);
@@ -1691,13 +1989,33 @@ static void devices_destroy_cb(libxl__egc *egc,
      * don't fit in existing userdata scheme very well.
      */
     rc = libxl__remove_file(gc, libxl__device_model_savefile(gc, domid));
-    if (rc < 0) goto out;
+    if (rc < 0) return rc;
     rc = libxl__remove_file(gc,
              GCSPRINTF(LIBXL_DEVICE_MODEL_RESTORE_FILE".%u", domid));
-    if (rc < 0) goto out;
+    if (rc < 0) return rc;
+
+    return 0;
+}
+
+/* Asks the hypervisor to destroy the domain, in a child since
+ * relinquishing a large domain's memory takes a while. */
+static void destroy_domid_fork(libxl__egc *egc,
+                               libxl__destroy_domid_state *dis)
+{
+    STATE_AO_GC(dis->ao);
+    libxl_ctx *ctx = CTX;
+    uint32_t domid = dis->domid;
+    int rc;
+
+    dis->destroyer_started = true;
 
     rc = libxl__ev_child_fork(gc, &dis->destroyer, domain_destroy_domid_cb);
-    if (rc < 0) goto out;
+    if (rc < 0) {
+        dis->destroyer_done = true;
+        if (!dis->rc)
+            dis->rc = rc;
+        return;
+    }
     if (!rc) { /* child */
         ctx->xch = xc_interface_open(ctx->lg,0,0);
         if (!ctx->xch) goto badchild;
@@ -1717,12 +2035,6 @@ static void devices_destroy_cb(libxl__egc *egc,
         }
     }
     LOG(DEBUG, "forked pid %ld for destroy of domain %d", (long)rc, domid);
-
-    return;
-
-out:
-    dis->callback(egc, dis, rc);
-    return;
 }
 
 static void domain_destroy_domid_cb(libxl__egc *egc,
@@ -1747,7 +2059,19 @@ static void domain_destroy_domid_cb(libxl__egc *egc,
     rc = 0;
 
  out:
-    dis->callback(egc, dis, rc);
+    dis->destroyer_done = true;
+    if (!dis->rc)
+        dis->rc = rc;
+    destroy_domid_check(egc, dis);
+}
+
+static void destroy_domid_check(libxl__egc *egc,
+                                libxl__destroy_domid_state *dis)
+{
+    if (!(dis->devices_done && dis->destroyer_done))
+        return;
+
+    dis->callback(egc, dis, dis->rc);
 }
 
 int libxl_console_exec(libxl_ctx *ctx, uint32_t domid, int cons_num,
@@ -2479,8 +2803,10 @@ static void device_disk_add(libxl__egc *egc, uint32_t domid,
                 flexarray_append(back, "params");
                 flexarray_append(back, dev);
 
-                script = libxl__abs_path(gc, disk->script?: "block",
-                                         libxl__xen_script_dir_path());
+                script = disk->script ?: "block";
+                if (!libxl__hotplug_script_native(script))
+                    script = libxl__abs_path(gc, script,
+                                             libxl__xen_script_dir_path());
                 flexarray_append_pair(back, "script", script);
 
                 /* If the user did not supply a block script then we
@@ -3330,6 +3656,8 @@ void libxl__device_nic_add(libxl__egc *egc, uint32_t domid,
     flexarray_append(back, GCSPRINTF("%d", XenbusStateInitialising));
     if (nic->script)
         flexarray_append_pair(back, "script",
+                              libxl__hotplug_script_native(nic->script) ?
+                              nic->script :
                               libxl__abs_path(gc, nic->script,
                                               libxl__xen_script_dir_path()));
 
@@ -4830,7 +5158,7 @@ retry_transaction:
     }
 
     libxl_dominfo_init(&ptr);
-    xcinfo2xlinfo(ctx, &info, &ptr);
+    xcinfo2xlinfo(ctx, &info, &ptr, LIBXL_DOMINFO_SSID_LABEL);
     uuid = libxl__uuid2string(gc, ptr.uuid);
     libxl__xs_write(gc, t, libxl__sprintf(gc, "/vm/%s/memory", uuid),
             "%"PRIu32, new_target_memkb / 1024);
@@ -5476,18 +5804,9 @@ static int libxl__set_vcpuonline_qmp(libxl__gc *gc, uint32_t domid,
                                      libxl_bitmap *cpumap,
                                      const libxl_dominfo *info)
 {
-    int i;
-
-    for (i = 0; i <= info->vcpu_max_id; i++) {
-        if (libxl_bitmap_test(cpumap, i)) {
-            /* Return value is ignore because it does not tell anything useful
-             * on the completion of the command.
-             * (For instance, "CPU already plugged-in" give the same return
-             * value as "command not supported".)
-             */
-            libxl__qmp_cpu_add(gc, domid, i);
-        }
-    }
+    /* Return value is ignored, as before, because it does not tell
+     * anything useful on the completion of the commands. */
+    libxl__qmp_cpus_add(gc, domid, cpumap, info->vcpu_max_id);
     return 0;
 }
 
@@ -546,6 +546,15 @@ typedef struct libxl__ctx libxl_ctx;
  */
 #define LIBXL_HAVE_DOMINFO_OUTSTANDING_MEMKB 1
 
+/*
+ * LIBXL_HAVE_LIST_DOMAIN_PAGED 1
+ *
+ * If this is defined, libxl_list_domain_paged() is available, libxl_dominfo
+ * has a name field, and libxl_list_domain() is no longer limited to 1024
+ * domains.
+ */
+#define LIBXL_HAVE_LIST_DOMAIN_PAGED 1
+
 /*
  * LIBXL_HAVE_QXL
  *
@@ -616,6 +625,40 @@ typedef struct libxl__ctx libxl_ctx;
  */
 #define LIBXL_HAVE_DOMAIN_CREATE_RESTORE_PARAMS 1
 
+/*
+ * LIBXL_HAVE_DOMAIN_CREATE_BATCH
+ *
+ * If this is defined, libxl_domain_create_batch() and the
+ * libxl_domain_create_limits structure are available.
+ */
+#define LIBXL_HAVE_DOMAIN_CREATE_BATCH 1
+
+/*
+ * LIBXL_HAVE_DOMAIN_TEMPLATE
+ *
+ * If this is defined, libxl_domain_template and the functions to
+ * create domains from one are available.
+ */
+#define LIBXL_HAVE_DOMAIN_TEMPLATE 1
+
+/*
+ * LIBXL_HAVE_HOTPLUG_NATIVE
+ *
+ * If this is defined, the script of a disk or nic may be given as
+ * "native:NAME", in which case libxl does the work of the hotplug
+ * script NAME itself where it can (on Linux, "block" for block devices
+ * and "vif-bridge"), and runs the script NAME otherwise.
+ */
+#define LIBXL_HAVE_HOTPLUG_NATIVE 1
+
+/*
+ * LIBXL_HAVE_DOMAIN_DESTROY_FAST
+ *
+ * If this is defined, libxl_domain_destroy_fast() and the
+ * DOMAIN_DESTROY_PROGRESS event are available.
+ */
+#define LIBXL_HAVE_DOMAIN_DESTROY_FAST 1
+
 /*
  * LIBXL_HAVE_CREATEINFO_PVH
  * If this is defined, then libxl supports creation of a PVH guest.
@@ -1107,6 +1150,73 @@ int libxl_domain_create_restore(libxl_ctx *ctx, libxl_domain_config *d_config,
                                 const libxl_asyncprogress_how *aop_console_how)
                                 LIBXL_EXTERNAL_CALLERS_ONLY;
 
+
+/*
+ * Creates nr_domains new domains, from d_configs[0..nr_domains-1], in
+ * one asynchronous operation.  The domains progress through creation
+ * concurrently; the number of domains which may be in each of the
+ * slow phases of creation at once is bounded by the corresponding
+ * member of *limits:
+ *
+ *   bootloader    running the bootloader
+ *   build         building the domain (populating its memory, etc.)
+ *   devices       adding disks and nics, including running hotplug
+ *                 scripts
+ *   device_model  starting the device model (or stub domain)
+ *
+ * A limit of 0, or limits==NULL, means no limit.
+ *
+ * On completion domids[i] is the domain id of the i'th domain, or -1,
+ * and, if rcs is not NULL, rcs[i] is its own result.  The operation as
+ * a whole succeeds only if every domain was created; domains which
+ * were created are left running even if others failed.
+ *
+ * No console progress reports are made.
+ */
+int libxl_domain_create_batch(libxl_ctx *ctx, int nr_domains,
+                              libxl_domain_config *d_configs,
+                              uint32_t *domids, int *rcs,
+                              const libxl_domain_create_limits *limits,
+                              const libxl_asyncop_how *ao_how)
+                              LIBXL_EXTERNAL_CALLERS_ONLY;
+
+/*
+ * Domain templates.
+ *
+ * A template is made once from a domain configuration, and then many
+ * domains can be created from it more cheaply than from scratch.  The
+ * template keeps a copy of the configuration and, for a PV guest whose
+ * kernel is given directly (no bootloader), the kernel image already
+ * decompressed; later changes to the kernel file are not seen.
+ *
+ * To create a domain, get a copy of the template's configuration with
+ * libxl_domain_template_config, change whatever must differ between
+ * instances (name, uuid, memory, nic MACs, ...), and pass it to
+ * libxl_domain_create_from_template, which otherwise behaves like
+ * libxl_domain_create_new.  The cached kernel is used only if the
+ * configuration still names the same kernel file.
+ *
+ * A template may be used by any number of creations at once, but must
+ * not be freed until they have all completed.
+ */
+typedef struct libxl__domain_template libxl_domain_template;
+
+int libxl_domain_template_create(libxl_ctx *ctx,
+                                 libxl_domain_config *d_config,
+                                 libxl_domain_template **template_r);
+void libxl_domain_template_free(libxl_ctx *ctx,
+                                libxl_domain_template *tmpl /* 0 is OK */);
+void libxl_domain_template_config(libxl_ctx *ctx,
+                                  libxl_domain_template *tmpl,
+                                  libxl_domain_config *d_config);
+int libxl_domain_create_from_template(libxl_ctx *ctx,
+                                      const libxl_domain_template *tmpl,
+                                      libxl_domain_config *d_config,
+                                      uint32_t *domid,
+                                      const libxl_asyncop_how *ao_how,
+                                      const libxl_asyncprogress_how *aop_console_how)
+                                      LIBXL_EXTERNAL_CALLERS_ONLY;
+
 #if defined(LIBXL_API_VERSION) && LIBXL_API_VERSION < 0x040400
 
 int static inline libxl_domain_create_restore_0x040200(
@@ -1173,6 +1283,33 @@ int libxl_domain_reboot(libxl_ctx *ctx, uint32_t domid);
 int libxl_domain_destroy(libxl_ctx *ctx, uint32_t domid,
                          const libxl_asyncop_how *ao_how)
                          LIBXL_EXTERNAL_CALLERS_ONLY;
+
+/*
+ * libxl_domain_destroy_fast:
+ *
+ *   Like libxl_domain_destroy, but the hypervisor starts relinquishing
+ *   the domain's memory while its devices are still being removed.
+ *
+ *   Progress is reported with DOMAIN_DESTROY_PROGRESS events:
+ *   - RELEASED once the device model, the devices and the domain's
+ *     xenstore state are gone.  From then on nothing but the domain's
+ *     memory is left, and the caller may reuse everything else (e.g.
+ *     backing storage, network names), although the domid itself
+ *     stays in use until the operation completes.
+ *   - RELINQUISHING from time to time afterwards, with the memory the
+ *     domain still holds, so that a caller may put what has already
+ *     been returned to use before the domain is entirely gone.
+ *
+ *   RELEASED is always reported before the operation completes
+ *   successfully, even when the domain has already disappeared by then
+ *   (memkb is then 0).  If the operation fails, it may not be reported.
+ *
+ *   The operation completes when the domain has disappeared.
+ */
+int libxl_domain_destroy_fast(libxl_ctx *ctx, uint32_t domid,
+                              const libxl_asyncop_how *ao_how,
+                              const libxl_asyncprogress_how *aop_progress_how)
+                              LIBXL_EXTERNAL_CALLERS_ONLY;
 int libxl_domain_preserve(libxl_ctx *ctx, uint32_t domid, libxl_domain_create_info *info, const char *name_suffix, libxl_uuid new_uuid);
 
 /* get max. number of cpus supported by hypervisor */
@@ -1277,6 +1414,29 @@ int libxl_domain_info(libxl_ctx*, libxl_dominfo *info_r,
 libxl_dominfo * libxl_list_domain(libxl_ctx*, int *nb_domain_out);
 void libxl_dominfo_list_free(libxl_dominfo *list, int nb_domain);
 
+/*
+ * Lists domains a page at a time into a buffer supplied by the caller,
+ * which avoids both the allocation of the whole list and any lookups the
+ * caller does not need.
+ *
+ * Start with *next_domid = 0.  Up to max domains, from *next_domid
+ * onwards, are stored in info[0..*nb_out-1], and *next_domid is advanced
+ * past them; fewer than max are returned only at the end of the list.
+ *
+ * The entries of info must have been initialised with libxl_dominfo_init;
+ * anything they held from a previous call is disposed of first, so the
+ * same buffer can be used over and over, and finally disposed of by the
+ * caller.
+ *
+ * fields says which of the more expensive parts of libxl_dominfo to fill
+ * in; the others are left NULL.  With fields == 0 nothing is allocated.
+ */
+#define LIBXL_DOMINFO_SSID_LABEL (1U << 0) /* flask context of ssidref */
+#define LIBXL_DOMINFO_NAME       (1U << 1) /* from xenstore */
+int libxl_list_domain_paged(libxl_ctx *ctx, uint32_t *next_domid,
+                            unsigned int fields,
+                            libxl_dominfo *info, int max, int *nb_out);
+
 libxl_cpupoolinfo * libxl_list_cpupool(libxl_ctx*, int *nb_pool_out);
 void libxl_cpupoolinfo_list_free(libxl_cpupoolinfo *list, int nb_pool);
 
@@ -628,6 +628,53 @@ void libxl__kill(libxl__gc *gc, pid_t pid, int sig, const char *what)
                 what, (unsigned long)pid, sig);
 }
 
+/*----- gate -----*/
+
+void libxl__gate_init(libxl__gate *gate, int limit)
+{
+    gate->limit = limit;
+    gate->active = 0;
+    gate->dispatching = 0;
+    LIBXL_TAILQ_INIT(&gate->waiters);
+}
+
+static bool gate_full(const libxl__gate *gate)
+{
+    return gate->limit > 0 && gate->active >= gate->limit;
+}
+
+static void gate_dispatch(libxl__egc *egc, libxl__gate *gate)
+{
+    libxl__gate_waiter *w;
+
+    /* A callback which leaves the gate again is picked up by this loop. */
+    if (gate->dispatching)
+        return;
+
+    gate->dispatching = 1;
+    while (!gate_full(gate) &&
+           (w = LIBXL_TAILQ_FIRST(&gate->waiters))) {
+        LIBXL_TAILQ_REMOVE(&gate->waiters, w, entry);
+        gate->active++;
+        w->callback(egc, w);
+    }
+    gate->dispatching = 0;
+}
+
+void libxl__gate_enter(libxl__egc *egc, libxl__gate *gate,
+                       libxl__gate_waiter *w)
+{
+    LIBXL_TAILQ_INSERT_TAIL(&gate->waiters, w, entry);
+    gate_dispatch(egc, gate);
+}
+
+void libxl__gate_leave(libxl__egc *egc, libxl__gate *gate)
+{
+    assert(gate->active > 0);
+    gate->active--;
+    gate_dispatch(egc, gate);
+}
+
 /*
  * Local variables:
  * mode: C
@@ -727,6 +727,12 @@ static void domcreate_bootloader_done(libxl__egc *egc,
 static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *aodevs,
                                 int ret);
 
+static void domcreate_qmp_initialized(libxl__egc *egc,
+                                      libxl__qmp_inits_state *qis,
+                                      int rc);
+static void domcreate_plug_devices(libxl__egc *egc,
+                                   libxl__domain_create_state *dcs);
+
 static void domcreate_attach_vtpms(libxl__egc *egc, libxl__multidev *multidev,
                                    int ret);
 static void domcreate_attach_pci(libxl__egc *egc, libxl__multidev *aodevs,
@@ -757,6 +763,44 @@ static void domcreate_destruction_cb(libxl__egc *egc,
                                      libxl__domain_destroy_state *dds,
                                      int rc);
 
+/* Phases which may be bounded by dcs->gates; entered via
+ * domcreate_phase_begin and left via domcreate_phase_end. */
+static libxl__gate_callback domcreate_run_bootloader;
+static libxl__gate_callback domcreate_build;
+static libxl__gate_callback domcreate_add_disks;
+static libxl__gate_callback domcreate_spawn_dm;
+static libxl__gate_callback domcreate_add_nics;
+
+static void domcreate_phase_begin(libxl__egc *egc,
+                                  libxl__domain_create_state *dcs,
+                                  libxl__domcreate_phase phase,
+                                  libxl__gate_callback *callback)
+{
+    assert(!dcs->gate_held);
+    dcs->gate_waiter.callback = callback;
+
+    if (!dcs->gates) {
+        callback(egc, &dcs->gate_waiter);
+        return;
+    }
+
+    dcs->gate_held = &dcs->gates[phase];
+    libxl__gate_enter(egc, dcs->gate_held, &dcs->gate_waiter);
+}
+
+/* Idempotent, so that error paths can simply call it. */
+static void domcreate_phase_end(libxl__egc *egc,
+                                libxl__domain_create_state *dcs)
+{
+    libxl__gate *gate = dcs->gate_held;
+
+    if (!gate)
+        return;
+
+    dcs->gate_held = NULL;
+    libxl__gate_leave(egc, gate);
+}
+
 static void initiate_domain_create(libxl__egc *egc,
                                    libxl__domain_create_state *dcs)
 {
@@ -952,7 +996,8 @@ static void initiate_domain_create(libxl__egc *egc,
         dcs->bl.kernel = &dcs->build_state.pv_kernel;
         dcs->bl.ramdisk = &dcs->build_state.pv_ramdisk;
 
-        libxl__bootloader_run(egc, &dcs->bl);
+        domcreate_phase_begin(egc, dcs, LIBXL__DOMCREATE_PHASE_BOOTLOADER,
+                              domcreate_run_bootloader);
     }
     return;
 
@@ -961,6 +1006,14 @@ error_out:
     domcreate_complete(egc, dcs, ret);
 }
 
+static void domcreate_run_bootloader(libxl__egc *egc,
+                                     libxl__gate_waiter *w)
+{
+    libxl__domain_create_state *dcs = CONTAINER_OF(w, *dcs, gate_waiter);
+
+    libxl__bootloader_run(egc, &dcs->bl);
+}
+
 static void domcreate_bootloader_console_available(libxl__egc *egc,
                                                    libxl__bootloader_state *bl)
 {
@@ -992,6 +1045,8 @@ static void domcreate_bootloader_done(libxl__egc *egc,
     libxl__srm_restore_autogen_callbacks *const callbacks =
         &dcs->srs.shs.callbacks.restore.a;
 
+    domcreate_phase_end(egc, dcs);
+
     if (rc) {
         domcreate_rebuild_done(egc, dcs, rc);
         return;
@@ -1001,6 +1056,8 @@ static void domcreate_bootloader_done(libxl__egc *egc,
      * been initialised by the bootloader already.
      */
     state->pv_cmdline = bl->cmdline;
+    if (dcs->tmpl)
+        libxl__domain_template_map_kernel(gc, dcs->tmpl, state);
 
     /* We might be going to call libxl__spawn_local_dm, or _spawn_stub_dm.
      * Fill in any field required by either, including both relevant
@@ -1012,8 +1069,8 @@ static void domcreate_bootloader_done(libxl__egc *egc,
     dcs->dmss.callback = domcreate_devmodel_started;
 
     if ( restore_fd < 0 ) {
-        rc = libxl__domain_build(gc, d_config, domid, state);
-        domcreate_rebuild_done(egc, dcs, rc);
+        domcreate_phase_begin(egc, dcs, LIBXL__DOMCREATE_PHASE_BUILD,
+                              domcreate_build);
         return;
     }
 
@@ -1127,6 +1184,18 @@ out:
     domcreate_rebuild_done(egc, dcs, ret);
 }
 
+static void domcreate_build(libxl__egc *egc, libxl__gate_waiter *w)
+{
+    libxl__domain_create_state *dcs = CONTAINER_OF(w, *dcs, gate_waiter);
+    STATE_AO_GC(dcs->ao);
+    int rc;
+
+    rc = libxl__domain_build(gc, dcs->guest_config, dcs->guest_domid,
+                             &dcs->build_state);
+    domcreate_phase_end(egc, dcs);
+    domcreate_rebuild_done(egc, dcs, rc);
+}
+
 static void domcreate_rebuild_done(libxl__egc *egc,
                                    libxl__domain_create_state *dcs,
                                    int ret)
@@ -1146,11 +1215,8 @@ static void domcreate_rebuild_done(libxl__egc *egc,
 
     store_libxl_entry(gc, domid, &d_config->b_info);
 
-    libxl__multidev_begin(ao, &dcs->multidev);
-    dcs->multidev.callback = domcreate_launch_dm;
-    libxl__add_disks(egc, ao, domid, d_config, &dcs->multidev);
-    libxl__multidev_prepared(egc, &dcs->multidev, 0);
-
+    domcreate_phase_begin(egc, dcs, LIBXL__DOMCREATE_PHASE_DEVICES,
+                          domcreate_add_disks);
     return;
 
  error_out:
@@ -1158,6 +1224,18 @@ static void domcreate_rebuild_done(libxl__egc *egc,
     domcreate_complete(egc, dcs, ret);
 }
 
+static void domcreate_add_disks(libxl__egc *egc, libxl__gate_waiter *w)
+{
+    libxl__domain_create_state *dcs = CONTAINER_OF(w, *dcs, gate_waiter);
+    STATE_AO_GC(dcs->ao);
+
+    libxl__multidev_begin(ao, &dcs->multidev);
+    dcs->multidev.callback = domcreate_launch_dm;
+    libxl__add_disks(egc, ao, dcs->guest_domid, dcs->guest_config,
+                     &dcs->multidev);
+    libxl__multidev_prepared(egc, &dcs->multidev, 0);
+}
+
 static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
                                 int ret)
 {
@@ -1170,6 +1248,8 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
     libxl_domain_config *const d_config = dcs->guest_config;
     libxl__domain_build_state *const state = &dcs->build_state;
 
+    domcreate_phase_end(egc, dcs);
+
     if (ret) {
         LOG(ERROR, "unable to add disk devices");
         goto error_out;
@@ -1266,19 +1346,8 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
         libxl_device_vkb_dispose(&vkb);
 
         dcs->dmss.dm.guest_domid = domid;
-        if (libxl_defbool_val(d_config->b_info.device_model_stubdomain))
-            libxl__spawn_stub_dm(egc, &dcs->dmss);
-        else
-            libxl__spawn_local_dm(egc, &dcs->dmss.dm);
-
-        /*
-         * Handle the domain's (and the related stubdomain's) access to
-         * the VGA framebuffer.
-         */
-        ret = libxl__grant_vga_iomem_permission(gc, domid, d_config);
-        if ( ret )
-            goto error_out;
-
+        domcreate_phase_begin(egc, dcs, LIBXL__DOMCREATE_PHASE_DEVICE_MODEL,
+                              domcreate_spawn_dm);
         return;
     }
     case LIBXL_DOMAIN_TYPE_PV:
@@ -1305,7 +1374,9 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
 
         if (need_qemu) {
             dcs->dmss.dm.guest_domid = domid;
-            libxl__spawn_local_dm(egc, &dcs->dmss.dm);
+            domcreate_phase_begin(egc, dcs,
+                                  LIBXL__DOMCREATE_PHASE_DEVICE_MODEL,
+                                  domcreate_spawn_dm);
             return;
         } else {
             assert(!dcs->dmss.dm.guest_domid);
@@ -1324,6 +1395,18 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
     domcreate_complete(egc, dcs, ret);
 }
 
+static void domcreate_spawn_dm(libxl__egc *egc, libxl__gate_waiter *w)
+{
+    libxl__domain_create_state *dcs = CONTAINER_OF(w, *dcs, gate_waiter);
+    libxl_domain_config *const d_config = dcs->guest_config;
+
+    if (d_config->c_info.type == LIBXL_DOMAIN_TYPE_HVM &&
+        libxl_defbool_val(d_config->b_info.device_model_stubdomain))
+        libxl__spawn_stub_dm(egc, &dcs->dmss);
+    else
+        libxl__spawn_local_dm(egc, &dcs->dmss.dm);
+}
+
 static void domcreate_devmodel_started(libxl__egc *egc,
                                        libxl__dm_spawn_state *dmss,
                                        int ret)
@@ -1336,35 +1419,89 @@ static void domcreate_devmodel_started(libxl__egc *egc,
     /* convenience aliases */
     libxl_domain_config *const d_config = dcs->guest_config;
 
+    domcreate_phase_end(egc, dcs);
+
     if (ret) {
         LIBXL__LOG(ctx, LIBXL__LOG_ERROR,
                    "device model did not start: %d", ret);
         goto error_out;
     }
 
+    /*
+     * Handle the domain's (and the related stubdomain's) access to
+     * the VGA framebuffer.  This needs the stubdomain to exist, and is
+     * done once the spawn has completed so that a failure here does not
+     * leave it outstanding.
+     */
+    if (d_config->c_info.type == LIBXL_DOMAIN_TYPE_HVM) {
+        ret = libxl__grant_vga_iomem_permission(gc, domid, d_config);
+        if (ret)
+            goto error_out;
+    }
+
     if (dcs->dmss.dm.guest_domid) {
         if (d_config->b_info.device_model_version
             == LIBXL_DEVICE_MODEL_VERSION_QEMU_XEN) {
-            libxl__qmp_initializations(gc, domid, d_config);
+            libxl__qmp_inits_state *qis = &dcs->qmp_inits;
+
+            qis->ao = ao;
+            qis->domid = domid;
+            qis->guest_config = d_config;
+            qis->callback = domcreate_qmp_initialized;
+            libxl__qmp_initializations(egc, qis);
+            return;
         }
     }
 
+    domcreate_plug_devices(egc, dcs);
+    return;
+
+error_out:
+    assert(ret);
+    domcreate_complete(egc, dcs, ret);
+}
+
+static void domcreate_qmp_initialized(libxl__egc *egc,
+                                      libxl__qmp_inits_state *qis,
+                                      int rc)
+{
+    libxl__domain_create_state *dcs = CONTAINER_OF(qis, *dcs, qmp_inits);
+
+    /* The device model not answering is not fatal; only being
+     * aborted is. */
+    if (rc == ERROR_ABORTED) {
+        domcreate_complete(egc, dcs, rc);
+        return;
+    }
+
+    domcreate_plug_devices(egc, dcs);
+}
+
+static void domcreate_plug_devices(libxl__egc *egc,
+                                   libxl__domain_create_state *dcs)
+{
+    libxl_domain_config *const d_config = dcs->guest_config;
+
     /* Plug nic interfaces */
     if (d_config->num_nics > 0) {
-        /* Attach nics */
-        libxl__multidev_begin(ao, &dcs->multidev);
-        dcs->multidev.callback = domcreate_attach_vtpms;
-        libxl__add_nics(egc, ao, domid, d_config, &dcs->multidev);
-        libxl__multidev_prepared(egc, &dcs->multidev, 0);
+        domcreate_phase_begin(egc, dcs, LIBXL__DOMCREATE_PHASE_DEVICES,
+                              domcreate_add_nics);
         return;
     }
 
     domcreate_attach_vtpms(egc, &dcs->multidev, 0);
-    return;
+}
 
-error_out:
-    assert(ret);
-    domcreate_complete(egc, dcs, ret);
+static void domcreate_add_nics(libxl__egc *egc, libxl__gate_waiter *w)
+{
+    libxl__domain_create_state *dcs = CONTAINER_OF(w, *dcs, gate_waiter);
+    STATE_AO_GC(dcs->ao);
+
+    libxl__multidev_begin(ao, &dcs->multidev);
+    dcs->multidev.callback = domcreate_attach_vtpms;
+    libxl__add_nics(egc, ao, dcs->guest_domid, dcs->guest_config,
+                    &dcs->multidev);
+    libxl__multidev_prepared(egc, &dcs->multidev, 0);
 }
 
 static void domcreate_attach_vtpms(libxl__egc *egc,
@@ -1377,6 +1514,8 @@ static void domcreate_attach_vtpms(libxl__egc *egc,
 
    libxl_domain_config* const d_config = dcs->guest_config;
 
+   domcreate_phase_end(egc, dcs);
+
    if(ret) {
        LOG(ERROR, "unable to add nic devices");
        goto error_out;
@@ -1484,6 +1623,8 @@ static void domcreate_complete(libxl__egc *egc,
     libxl_domain_config *const d_config = dcs->guest_config;
     libxl_domain_config *d_config_saved = &dcs->guest_config_saved;
 
+    domcreate_phase_end(egc, dcs);
+
     if (!rc && d_config->b_info.exec_ssidref)
         rc = xc_flask_relabel_domain(CTX->xch, dcs->guest_domid, d_config->b_info.exec_ssidref);
 
@@ -1551,6 +1692,7 @@ static void domain_create_cb(libxl__egc *egc,
 static int do_domain_create(libxl_ctx *ctx, libxl_domain_config *d_config,
                             uint32_t *domid, int restore_fd,
                             const libxl_domain_restore_params *params,
+                            const libxl_domain_template *tmpl,
                             const libxl_asyncop_how *ao_how,
                             const libxl_asyncprogress_how *aop_console_how)
 {
@@ -1572,6 +1714,7 @@ static int do_domain_create(libxl_ctx *ctx, libxl_domain_config *d_config,
         if (rc < 0) goto out_err;
     }
     cdcs->dcs.callback = domain_create_cb;
+    cdcs->dcs.tmpl = tmpl;
     libxl__ao_progress_gethow(&cdcs->dcs.aop_console_how, aop_console_how);
     cdcs->domid_out = domid;
 
@@ -1612,7 +1755,18 @@ int libxl_domain_create_new(libxl_ctx *ctx, libxl_domain_config *d_config,
                             const libxl_asyncop_how *ao_how,
                             const libxl_asyncprogress_how *aop_console_how)
 {
-    return do_domain_create(ctx, d_config, domid, -1, NULL,
+    return do_domain_create(ctx, d_config, domid, -1, NULL, NULL,
+                            ao_how, aop_console_how);
+}
+
+int libxl_domain_create_from_template(libxl_ctx *ctx,
+                                      const libxl_domain_template *tmpl,
+                                      libxl_domain_config *d_config,
+                                      uint32_t *domid,
+                                      const libxl_asyncop_how *ao_how,
+                                      const libxl_asyncprogress_how *aop_console_how)
+{
+    return do_domain_create(ctx, d_config, domid, -1, NULL, tmpl,
                             ao_how, aop_console_how);
 }
 
@@ -1622,10 +1776,134 @@ int libxl_domain_create_restore(libxl_ctx *ctx, libxl_domain_config *d_config,
                                 const libxl_asyncop_how *ao_how,
                                 const libxl_asyncprogress_how *aop_console_how)
 {
-    return do_domain_create(ctx, d_config, domid, restore_fd, params,
+    return do_domain_create(ctx, d_config, domid, restore_fd, params, NULL,
                             ao_how, aop_console_how);
 }
 
+/*----- application-facing batch domain creation interface -----*/
+
+typedef struct libxl__batch_domain_create_state
+    libxl__batch_domain_create_state;
+
+typedef struct {
+    libxl__domain_create_state dcs;
+    libxl__batch_domain_create_state *bdcs;
+    int index;
+} libxl__batch_domain_create_entry;
+
+struct libxl__batch_domain_create_state {
+    libxl__ao *ao;
+    libxl__gate gates[LIBXL__DOMCREATE_NR_PHASES];
+    libxl__batch_domain_create_entry *entries;
+    int outstanding;
+    uint32_t *domids_out;
+    int *rcs_out;
+    int rc;
+};
+
+static void batch_domain_create_cb(libxl__egc *egc,
+                                   libxl__domain_create_state *dcs,
+                                   int rc, uint32_t domid);
+static void batch_domain_create_put(libxl__egc *egc,
+                                    libxl__batch_domain_create_state *bdcs);
+
+int libxl_domain_create_batch(libxl_ctx *ctx, int nr_domains,
+                              libxl_domain_config *d_configs,
+                              uint32_t *domids, int *rcs,
+                              const libxl_domain_create_limits *limits,
+                              const libxl_asyncop_how *ao_how)
+{
+    AO_CREATE(ctx, 0, ao_how);
+    libxl__batch_domain_create_state *bdcs;
+    int i;
+
+    if (nr_domains <= 0) {
+        LOG(ERROR, "batch of %d domains requested", nr_domains);
+        return AO_CREATE_FAIL(ERROR_INVAL);
+    }
+
+    GCNEW(bdcs);
+    bdcs->ao = ao;
+    bdcs->domids_out = domids;
+    bdcs->rcs_out = rcs;
+    libxl__gate_init(&bdcs->gates[LIBXL__DOMCREATE_PHASE_BOOTLOADER],
+                     limits ? limits->bootloader : 0);
+    libxl__gate_init(&bdcs->gates[LIBXL__DOMCREATE_PHASE_BUILD],
+                     limits ? limits->build : 0);
+    libxl__gate_init(&bdcs->gates[LIBXL__DOMCREATE_PHASE_DEVICES],
+                     limits ? limits->devices : 0);
+    libxl__gate_init(&bdcs->gates[LIBXL__DOMCREATE_PHASE_DEVICE_MODEL],
+                     limits ? limits->device_model : 0);
+    GCNEW_ARRAY(bdcs->entries, nr_domains);
+
+    for (i = 0; i < nr_domains; i++) {
+        domids[i] = -1;
+        if (rcs)
+            rcs[i] = ERROR_FAIL;
+    }
+
+    /*
+     * One reference for each domain, plus one held until they have all
+     * been started, since any of them may fail synchronously.
+     */
+    bdcs->outstanding = nr_domains + 1;
+
+    for (i = 0; i < nr_domains; i++) {
+        libxl__batch_domain_create_entry *ent = &bdcs->entries[i];
+        libxl__domain_create_state *dcs = &ent->dcs;
+
+        ent->bdcs = bdcs;
+        ent->index = i;
+        dcs->ao = ao;
+        dcs->guest_config = &d_configs[i];
+        libxl_domain_config_init(&dcs->guest_config_saved);
+        libxl_domain_config_copy(ctx, &dcs->guest_config_saved,
+                                 &d_configs[i]);
+        dcs->restore_fd = dcs->libxc_fd = -1;
+        dcs->callback = batch_domain_create_cb;
+        libxl__ao_progress_gethow(&dcs->aop_console_how, NULL);
+        dcs->gates = bdcs->gates;
+
+        initiate_domain_create(egc, dcs);
+    }
+
+    batch_domain_create_put(egc, bdcs);
+
+    return AO_INPROGRESS;
+}
+
+static void batch_domain_create_cb(libxl__egc *egc,
+                                   libxl__domain_create_state *dcs,
+                                   int rc, uint32_t domid)
+{
+    libxl__batch_domain_create_entry *ent = CONTAINER_OF(dcs, *ent, dcs);
+    libxl__batch_domain_create_state *bdcs = ent->bdcs;
+    STATE_AO_GC(bdcs->ao);
+
+    bdcs->domids_out[ent->index] = domid;
+    if (bdcs->rcs_out)
+        bdcs->rcs_out[ent->index] = rc;
+
+    if (rc) {
+        LOG(ERROR, "batch creation of domain %d (%s) failed: %d",
+            ent->index, dcs->guest_config->c_info.name ?: "unnamed", rc);
+        if (!bdcs->rc)
+            bdcs->rc = rc;
+    }
+
+    batch_domain_create_put(egc, bdcs);
+}
+
+static void batch_domain_create_put(libxl__egc *egc,
+                                    libxl__batch_domain_create_state *bdcs)
+{
+    assert(bdcs->outstanding > 0);
+    if (--bdcs->outstanding)
+        return;
+
+    libxl__ao_complete(egc, bdcs->ao, bdcs->rc);
+}
+
 /*
  * Local variables:
  * mode: C
@@ -339,6 +339,21 @@ int libxl__device_physdisk_major_minor(const char *physpath, int *major, int *mi
     return 0;
 }
 
+const char *libxl__hotplug_script_native(const char *script)
+{
+    size_t len = strlen(LIBXL__HOTPLUG_NATIVE_PREFIX);
+
+    if (strncmp(script, LIBXL__HOTPLUG_NATIVE_PREFIX, len))
+        return NULL;
+    return script + len;
+}
+
+char *libxl__hotplug_script_path(libxl__gc *gc, const char *script)
+{
+    return libxl__abs_path(gc, libxl__hotplug_script_native(script) ?: script,
+                           libxl__xen_script_dir_path());
+}
+
 static int device_virtdisk_matches(const char *virtpath, const char *devtype,
                                    int *index_r, int max_index,
                                    int *partition_r, int max_partition) {
@@ -727,6 +742,8 @@ static void device_backend_cleanup(libxl__gc *gc,
 
 static void device_hotplug(libxl__egc *egc, libxl__ao_device *aodev);
 
+static void device_hotplug_exec(libxl__egc *egc, libxl__gate_waiter *w);
+
 static void device_hotplug_child_death_cb(libxl__egc *egc,
                                           libxl__async_exec_state *aes,
                                           int rc, int status);
@@ -976,7 +993,7 @@ static void device_hotplug(libxl__egc *egc, libxl__ao_device *aodev)
     char *be_path = libxl__device_backend_path(gc, aodev->dev);
     char **args = NULL, **env = NULL;
     int rc = 0;
-    int hotplug, nullfd = -1;
+    int hotplug;
     uint32_t domid;
 
     /*
@@ -1011,6 +1028,19 @@ static void device_hotplug(libxl__egc *egc, libxl__ao_device *aodev)
         return;
     }
 
+    hotplug = libxl__hotplug_native(gc, aodev->dev, aodev->action,
+                                    aodev->num_exec);
+    if (hotplug < 0) {
+        rc = hotplug;
+        goto out;
+    }
+    if (hotplug) {
+        /* As if the script had run; see whether there is another. */
+        aodev->num_exec++;
+        device_hotplug(egc, aodev);
+        return;
+    }
+
     /* Check if we have to execute hotplug scripts for this device
      * and return the necessary args/env vars for execution */
     hotplug = libxl__get_hotplug_script_info(gc, aodev->dev, &args, &env,
@@ -1032,7 +1062,32 @@ static void device_hotplug(libxl__egc *egc, libxl__ao_device *aodev)
         goto out;
     }
 
-    LOG(DEBUG, "calling hotplug script: %s %s", args[0], args[1]);
+    aes->ao = ao;
+    aes->what = GCSPRINTF("%s %s", args[0], args[1]);
+    aes->env = env;
+    aes->args = args;
+    aes->callback = device_hotplug_child_death_cb;
+    aes->timeout_ms = LIBXL_HOTPLUG_TIMEOUT * 1000;
+
+    /* Scripts of different devices run concurrently, up to a limit. */
+    aodev->hotplug_waiter.callback = device_hotplug_exec;
+    libxl__gate_enter(egc, CTX->hotplug_gate, &aodev->hotplug_waiter);
+    return;
+
+out:
+    aodev->rc = rc;
+    device_hotplug_done(egc, aodev);
+    return;
+}
+
+static void device_hotplug_exec(libxl__egc *egc, libxl__gate_waiter *w)
+{
+    libxl__ao_device *aodev = CONTAINER_OF(w, *aodev, hotplug_waiter);
+    STATE_AO_GC(aodev->ao);
+    libxl__async_exec_state *aes = &aodev->aes;
+    int rc, nullfd = -1;
+
+    LOG(DEBUG, "calling hotplug script: %s", aes->what);
 
     nullfd = open("/dev/null", O_RDONLY);
     if (nullfd < 0) {
@@ -1041,12 +1096,6 @@ static void device_hotplug(libxl__egc *egc, libxl__ao_device *aodev)
         goto out;
     }
 
-    aes->ao = ao;
-    aes->what = GCSPRINTF("%s %s", args[0], args[1]);
-    aes->env = env;
-    aes->args = args;
-    aes->callback = device_hotplug_child_death_cb;
-    aes->timeout_ms = LIBXL_HOTPLUG_TIMEOUT * 1000;
     aes->stdfds[0] = nullfd;
     aes->stdfds[1] = 2;
     aes->stdfds[2] = -1;
@@ -1062,9 +1111,9 @@ static void device_hotplug(libxl__egc *egc, libxl__ao_device *aodev)
 
 out:
     if (nullfd >= 0) close(nullfd);
+    libxl__gate_leave(egc, CTX->hotplug_gate);
     aodev->rc = rc;
     device_hotplug_done(egc, aodev);
-    return;
 }
 
 static void device_hotplug_child_death_cb(libxl__egc *egc,
@@ -1076,6 +1125,7 @@ static void device_hotplug_child_death_cb(libxl__egc *egc,
     char *be_path = libxl__device_backend_path(gc, aodev->dev);
     char *hotplug_error;
 
+    libxl__gate_leave(egc, CTX->hotplug_gate);
     device_hotplug_clean(gc, aodev);
 
     if (status && !rc) {
@@ -169,6 +169,113 @@ static void osevent_hook_failed_noop(libxl__gc *gc, void *ev,
                                      libxl__osevent_hook_nexus **nexus) { }
 
 
+/*
+ * kernel fd set
+ *
+ * Where the platform has one (epoll on Linux), the internal pollers
+ * do not poll() every registered fd on each iteration.  Instead the
+ * kernel keeps a set mirroring CTX->efds, and a poller waits for just
+ * that set and its own wakeup pipe, then harvests the ready fds.  The
+ * cost of an iteration then depends on the number of ready fds rather
+ * than on the number registered.
+ *
+ * The interest in each fd is the union of the events of all the
+ * efds on it, which are listed in CTX->efd_slots[fd].  Some fds
+ * (regular files, for example) cannot be put in the set at all;
+ * poll() would always report those ready, so we do the same.
+ *
+ * The application's poller (libxl_osevent_beforepoll and _afterpoll)
+ * is unaffected.
+ */
+
+void libxl__ev_fdset_setup(libxl__gc *gc)
+{
+    const char *force_poll = getenv("LIBXL_EVENT_FORCE_POLL");
+
+    CTX->efds_set = -1;
+    if (force_poll && *force_poll && strcmp(force_poll, "0"))
+        return;
+
+    CTX->efds_set = libxl__fdset_open();
+    if (CTX->efds_set < 0 && errno != ENOSYS)
+        LOGE(DEBUG, "cannot create kernel fd set, polling every fd instead");
+}
+
+/* Brings CTX->efds_set into line with the efds on fd. */
+static int fdset_update(libxl__gc *gc, int fd)
+{
+    libxl__ev_fd_slot *slot = &CTX->efd_slots[fd];
+    libxl__ev_fd *efd;
+    short events = 0;
+    int e;
+
+    if (slot->unpollable) {
+        if (LIBXL_LIST_EMPTY(&slot->efds)) {
+            slot->unpollable = 0;
+            CTX->efds_unpollable--;
+        }
+        return 0;
+    }
+
+    LIBXL_LIST_FOREACH(efd, &slot->efds, slot_entry)
+        events |= efd->events;
+
+    if (events == slot->events)
+        return 0;
+
+    e = libxl__fdset_ctl(CTX->efds_set, fd, slot->events, events);
+    if (e == EPERM && !slot->events) {
+        slot->unpollable = 1;
+        CTX->efds_unpollable++;
+        return 0;
+    }
+    if (e) {
+        LOGEV(ERROR, e, "cannot watch fd=%d in kernel fd set", fd);
+        return ERROR_FAIL;
+    }
+
+    slot->events = events;
+    return 0;
+}
+
+static int fdset_add(libxl__gc *gc, libxl__ev_fd *ev)
+{
+    int rc;
+
+    if (CTX->efds_set < 0)
+        return 0;
+
+    if (ev->fd >= CTX->efd_slots_allocd) {
+        int newsize = ev->fd + 1;
+        if (newsize < CTX->efd_slots_allocd * 2)
+            newsize = CTX->efd_slots_allocd * 2;
+        CTX->efd_slots = libxl__realloc(NOGC, CTX->efd_slots,
+                                        newsize * sizeof(*CTX->efd_slots));
+        memset(CTX->efd_slots + CTX->efd_slots_allocd, 0,
+               (newsize - CTX->efd_slots_allocd) * sizeof(*CTX->efd_slots));
+        CTX->efd_slots_allocd = newsize;
+    }
+
+    ev->round = CTX->efds_round - 1;
+    LIBXL_LIST_INSERT_HEAD(&CTX->efd_slots[ev->fd].efds, ev, slot_entry);
+
+    rc = fdset_update(gc, ev->fd);
+    if (rc) {
+        LIBXL_LIST_REMOVE(ev, slot_entry);
+        fdset_update(gc, ev->fd);
+    }
+    return rc;
+}
+
+static void fdset_remove(libxl__gc *gc, libxl__ev_fd *ev)
+{
+    if (CTX->efds_set < 0)
+        return;
+
+    LIBXL_LIST_REMOVE(ev, slot_entry);
+    fdset_update(gc, ev->fd);
+}
+
 /*
  * fd events
  */
@@ -185,12 +292,18 @@ int libxl__ev_fd_register(libxl__gc *gc, libxl__ev_fd *ev,
 
     DBG("ev_fd=%p register fd=%d events=%x", ev, fd, events);
 
+    ev->fd = fd;
+    ev->events = events;
+    rc = fdset_add(gc, ev);
+    if (rc) goto out;
+
     rc = OSEVENT_HOOK(fd,register, alloc, fd, &ev->nexus->for_app_reg,
                       events, ev->nexus);
-    if (rc) goto out;
+    if (rc) {
+        fdset_remove(gc, ev);
+        goto out;
+    }
 
-    ev->fd = fd;
-    ev->events = events;
     ev->func = func;
 
     LIBXL_LIST_INSERT_HEAD(&CTX->efds, ev, entry);
@@ -198,12 +311,14 @@ int libxl__ev_fd_register(libxl__gc *gc, libxl__ev_fd *ev,
     rc = 0;
 
  out:
+    if (rc) ev->fd = -1;
     CTX_UNLOCK;
     return rc;
 }
 
 int libxl__ev_fd_modify(libxl__gc *gc, libxl__ev_fd *ev, short events)
 {
+    short old_events;
     int rc;
 
     CTX_LOCK;
@@ -211,13 +326,23 @@ int libxl__ev_fd_modify(libxl__gc *gc, libxl__ev_fd *ev, short events)
 
     DBG("ev_fd=%p modify fd=%d events=%x", ev, ev->fd, events);
 
+    old_events = ev->events;
+    ev->events = events;
+    if (CTX->efds_set >= 0) {
+        rc = fdset_update(gc, ev->fd);
+        if (rc) goto out;
+    }
+
     rc = OSEVENT_HOOK(fd,modify, noop, ev->fd, &ev->nexus->for_app_reg, events);
     if (rc) goto out;
 
-    ev->events = events;
-
     rc = 0;
  out:
+    if (rc) {
+        ev->events = old_events;
+        if (CTX->efds_set >= 0)
+            fdset_update(gc, ev->fd);
+    }
     CTX_UNLOCK;
     return rc;
 }
@@ -236,6 +361,7 @@ void libxl__ev_fd_deregister(libxl__gc *gc, libxl__ev_fd *ev)
 
     OSEVENT_HOOK_VOID(fd,deregister, release, ev->fd, ev->nexus->for_app_reg);
     LIBXL_LIST_REMOVE(ev, entry);
+    fdset_remove(gc, ev);
     ev->fd = -1;
 
     LIBXL_LIST_FOREACH(poller, &CTX->pollers_fds_changed, fds_changed_entry)
@@ -299,11 +425,91 @@ static int time_rel_to_abs(libxl__gc *gc, int ms, struct timeval *abs_out)
     return 0;
 }
 
+/*
+ * The finite timeouts are kept in CTX->etimes, a binary min-heap
+ * ordered by abs and then by order of registration (so that timeouts
+ * for the same time still occur in the order they were set up).  Each
+ * ev_time records its own heap_index, so that it can be removed from
+ * the middle of the heap in O(log n).
+ */
+
+static bool time_before(const libxl__ev_time *a, const libxl__ev_time *b)
+{
+    if (timercmp(&a->abs, &b->abs, !=))
+        return timercmp(&a->abs, &b->abs, <);
+    return a->seq < b->seq;
+}
+
+static void time_heap_set(libxl_ctx *ctx, int i, libxl__ev_time *ev)
+{
+    ctx->etimes[i] = ev;
+    ev->heap_index = i;
+}
+
+static void time_heap_fixup(libxl_ctx *ctx, int i)
+{
+    libxl__ev_time *ev = ctx->etimes[i];
+
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!time_before(ev, ctx->etimes[parent]))
+            break;
+        time_heap_set(ctx, i, ctx->etimes[parent]);
+        i = parent;
+    }
+
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= ctx->etimes_used)
+            break;
+        if (child + 1 < ctx->etimes_used &&
+            time_before(ctx->etimes[child + 1], ctx->etimes[child]))
+            child++;
+        if (!time_before(ctx->etimes[child], ev))
+            break;
+        time_heap_set(ctx, i, ctx->etimes[child]);
+        i = child;
+    }
+
+    time_heap_set(ctx, i, ev);
+}
+
+static void time_heap_insert(libxl__gc *gc, libxl__ev_time *ev)
+{
+    if (CTX->etimes_used == CTX->etimes_allocd) {
+        int newsize = CTX->etimes_allocd ? CTX->etimes_allocd * 2 : 16;
+        CTX->etimes = libxl__realloc(NOGC, CTX->etimes,
+                                     newsize * sizeof(*CTX->etimes));
+        CTX->etimes_allocd = newsize;
+    }
+
+    ev->seq = CTX->etimes_seq++;
+    time_heap_set(CTX, CTX->etimes_used++, ev);
+    time_heap_fixup(CTX, ev->heap_index);
+}
+
+static void time_heap_remove(libxl__gc *gc, libxl__ev_time *ev)
+{
+    int i = ev->heap_index;
+
+    assert(i < CTX->etimes_used && CTX->etimes[i] == ev);
+
+    CTX->etimes_used--;
+    if (i < CTX->etimes_used) {
+        time_heap_set(CTX, i, CTX->etimes[CTX->etimes_used]);
+        time_heap_fixup(CTX, i);
+    }
+}
+
+static libxl__ev_time *time_heap_first(libxl_ctx *ctx)
+{
+    return ctx->etimes_used ? ctx->etimes[0] : NULL;
+}
+
 static int time_register_finite(libxl__gc *gc, libxl__ev_time *ev,
                                 struct timeval absolute)
 {
     int rc;
-    libxl__ev_time *evsearch;
 
     rc = OSEVENT_HOOK(timeout,register, alloc, &ev->nexus->for_app_reg,
                       absolute, ev->nexus);
@@ -311,8 +517,7 @@ static int time_register_finite(libxl__gc *gc, libxl__ev_time *ev,
 
     ev->infinite = 0;
     ev->abs = absolute;
-    LIBXL_TAILQ_INSERT_SORTED(&CTX->etimes, entry, ev, evsearch, /*empty*/,
-                              timercmp(&ev->abs, &evsearch->abs, >));
+    time_heap_insert(gc, ev);
 
     return 0;
 }
@@ -328,7 +533,7 @@ static void time_deregister(libxl__gc *gc, libxl__ev_time *ev)
         OSEVENT_HOOK_VOID(timeout,modify,
                           noop /* release nexus in _occurred_ */,
                           &ev->nexus->for_app_reg, right_away);
-        LIBXL_TAILQ_REMOVE(&CTX->etimes, ev, entry);
+        time_heap_remove(gc, ev);
     }
 }
 
@@ -1010,6 +1215,29 @@ int libxl__domaindeathcheck_start(libxl__ao *ao,
  * osevent poll
  */
 
+/* Lowers *timeout_upd (as for poll) to the first of our timeouts. */
+static void time_timeout(libxl__gc *gc, int *timeout_upd, struct timeval now)
+{
+    libxl__ev_time *etime = time_heap_first(CTX);
+    if (etime) {
+        int our_timeout;
+        struct timeval rel;
+        static struct timeval zero;
+
+        timersub(&etime->abs, &now, &rel);
+
+        if (timercmp(&rel, &zero, <)) {
+            our_timeout = 0;
+        } else if (rel.tv_sec >= 2000000) {
+            our_timeout = 2000000000;
+        } else {
+            our_timeout = rel.tv_sec * 1000 + (rel.tv_usec + 999) / 1000;
+        }
+        if (*timeout_upd < 0 || our_timeout < *timeout_upd)
+            *timeout_upd = our_timeout;
+    }
+}
+
 static int beforepoll_internal(libxl__gc *gc, libxl__poller *poller,
                                int *nfds_io, struct pollfd *fds,
                                int *timeout_upd, struct timeval now)
@@ -1116,24 +1344,7 @@ static int beforepoll_internal(libxl__gc *gc, libxl__poller *poller,
 
     poller->fds_changed = 0;
 
-    libxl__ev_time *etime = LIBXL_TAILQ_FIRST(&CTX->etimes);
-    if (etime) {
-        int our_timeout;
-        struct timeval rel;
-        static struct timeval zero;
-
-        timersub(&etime->abs, &now, &rel);
-
-        if (timercmp(&rel, &zero, <)) {
-            our_timeout = 0;
-        } else if (rel.tv_sec >= 2000000) {
-            our_timeout = 2000000000;
-        } else {
-            our_timeout = rel.tv_sec * 1000 + (rel.tv_usec + 999) / 1000;
-        }
-        if (*timeout_upd < 0 || our_timeout < *timeout_upd)
-            *timeout_upd = our_timeout;
-    }
+    time_timeout(gc, timeout_upd, now);
 
     return rc;
 }
@@ -1206,6 +1417,27 @@ static void fd_occurs(libxl__egc *egc, libxl__ev_fd *efd, short revents_ign)
         efd->func(egc, efd, efd->fd, efd->events, revents_current);
 }
 
+/* Calls back every timeout whose time has come. */
+static void time_occurs_due(libxl__egc *egc, struct timeval now)
+{
+    EGC_GC;
+
+    for (;;) {
+        libxl__ev_time *etime = time_heap_first(CTX);
+        if (!etime)
+            break;
+
+        assert(!etime->infinite);
+
+        if (timercmp(&etime->abs, &now, >))
+            break;
+
+        time_deregister(gc, etime);
+
+        time_occurs(egc, etime, ERROR_TIMEDOUT);
+    }
+}
+
 static void afterpoll_internal(libxl__egc *egc, libxl__poller *poller,
                                int nfds, const struct pollfd *fds,
                                struct timeval now)
@@ -1276,20 +1508,7 @@ static void afterpoll_internal(libxl__egc *egc, libxl__poller *poller,
         if (e) LIBXL__EVENT_DISASTER(egc, "read wakeup", e, 0);
     }
 
-    for (;;) {
-        libxl__ev_time *etime = LIBXL_TAILQ_FIRST(&CTX->etimes);
-        if (!etime)
-            break;
-
-        assert(!etime->infinite);
-
-        if (timercmp(&etime->abs, &now, >))
-            break;
-
-        time_deregister(gc, etime);
-
-        time_occurs(egc, etime, ERROR_TIMEDOUT);
-    }
+    time_occurs_due(egc, now);
 }
 
 void libxl_osevent_afterpoll(libxl_ctx *ctx, int nfds, const struct pollfd *fds,
@@ -1313,7 +1532,7 @@ void libxl_osevent_register_hooks(libxl_ctx *ctx,
     GC_INIT(ctx);
     CTX_LOCK;
     assert(LIBXL_LIST_EMPTY(&ctx->efds));
-    assert(LIBXL_TAILQ_EMPTY(&ctx->etimes));
+    assert(!ctx->etimes_used);
     ctx->osevent_hooks = hooks;
     ctx->osevent_user = user;
     CTX_UNLOCK;
@@ -1353,7 +1572,7 @@ void libxl_osevent_occurred_timeout(libxl_ctx *ctx, void *for_libxl)
     if (!ev) goto out;
     assert(!ev->infinite);
 
-    LIBXL_TAILQ_REMOVE(&CTX->etimes, ev, entry);
+    time_heap_remove(gc, ev);
 
     time_occurs(egc, ev, ERROR_TIMEDOUT);
 
@@ -1666,6 +1885,122 @@ void libxl__poller_wakeup(libxl__egc *egc, libxl__poller *p)
  * Main event loop iteration
  */
 
+#define FDSET_HARVEST 64
+
+/* Calls back the efds on fd for which the kernel fd set said revents. */
+static void fdset_occurs(libxl__egc *egc, int fd, short revents)
+{
+    EGC_GC;
+    libxl__ev_fd *efd;
+    unsigned round = ++CTX->efds_round;
+
+    /* As in afterpoll_internal, a callback may change the efds on fd
+     * arbitrarily, so we restart the scan after each one, and mark
+     * the efds we have called so as not to call them again. */
+    for (;;) {
+        if (fd >= CTX->efd_slots_allocd)
+            return;
+
+        LIBXL_LIST_FOREACH(efd, &CTX->efd_slots[fd].efds, slot_entry) {
+            if (efd->round != round &&
+                (revents & (efd->events | POLLERR | POLLHUP)))
+                goto found;
+        }
+        return;
+
+    found:
+        efd->round = round;
+        fd_occurs(egc, efd, revents);
+    }
+}
+
+/* Calls back the efds on fds which the kernel fd set would not take. */
+static void fdset_unpollable_occur(libxl__egc *egc)
+{
+    EGC_GC;
+    libxl__ev_fd *efd;
+    unsigned round = ++CTX->efds_round;
+
+    while (CTX->efds_unpollable) {
+        LIBXL_LIST_FOREACH(efd, &CTX->efds, entry) {
+            if (efd->round != round && efd->events &&
+                CTX->efd_slots[efd->fd].unpollable)
+                goto found;
+        }
+        return;
+
+    found:
+        efd->round = round;
+        fd_occurs(egc, efd, efd->events);
+    }
+}
+
+static int eventloop_iteration_fdset(libxl__egc *egc, libxl__poller *poller)
+{
+    /* Like eventloop_iteration, but waiting on CTX->efds_set. */
+    EGC_GC;
+    struct pollfd fds[2];
+    libxl__fdset_ready ready[FDSET_HARVEST];
+    struct timeval now;
+    int rc, nready, i, timeout = -1;
+
+    rc = libxl__gettimeofday(gc, &now);
+    if (rc) goto out;
+
+    time_timeout(gc, &timeout, now);
+    if (CTX->efds_unpollable)
+        timeout = 0;
+
+    fds[0].fd = poller->wakeup_pipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = CTX->efds_set;
+    fds[1].events = POLLIN;
+
+    CTX_UNLOCK;
+    rc = poll(fds, 2, timeout);
+    CTX_LOCK;
+
+    if (rc < 0) {
+        if (errno == EINTR)
+            return 0; /* will go round again if caller requires */
+
+        LIBXL__LOG_ERRNOVAL(CTX, LIBXL__LOG_ERROR, errno, "poll failed");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    rc = libxl__gettimeofday(gc, &now);
+    if (rc) goto out;
+
+    /* Another thread may have harvested the same fds since, in which
+     * case there is nothing left for us; we don't mind. */
+    nready = libxl__fdset_harvest(CTX->efds_set, ready, FDSET_HARVEST);
+    if (nready < 0) {
+        if (errno == EINTR)
+            return 0;
+
+        LOGE(ERROR, "failed to collect ready fds from kernel fd set");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    for (i = 0; i < nready; i++)
+        fdset_occurs(egc, ready[i].fd, ready[i].revents);
+
+    fdset_unpollable_occur(egc);
+
+    if (fds[0].revents & POLLIN) {
+        int e = libxl__self_pipe_eatall(poller->wakeup_pipe[0]);
+        if (e) LIBXL__EVENT_DISASTER(egc, "read wakeup", e, 0);
+    }
+
+    time_occurs_due(egc, now);
+
+    rc = 0;
+ out:
+    return rc;
+}
+
 static int eventloop_iteration(libxl__egc *egc, libxl__poller *poller) {
     /* The CTX must be locked EXACTLY ONCE so that this function
      * can unlock it when it polls.
@@ -1673,7 +2008,10 @@ static int eventloop_iteration(libxl__egc *egc, libxl__poller *poller) {
     EGC_GC;
     int rc, nfds;
     struct timeval now;
-    
+
+    if (CTX->efds_set >= 0)
+        return eventloop_iteration_fdset(egc, poller);
+
     rc = libxl__gettimeofday(gc, &now);
     if (rc) goto out;
 
@@ -77,7 +77,7 @@ static int libxl__hotplug_nic(libxl__gc *gc, libxl__device *dev, char ***args,
     }
 
     GCNEW_ARRAY(*args, arraysize);
-    (*args)[nr++] = script;
+    (*args)[nr++] = libxl__hotplug_script_path(gc, script);
     (*args)[nr++] = be_path;
     (*args)[nr++] = GCSPRINTF("%s", action == LIBXL__DEVICE_ACTION_ADD ?
                                     "add" : "remove");
@@ -127,6 +127,13 @@ out:
     return rc;
 }
 
+int libxl__hotplug_native(libxl__gc *gc, libxl__device *dev,
+                          libxl__device_action action, int num_exec)
+{
+    /* Always run the script. */
+    return 0;
+}
+
 libxl_device_model_version libxl__default_device_model(libxl__gc *gc)
 {
     return LIBXL_DEVICE_MODEL_VERSION_QEMU_XEN;
@@ -143,3 +150,20 @@ int libxl__pci_topology_init(libxl__gc *gc,
 {
     return ERROR_NI;
 }
+
+int libxl__fdset_open(void)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int libxl__fdset_ctl(int setfd, int fd, short old, short new)
+{
+    return ENOSYS;
+}
+
+int libxl__fdset_harvest(int setfd, libxl__fdset_ready *ready, int max)
+{
+    errno = ENOSYS;
+    return -1;
+}
@@ -385,18 +385,14 @@ int libxl__device_model_version_running(libxl__gc *gc, uint32_t domid)
 /* Portability note: this lock utilises flock(2) so a proper implementation of
  * flock(2) is required.
  */
-libxl__domain_userdata_lock *libxl__lock_domain_userdata(libxl__gc *gc,
-                                                         uint32_t domid)
+static libxl__file_lock *lock_file(libxl__gc *gc, const char *lockfile,
+                                   bool wait, bool *busy_r)
 {
-    libxl__domain_userdata_lock *lock = NULL;
-    const char *lockfile;
+    libxl__file_lock *lock;
     int fd;
     struct stat stab, fstab;
 
-    lockfile = libxl__userdata_path(gc, domid, "domain-userdata-lock", "l");
-    if (!lockfile) goto out;
-
-    lock = libxl__zalloc(NOGC, sizeof(libxl__domain_userdata_lock));
+    lock = libxl__zalloc(NOGC, sizeof(libxl__file_lock));
     lock->path = libxl__strdup(NOGC, lockfile);
 
     while (true) {
@@ -407,14 +403,24 @@ libxl__domain_userdata_lock *libxl__lock_domain_userdata(libxl__gc *gc,
         lock->carefd = libxl__carefd_opened(CTX, fd);
         if (fd < 0) goto out;
 
-        /* Lock the file in exclusive mode, wait indefinitely to
-         * acquire the lock
+        /* Lock the file in exclusive mode, waiting indefinitely to
+         * acquire the lock unless told otherwise
          */
-        while (flock(fd, LOCK_EX)) {
+        while (flock(fd, LOCK_EX | (wait ? 0 : LOCK_NB))) {
             switch (errno) {
             case EINTR:
                 /* Signal received, retry */
                 continue;
+            case EWOULDBLOCK:
+                if (!wait) {
+                    /* Someone else's lock file: leave it be. */
+                    *busy_r = true;
+                    libxl__carefd_close(lock->carefd);
+                    free(lock->path);
+                    free(lock);
+                    return NULL;
+                }
+                /* fall through */
             default:
                 /* All other errno: EBADF, EINVAL, ENOLCK, EWOULDBLOCK */
                 LOGE(ERROR,
@@ -442,20 +448,30 @@ libxl__domain_userdata_lock *libxl__lock_domain_userdata(libxl__gc *gc,
         libxl__carefd_close(lock->carefd);
     }
 
-    /* Check the domain is still there, if not we should release the
-     * lock and clean up.
-     */
-    if (libxl_domain_info(CTX, NULL, domid))
-        goto out;
-
     return lock;
 
 out:
-    if (lock) libxl__unlock_domain_userdata(lock);
+    libxl__unlock_file(lock);
     return NULL;
 }
 
-void libxl__unlock_domain_userdata(libxl__domain_userdata_lock *lock)
+libxl__file_lock *libxl__lock_file(libxl__gc *gc, const char *lockfile)
+{
+    return lock_file(gc, lockfile, true, NULL);
+}
+
+int libxl__trylock_file(libxl__gc *gc, const char *lockfile,
+                        libxl__file_lock **lock_r)
+{
+    bool busy = false;
+
+    *lock_r = lock_file(gc, lockfile, false, &busy);
+    if (*lock_r || busy)
+        return 0;
+    return ERROR_LOCK_FAIL;
+}
+
+void libxl__unlock_file(libxl__file_lock *lock)
 {
     /* It's important to unlink the file before closing fd to avoid
      * the following race (if close before unlink):
@@ -477,6 +493,34 @@ void libxl__unlock_domain_userdata(libxl__domain_userdata_lock *lock)
     free(lock);
 }
 
+libxl__domain_userdata_lock *libxl__lock_domain_userdata(libxl__gc *gc,
+                                                         uint32_t domid)
+{
+    libxl__domain_userdata_lock *lock;
+    const char *lockfile;
+
+    lockfile = libxl__userdata_path(gc, domid, "domain-userdata-lock", "l");
+    if (!lockfile) return NULL;
+
+    lock = libxl__lock_file(gc, lockfile);
+    if (!lock) return NULL;
+
+    /* Check the domain is still there, if not we should release the
+     * lock and clean up.
+     */
+    if (libxl_domain_info(CTX, NULL, domid)) {
+        libxl__unlock_domain_userdata(lock);
+        return NULL;
+    }
+
+    return lock;
+}
+
+void libxl__unlock_domain_userdata(libxl__domain_userdata_lock *lock)
+{
+    libxl__unlock_file(lock);
+}
+
 int libxl__get_domain_configuration(libxl__gc *gc, uint32_t domid,
                                     libxl_domain_config *d_config)
 {
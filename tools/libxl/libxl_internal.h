@@ -87,6 +87,9 @@
 #define LIBXL_INIT_TIMEOUT 10
 #define LIBXL_DESTROY_TIMEOUT 10
 #define LIBXL_HOTPLUG_TIMEOUT 40
+/* Hotplug scripts run at once per ctx; LIBXL_HOTPLUG_CONCURRENCY in the
+ * environment overrides this, and 0 means no limit. */
+#define LIBXL_HOTPLUG_CONCURRENCY 8
 /* QEMU may be slow to load and start due to a bug in Linux where the I/O
  * subsystem sometime produce high latency under load. */
 #define LIBXL_DEVICE_MODEL_START_TIMEOUT 60
@@ -201,6 +204,8 @@ struct libxl__ev_fd {
     /* remainder is private for libxl__ev_fd... */
     LIBXL_LIST_ENTRY(libxl__ev_fd) entry;
     libxl__osevent_hook_nexus *nexus;
+    LIBXL_LIST_ENTRY(libxl__ev_fd) slot_entry; /* only if CTX->efds_set */
+    unsigned round; /* see libxl_event.c:fdset_occurs */
 };
 
 
@@ -249,8 +254,9 @@ struct libxl__ev_time {
     /* read-only for caller, who may read only when registered: */
     libxl__ev_time_callback *func;
     /* remainder is private for libxl__ev_time... */
-    int infinite; /* not registered in list or with app if infinite */
-    LIBXL_TAILQ_ENTRY(libxl__ev_time) entry;
+    int infinite; /* not registered in heap or with app if infinite */
+    int heap_index; /* in CTX->etimes */
+    uint64_t seq; /* orders timeouts with the same abs */
     struct timeval abs;
     libxl__osevent_hook_nexus *nexus;
     libxl__ao_abortable abrt;
@@ -343,6 +349,12 @@ struct libxl__evgen_disk_eject {
 _hidden void
 libxl__evdisable_disk_eject(libxl__gc*, libxl_evgen_disk_eject*);
 
+typedef struct libxl__ev_fd_slot {
+    LIBXL_LIST_HEAD(, libxl__ev_fd) efds; /* all on one fd */
+    short events; /* as currently in CTX->efds_set */
+    bool unpollable; /* refused by the set; treated as always ready */
+} libxl__ev_fd_slot;
+
 typedef struct libxl__poller libxl__poller;
 struct libxl__poller {
     /*
@@ -431,7 +443,18 @@ struct libxl__ctx {
     LIBXL_SLIST_HEAD(libxl__osevent_hook_nexi, libxl__osevent_hook_nexus)
         hook_fd_nexi_idle, hook_timeout_nexi_idle;
     LIBXL_LIST_HEAD(, libxl__ev_fd) efds;
-    LIBXL_TAILQ_HEAD(, libxl__ev_time) etimes;
+    libxl__ev_time **etimes; /* binary min-heap, see libxl_event.c */
+    int etimes_used, etimes_allocd;
+    uint64_t etimes_seq;
+
+    /* Kernel fd set (epoll on Linux) mirroring efds, used by the
+     * internal pollers instead of poll()ing every fd; -1 if none.
+     * efd_slots is indexed by fd.  See libxl_event.c. */
+    int efds_set;
+    libxl__ev_fd_slot *efd_slots;
+    int efd_slots_allocd;
+    int efds_unpollable; /* slots the kernel set would not take */
+    unsigned efds_round;
 
     libxl__ev_watch_slot *watch_slots;
     int watch_nslots, nwatches;
@@ -449,6 +472,8 @@ struct libxl__ctx {
         death_list /* sorted by domid */,
         death_reported;
     libxl__ev_xswatch death_watch;
+
+    struct libxl__gate *hotplug_gate; /* bounds running hotplug scripts */
     
     LIBXL_LIST_HEAD(, libxl_evgen_disk_eject) disk_eject_evgens;
 
@@ -1027,6 +1052,24 @@ _hidden void libxl__poller_put(libxl_ctx*, libxl__poller *p /* may be NULL */);
  * ctx must be locked. */
 _hidden void libxl__poller_wakeup(libxl__egc *egc, libxl__poller *p);
 
+/* Sets up CTX->efds_set, unless the platform has no kernel fd set
+ * or LIBXL_EVENT_FORCE_POLL is set in the environment.  Cannot fail
+ * (we just poll() every fd instead).  For libxl_ctx_alloc. */
+_hidden void libxl__ev_fdset_setup(libxl__gc *gc);
+
+/* OS-dependent kernel fd set (libxl_<os>.c).  _open returns a
+ * close-on-exec fd, or -1 setting errno (ENOSYS if there is no such
+ * facility).  _ctl changes the interest in fd from the poll(2) events
+ * old to new (0 meaning not in the set), returning 0 or an errno value
+ * (EPERM if fd is of a kind the set cannot watch).  _harvest fills in
+ * up to max ready fds without blocking, returning how many, or -1
+ * setting errno. */
+typedef struct { int fd; short revents; } libxl__fdset_ready;
+_hidden int libxl__fdset_open(void);
+_hidden int libxl__fdset_ctl(int setfd, int fd, short old, short new);
+_hidden int libxl__fdset_harvest(int setfd, libxl__fdset_ready *ready,
+                                 int max);
+
 /* Internal to fork and child reaping machinery */
 extern const libxl_childproc_hooks libxl__childproc_default_hooks;
 int libxl__sigchld_needed(libxl__gc*); /* non-reentrant idempotent, logs errs */
@@ -1753,9 +1796,13 @@ _hidden void libxl__qmp_close(libxl__qmp_handler *qmp);
  * nothing happen */
 _hidden void libxl__qmp_cleanup(libxl__gc *gc, uint32_t domid);
 
-/* this helper calls qmp_initialize, query_serial and qmp_close */
-_hidden int libxl__qmp_initializations(libxl__gc *gc, uint32_t domid,
-                                       const libxl_domain_config *guest_config);
+/* Adds the virtual CPUs in cpumap, up to max_id, sending all the
+ * commands before waiting for any reply.  Failures of individual
+ * commands are ignored, as they do not tell anything useful (for
+ * instance, "CPU already plugged-in" looks like "command not
+ * supported"). */
+_hidden int libxl__qmp_cpus_add(libxl__gc *gc, int domid,
+                                const libxl_bitmap *cpumap, int max_id);
 
 /* on failure, logs */
 int libxl__sendmsg_fds(libxl__gc *gc, int carrier,
@@ -1815,6 +1862,153 @@ typedef struct {
     libxl__json_object *obj;
 } libxl__json_map_node;
 
+/*
+ * Streaming parse of JSON straight into IDL types.
+ *
+ * gentypes.py describes each struct type with a libxl__json_sax_type
+ * (libxl__FOO_sax), which libxl__json_parse_sax follows as yajl calls
+ * back, filling in the struct as it goes without first building a
+ * tree of libxl__json_objects.  Values of the builtin types are still
+ * handed to their libxl__FOO_parse_json function as a
+ * libxl__json_object: scalars on the stack, and the few builtins which
+ * are arrays or maps in JSON (bitmaps, lists) as a small tree.
+ *
+ * What is accepted, and what is ignored, is exactly as for the
+ * corresponding libxl__FOO_parse_json.
+ */
+typedef struct libxl__json_sax_type libxl__json_sax_type;
+
+typedef struct {
+    const char *name;
+    size_t name_len;
+    libxl__json_node_type json_type; /* values of other types are ignored */
+    size_t offset; /* of the member, from the start of the struct */
+    const libxl__json_sax_type *type; /* of the elements, for an array */
+    /* arrays only: */
+    size_t elem_size;
+    size_t len_offset; /* of the int count of elements */
+    /* members of keyed unions only: */
+    void (*select)(void *p); /* sets the key and initialises the member */
+} libxl__json_sax_field;
+
+struct libxl__json_sax_type {
+    /* a builtin type */
+    libxl__json_parse_callback parse;
+    /* otherwise, a struct */
+    const libxl__json_sax_field *fields;
+    int nr_fields;
+};
+
+_hidden int libxl__json_parse_sax(libxl__gc *gc, const char *s,
+                                  const libxl__json_sax_type *type, void *p);
+_hidden int libxl__object_from_json_sax(libxl_ctx *ctx, const char *type,
+                                        const libxl__json_sax_type *sax,
+                                        void *p, const char *s);
+
+/*
+ * Generating JSON into a buffer which can be reused, so that a caller
+ * producing JSON repeatedly need not allocate each time.  buf is
+ * NUL-terminated once anything has been generated into it.
+ */
+typedef struct {
+    char *buf;
+    size_t used, allocd;
+} libxl__json_buf;
+
+static inline void libxl__json_buf_init(libxl__json_buf *jb)
+{
+    jb->buf = NULL;
+    jb->used = jb->allocd = 0;
+}
+
+_hidden void libxl__json_buf_dispose(libxl__json_buf *jb);
+
+/* Replaces the contents of jb with the JSON for p.  Returns 0 or
+ * ERROR_FAIL, having logged. */
+_hidden int libxl__object_to_json_buf(libxl_ctx *ctx, libxl__json_buf *jb,
+                                      const char *type,
+                                      libxl__gen_json_callback gen, void *p);
+
+/*
+ * libxl__ev_qmp: an asynchronous QMP channel to a domain's device
+ * model, for use within an ao.
+ *
+ * The channel connects when the first command is sent, and then stays
+ * open until it is disposed of, so that an operation with several
+ * commands to send pays for the connection and capability negotiation
+ * once.  Commands are written as soon as they are sent, without
+ * waiting for the replies to earlier ones; each reply is passed to
+ * its command's callback, in order.
+ *
+ * qemu serves one QMP client at a time on the libxl socket, so a
+ * channel must not outlive the operation which uses it.
+ *
+ * Possible states:
+ *   Idle:       fd < 0; nothing registered.  After init or dispose.
+ *   Connected:  fd >= 0; efd registered; timeout registered iff any
+ *               commands are awaiting replies.
+ * If the connection fails or times out, every command awaiting a
+ * reply has its callback called with rc != 0, and the channel goes
+ * back to Idle.
+ */
+typedef struct libxl__ev_qmp libxl__ev_qmp;
+typedef struct libxl__ev_qmp_cmd libxl__ev_qmp_cmd;
+
+/* response is the "return" value of the command if rc == 0 (valid only
+ * during the callback), or NULL otherwise.  The callback may send more
+ * commands, or dispose of ev, but must not free it. */
+typedef void libxl__ev_qmp_callback(libxl__egc *egc, libxl__ev_qmp *ev,
+                                    const libxl__json_object *response,
+                                    void *opaque, int rc);
+
+struct libxl__ev_qmp {
+    /* caller must fill these in, and they must all remain valid */
+    libxl__ao *ao;
+    uint32_t domid;
+    /* private to libxl_qmp.c */
+    int fd;
+    libxl__ev_fd efd;
+    libxl__ev_time timeout;
+    bool ready; /* capabilities negotiated */
+    int last_id;
+    unsigned connection; /* connections made so far */
+    char *rx; /* received, not yet handled; NUL-terminated */
+    size_t rx_used, rx_allocd;
+    LIBXL_TAILQ_HEAD(, libxl__ev_qmp_cmd) cmds; /* awaiting replies */
+    libxl__ev_qmp_cmd *tx; /* first not completely written */
+    size_t tx_off;
+};
+
+_hidden void libxl__ev_qmp_init(libxl__ev_qmp *ev);
+/* Queues cmd, with args (which may be NULL), connecting first if ev is
+ * Idle.  On failure, the callback will not be called. */
+_hidden int libxl__ev_qmp_send(libxl__ev_qmp *ev, const char *cmd,
+                               libxl__json_object *args,
+                               libxl__ev_qmp_callback *callback,
+                               void *opaque);
+/* Closes the channel; callbacks of commands not yet answered are not
+ * called.  Idempotent. */
+_hidden void libxl__ev_qmp_dispose(libxl__gc *gc, libxl__ev_qmp *ev);
+
+/* Asks the device model of a new domain for its serial ports and VNC
+ * address, and sets the VNC password, recording what it says in
+ * xenstore.  All of the commands go down one channel at once. */
+typedef struct libxl__qmp_inits_state libxl__qmp_inits_state;
+typedef void libxl__qmp_inits_callback(libxl__egc *egc,
+                                       libxl__qmp_inits_state *qis, int rc);
+struct libxl__qmp_inits_state {
+    /* caller must fill these in, and they must all remain valid */
+    libxl__ao *ao;
+    uint32_t domid;
+    const libxl_domain_config *guest_config;
+    libxl__qmp_inits_callback *callback;
+    /* private to libxl_qmp.c */
+    libxl__ev_qmp qmp;
+    int pending, rc;
+};
+_hidden void libxl__qmp_initializations(libxl__egc *egc,
+                                        libxl__qmp_inits_state *qis);
+
 typedef struct libxl__yajl_ctx libxl__yajl_ctx;
 
 static inline bool libxl__json_object_is_null(const libxl__json_object *o)
@@ -2285,6 +2479,46 @@ bool libxl__async_exec_inuse(const libxl__async_exec_state *aes);
 
 _hidden void libxl__kill(libxl__gc *gc, pid_t pid, int sig, const char *what);
 
+/*----- gate: bound the number of operations in some phase -----*/
+
+/*
+ * A gate admits at most `limit' holders at a time (0 means no limit).
+ * libxl__gate_enter calls waiter->callback, either straight away or,
+ * once the gate is full, when some holder calls libxl__gate_leave.
+ * Waiters are admitted in the order they arrived.  Each successful
+ * enter must be paired with exactly one leave.
+ *
+ * Callbacks made from libxl__gate_leave are made from a loop rather
+ * than recursively, so a long queue of waiters whose phase completes
+ * synchronously does not eat stack.
+ */
+
+typedef struct libxl__gate libxl__gate;
+typedef struct libxl__gate_waiter libxl__gate_waiter;
+
+typedef void libxl__gate_callback(libxl__egc *egc, libxl__gate_waiter *w);
+
+struct libxl__gate_waiter {
+    /* caller must fill this in */
+    libxl__gate_callback *callback;
+    /* private */
+    LIBXL_TAILQ_ENTRY(libxl__gate_waiter) entry;
+};
+
+struct libxl__gate {
+    /* caller must fill this in (libxl__gate_init does it) */
+    int limit;
+    /* private */
+    int active;
+    bool dispatching;
+    LIBXL_TAILQ_HEAD(, libxl__gate_waiter) waiters;
+};
+
+_hidden void libxl__gate_init(libxl__gate *gate, int limit);
+_hidden void libxl__gate_enter(libxl__egc *egc, libxl__gate *gate,
+                               libxl__gate_waiter *w);
+_hidden void libxl__gate_leave(libxl__egc *egc, libxl__gate *gate);
+
 /*----- device addition/removal -----*/
 
 typedef struct libxl__ao_device libxl__ao_device;
@@ -2327,6 +2561,7 @@ struct libxl__ao_device {
     libxl__xswait_state xswait;
     int num_exec;
     /* for calling hotplug scripts */
+    libxl__gate_waiter hotplug_waiter;
     libxl__async_exec_state aes;
     /* If we need to update JSON config */
     bool update_json;
@@ -2617,6 +2852,30 @@ _hidden int libxl__get_hotplug_script_info(libxl__gc *gc, libxl__device *dev,
                                            libxl__device_action action,
                                            int num_exec);
 
+/*
+ * A hotplug script given as "native:NAME" asks libxl to do the work of
+ * the script NAME itself, where libxl__hotplug_native knows how to, and
+ * to run NAME from the script directory otherwise.  The "native:" name
+ * is what is stored in xenstore.
+ *
+ * libxl__hotplug_script_native returns NAME, or NULL for an ordinary
+ * script.  libxl__hotplug_script_path returns the script to execute.
+ */
+#define LIBXL__HOTPLUG_NATIVE_PREFIX "native:"
+_hidden const char *libxl__hotplug_script_native(const char *script);
+_hidden char *libxl__hotplug_script_path(libxl__gc *gc, const char *script);
+
+/*
+ * libxl__hotplug_native is called, with the same num_exec, before each
+ * call to libxl__get_hotplug_script_info.  It returns:
+ * < 0: Error
+ * 0: Not done natively; run the hotplug script, if any, as usual
+ * 1: Done; carry on as if the hotplug script had run successfully
+ */
+_hidden int libxl__hotplug_native(libxl__gc *gc, libxl__device *dev,
+                                  libxl__device_action action,
+                                  int num_exec);
+
 /*----- local disk attach: attach a disk locally to run the bootloader -----*/
 
 typedef struct libxl__disk_local_state libxl__disk_local_state;
@@ -3189,6 +3448,13 @@ _hidden void libxl__bootloader_run(libxl__egc*, libxl__bootloader_state *st);
  * libxl__destroy_domid actually destroys the domain, but it
  * doesn't check for stubdomains, since that would involve
  * recursion, which we want to avoid.
+ *
+ * By default the hypervisor is only asked to destroy the domain once
+ * its devices and xenstore state are gone.  If the user supplies a
+ * released callback, the hypervisor starts relinquishing the domain's
+ * memory as soon as device removal has been initiated, and released
+ * is called once that is the only thing left (or the domain is already
+ * gone); callback follows when the domain has disappeared.
  */
 
 typedef struct libxl__domain_destroy_state libxl__domain_destroy_state;
@@ -3223,7 +3489,10 @@ struct libxl__destroy_domid_state {
     libxl__ao *ao;
     uint32_t domid;
     libxl__domid_destroy_cb *callback;
+    libxl__domid_destroy_cb *released; /* optional, see above */
     /* private to implementation */
+    int rc;
+    bool devices_done, destroyer_started, destroyer_done;
     libxl__devices_remove_state drs;
     libxl__ev_child destroyer;
 };
@@ -3233,13 +3502,14 @@ struct libxl__domain_destroy_state {
     libxl__ao *ao;
     uint32_t domid;
     libxl__domain_destroy_cb *callback;
+    libxl__domain_destroy_cb *released; /* optional, see above */
     /* Private */
     int rc;
     uint32_t stubdomid;
     libxl__destroy_domid_state stubdom;
-    int stubdom_finished;
+    int stubdom_finished, stubdom_released;
     libxl__destroy_domid_state domain;
-    int domain_finished;
+    int domain_finished, domain_released;
 };
 
 /*
@@ -3334,6 +3604,19 @@ typedef void libxl__domain_create_cb(libxl__egc *egc,
                                      libxl__domain_create_state*,
                                      int rc, uint32_t domid);
 
+/*
+ * Phases of domain creation which may be bounded when several domains
+ * are created together (see libxl_domain_create_batch).  Each phase is
+ * guarded by one libxl__gate in the array dcs->gates.
+ */
+typedef enum {
+    LIBXL__DOMCREATE_PHASE_BOOTLOADER,
+    LIBXL__DOMCREATE_PHASE_BUILD,
+    LIBXL__DOMCREATE_PHASE_DEVICES,
+    LIBXL__DOMCREATE_PHASE_DEVICE_MODEL,
+    LIBXL__DOMCREATE_NR_PHASES
+} libxl__domcreate_phase;
+
 /* State for manipulating a libxl migration v2 stream */
 typedef struct libxl__stream_read_state libxl__stream_read_state;
 
@@ -3418,8 +3701,21 @@ struct libxl__domain_create_state {
     /* necessary if the domain creation failed and we have to destroy it */
     libxl__domain_destroy_state dds;
     libxl__multidev multidev;
+    const libxl_domain_template *tmpl; /* or NULL */
+    /* gates[LIBXL__DOMCREATE_NR_PHASES], shared by a batch, or NULL */
+    libxl__gate *gates;
+    libxl__gate *gate_held;
+    libxl__gate_waiter gate_waiter;
+    libxl__qmp_inits_state qmp_inits;
 };
 
+/* If tmpl caches the kernel state is about to load, maps the cached
+ * image into state->pv_kernel.  Otherwise, or on failure, does nothing
+ * and the kernel is loaded as usual. */
+_hidden void libxl__domain_template_map_kernel(libxl__gc *gc,
+                                       const libxl_domain_template *tmpl,
+                                       libxl__domain_build_state *state);
+
 /*----- Domain suspend (save) functions -----*/
 
 /* calls dss->callback when done */
@@ -3713,6 +4009,32 @@ _hidden int libxl__get_numa_candidate(libxl__gc *gc,
                                       libxl__numa_candidate *cndt_out,
                                       int *cndt_found);
 
+/*
+ * The search itself, working on figures about each node which have been
+ * gathered beforehand: the node distances from ninfo (which must have
+ * nr_nodes elements), and the per-node numbers in nodes[]. Only the nodes
+ * in suitable_nodemap are considered, and min_nodes and max_nodes must be
+ * sensible already (1 <= min_nodes <= max_nodes). Everything else is as for
+ * libxl__get_numa_candidate(). This is split out so that it can be run on
+ * made-up hosts as well (see libxl_test_numaplace.c).
+ */
+typedef struct {
+    int nr_cpus;            /* Suitable cpus in the node */
+    int nr_vcpus;           /* Vcpus able to run on the node */
+    uint32_t free_memkb;
+} libxl__numa_node_info;
+
+_hidden int libxl__numa_candidate_search(libxl__gc *gc,
+                                         const libxl_numainfo *ninfo,
+                                         const libxl__numa_node_info *nodes,
+                                         int nr_nodes,
+                                         const libxl_bitmap *suitable_nodemap,
+                                         uint32_t min_free_memkb, int min_cpus,
+                                         int min_nodes, int max_nodes,
+                                         libxl__numa_candidate_cmpf numa_cmpf,
+                                         libxl__numa_candidate *cndt_out,
+                                         int *cndt_found);
+
 /* Initialization, allocation and deallocation for placement candidates */
 static inline void libxl__numa_candidate_init(libxl__numa_candidate *cndt)
 {
@@ -3904,7 +4226,17 @@ int libxl__cpuid_policy_is_empty(libxl_cpuid_policy_list *pl);
 typedef struct {
     libxl__carefd *carefd;
     char *path; /* path of the lock file itself */
-} libxl__domain_userdata_lock;
+} libxl__file_lock;
+/* Same protocol as with-lock-ex(1) and the hotplug scripts' claim_lock.
+ * Returns NULL, having logged, on failure. */
+libxl__file_lock *libxl__lock_file(libxl__gc *gc, const char *lockfile);
+/* Does not wait: if the lock is held elsewhere, returns 0 with *lock_r
+ * NULL.  Otherwise as libxl__lock_file, with ERROR_LOCK_FAIL for NULL. */
+int libxl__trylock_file(libxl__gc *gc, const char *lockfile,
+                        libxl__file_lock **lock_r);
+void libxl__unlock_file(libxl__file_lock *lock);
+
+typedef libxl__file_lock libxl__domain_userdata_lock;
 /* The CTX_LOCK must be held around uses of this lock */
 libxl__domain_userdata_lock *libxl__lock_domain_userdata(libxl__gc *gc,
                                                          uint32_t domid);
@@ -717,14 +717,12 @@ static bool is_decimal(const char *s, unsigned len)
     return false;
 }
 
-static int json_callback_number(void *opaque, const char *s, libxl_yajl_length len)
+/* Fills in the type and value of obj from the number s. */
+static void json_number_parse(libxl__gc *gc, const char *s,
+                              libxl_yajl_length len, libxl__json_object *obj)
 {
-    libxl__yajl_ctx *ctx = opaque;
-    libxl__json_object *obj = NULL;
     char *t = NULL;
 
-    DEBUG_GEN_NUMBER(ctx, s, len);
-
     if (is_decimal(s, len)) {
         double d = strtod(s, NULL);
 
@@ -732,7 +730,7 @@ static int json_callback_number(void *opaque, const char *s, libxl_yajl_length l
             goto error;
         }
 
-        obj = libxl__json_object_alloc(ctx->gc, JSON_DOUBLE);
+        obj->type = JSON_DOUBLE;
         obj->u.d = d;
     } else {
         long long i = strtoll(s, NULL, 10);
@@ -741,22 +739,31 @@ static int json_callback_number(void *opaque, const char *s, libxl_yajl_length l
             goto error;
         }
 
-        obj = libxl__json_object_alloc(ctx->gc, JSON_INTEGER);
+        obj->type = JSON_INTEGER;
         obj->u.i = i;
     }
-    goto out;
+    return;
 
 error:
     /* If the conversion fail, we just store the original string. */
-    obj = libxl__json_object_alloc(ctx->gc, JSON_NUMBER);
-
-    t = libxl__zalloc(ctx->gc, len + 1);
+    t = libxl__zalloc(gc, len + 1);
     strncpy(t, s, len);
     t[len] = 0;
 
+    obj->type = JSON_NUMBER;
     obj->u.string = t;
+}
+
+static int json_callback_number(void *opaque, const char *s, libxl_yajl_length len)
+{
+    libxl__yajl_ctx *ctx = opaque;
+    libxl__json_object *obj = NULL;
+
+    DEBUG_GEN_NUMBER(ctx, s, len);
+
+    obj = libxl__json_object_alloc(ctx->gc, JSON_NULL);
+    json_number_parse(ctx->gc, s, len, obj);
 
-out:
     if (libxl__json_object_append_to(ctx->gc, obj, ctx))
         return 0;
 
@@ -946,6 +953,435 @@ out:
     return NULL;
 }
 
+/*
+ * Streaming parser, see libxl__json_sax_type in libxl_internal.h
+ */
+
+#define SAX_MAX_DEPTH 32
+
+typedef enum {
+    SAX_STRUCT, /* filling in a struct from a map */
+    SAX_ARRAY,  /* filling in an array from an array */
+    SAX_TREE,   /* building the libxl__json_object for a builtin type */
+    SAX_SKIP,   /* ignoring a value */
+} sax_frame_kind;
+
+typedef struct {
+    sax_frame_kind kind;
+    const libxl__json_sax_type *type; /* of the elements, for ARRAY */
+    char *p; /* being filled in; for ARRAY, the struct with the array */
+    const libxl__json_sax_field *field; /* STRUCT: for the value after the
+                                         * current key, NULL to ignore it;
+                                         * ARRAY: the array */
+    int next_field; /* STRUCT: where to look for the next key first */
+    int depth;      /* TREE, SKIP: of maps and arrays not yet closed */
+    int allocd;     /* ARRAY: elements allocated */
+} sax_frame;
+
+typedef struct {
+    libxl__gc *gc;
+    const libxl__json_sax_type *type;
+    void *p;
+    int rc; /* set when we stop the parse */
+    int nr_frames;
+    sax_frame stack[SAX_MAX_DEPTH];
+    libxl__yajl_ctx tree; /* for the one SAX_TREE frame, if any */
+    char *scratch; /* for NUL-terminating strings */
+    size_t scratch_allocd;
+} libxl__json_sax_ctx;
+
+static sax_frame *sax_top(libxl__json_sax_ctx *sc)
+{
+    return sc->nr_frames ? &sc->stack[sc->nr_frames - 1] : NULL;
+}
+
+static sax_frame *sax_push(libxl__json_sax_ctx *sc, sax_frame_kind kind)
+{
+    sax_frame *f;
+
+    if (sc->nr_frames == SAX_MAX_DEPTH) {
+        LIBXL__LOG(libxl__gc_owner(sc->gc), LIBXL__LOG_ERROR,
+                   "JSON nested too deeply");
+        sc->rc = ERROR_FAIL;
+        return NULL;
+    }
+
+    f = &sc->stack[sc->nr_frames++];
+    memset(f, 0, sizeof(*f));
+    f->kind = kind;
+    return f;
+}
+
+static bool sax_in(libxl__json_sax_ctx *sc, sax_frame_kind kind)
+{
+    sax_frame *f = sax_top(sc);
+    return f && f->kind == kind;
+}
+
+static int sax_skip(libxl__json_sax_ctx *sc, const libxl__json_object *obj)
+{
+    sax_frame *f;
+
+    if (obj->type != JSON_MAP && obj->type != JSON_ARRAY)
+        return 1;
+
+    f = sax_push(sc, SAX_SKIP);
+    if (!f) return 0;
+    f->depth = 1;
+    return 1;
+}
+
+static int sax_leaf(libxl__json_sax_ctx *sc, const libxl__json_sax_type *type,
+                    char *p, libxl__json_object *obj)
+{
+    int rc = type->parse(sc->gc, obj, p);
+    if (rc) {
+        sc->rc = rc;
+        return 0;
+    }
+    return 1;
+}
+
+/* Starts filling in p, of the given type, from the value obj (which,
+ * for a map or an array, has no contents yet). */
+static int sax_fill(libxl__json_sax_ctx *sc, const libxl__json_sax_type *type,
+                    char *p, libxl__json_object *obj)
+{
+    sax_frame *f;
+
+    if (!type->parse) {
+        /* As for libxl__FOO_parse_json, a struct only takes a map. */
+        if (obj->type != JSON_MAP)
+            return sax_skip(sc, obj);
+        f = sax_push(sc, SAX_STRUCT);
+        if (!f) return 0;
+        f->type = type;
+        f->p = p;
+        return 1;
+    }
+
+    if (obj->type != JSON_MAP && obj->type != JSON_ARRAY)
+        return sax_leaf(sc, type, p, obj);
+
+    f = sax_push(sc, SAX_TREE);
+    if (!f) return 0;
+    f->type = type;
+    f->p = p;
+    f->depth = 1;
+    sc->tree.head = sc->tree.current = NULL;
+    return obj->type == JSON_MAP ? json_callback_start_map(&sc->tree)
+                                 : json_callback_start_array(&sc->tree);
+}
+
+static char *sax_array_append(libxl__gc *gc, sax_frame *f)
+{
+    const libxl__json_sax_field *field = f->field;
+    void **arrayp = (void **)(f->p + field->offset);
+    int *lenp = (int *)(f->p + field->len_offset);
+    char *elem;
+
+    if (*lenp == f->allocd) {
+        f->allocd = f->allocd ? f->allocd * 2 : 4;
+        *arrayp = libxl__realloc(NOGC, *arrayp, f->allocd * field->elem_size);
+    }
+
+    /* Counted straight away, so that disposing of the struct after a
+     * failure disposes of this element too. */
+    elem = (char *)*arrayp + (*lenp)++ * field->elem_size;
+    memset(elem, 0, field->elem_size);
+    return elem;
+}
+
+/* Deals with the start of each value which is not part of the tree for
+ * a builtin type, and is not being skipped.  obj is the value if it is
+ * a scalar; for a map or an array it just says which. */
+static int sax_value(libxl__json_sax_ctx *sc, libxl__json_object *obj)
+{
+    sax_frame *f = sax_top(sc);
+    const libxl__json_sax_field *field;
+
+    if (!f)
+        return sax_fill(sc, sc->type, sc->p, obj);
+
+    if (f->kind == SAX_ARRAY)
+        return sax_fill(sc, f->type, sax_array_append(sc->gc, f), obj);
+
+    assert(f->kind == SAX_STRUCT);
+    field = f->field;
+    f->field = NULL;
+
+    if (!field || !(obj->type & field->json_type))
+        return sax_skip(sc, obj);
+
+    if (field->select) {
+        field->select(f->p);
+        if (!field->type)
+            return sax_skip(sc, obj);
+    }
+
+    if (field->elem_size) {
+        char *parent = f->p;
+
+        f = sax_push(sc, SAX_ARRAY);
+        if (!f) return 0;
+        f->type = field->type;
+        f->p = parent;
+        f->field = field;
+        *(void **)(parent + field->offset) = NULL;
+        *(int *)(parent + field->len_offset) = 0;
+        return 1;
+    }
+
+    return sax_fill(sc, field->type, f->p + field->offset, obj);
+}
+
+static int sax_end(libxl__json_sax_ctx *sc, bool map)
+{
+    sax_frame *f = sax_top(sc);
+    int r = 1;
+
+    assert(f);
+
+    switch (f->kind) {
+    case SAX_TREE:
+        r = map ? json_callback_end_map(&sc->tree)
+                : json_callback_end_array(&sc->tree);
+        if (!r || --f->depth)
+            return r;
+        r = sax_leaf(sc, f->type, f->p, sc->tree.head);
+        break;
+    case SAX_SKIP:
+        if (--f->depth)
+            return 1;
+        break;
+    case SAX_STRUCT:
+    case SAX_ARRAY:
+        break;
+    }
+
+    sc->nr_frames--;
+    return r;
+}
+
+static int sax_callback_null(void *opaque)
+{
+    libxl__json_sax_ctx *sc = opaque;
+    libxl__json_object obj = { .type = JSON_NULL };
+
+    if (sax_in(sc, SAX_TREE))
+        return json_callback_null(&sc->tree);
+    if (sax_in(sc, SAX_SKIP))
+        return 1;
+    return sax_value(sc, &obj);
+}
+
+static int sax_callback_boolean(void *opaque, int boolean)
+{
+    libxl__json_sax_ctx *sc = opaque;
+    libxl__json_object obj = { .type = JSON_BOOL, .u.b = boolean };
+
+    if (sax_in(sc, SAX_TREE))
+        return json_callback_boolean(&sc->tree, boolean);
+    if (sax_in(sc, SAX_SKIP))
+        return 1;
+    return sax_value(sc, &obj);
+}
+
+static int sax_callback_number(void *opaque, const char *s,
+                               libxl_yajl_length len)
+{
+    libxl__json_sax_ctx *sc = opaque;
+    libxl__json_object obj;
+
+    if (sax_in(sc, SAX_TREE))
+        return json_callback_number(&sc->tree, s, len);
+    if (sax_in(sc, SAX_SKIP))
+        return 1;
+    json_number_parse(sc->gc, s, len, &obj);
+    return sax_value(sc, &obj);
+}
+
+static int sax_callback_string(void *opaque, const unsigned char *str,
+                               libxl_yajl_length len)
+{
+    libxl__json_sax_ctx *sc = opaque;
+    libxl__gc *gc = sc->gc;
+    libxl__json_object obj = { .type = JSON_STRING };
+
+    if (sax_in(sc, SAX_TREE))
+        return json_callback_string(&sc->tree, str, len);
+    if (sax_in(sc, SAX_SKIP))
+        return 1;
+
+    if (len + 1 > sc->scratch_allocd) {
+        sc->scratch = libxl__realloc(NOGC, sc->scratch, len + 1);
+        sc->scratch_allocd = len + 1;
+    }
+    memcpy(sc->scratch, str, len);
+    sc->scratch[len] = 0;
+    obj.u.string = sc->scratch;
+
+    return sax_value(sc, &obj);
+}
+
+static int sax_callback_map_key(void *opaque, const unsigned char *str,
+                                libxl_yajl_length len)
+{
+    libxl__json_sax_ctx *sc = opaque;
+    sax_frame *f = sax_top(sc);
+    const libxl__json_sax_type *type;
+    int i, n;
+
+    assert(f);
+
+    switch (f->kind) {
+    case SAX_TREE:
+        return json_callback_map_key(&sc->tree, str, len);
+    case SAX_SKIP:
+        return 1;
+    case SAX_STRUCT:
+        break;
+    case SAX_ARRAY:
+        abort();
+    }
+
+    /* Keys mostly come in the order we generate them, which is the
+     * order of the fields, so we look just after the last one first. */
+    type = f->type;
+    f->field = NULL;
+    for (n = 0; n < type->nr_fields; n++) {
+        i = (f->next_field + n) % type->nr_fields;
+        if (type->fields[i].name_len == len &&
+            !memcmp(type->fields[i].name, str, len)) {
+            f->field = &type->fields[i];
+            f->next_field = i + 1;
+            break;
+        }
+    }
+
+    return 1;
+}
+
+static int sax_callback_start_map(void *opaque)
+{
+    libxl__json_sax_ctx *sc = opaque;
+    libxl__json_object obj = { .type = JSON_MAP };
+
+    if (sax_in(sc, SAX_TREE)) {
+        sax_top(sc)->depth++;
+        return json_callback_start_map(&sc->tree);
+    }
+    if (sax_in(sc, SAX_SKIP)) {
+        sax_top(sc)->depth++;
+        return 1;
+    }
+    return sax_value(sc, &obj);
+}
+
+static int sax_callback_end_map(void *opaque)
+{
+    return sax_end(opaque, true);
+}
+
+static int sax_callback_start_array(void *opaque)
+{
+    libxl__json_sax_ctx *sc = opaque;
+    libxl__json_object obj = { .type = JSON_ARRAY };
+
+    if (sax_in(sc, SAX_TREE)) {
+        sax_top(sc)->depth++;
+        return json_callback_start_array(&sc->tree);
+    }
+    if (sax_in(sc, SAX_SKIP)) {
+        sax_top(sc)->depth++;
+        return 1;
+    }
+    return sax_value(sc, &obj);
+}
+
+static int sax_callback_end_array(void *opaque)
+{
+    return sax_end(opaque, false);
+}
+
+static yajl_callbacks sax_callbacks = {
+    sax_callback_null,
+    sax_callback_boolean,
+    NULL,
+    NULL,
+    sax_callback_number,
+    sax_callback_string,
+    sax_callback_start_map,
+    sax_callback_map_key,
+    sax_callback_end_map,
+    sax_callback_start_array,
+    sax_callback_end_array
+};
+
+int libxl__json_parse_sax(libxl__gc *gc, const char *s,
+                          const libxl__json_sax_type *type, void *p)
+{
+    libxl__json_sax_ctx sc;
+    yajl_handle hand;
+    yajl_status status;
+    unsigned char *str;
+    int rc;
+
+    memset(&sc, 0, sizeof(sc));
+    sc.gc = gc;
+    sc.type = type;
+    sc.p = p;
+    sc.tree.gc = gc;
+
+    hand = libxl__yajl_alloc(&sax_callbacks, NULL, &sc);
+    if (!hand) {
+        LOG(ERROR, "unable to allocate JSON parser");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    status = yajl_parse(hand, (const unsigned char *)s, strlen(s));
+    if (status == yajl_status_ok)
+        status = yajl_complete_parse(hand);
+
+    if (status != yajl_status_ok) {
+        if (sc.rc) {
+            rc = sc.rc;
+            goto out;
+        }
+        str = yajl_get_error(hand, 1, (const unsigned char*)s, strlen(s));
+        LOG(ERROR, "yajl error: %s", str);
+        yajl_free_error(hand, str);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    rc = 0;
+
+out:
+    if (hand) yajl_free(hand);
+    free(sc.scratch);
+    return rc;
+}
+
+int libxl__object_from_json_sax(libxl_ctx *ctx, const char *type,
+                                const libxl__json_sax_type *sax,
+                                void *p, const char *s)
+{
+    GC_INIT(ctx);
+    int rc;
+
+    rc = libxl__json_parse_sax(gc, s, sax, p);
+    if (rc) {
+        LOG(ERROR, "unable to convert JSON representation to %s. (rc=%d)",
+            type, rc);
+        rc = ERROR_FAIL;
+    }
+
+    GC_FREE;
+    return rc;
+}
+
 static const char *yajl_gen_status_to_string(yajl_gen_status s)
 {
         switch (s) {
@@ -971,29 +1407,79 @@ static const char *yajl_gen_status_to_string(yajl_gen_status s)
         }
 }
 
-char *libxl__object_to_json(libxl_ctx *ctx, const char *type,
-                            libxl__gen_json_callback gen, void *p)
+/*
+ * Generation straight into a libxl__json_buf, rather than into yajl's
+ * own buffer and then copying it out.
+ */
+
+typedef struct {
+    libxl__gc *gc;
+    libxl__json_buf *jb;
+} json_buf_printer;
+
+static void json_buf_append(libxl__gc *gc, libxl__json_buf *jb,
+                            const char *str, size_t len)
+{
+
+    if (jb->used + len + 1 > jb->allocd) {
+        size_t newsize = jb->allocd ? jb->allocd : 1024;
+        while (newsize < jb->used + len + 1)
+            newsize *= 2;
+        jb->buf = libxl__realloc(NOGC, jb->buf, newsize);
+        jb->allocd = newsize;
+    }
+
+    memcpy(jb->buf + jb->used, str, len);
+    jb->used += len;
+    jb->buf[jb->used] = 0;
+}
+
+static void json_buf_print(void *opaque, const char *str,
+                           libxl_yajl_length len)
 {
-    const unsigned char *buf;
-    char *ret = NULL;
-    libxl_yajl_length len = 0;
+    json_buf_printer *pr = opaque;
+
+    json_buf_append(pr->gc, pr->jb, str, len);
+}
+
+static yajl_gen json_buf_gen_alloc(json_buf_printer *pr)
+{
+#ifdef HAVE_YAJL_V2
+    yajl_gen g = libxl_yajl_gen_alloc(NULL);
+    if (g)
+        yajl_gen_config(g, yajl_gen_print_callback, json_buf_print, pr);
+    return g;
+#else
+    yajl_gen_config conf = { 1, "    " };
+    return yajl_gen_alloc2(json_buf_print, &conf, NULL, pr);
+#endif
+}
+
+void libxl__json_buf_dispose(libxl__json_buf *jb)
+{
+    free(jb->buf);
+    libxl__json_buf_init(jb);
+}
+
+int libxl__object_to_json_buf(libxl_ctx *ctx, libxl__json_buf *jb,
+                              const char *type,
+                              libxl__gen_json_callback gen, void *p)
+{
+    json_buf_printer pr = { .gc = &ctx->nogc_gc, .jb = jb };
     yajl_gen_status s;
     yajl_gen hand;
 
-    hand = libxl_yajl_gen_alloc(NULL);
-    if (!hand)
-        return NULL;
-
-    s = gen(hand, p);
-    if (s != yajl_gen_status_ok)
-        goto out;
+    jb->used = 0;
+    json_buf_append(pr.gc, jb, "", 0);
 
-    s = yajl_gen_get_buf(hand, &buf, &len);
-    if (s != yajl_gen_status_ok)
-        goto out;
-    ret = strdup((const char *)buf);
+    hand = json_buf_gen_alloc(&pr);
+    if (!hand) {
+        LIBXL__LOG(ctx, LIBXL__LOG_ERROR,
+                   "unable to allocate JSON generator for %s", type);
+        return ERROR_FAIL;
+    }
 
-out:
+    s = gen(hand, p);
     yajl_gen_free(hand);
 
     if (s != yajl_gen_status_ok) {
@@ -1001,34 +1487,34 @@ out:
                    "unable to convert %s to JSON representation. "
                    "YAJL error code %d: %s", type,
                    s, yajl_gen_status_to_string(s));
-    } else if (!ret) {
-        LIBXL__LOG(ctx, LIBXL__LOG_ERROR,
-                   "unable to allocate space for to JSON representation of %s",
-                   type);
+        return ERROR_FAIL;
     }
 
-    return ret;
+    return 0;
 }
 
-yajl_gen_status libxl__uint64_gen_json(yajl_gen hand, uint64_t val)
+char *libxl__object_to_json(libxl_ctx *ctx, const char *type,
+                            libxl__gen_json_callback gen, void *p)
 {
-    char *num;
-    int len;
-    yajl_gen_status s;
-
+    libxl__json_buf jb;
 
-    len = asprintf(&num, "%"PRIu64, val);
-    if (len == -1) {
-        s = yajl_gen_in_error_state;
-        goto out;
+    libxl__json_buf_init(&jb);
+    if (libxl__object_to_json_buf(ctx, &jb, type, gen, p)) {
+        libxl__json_buf_dispose(&jb);
+        return NULL;
     }
 
-    s = yajl_gen_number(hand, num, len);
+    return jb.buf;
+}
 
-    free(num);
+yajl_gen_status libxl__uint64_gen_json(yajl_gen hand, uint64_t val)
+{
+    char num[sizeof("18446744073709551615")];
+    int len;
 
-out:
-    return s;
+    len = snprintf(num, sizeof(num), "%"PRIu64, val);
+
+    return yajl_gen_number(hand, num, len);
 }
 
 int libxl__object_from_json(libxl_ctx *ctx, const char *type,
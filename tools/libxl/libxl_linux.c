@@ -16,6 +16,13 @@
 #include "libxl_osdeps.h" /* must come before any other headers */
 
 #include "libxl_internal.h"
+
+#include <sys/epoll.h>
+#include <mntent.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <linux/sockios.h>
+#include <sys/sysmacros.h>
  
 int libxl__try_phy_backend(mode_t st_mode)
 {
@@ -157,6 +164,7 @@ static int libxl__hotplug_nic(libxl__gc *gc, libxl__device *dev,
         rc = ERROR_FAIL;
         goto out;
     }
+    script = libxl__hotplug_script_path(gc, script);
 
     rc = libxl__nic_type(gc, dev, &nictype);
     if (rc) {
@@ -211,6 +219,7 @@ static int libxl__hotplug_disk(libxl__gc *gc, libxl__device *dev,
         rc = ERROR_FAIL;
         goto error;
     }
+    script = libxl__hotplug_script_path(gc, script);
 
     *env = get_hotplug_env(gc, script, dev);
     if (!*env) {
@@ -273,6 +282,389 @@ out:
     return rc;
 }
 
+/* Native hotplug: what vif-bridge and block do in the common cases */
+
+#define HOTPLUG_LOCK_DIR "/var/run/xen-hotplug" /* as in locking.sh */
+
+static int netdev_ioctl(int sock, unsigned long request, const char *ifname,
+                        struct ifreq *ifr)
+{
+    if (strlen(ifname) >= sizeof(ifr->ifr_name)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(ifr->ifr_name, ifname);
+    return ioctl(sock, request, ifr);
+}
+
+static int netdev_set_up(int sock, const char *ifname, bool up)
+{
+    struct ifreq ifr;
+
+    memset(&ifr, 0, sizeof(ifr));
+    if (netdev_ioctl(sock, SIOCGIFFLAGS, ifname, &ifr))
+        return -1;
+    if (up)
+        ifr.ifr_flags |= IFF_UP;
+    else
+        ifr.ifr_flags &= ~IFF_UP;
+    return netdev_ioctl(sock, SIOCSIFFLAGS, ifname, &ifr);
+}
+
+/*
+ * Whether bridged traffic goes through the iptables FORWARD chain, in
+ * which case vif-bridge's handle_iptable inserts rules accepting the
+ * vif's traffic, which a DROP policy would otherwise discard.
+ */
+static bool bridge_nf_call_iptables(libxl__gc *gc)
+{
+    const char *path = "/proc/sys/net/bridge/bridge-nf-call-iptables";
+    char val = '0';
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        /* No br_netfilter, so iptables never sees bridged frames. */
+        if (errno == ENOENT)
+            return false;
+        LOGE(DEBUG, "unable to open %s", path);
+        return true;
+    }
+    if (read(fd, &val, 1) != 1) {
+        LOGE(DEBUG, "unable to read %s", path);
+        val = '1';
+    }
+    close(fd);
+
+    return val != '0';
+}
+
+static int hotplug_native_vif(libxl__gc *gc, libxl__device *dev,
+                              const char *be_path,
+                              libxl__device_action action)
+{
+    const char *vif, *bridge, *ip, *vifname;
+    struct ifreq ifr;
+    int sock = -1, rc;
+
+    rc = libxl__xs_read_checked(gc, XBT_NULL,
+                                GCSPRINTF("%s/bridge", be_path), &bridge);
+    if (rc) goto out;
+    rc = libxl__xs_read_checked(gc, XBT_NULL,
+                                GCSPRINTF("%s/ip", be_path), &ip);
+    if (rc) goto out;
+    rc = libxl__xs_read_checked(gc, XBT_NULL,
+                                GCSPRINTF("%s/vifname", be_path), &vifname);
+    if (rc) goto out;
+
+    /*
+     * Guessing the bridge, translating old xenbrN names, renaming the vif
+     * and any iptables rules are left to the script.  No rules are needed
+     * unless bridged traffic is filtered, so check that on removal too,
+     * lest rules the script inserted at addition be left behind.
+     */
+    if (!bridge || ip || vifname ||
+        access(GCSPRINTF("/sys/class/net/%s/bridge", bridge), F_OK) ||
+        bridge_nf_call_iptables(gc)) {
+        LOG(DEBUG, "not handling %s natively", be_path);
+        rc = 0;
+        goto out;
+    }
+
+    vif = libxl__device_nic_devname(gc, dev->domid, dev->devid,
+                                    LIBXL_NIC_TYPE_VIF);
+
+    sock = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        LOGE(ERROR, "unable to create socket to configure %s", vif);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    if (action == LIBXL__DEVICE_ACTION_REMOVE) {
+        /* Like the script, ignore errors: the vif may be gone already. */
+        memset(&ifr, 0, sizeof(ifr));
+        ifr.ifr_ifindex = if_nametoindex(vif);
+        if (ifr.ifr_ifindex)
+            netdev_ioctl(sock, SIOCBRDELIF, bridge, &ifr);
+        netdev_set_up(sock, vif, false);
+        LOG(DEBUG, "removed %s from bridge %s", vif, bridge);
+        rc = 1;
+        goto out;
+    }
+
+    /*
+     * The largest non-broadcast MAC address, so that the bridge never
+     * takes the vif's for its own.  A new vif has no IP addresses, so
+     * unlike the script we need not flush them.
+     */
+    if (netdev_set_up(sock, vif, false)) {
+        LOGE(ERROR, "unable to take %s down", vif);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_hwaddr.sa_family = ARPHRD_ETHER;
+    memset(ifr.ifr_hwaddr.sa_data, 0xff, 6);
+    ifr.ifr_hwaddr.sa_data[0] = 0xfe;
+    netdev_ioctl(sock, SIOCSIFHWADDR, vif, &ifr);
+
+    memset(&ifr, 0, sizeof(ifr));
+    if (!netdev_ioctl(sock, SIOCGIFMTU, bridge, &ifr))
+        netdev_ioctl(sock, SIOCSIFMTU, vif, &ifr);
+
+    if (access(GCSPRINTF("/sys/class/net/%s/brif/%s", bridge, vif), F_OK)) {
+        memset(&ifr, 0, sizeof(ifr));
+        ifr.ifr_ifindex = if_nametoindex(vif);
+        if (!ifr.ifr_ifindex ||
+            netdev_ioctl(sock, SIOCBRADDIF, bridge, &ifr)) {
+            LOGE(ERROR, "unable to add %s to bridge %s", vif, bridge);
+            rc = ERROR_FAIL;
+            goto out;
+        }
+    }
+
+    if (netdev_set_up(sock, vif, true)) {
+        LOGE(ERROR, "unable to bring %s up", vif);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    rc = libxl__xs_write_checked(gc, XBT_NULL,
+                                 GCSPRINTF("%s/hotplug-status", be_path),
+                                 "connected");
+    if (rc) goto out;
+
+    LOG(DEBUG, "added %s to bridge %s", vif, bridge);
+    rc = 1;
+
+out:
+    if (sock >= 0) close(sock);
+    return rc;
+}
+
+/* Whether domain otherdom belongs to the same VM as domid, as far as
+ * sharing a disk goes; this is same_vm in block-common.sh. */
+static bool block_same_vm(libxl__gc *gc, uint32_t domid, const char *vm,
+                          uint32_t otherdom)
+{
+    const char *othervm, *target, *otarget, *otvm;
+
+    /* A backend left behind by a vanished domain does not count. */
+    othervm = libxl__xs_read(gc, XBT_NULL,
+                             GCSPRINTF("/local/domain/%u/vm", otherdom));
+    if (!othervm || (vm && !strcmp(othervm, vm)))
+        return true;
+
+    target = libxl__xs_read(gc, XBT_NULL,
+                            GCSPRINTF("/local/domain/%u/target", domid));
+    if (target && strtoul(target, NULL, 10) == otherdom)
+        return true;
+
+    otarget = libxl__xs_read(gc, XBT_NULL,
+                             GCSPRINTF("/local/domain/%u/target", otherdom));
+    if (!otarget)
+        return false;
+    otvm = libxl__xs_read(gc, XBT_NULL,
+                          GCSPRINTF("/local/domain/%s/vm", otarget));
+    return otvm && vm && !strcmp(otvm, vm);
+}
+
+/*
+ * As check_device_sharing in the block script: a device may not be
+ * given to a guest while it is mounted here, or while another guest has
+ * it, unless neither use writes or the mode says not to check ("w!").
+ */
+static int block_check_sharing(libxl__gc *gc, libxl__device *dev,
+                               const char *path, dev_t rdev,
+                               const char *mode)
+{
+    bool writable = mode && strchr(mode, 'w');
+    const char *base, *devmm, *vm, *othermm, *othermode;
+    char **doms, **devs;
+    unsigned int i, j, ndoms, ndevs;
+    struct mntent *ent;
+    struct stat stab;
+    FILE *mounts;
+    int rc = 0;
+
+    if (writable && strchr(mode, '!'))
+        return 0;
+
+    mounts = setmntent("/proc/mounts", "r");
+    if (!mounts) {
+        LOGE(ERROR, "unable to read /proc/mounts");
+        return ERROR_FAIL;
+    }
+    while ((ent = getmntent(mounts))) {
+        if (!writable && hasmntopt(ent, "ro"))
+            continue;
+        if (!stat(ent->mnt_fsname, &stab) && S_ISBLK(stab.st_mode) &&
+            stab.st_rdev == rdev) {
+            LOG(ERROR, "%s is mounted %sin the privileged domain, "
+                "and so cannot be mounted %sby a guest", path,
+                writable ? "" : "read-write ",
+                writable ? "" : "read-only ");
+            rc = ERROR_FAIL;
+            break;
+        }
+    }
+    endmntent(mounts);
+    if (rc) return rc;
+
+    devmm = GCSPRINTF("%x:%x", major(rdev), minor(rdev));
+    vm = libxl__xs_read(gc, XBT_NULL,
+                        GCSPRINTF("/local/domain/%u/vm", dev->domid));
+    base = GCSPRINTF("%s/backend/vbd",
+                     libxl__xs_get_dompath(gc, dev->backend_domid));
+
+    doms = libxl__xs_directory(gc, XBT_NULL, base, &ndoms);
+    for (i = 0; doms && i < ndoms; i++) {
+        devs = libxl__xs_directory(gc, XBT_NULL,
+                                   GCSPRINTF("%s/%s", base, doms[i]), &ndevs);
+        for (j = 0; devs && j < ndevs; j++) {
+            const char *p = GCSPRINTF("%s/%s/%s", base, doms[i], devs[j]);
+
+            othermm = libxl__xs_read(gc, XBT_NULL,
+                                     GCSPRINTF("%s/physical-device", p));
+            if (!othermm || strcmp(othermm, devmm))
+                continue;
+            if (!writable) {
+                othermode = libxl__xs_read(gc, XBT_NULL,
+                                           GCSPRINTF("%s/mode", p));
+                if (!othermode || !strchr(othermode, 'w') ||
+                    strchr(othermode, '!'))
+                    continue;
+            }
+            if (!block_same_vm(gc, dev->domid, vm,
+                               strtoul(doms[i], NULL, 10))) {
+                LOG(ERROR, "%s is mounted %sin a guest domain, "
+                    "and so cannot be mounted %snow", path,
+                    writable ? "" : "read-write ",
+                    writable ? "" : "read-only ");
+                return ERROR_FAIL;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int hotplug_native_block(libxl__gc *gc, libxl__device *dev,
+                                const char *be_path,
+                                libxl__device_action action)
+{
+    const char *params, *path, *mode, *phys;
+    libxl__file_lock *lock = NULL;
+    struct stat stab;
+    int rc;
+
+    rc = libxl__xs_read_checked(gc, XBT_NULL,
+                                GCSPRINTF("%s/params", be_path), &params);
+    if (rc) goto out;
+
+    /* Files need a loop device, and other types a helper: the script. */
+    if (!params || !*params) {
+        rc = 0;
+        goto out;
+    }
+    path = params[0] == '/' ? params : GCSPRINTF("/dev/%s", params);
+    if (stat(path, &stab) || !S_ISBLK(stab.st_mode)) {
+        LOG(DEBUG, "%s is not a block device, not handling it natively",
+            path);
+        rc = 0;
+        goto out;
+    }
+
+    /* There is nothing to undo for a block device. */
+    if (action == LIBXL__DEVICE_ACTION_REMOVE) {
+        rc = 1;
+        goto out;
+    }
+
+    rc = libxl__xs_read_checked(gc, XBT_NULL,
+                                GCSPRINTF("%s/physical-device", be_path),
+                                &phys);
+    if (rc) goto out;
+    if (phys) {
+        rc = 1;
+        goto out;
+    }
+
+    rc = libxl__xs_read_checked(gc, XBT_NULL,
+                                GCSPRINTF("%s/mode", be_path), &mode);
+    if (rc) goto out;
+
+    /* Shared with the block scripts, which may be running meanwhile. */
+    if (mkdir(HOTPLUG_LOCK_DIR, 0755) && errno != EEXIST) {
+        LOGE(ERROR, "unable to create %s", HOTPLUG_LOCK_DIR);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+    /* We are in the event loop: rather than wait, leave it to the script. */
+    rc = libxl__trylock_file(gc, HOTPLUG_LOCK_DIR "/block", &lock);
+    if (rc) goto out;
+    if (!lock) {
+        LOG(DEBUG, "block hotplug lock busy, not handling %s natively",
+            be_path);
+        goto out;
+    }
+
+    rc = block_check_sharing(gc, dev, path, stab.st_rdev, mode);
+    if (rc) goto out;
+
+    rc = libxl__xs_write_checked(gc, XBT_NULL,
+                                 GCSPRINTF("%s/physical-device", be_path),
+                                 GCSPRINTF("%x:%x", major(stab.st_rdev),
+                                           minor(stab.st_rdev)));
+    if (rc) goto out;
+    rc = libxl__xs_write_checked(gc, XBT_NULL,
+                                 GCSPRINTF("%s/hotplug-status", be_path),
+                                 "connected");
+    if (rc) goto out;
+
+    LOG(DEBUG, "%s is %s", be_path, path);
+    rc = 1;
+
+out:
+    if (lock) libxl__unlock_file(lock);
+    return rc;
+}
+
+int libxl__hotplug_native(libxl__gc *gc, libxl__device *dev,
+                          libxl__device_action action, int num_exec)
+{
+    char *be_path = libxl__device_backend_path(gc, dev);
+    const char *script, *native;
+    int rc;
+
+    /* Later passes are for the tap of an emulated nic: the script. */
+    if (num_exec != 0)
+        return 0;
+
+    rc = libxl__xs_read_checked(gc, XBT_NULL,
+                                GCSPRINTF("%s/script", be_path), &script);
+    if (rc) return rc;
+    if (!script)
+        return 0;
+    native = libxl__hotplug_script_native(script);
+    if (!native)
+        return 0;
+
+    switch (dev->backend_kind) {
+    case LIBXL__DEVICE_KIND_VBD:
+        if (strcmp(native, "block"))
+            return 0;
+        return hotplug_native_block(gc, dev, be_path, action);
+    case LIBXL__DEVICE_KIND_VIF:
+        if (strcmp(native, "vif-bridge"))
+            return 0;
+        return hotplug_native_vif(gc, dev, be_path, action);
+    default:
+        return 0;
+    }
+}
+
 libxl_device_model_version libxl__default_device_model(libxl__gc *gc)
 {
     return LIBXL_DEVICE_MODEL_VERSION_QEMU_XEN;
@@ -347,3 +739,60 @@ int libxl__pci_topology_init(libxl__gc *gc,
 
     return err;
 }
+
+int libxl__fdset_open(void)
+{
+    return epoll_create1(EPOLL_CLOEXEC);
+}
+
+int libxl__fdset_ctl(int setfd, int fd, short old, short new)
+{
+    struct epoll_event ev;
+    int r;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = fd;
+    if (new & POLLIN)  ev.events |= EPOLLIN;
+    if (new & POLLPRI) ev.events |= EPOLLPRI;
+    if (new & POLLOUT) ev.events |= EPOLLOUT;
+
+    if (!new) {
+        r = epoll_ctl(setfd, EPOLL_CTL_DEL, fd, &ev);
+        /* Closing the fd has already removed it. */
+        if (r && (errno == EBADF || errno == ENOENT))
+            r = 0;
+    } else if (old) {
+        r = epoll_ctl(setfd, EPOLL_CTL_MOD, fd, &ev);
+        /* Closed and reopened behind our back. */
+        if (r && errno == ENOENT)
+            r = epoll_ctl(setfd, EPOLL_CTL_ADD, fd, &ev);
+    } else {
+        r = epoll_ctl(setfd, EPOLL_CTL_ADD, fd, &ev);
+        if (r && errno == EEXIST)
+            r = epoll_ctl(setfd, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    return r ? errno : 0;
+}
+
+int libxl__fdset_harvest(int setfd, libxl__fdset_ready *ready, int max)
+{
+    struct epoll_event evs[max];
+    int i, r;
+
+    r = epoll_wait(setfd, evs, max, 0);
+    if (r < 0)
+        return -1;
+
+    for (i = 0; i < r; i++) {
+        ready[i].fd = evs[i].data.fd;
+        ready[i].revents = 0;
+        if (evs[i].events & EPOLLIN)  ready[i].revents |= POLLIN;
+        if (evs[i].events & EPOLLPRI) ready[i].revents |= POLLPRI;
+        if (evs[i].events & EPOLLOUT) ready[i].revents |= POLLOUT;
+        if (evs[i].events & EPOLLERR) ready[i].revents |= POLLERR;
+        if (evs[i].events & EPOLLHUP) ready[i].revents |= POLLHUP;
+    }
+
+    return r;
+}
@@ -88,30 +88,25 @@ static const int QMP_SOCKET_CONNECT_TIMEOUT = 5;
  * QMP callbacks functions
  */
 
-static int store_serial_port_info(libxl__qmp_handler *qmp,
+static int store_serial_port_info(libxl__gc *gc, uint32_t domid,
                                   const char *chardev,
                                   int port)
 {
-    GC_INIT(qmp->ctx);
     char *path = NULL;
-    int ret = 0;
 
     if (!(chardev && strncmp("pty:", chardev, 4) == 0)) {
         return 0;
     }
 
-    path = libxl__xs_get_dompath(gc, qmp->domid);
+    path = libxl__xs_get_dompath(gc, domid);
     path = GCSPRINTF("%s/serial/%d/tty", path, port);
 
-    ret = libxl__xs_write(gc, XBT_NULL, path, "%s", chardev + 4);
-
-    GC_FREE;
-    return ret;
+    return libxl__xs_write(gc, XBT_NULL, path, "%s", chardev + 4);
 }
 
-static int register_serials_chardev_callback(libxl__qmp_handler *qmp,
-                                             const libxl__json_object *o,
-                                             void *unused)
+/* Records the serial ports in the reply o to query-chardev. */
+static int register_serials_chardev(libxl__gc *gc, uint32_t domid,
+                                    const libxl__json_object *o)
 {
     const libxl__json_object *obj = NULL;
     const libxl__json_object *label = NULL;
@@ -137,15 +132,13 @@ static int register_serials_chardev_callback(libxl__qmp_handler *qmp,
             s += strlen("serial");
             port_number = strtol(s, &endptr, 10);
             if (*s == 0 || *endptr != 0) {
-                LIBXL__LOG(qmp->ctx, LIBXL__LOG_ERROR,
-                           "Invalid serial port number: %s", s);
+                LOG(ERROR, "Invalid serial port number: %s", s);
                 return -1;
             }
-            ret = store_serial_port_info(qmp, chardev, port_number);
+            ret = store_serial_port_info(gc, domid, chardev, port_number);
             if (ret) {
-                LIBXL__LOG_ERRNO(qmp->ctx, LIBXL__LOG_ERROR,
-                                 "Failed to store serial port information"
-                                 " in xenstore");
+                LOGE(ERROR, "Failed to store serial port information"
+                     " in xenstore");
                 return ret;
             }
         }
@@ -154,6 +147,16 @@ static int register_serials_chardev_callback(libxl__qmp_handler *qmp,
     return ret;
 }
 
+static int register_serials_chardev_callback(libxl__qmp_handler *qmp,
+                                             const libxl__json_object *o,
+                                             void *unused)
+{
+    GC_INIT(qmp->ctx);
+    int ret = register_serials_chardev(gc, qmp->domid, o);
+    GC_FREE;
+    return ret;
+}
+
 static int qmp_write_domain_console_item(libxl__gc *gc, int domid,
                                          const char *item, const char *value)
 {
@@ -165,11 +168,10 @@ static int qmp_write_domain_console_item(libxl__gc *gc, int domid,
     return libxl__xs_write(gc, XBT_NULL, path, "%s", value);
 }
 
-static int qmp_register_vnc_callback(libxl__qmp_handler *qmp,
-                                     const libxl__json_object *o,
-                                     void *unused)
+/* Records the VNC address in the reply o to query-vnc. */
+static int qmp_register_vnc(libxl__gc *gc, uint32_t domid,
+                            const libxl__json_object *o)
 {
-    GC_INIT(qmp->ctx);
     const libxl__json_object *obj;
     const char *addr, *port;
     int rc = -1;
@@ -194,12 +196,11 @@ static int qmp_register_vnc_callback(libxl__qmp_handler *qmp,
         goto out;
     }
 
-    rc = qmp_write_domain_console_item(gc, qmp->domid, "vnc-listen", addr);
+    rc = qmp_write_domain_console_item(gc, domid, "vnc-listen", addr);
     if (!rc)
-        rc = qmp_write_domain_console_item(gc, qmp->domid, "vnc-port", port);
+        rc = qmp_write_domain_console_item(gc, domid, "vnc-port", port);
 
 out:
-    GC_FREE;
     return rc;
 }
 
@@ -503,17 +504,15 @@ static int qmp_next(libxl__gc *gc, libxl__qmp_handler *qmp)
     return rc;
 }
 
-static char *qmp_send_prepare(libxl__gc *gc, libxl__qmp_handler *qmp,
-                              const char *cmd, libxl__json_object *args,
-                              qmp_callback_t callback, void *opaque,
-                              qmp_request_context *context)
+/* Returns the JSON for command cmd, or NULL on error. */
+static char *qmp_command_json(libxl__gc *gc, const char *cmd, int id,
+                              libxl__json_object *args)
 {
     const unsigned char *buf = NULL;
     char *ret = NULL;
     libxl_yajl_length len = 0;
     yajl_gen_status s;
     yajl_gen hand;
-    callback_id_pair *elm = NULL;
 
     hand = libxl_yajl_gen_alloc(NULL);
 
@@ -525,7 +524,7 @@ static char *qmp_send_prepare(libxl__gc *gc, libxl__qmp_handler *qmp,
     libxl__yajl_gen_asciiz(hand, "execute");
     libxl__yajl_gen_asciiz(hand, cmd);
     libxl__yajl_gen_asciiz(hand, "id");
-    yajl_gen_integer(hand, ++qmp->last_id_used);
+    yajl_gen_integer(hand, id);
     if (args) {
         libxl__yajl_gen_asciiz(hand, "arguments");
         libxl__json_object_to_yajl_gen(gc, hand, args);
@@ -539,10 +538,31 @@ static char *qmp_send_prepare(libxl__gc *gc, libxl__qmp_handler *qmp,
         goto out;
     }
 
+    ret = libxl__strndup(gc, (const char*)buf, len);
+
+    LOG(DEBUG, "next qmp command: '%s'", buf);
+
+out:
+    yajl_gen_free(hand);
+    return ret;
+}
+
+static char *qmp_send_prepare(libxl__gc *gc, libxl__qmp_handler *qmp,
+                              const char *cmd, libxl__json_object *args,
+                              qmp_callback_t callback, void *opaque,
+                              qmp_request_context *context)
+{
+    char *ret = NULL;
+    callback_id_pair *elm = NULL;
+
+    ret = qmp_command_json(gc, cmd, ++qmp->last_id_used, args);
+    if (!ret)
+        return NULL;
+
     elm = malloc(sizeof (callback_id_pair));
     if (elm == NULL) {
         LOGE(ERROR, "Failed to allocate a QMP callback");
-        goto out;
+        return NULL;
     }
     elm->id = qmp->last_id_used;
     elm->callback = callback;
@@ -550,12 +570,6 @@ static char *qmp_send_prepare(libxl__gc *gc, libxl__qmp_handler *qmp,
     elm->context = context;
     LIBXL_STAILQ_INSERT_TAIL(&qmp->callback_list, elm, next);
 
-    ret = libxl__strndup(gc, (const char*)buf, len);
-
-    LOG(DEBUG, "next qmp command: '%s'", buf);
-
-out:
-    yajl_gen_free(hand);
     return ret;
 }
 
@@ -618,6 +632,30 @@ static int qmp_synchronous_send(libxl__qmp_handler *qmp, const char *cmd,
     return ret;
 }
 
+/* Waits for the replies to every command sent so far.  Error replies
+ * are logged, and otherwise ignored. */
+static int qmp_wait_all(libxl__gc *gc, libxl__qmp_handler *qmp)
+{
+    callback_id_pair *pp;
+    int pending;
+
+    for (;;) {
+        pending = 0;
+        LIBXL_STAILQ_FOREACH(pp, &qmp->callback_list, next)
+            pending++;
+        if (!pending)
+            return 0;
+
+        /* An error reply makes qmp_next fail too, but is dealt with. */
+        if (qmp_next(gc, qmp) < 0) {
+            LIBXL_STAILQ_FOREACH(pp, &qmp->callback_list, next)
+                pending--;
+            if (!pending)
+                return ERROR_FAIL;
+        }
+    }
+}
+
 static void qmp_free_handler(libxl__qmp_handler *qmp)
 {
     free(qmp);
@@ -754,13 +792,6 @@ int libxl__qmp_query_serial(libxl__qmp_handler *qmp)
                                 NULL, qmp->timeout);
 }
 
-static int qmp_query_vnc(libxl__qmp_handler *qmp)
-{
-    return qmp_synchronous_send(qmp, "query-vnc", NULL,
-                                qmp_register_vnc_callback,
-                                NULL, qmp->timeout);
-}
-
 static int pci_add_callback(libxl__qmp_handler *qmp,
                             const libxl__json_object *response, void *opaque)
 {
@@ -905,24 +936,6 @@ int libxl__qmp_save(libxl__gc *gc, int domid, const char *filename)
                            NULL, NULL);
 }
 
-static int qmp_change(libxl__gc *gc, libxl__qmp_handler *qmp,
-                      char *device, char *target, char *arg)
-{
-    libxl__json_object *args = NULL;
-    int rc = 0;
-
-    qmp_parameters_add_string(gc, &args, "device", device);
-    qmp_parameters_add_string(gc, &args, "target", target);
-    if (arg) {
-        qmp_parameters_add_string(gc, &args, "arg", arg);
-    }
-
-    rc = qmp_synchronous_send(qmp, "change", args,
-                              NULL, NULL, qmp->timeout);
-
-    return rc;
-}
-
 int libxl__qmp_stop(libxl__gc *gc, int domid)
 {
     return qmp_run_command(gc, domid, "stop", NULL, NULL, NULL);
@@ -968,26 +981,532 @@ int libxl__qmp_cpu_add(libxl__gc *gc, int domid, int idx)
     return qmp_run_command(gc, domid, "cpu-add", args, NULL, NULL);
 }
 
-int libxl__qmp_initializations(libxl__gc *gc, uint32_t domid,
-                               const libxl_domain_config *guest_config)
+int libxl__qmp_cpus_add(libxl__gc *gc, int domid,
+                        const libxl_bitmap *cpumap, int max_id)
 {
-    const libxl_vnc_info *vnc = libxl__dm_vnc(guest_config);
     libxl__qmp_handler *qmp = NULL;
-    int ret = 0;
+    libxl__json_object *args;
+    int i, rc;
 
     qmp = libxl__qmp_initialize(gc, domid);
     if (!qmp)
-        return -1;
-    ret = libxl__qmp_query_serial(qmp);
-    if (!ret && vnc && vnc->passwd) {
-        ret = qmp_change(gc, qmp, "vnc", "password", vnc->passwd);
-        qmp_write_domain_console_item(gc, domid, "vnc-pass", vnc->passwd);
-    }
-    if (!ret) {
-        ret = qmp_query_vnc(qmp);
+        return ERROR_FAIL;
+
+    for (i = 0; i <= max_id; i++) {
+        if (!libxl_bitmap_test(cpumap, i))
+            continue;
+        args = NULL;
+        qmp_parameters_add_integer(gc, &args, "id", i);
+        if (qmp_send(qmp, "cpu-add", args, NULL, NULL, NULL) < 0) {
+            rc = ERROR_FAIL;
+            goto out;
+        }
     }
+
+    rc = qmp_wait_all(gc, qmp);
+
+out:
     libxl__qmp_close(qmp);
-    return ret;
+    return rc;
+}
+
+/*
+ * Asynchronous channel
+ */
+
+#define QMP_EV_TIMEOUT_MS 5000
+
+struct libxl__ev_qmp_cmd {
+    int id;
+    char *text; /* with the CRLF */
+    size_t len;
+    libxl__ev_qmp_callback *callback;
+    void *opaque;
+    LIBXL_TAILQ_ENTRY(libxl__ev_qmp_cmd) entry;
+};
+
+static void qmp_ev_fd_callback(libxl__egc *egc, libxl__ev_fd *efd,
+                               int fd, short events, short revents);
+static void qmp_ev_timeout(libxl__egc *egc, libxl__ev_time *et,
+                           const struct timeval *requested_abs, int rc);
+static void qmp_ev_capabilities_callback(libxl__egc *egc, libxl__ev_qmp *ev,
+                                         const libxl__json_object *response,
+                                         void *unused, int rc);
+
+void libxl__ev_qmp_init(libxl__ev_qmp *ev)
+{
+    ev->fd = -1;
+    libxl__ev_fd_init(&ev->efd);
+    libxl__ev_time_init(&ev->timeout);
+    ev->ready = false;
+    ev->last_id = 0;
+    ev->connection = 0;
+    ev->rx = NULL;
+    ev->rx_used = ev->rx_allocd = 0;
+    LIBXL_TAILQ_INIT(&ev->cmds);
+    ev->tx = NULL;
+    ev->tx_off = 0;
+}
+
+/* Back to Idle, forgetting about any commands. */
+static void qmp_ev_close(libxl__gc *gc, libxl__ev_qmp *ev)
+{
+    libxl__ev_fd_deregister(gc, &ev->efd);
+    libxl__ev_time_deregister(gc, &ev->timeout);
+    if (ev->fd >= 0)
+        close(ev->fd);
+    ev->fd = -1;
+    ev->ready = false;
+    ev->rx_used = 0;
+    LIBXL_TAILQ_INIT(&ev->cmds);
+    ev->tx = NULL;
+    ev->tx_off = 0;
+}
+
+void libxl__ev_qmp_dispose(libxl__gc *gc, libxl__ev_qmp *ev)
+{
+    qmp_ev_close(gc, ev);
+    free(ev->rx);
+    ev->rx = NULL;
+    ev->rx_allocd = 0;
+}
+
+static int qmp_ev_connect(libxl__gc *gc, libxl__ev_qmp *ev)
+{
+    struct sockaddr_un addr;
+    const char *path;
+    int rc;
+
+    path = GCSPRINTF("%s/qmp-libxl-%d", libxl__run_dir_path(), ev->domid);
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        LOG(ERROR, "QMP socket path too long: %s", path);
+        return ERROR_FAIL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    ev->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ev->fd < 0) {
+        LOGE(ERROR, "cannot create socket for QMP");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+    rc = libxl_fd_set_nonblock(CTX, ev->fd, 1);
+    if (rc) goto out;
+    rc = libxl_fd_set_cloexec(CTX, ev->fd, 1);
+    if (rc) goto out;
+
+    if (connect(ev->fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        LOGE(ERROR, "cannot connect to QMP socket %s", path);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    rc = libxl__ev_fd_register(gc, &ev->efd, qmp_ev_fd_callback,
+                               ev->fd, POLLIN);
+    if (rc) goto out;
+
+    LOG(DEBUG, "connected to %s", path);
+    ev->connection++;
+    rc = 0;
+
+out:
+    if (rc)
+        qmp_ev_close(gc, ev);
+    return rc;
+}
+
+/* Gives the device model QMP_EV_TIMEOUT_MS from now to say something,
+ * if we are waiting for it to. */
+static int qmp_ev_timeout_update(libxl__gc *gc, libxl__ev_qmp *ev)
+{
+    libxl__ev_time_deregister(gc, &ev->timeout);
+    if (LIBXL_TAILQ_EMPTY(&ev->cmds))
+        return 0;
+    return libxl__ev_time_register_rel(ev->ao, &ev->timeout, qmp_ev_timeout,
+                                       QMP_EV_TIMEOUT_MS);
+}
+
+/* Writes as much of the queued commands as the socket will take.
+ * Until the capabilities have been negotiated, qemu will take nothing
+ * but qmp_capabilities.  Write errors are left for the reading side
+ * to notice, as EOF or an error. */
+static void qmp_ev_flush(libxl__gc *gc, libxl__ev_qmp *ev)
+{
+    libxl__ev_qmp_cmd *c;
+    short events = POLLIN;
+    ssize_t r;
+
+    while ((c = ev->tx) &&
+           (ev->ready || c->callback == qmp_ev_capabilities_callback)) {
+        r = send(ev->fd, c->text + ev->tx_off, c->len - ev->tx_off,
+                 MSG_NOSIGNAL);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                events |= POLLOUT;
+            else
+                LOGE(ERROR, "QMP socket write error");
+            break;
+        }
+        ev->tx_off += r;
+        if (ev->tx_off == c->len) {
+            ev->tx = LIBXL_TAILQ_NEXT(c, entry);
+            ev->tx_off = 0;
+        }
+    }
+
+    libxl__ev_fd_modify(gc, &ev->efd, events);
+}
+
+static int qmp_ev_queue(libxl__gc *gc, libxl__ev_qmp *ev,
+                        const char *cmd, libxl__json_object *args,
+                        libxl__ev_qmp_callback *callback, void *opaque)
+{
+    libxl__ev_qmp_cmd *c;
+    char *json;
+
+    json = qmp_command_json(gc, cmd, ev->last_id + 1, args);
+    if (!json)
+        return ERROR_FAIL;
+
+    GCNEW(c);
+    c->id = ++ev->last_id;
+    c->text = GCSPRINTF("%s\r\n", json);
+    c->len = strlen(c->text);
+    c->callback = callback;
+    c->opaque = opaque;
+
+    if (callback == qmp_ev_capabilities_callback) {
+        /* Nothing can have been written before it. */
+        LIBXL_TAILQ_INSERT_HEAD(&ev->cmds, c, entry);
+        ev->tx = c;
+        ev->tx_off = 0;
+    } else {
+        LIBXL_TAILQ_INSERT_TAIL(&ev->cmds, c, entry);
+        if (!ev->tx)
+            ev->tx = c;
+    }
+
+    return 0;
+}
+
+int libxl__ev_qmp_send(libxl__ev_qmp *ev, const char *cmd,
+                       libxl__json_object *args,
+                       libxl__ev_qmp_callback *callback, void *opaque)
+{
+    STATE_AO_GC(ev->ao);
+    int rc;
+
+    if (ev->fd < 0) {
+        rc = qmp_ev_connect(gc, ev);
+        if (rc) return rc;
+    }
+
+    if (!libxl__ev_time_isregistered(&ev->timeout)) {
+        rc = libxl__ev_time_register_rel(ev->ao, &ev->timeout,
+                                         qmp_ev_timeout, QMP_EV_TIMEOUT_MS);
+        if (rc) return rc;
+    }
+
+    rc = qmp_ev_queue(gc, ev, cmd, args, callback, opaque);
+    if (rc) {
+        if (LIBXL_TAILQ_EMPTY(&ev->cmds))
+            libxl__ev_time_deregister(gc, &ev->timeout);
+        return rc;
+    }
+
+    qmp_ev_flush(gc, ev);
+    return 0;
+}
+
+/* Closes the connection, and fails every command awaiting a reply. */
+static void qmp_ev_fail(libxl__egc *egc, libxl__ev_qmp *ev, int rc)
+{
+    EGC_GC;
+    LIBXL_TAILQ_HEAD(, libxl__ev_qmp_cmd) failed;
+    libxl__ev_qmp_cmd *c;
+
+    LIBXL_TAILQ_INIT(&failed);
+    LIBXL_TAILQ_CONCAT(&failed, &ev->cmds, entry);
+    qmp_ev_close(gc, ev);
+
+    /* ev may be used again by the callbacks; failed is ours. */
+    while ((c = LIBXL_TAILQ_FIRST(&failed))) {
+        LIBXL_TAILQ_REMOVE(&failed, c, entry);
+        if (c->callback != qmp_ev_capabilities_callback)
+            c->callback(egc, ev, NULL, c->opaque, rc);
+    }
+}
+
+static void qmp_ev_timeout(libxl__egc *egc, libxl__ev_time *et,
+                           const struct timeval *requested_abs, int rc)
+{
+    libxl__ev_qmp *ev = CONTAINER_OF(et, *ev, timeout);
+    EGC_GC;
+
+    if (rc == ERROR_TIMEDOUT)
+        LOG(ERROR, "timed out waiting for QMP reply from domain %u",
+            ev->domid);
+    qmp_ev_fail(egc, ev, rc);
+}
+
+static void qmp_ev_capabilities_callback(libxl__egc *egc, libxl__ev_qmp *ev,
+                                         const libxl__json_object *response,
+                                         void *unused, int rc)
+{
+    EGC_GC;
+
+    if (rc) {
+        qmp_ev_fail(egc, ev, rc);
+        return;
+    }
+
+    ev->ready = true;
+    qmp_ev_flush(gc, ev);
+}
+
+/* Reads what there is to read.  Any data read before EOF has been
+ * returned by an earlier call, so EOF means there is no more. */
+static int qmp_ev_read(libxl__gc *gc, libxl__ev_qmp *ev)
+{
+    ssize_t r;
+
+    if (ev->rx_allocd - ev->rx_used < QMP_RECEIVE_BUFFER_SIZE + 1) {
+        ev->rx_allocd = ev->rx_used + QMP_RECEIVE_BUFFER_SIZE + 1;
+        if (ev->rx_allocd < ev->rx_used * 2)
+            ev->rx_allocd = ev->rx_used * 2;
+        ev->rx = libxl__realloc(NOGC, ev->rx, ev->rx_allocd);
+    }
+
+    for (;;) {
+        r = read(ev->fd, ev->rx + ev->rx_used,
+                 ev->rx_allocd - ev->rx_used - 1);
+        if (r > 0)
+            break;
+        if (r == 0) {
+            LOG(ERROR, "QMP connection to domain %u closed", ev->domid);
+            return ERROR_FAIL;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        LOGE(ERROR, "QMP socket read error");
+        return ERROR_FAIL;
+    }
+
+    DEBUG_REPORT_RECEIVED(ev->rx + ev->rx_used, (int)r);
+    ev->rx_used += r;
+    ev->rx[ev->rx_used] = 0;
+
+    return qmp_ev_timeout_update(gc, ev);
+}
+
+static libxl__ev_qmp_cmd *qmp_ev_reply_cmd(libxl__ev_qmp *ev,
+                                           const libxl__json_object *o)
+{
+    const libxl__json_object *id = libxl__json_map_get("id", o,
+                                                       JSON_INTEGER);
+    libxl__ev_qmp_cmd *c;
+
+    if (!id)
+        return NULL;
+
+    LIBXL_TAILQ_FOREACH(c, &ev->cmds, entry) {
+        if (c->id == libxl__json_object_get_integer(id))
+            return c;
+    }
+    return NULL;
+}
+
+/* Handles each complete message received.  Stops as soon as a callback
+ * has closed the connection, which may also have been reopened. */
+static void qmp_ev_dispatch(libxl__egc *egc, libxl__ev_qmp *ev)
+{
+    EGC_GC;
+    unsigned connection = ev->connection;
+    const libxl__json_object *o, *response;
+    libxl__ev_qmp_cmd *c;
+    char *line, *end;
+    int rc;
+
+    while (ev->rx && (end = strstr(ev->rx, "\r\n"))) {
+        line = libxl__strndup(gc, ev->rx, end - ev->rx);
+        ev->rx_used -= end + 2 - ev->rx;
+        memmove(ev->rx, end + 2, ev->rx_used + 1);
+
+        o = libxl__json_parse(gc, line);
+        if (!o) {
+            LOG(ERROR, "Parse error of : %s", line);
+            qmp_ev_fail(egc, ev, ERROR_FAIL);
+            return;
+        }
+
+        switch (qmp_response_type(NULL, o)) {
+        case LIBXL__QMP_MESSAGE_TYPE_QMP:
+            /* The greeting; negotiate capabilities before anything else */
+            rc = qmp_ev_queue(gc, ev, "qmp_capabilities", NULL,
+                              qmp_ev_capabilities_callback, NULL);
+            if (rc) {
+                qmp_ev_fail(egc, ev, rc);
+                return;
+            }
+            qmp_ev_flush(gc, ev);
+            continue;
+        case LIBXL__QMP_MESSAGE_TYPE_RETURN:
+            response = libxl__json_map_get("return", o, JSON_ANY);
+            rc = 0;
+            break;
+        case LIBXL__QMP_MESSAGE_TYPE_ERROR:
+            response = libxl__json_map_get("error", o, JSON_MAP);
+            response = libxl__json_map_get("desc", response, JSON_STRING);
+            LOG(ERROR, "received an error message from QMP server: %s",
+                libxl__json_object_get_string(response));
+            response = NULL;
+            rc = ERROR_FAIL;
+            break;
+        case LIBXL__QMP_MESSAGE_TYPE_EVENT:
+            continue;
+        case LIBXL__QMP_MESSAGE_TYPE_INVALID:
+        default:
+            LOG(ERROR, "unexpected QMP message: %s", line);
+            qmp_ev_fail(egc, ev, ERROR_FAIL);
+            return;
+        }
+
+        c = qmp_ev_reply_cmd(ev, o);
+        if (!c) {
+            LOG(ERROR, "QMP reply to no command: %s", line);
+            continue;
+        }
+        LIBXL_TAILQ_REMOVE(&ev->cmds, c, entry);
+        if (LIBXL_TAILQ_EMPTY(&ev->cmds))
+            libxl__ev_time_deregister(gc, &ev->timeout);
+
+        c->callback(egc, ev, response, c->opaque, rc);
+        if (ev->fd < 0 || ev->connection != connection)
+            return;
+    }
+}
+
+static void qmp_ev_fd_callback(libxl__egc *egc, libxl__ev_fd *efd,
+                               int fd, short events, short revents)
+{
+    libxl__ev_qmp *ev = CONTAINER_OF(efd, *ev, efd);
+    EGC_GC;
+    int rc;
+
+    if (revents & POLLOUT)
+        qmp_ev_flush(gc, ev);
+
+    if (revents & (POLLIN | POLLHUP | POLLERR)) {
+        rc = qmp_ev_read(gc, ev);
+        if (rc) {
+            qmp_ev_fail(egc, ev, rc);
+            return;
+        }
+        qmp_ev_dispatch(egc, ev);
+    }
+}
+
+/*
+ * Initializations of a new domain's device model
+ */
+
+static void qmp_inits_reply(libxl__egc *egc, libxl__qmp_inits_state *qis,
+                            int rc)
+{
+    EGC_GC;
+
+    if (rc && !qis->rc)
+        qis->rc = rc;
+    if (--qis->pending)
+        return;
+
+    libxl__ev_qmp_dispose(gc, &qis->qmp);
+    qis->callback(egc, qis, qis->rc);
+}
+
+static void qmp_inits_serial(libxl__egc *egc, libxl__ev_qmp *ev,
+                             const libxl__json_object *response,
+                             void *unused, int rc)
+{
+    libxl__qmp_inits_state *qis = CONTAINER_OF(ev, *qis, qmp);
+    EGC_GC;
+
+    if (!rc && register_serials_chardev(gc, qis->domid, response))
+        rc = ERROR_FAIL;
+    qmp_inits_reply(egc, qis, rc);
+}
+
+static void qmp_inits_vnc_passwd(libxl__egc *egc, libxl__ev_qmp *ev,
+                                 const libxl__json_object *response,
+                                 void *unused, int rc)
+{
+    libxl__qmp_inits_state *qis = CONTAINER_OF(ev, *qis, qmp);
+
+    qmp_inits_reply(egc, qis, rc);
+}
+
+static void qmp_inits_vnc(libxl__egc *egc, libxl__ev_qmp *ev,
+                          const libxl__json_object *response,
+                          void *unused, int rc)
+{
+    libxl__qmp_inits_state *qis = CONTAINER_OF(ev, *qis, qmp);
+    EGC_GC;
+
+    if (!rc && qmp_register_vnc(gc, qis->domid, response))
+        rc = ERROR_FAIL;
+    qmp_inits_reply(egc, qis, rc);
+}
+
+void libxl__qmp_initializations(libxl__egc *egc, libxl__qmp_inits_state *qis)
+{
+    STATE_AO_GC(qis->ao);
+    const libxl_vnc_info *vnc = libxl__dm_vnc(qis->guest_config);
+    libxl__json_object *args = NULL;
+    int rc;
+
+    libxl__ev_qmp_init(&qis->qmp);
+    qis->qmp.ao = ao;
+    qis->qmp.domid = qis->domid;
+    qis->pending = 0;
+    qis->rc = 0;
+
+    rc = libxl__ev_qmp_send(&qis->qmp, "query-chardev", NULL,
+                            qmp_inits_serial, NULL);
+    if (rc) goto out;
+    qis->pending++;
+
+    if (vnc && vnc->passwd) {
+        qmp_parameters_add_string(gc, &args, "device", "vnc");
+        qmp_parameters_add_string(gc, &args, "target", "password");
+        qmp_parameters_add_string(gc, &args, "arg", vnc->passwd);
+        rc = libxl__ev_qmp_send(&qis->qmp, "change", args,
+                                qmp_inits_vnc_passwd, NULL);
+        if (rc) goto out;
+        qis->pending++;
+        qmp_write_domain_console_item(gc, qis->domid, "vnc-pass",
+                                      vnc->passwd);
+    }
+
+    rc = libxl__ev_qmp_send(&qis->qmp, "query-vnc", NULL,
+                            qmp_inits_vnc, NULL);
+    if (rc) goto out;
+    qis->pending++;
+
+    return;
+
+out:
+    /* Anything already sent will still be answered, or failed. */
+    qis->rc = rc;
+    if (!qis->pending) {
+        libxl__ev_qmp_dispose(gc, &qis->qmp);
+        qis->callback(egc, qis, rc);
+    }
 }
 
 /*
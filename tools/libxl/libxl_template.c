@@ -0,0 +1,175 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/*
+ * Domain templates.
+ *
+ * A template holds what every domain created from one configuration
+ * has in common: the configuration itself, and, for a PV guest booted
+ * straight from a kernel file, the kernel image as libxc's loaders see
+ * it after decompression.  The image is kept in an unlinked file, so
+ * that each domain built from the template just maps it.
+ */
+
+#include "libxl_osdeps.h" /* must come before any other headers */
+
+#include "libxl_internal.h"
+
+#include <xc_dom.h>
+
+struct libxl__domain_template {
+    libxl_domain_config config;
+    char *kernel_path;  /* the kernel cached in kernel_fd, or NULL */
+    int kernel_fd;
+    size_t kernel_size;
+};
+
+/* Reads, decompresses and stashes the kernel at path. */
+static int template_cache_kernel(libxl__gc *gc, libxl_domain_template *tmpl,
+                                 const char *path)
+{
+    struct xc_dom_image *dom;
+    const void *blob;
+    size_t size;
+    char *stash;
+    int fd = -1, rc;
+
+    xc_dom_loginit(CTX->xch);
+
+    dom = xc_dom_allocate(CTX->xch, NULL, NULL);
+    if (!dom) {
+        LOGE(ERROR, "xc_dom_allocate failed");
+        return ERROR_FAIL;
+    }
+
+    if (xc_dom_kernel_file(dom, path) ||
+        xc_dom_kernel_probe(dom, &blob, &size)) {
+        LOGE(ERROR, "cannot load kernel %s for template", path);
+        rc = ERROR_INVAL;
+        goto out;
+    }
+
+    stash = GCSPRINTF("%s/template-kernel.XXXXXX", libxl__run_dir_path());
+    fd = mkstemp(stash);
+    if (fd < 0) {
+        LOGE(ERROR, "cannot create %s", stash);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+    unlink(stash);
+
+    rc = libxl_write_exactly(CTX, fd, blob, size, stash, "template kernel");
+    if (rc)
+        goto out;
+
+    LOG(DEBUG, "template kernel %s: %zu bytes once loaded", path, size);
+
+    tmpl->kernel_path = libxl__strdup(NOGC, path);
+    tmpl->kernel_fd = fd;
+    tmpl->kernel_size = size;
+    fd = -1;
+    rc = 0;
+
+ out:
+    if (fd >= 0)
+        close(fd);
+    xc_dom_release(dom);
+    return rc;
+}
+
+int libxl_domain_template_create(libxl_ctx *ctx,
+                                 libxl_domain_config *d_config,
+                                 libxl_domain_template **template_r)
+{
+    GC_INIT(ctx);
+    libxl_domain_template *tmpl;
+    const libxl_domain_build_info *b_info = &d_config->b_info;
+    const char *kernel = b_info->kernel;
+    int rc;
+
+    tmpl = libxl__zalloc(NOGC, sizeof(*tmpl));
+    tmpl->kernel_fd = -1;
+    libxl_domain_config_init(&tmpl->config);
+    libxl_domain_config_copy(ctx, &tmpl->config, d_config);
+
+    if (d_config->c_info.type == LIBXL_DOMAIN_TYPE_PV) {
+        if (!kernel)
+            kernel = b_info->u.pv.kernel;
+
+        /* With a bootloader the kernel is only known at boot time. */
+        if (!b_info->u.pv.bootloader && kernel) {
+            rc = template_cache_kernel(gc, tmpl, kernel);
+            if (rc)
+                goto out;
+        }
+    }
+
+    *template_r = tmpl;
+    tmpl = NULL;
+    rc = 0;
+
+ out:
+    libxl_domain_template_free(ctx, tmpl);
+    GC_FREE;
+    return rc;
+}
+
+void libxl_domain_template_free(libxl_ctx *ctx, libxl_domain_template *tmpl)
+{
+    if (!tmpl)
+        return;
+
+    if (tmpl->kernel_fd >= 0)
+        close(tmpl->kernel_fd);
+    free(tmpl->kernel_path);
+    libxl_domain_config_dispose(&tmpl->config);
+    free(tmpl);
+}
+
+void libxl_domain_template_config(libxl_ctx *ctx,
+                                  libxl_domain_template *tmpl,
+                                  libxl_domain_config *d_config)
+{
+    libxl_domain_config_copy(ctx, d_config, &tmpl->config);
+}
+
+void libxl__domain_template_map_kernel(libxl__gc *gc,
+                                       const libxl_domain_template *tmpl,
+                                       libxl__domain_build_state *state)
+{
+    void *data;
+
+    if (!tmpl->kernel_path || state->pv_kernel.mapped ||
+        !state->pv_kernel.path ||
+        strcmp(state->pv_kernel.path, tmpl->kernel_path))
+        return;
+
+    data = mmap(NULL, tmpl->kernel_size, PROT_READ, MAP_PRIVATE,
+                tmpl->kernel_fd, 0);
+    if (data == MAP_FAILED) {
+        LOGE(WARN, "cannot map template kernel, loading %s afresh",
+             tmpl->kernel_path);
+        return;
+    }
+
+    state->pv_kernel.mapped = 1;
+    state->pv_kernel.data = data;
+    state->pv_kernel.size = tmpl->kernel_size;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
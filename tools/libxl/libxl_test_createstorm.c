@@ -0,0 +1,161 @@
+/*
+ * create-storm benchmark for batch domain creation
+ *
+ * To run this test:
+ *    ./test_createstorm [nr_domains]
+ * Success:
+ *    prints how long creating the domains takes one after another and
+ *    as batches with various limits, and exits 0
+ * Failure:
+ *    crash
+ *
+ * No domains are created, so libxl_domain_create_batch is not called.
+ * Instead each pretend domain goes through the same gates, in the same
+ * order, as the creation state machine puts real ones through when
+ * batched: bootloader, build, devices (disks), device model, and the
+ * devices gate again (nics).  It spends a fixed time in each phase.
+ */
+
+#include "libxl_internal.h"
+
+#include "libxl_test_createstorm.h"
+
+typedef struct storm storm;
+
+/* The order in which libxl_create.c enters the gates. */
+static const libxl__domcreate_phase steps[] = {
+    LIBXL__DOMCREATE_PHASE_BOOTLOADER,
+    LIBXL__DOMCREATE_PHASE_BUILD,
+    LIBXL__DOMCREATE_PHASE_DEVICES,       /* disks */
+    LIBXL__DOMCREATE_PHASE_DEVICE_MODEL,
+    LIBXL__DOMCREATE_PHASE_DEVICES,       /* nics */
+};
+
+typedef struct {
+    storm *st;
+    int step;
+    libxl__gate_waiter waiter;
+    libxl__ev_time timer;
+} storm_domain;
+
+struct storm {
+    libxl__ao *ao;
+    libxl__gate gates[LIBXL__DOMCREATE_NR_PHASES];
+    const int *phase_ms;
+    int active[LIBXL_TEST_CREATESTORM_PHASES];
+    int *peak;
+    int outstanding;
+    int rc;
+};
+
+static void phase_admitted(libxl__egc *egc, libxl__gate_waiter *w);
+static void phase_timeout(libxl__egc *egc, libxl__ev_time *ev,
+                          const struct timeval *requested_abs, int rc);
+static void phase_done(libxl__egc *egc, storm_domain *sd, int rc);
+static void storm_put(libxl__egc *egc, storm *st);
+
+int libxl_test_createstorm(libxl_ctx *ctx, int nr_domains,
+                           const libxl_domain_create_limits *limits,
+                           const int phase_ms[LIBXL_TEST_CREATESTORM_PHASES],
+                           int peak[LIBXL_TEST_CREATESTORM_PHASES],
+                           libxl_asyncop_how *ao_how)
+{
+    AO_CREATE(ctx, 0, ao_how);
+    storm *st;
+    storm_domain *sds;
+    int i;
+
+    BUILD_BUG_ON(LIBXL_TEST_CREATESTORM_PHASES != LIBXL__DOMCREATE_NR_PHASES);
+
+    GCNEW(st);
+    st->ao = ao;
+    st->phase_ms = phase_ms;
+    st->peak = peak;
+    libxl__gate_init(&st->gates[LIBXL__DOMCREATE_PHASE_BOOTLOADER],
+                     limits->bootloader);
+    libxl__gate_init(&st->gates[LIBXL__DOMCREATE_PHASE_BUILD],
+                     limits->build);
+    libxl__gate_init(&st->gates[LIBXL__DOMCREATE_PHASE_DEVICES],
+                     limits->devices);
+    libxl__gate_init(&st->gates[LIBXL__DOMCREATE_PHASE_DEVICE_MODEL],
+                     limits->device_model);
+    for (i = 0; i < LIBXL_TEST_CREATESTORM_PHASES; i++)
+        peak[i] = 0;
+
+    GCNEW_ARRAY(sds, nr_domains);
+    st->outstanding = nr_domains + 1;
+
+    for (i = 0; i < nr_domains; i++) {
+        storm_domain *sd = &sds[i];
+
+        sd->st = st;
+        sd->step = 0;
+        sd->waiter.callback = phase_admitted;
+        libxl__ev_time_init(&sd->timer);
+        libxl__gate_enter(egc, &st->gates[steps[0]], &sd->waiter);
+    }
+
+    storm_put(egc, st);
+
+    return AO_INPROGRESS;
+}
+
+static void phase_admitted(libxl__egc *egc, libxl__gate_waiter *w)
+{
+    storm_domain *sd = CONTAINER_OF(w, *sd, waiter);
+    storm *st = sd->st;
+    STATE_AO_GC(st->ao);
+    libxl__domcreate_phase phase = steps[sd->step];
+    int ms = st->phase_ms[phase];
+    int rc;
+
+    if (++st->active[phase] > st->peak[phase])
+        st->peak[phase] = st->active[phase];
+
+    if (phase == LIBXL__DOMCREATE_PHASE_BUILD) {
+        /* Like libxl__domain_build, hold up everything else. */
+        usleep(ms * 1000);
+        phase_done(egc, sd, 0);
+        return;
+    }
+
+    rc = libxl__ev_time_register_rel(ao, &sd->timer, phase_timeout, ms);
+    if (rc)
+        phase_done(egc, sd, rc);
+}
+
+static void phase_timeout(libxl__egc *egc, libxl__ev_time *ev,
+                          const struct timeval *requested_abs, int rc)
+{
+    storm_domain *sd = CONTAINER_OF(ev, *sd, timer);
+
+    phase_done(egc, sd, rc == ERROR_TIMEDOUT ? 0 : rc);
+}
+
+static void phase_done(libxl__egc *egc, storm_domain *sd, int rc)
+{
+    storm *st = sd->st;
+    libxl__domcreate_phase phase = steps[sd->step];
+
+    st->active[phase]--;
+    libxl__gate_leave(egc, &st->gates[phase]);
+
+    if (rc && !st->rc)
+        st->rc = rc;
+
+    if (rc || ++sd->step == ARRAY_SIZE(steps)) {
+        storm_put(egc, st);
+        return;
+    }
+
+    libxl__gate_enter(egc, &st->gates[steps[sd->step]], &sd->waiter);
+}
+
+static void storm_put(libxl__egc *egc, storm *st)
+{
+    assert(st->outstanding > 0);
+    if (--st->outstanding)
+        return;
+
+    libxl__ao_complete(egc, st->ao, st->rc);
+}
@@ -0,0 +1,21 @@
+#ifndef TEST_CREATESTORM_H
+#define TEST_CREATESTORM_H
+
+/* Phases, in the order of the members of libxl_domain_create_limits */
+#define LIBXL_TEST_CREATESTORM_PHASES 4
+
+int libxl_test_createstorm(libxl_ctx *ctx, int nr_domains,
+                           const libxl_domain_create_limits *limits,
+                           const int phase_ms[LIBXL_TEST_CREATESTORM_PHASES],
+                           int peak[LIBXL_TEST_CREATESTORM_PHASES],
+                           libxl_asyncop_how *ao_how)
+                           LIBXL_EXTERNAL_CALLERS_ONLY;
+/* Pretends to create nr_domains domains at once, bounding the phases of
+ * creation by limits exactly as libxl_domain_create_batch does, and
+ * passing through the devices phase twice (disks, then nics).  Each
+ * pass takes phase_ms[phase] ms: the build phase by blocking, as the
+ * real one does, and the others by waiting for a timeout, as the real
+ * ones wait for child processes.  The greatest number of domains seen
+ * in each phase at once is returned in peak. */
+
+#endif /*TEST_CREATESTORM_H*/
@@ -0,0 +1,174 @@
+/*
+ * event loop benchmark
+ *
+ * To run this test:
+ *    ./test_evloop [max_fds [max_timers [hops]]]
+ * Success:
+ *    prints the cost of an event loop iteration, for various numbers
+ *    of idle fds and timeouts, with and without the kernel fd set,
+ *    and exits 0
+ * Failure:
+ *    crash
+ */
+
+#include "libxl_internal.h"
+
+#include "libxl_test_evloop.h"
+
+#define EVLOOP_TIMEOUT_MS 600000
+
+typedef struct evloop evloop;
+
+typedef struct {
+    evloop *el;
+    int pipe[2];
+    libxl__ev_fd efd;
+} evloop_fd;
+
+typedef struct {
+    evloop *el;
+    libxl__ev_time ev;
+} evloop_timer;
+
+struct evloop {
+    libxl__ao *ao;
+    int nr_fds, nr_timers, hops_left;
+    evloop_fd *fds;
+    evloop_timer *timers;
+    int next_timer;
+};
+
+static void evloop_fd_cb(libxl__egc *egc, libxl__ev_fd *ev,
+                         int fd, short events, short revents);
+static void evloop_timer_cb(libxl__egc *egc, libxl__ev_time *ev,
+                            const struct timeval *requested_abs, int rc);
+
+static void evloop_cleanup(libxl__gc *gc, evloop *el)
+{
+    int i;
+
+    for (i = 0; i < el->nr_fds; i++) {
+        libxl__ev_fd_deregister(gc, &el->fds[i].efd);
+        libxl__pipe_close(el->fds[i].pipe);
+    }
+    for (i = 0; i < el->nr_timers; i++)
+        libxl__ev_time_deregister(gc, &el->timers[i].ev);
+}
+
+static void evloop_complete(libxl__egc *egc, evloop *el, int rc)
+{
+    STATE_AO_GC(el->ao);
+    evloop_cleanup(gc, el);
+    libxl__ao_complete(egc, ao, rc);
+}
+
+static int evloop_timer_register(evloop *el, evloop_timer *et)
+{
+    /* Spread the timeouts out, so that they land all over the heap. */
+    return libxl__ev_time_register_rel(el->ao, &et->ev, evloop_timer_cb,
+                                       EVLOOP_TIMEOUT_MS +
+                                       (rand() % EVLOOP_TIMEOUT_MS));
+}
+
+static int evloop_kick(evloop_fd *ef)
+{
+    static const char byte = 0;
+    int r = write(ef->pipe[1], &byte, 1);
+    return r == 1 ? 0 : ERROR_FAIL;
+}
+
+static void evloop_fd_cb(libxl__egc *egc, libxl__ev_fd *ev,
+                         int fd, short events, short revents)
+{
+    evloop_fd *ef = CONTAINER_OF(ev, *ef, efd);
+    evloop *el = ef->el;
+    STATE_AO_GC(el->ao);
+    char byte;
+    int rc;
+
+    if (read(fd, &byte, 1) != 1) {
+        LOGE(ERROR, "read from evloop pipe");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    if (!--el->hops_left) {
+        rc = 0;
+        goto out;
+    }
+
+    if (el->nr_timers) {
+        evloop_timer *et = &el->timers[el->next_timer++ % el->nr_timers];
+        libxl__ev_time_deregister(gc, &et->ev);
+        rc = evloop_timer_register(el, et);
+        if (rc) goto out;
+    }
+
+    rc = evloop_kick(&el->fds[(ef - el->fds + 1) % el->nr_fds]);
+    if (rc) goto out;
+
+    return;
+
+ out:
+    evloop_complete(egc, el, rc);
+}
+
+static void evloop_timer_cb(libxl__egc *egc, libxl__ev_time *ev,
+                            const struct timeval *requested_abs, int rc)
+{
+    evloop_timer *et = CONTAINER_OF(ev, *et, ev);
+    evloop_complete(egc, et->el, rc ?: ERROR_FAIL);
+}
+
+int libxl_test_evloop(libxl_ctx *ctx, int nr_fds, int nr_timers, int hops,
+                      libxl_asyncop_how *ao_how)
+{
+    AO_CREATE(ctx, 0, ao_how);
+    evloop *el;
+    int i, rc;
+
+    assert(nr_fds > 0 && hops > 0);
+
+    GCNEW(el);
+    el->ao = ao;
+    el->nr_fds = nr_fds;
+    el->nr_timers = nr_timers;
+    el->hops_left = hops;
+    GCNEW_ARRAY(el->fds, nr_fds);
+    GCNEW_ARRAY(el->timers, nr_timers);
+
+    for (i = 0; i < nr_fds; i++) {
+        el->fds[i].el = el;
+        el->fds[i].pipe[0] = el->fds[i].pipe[1] = -1;
+        libxl__ev_fd_init(&el->fds[i].efd);
+    }
+    for (i = 0; i < nr_timers; i++) {
+        el->timers[i].el = el;
+        libxl__ev_time_init(&el->timers[i].ev);
+    }
+
+    for (i = 0; i < nr_fds; i++) {
+        evloop_fd *ef = &el->fds[i];
+
+        rc = libxl__pipe_nonblock(CTX, ef->pipe);
+        if (rc) goto out;
+
+        rc = libxl__ev_fd_register(gc, &ef->efd, evloop_fd_cb,
+                                   ef->pipe[0], POLLIN);
+        if (rc) goto out;
+    }
+
+    for (i = 0; i < nr_timers; i++) {
+        rc = evloop_timer_register(el, &el->timers[i]);
+        if (rc) goto out;
+    }
+
+    rc = evloop_kick(&el->fds[0]);
+    if (rc) goto out;
+
+    return AO_INPROGRESS;
+
+ out:
+    evloop_cleanup(gc, el);
+    return AO_CREATE_FAIL(rc);
+}
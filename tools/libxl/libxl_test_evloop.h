@@ -0,0 +1,15 @@
+#ifndef TEST_EVLOOP_H
+#define TEST_EVLOOP_H
+
+int libxl_test_evloop(libxl_ctx *ctx, int nr_fds, int nr_timers, int hops,
+                      libxl_asyncop_how *ao_how)
+                      LIBXL_EXTERNAL_CALLERS_ONLY;
+/* Registers nr_fds pipes and nr_timers timeouts (which are far in the
+ * future, and never occur) and passes a single byte around the pipes,
+ * hops times, one pipe per event loop iteration.  On each hop one of
+ * the timeouts is deregistered and registered again for a different
+ * time.  So all but one of the fds, and all the timeouts, are idle
+ * load on the event loop.  Completes successfully after the last hop
+ * (or, it can be aborted). */
+
+#endif /*TEST_EVLOOP_H*/
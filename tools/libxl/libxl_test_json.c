@@ -0,0 +1,210 @@
+/*
+ * JSON conversion benchmark
+ *
+ * To run this test:
+ *    ./test_json [max_devices [iterations]]
+ * Success:
+ *    prints, for domain configurations of increasing size, the time
+ *    taken to convert them to JSON and back, with the old and new
+ *    methods, and exits 0
+ *
+ * The old generation method, copying the JSON out of yajl's own
+ * buffer, is no longer used by libxl; a copy of it is kept here as the
+ * baseline.  It shares the generated per-type functions with the new
+ * one, so only the handling of the output differs.
+ * Failure:
+ *    crash
+ */
+
+#include "libxl_internal.h"
+
+#include "libxl_test_json.h"
+
+static uint64_t ns_since(const struct timespec *start, int iterations)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start->tv_sec) * 1000000000ULL +
+            end.tv_nsec - start->tv_nsec) / iterations;
+}
+
+/* libxl__object_to_json as it was before libxl__object_to_json_buf */
+static char *gen_json_yajl(libxl__gc *gc, libxl__gen_json_callback gen,
+                           void *p)
+{
+    const unsigned char *buf;
+    char *ret = NULL;
+    libxl_yajl_length len = 0;
+    yajl_gen_status s;
+    yajl_gen hand;
+
+    hand = libxl_yajl_gen_alloc(NULL);
+    if (!hand)
+        return NULL;
+
+    s = gen(hand, p);
+    if (s != yajl_gen_status_ok)
+        goto out;
+
+    s = yajl_gen_get_buf(hand, &buf, &len);
+    if (s != yajl_gen_status_ok)
+        goto out;
+    ret = strdup((const char *)buf);
+
+out:
+    yajl_gen_free(hand);
+    if (s != yajl_gen_status_ok)
+        LOG(ERROR, "YAJL error code %d", s);
+    return ret;
+}
+
+static void make_config(libxl__gc *gc, libxl_domain_config *d_config,
+                        int nr_devices)
+{
+    libxl_domain_create_info *c_info = &d_config->c_info;
+    libxl_domain_build_info *b_info = &d_config->b_info;
+    int i;
+
+    c_info->type = LIBXL_DOMAIN_TYPE_PV;
+    c_info->name = libxl__strdup(NOGC, "json-bench");
+    libxl_uuid_generate(&c_info->uuid);
+
+    libxl_domain_build_info_init_type(b_info, LIBXL_DOMAIN_TYPE_PV);
+    b_info->max_vcpus = 4;
+    b_info->max_memkb = b_info->target_memkb = 1 << 20;
+    b_info->u.pv.kernel = libxl__strdup(NOGC, "/boot/vmlinuz");
+    b_info->u.pv.cmdline = libxl__strdup(NOGC, "root=/dev/xvda1 ro");
+
+    d_config->disks = libxl__calloc(NOGC, nr_devices,
+                                    sizeof(*d_config->disks));
+    d_config->nics = libxl__calloc(NOGC, nr_devices,
+                                   sizeof(*d_config->nics));
+    for (i = 0; i < nr_devices; i++) {
+        libxl_device_disk *disk = &d_config->disks[i];
+        libxl_device_nic *nic = &d_config->nics[i];
+
+        libxl_device_disk_init(disk);
+        disk->pdev_path = libxl__sprintf(NOGC, "/dev/vg0/json-bench-%d", i);
+        disk->vdev = libxl__sprintf(NOGC, "xvd%c%c",
+                                    'a' + i / 26 % 26, 'a' + i % 26);
+        disk->backend = LIBXL_DISK_BACKEND_PHY;
+        disk->format = LIBXL_DISK_FORMAT_RAW;
+        disk->readwrite = 1;
+        d_config->num_disks++;
+
+        libxl_device_nic_init(nic);
+        nic->devid = i;
+        nic->mac[0] = 0x00; nic->mac[1] = 0x16; nic->mac[2] = 0x3e;
+        nic->mac[3] = i >> 16; nic->mac[4] = i >> 8; nic->mac[5] = i;
+        nic->bridge = libxl__strdup(NOGC, "xenbr0");
+        nic->script = libxl__strdup(NOGC, "vif-bridge");
+        d_config->num_nics++;
+    }
+}
+
+int libxl_test_json(libxl_ctx *ctx, int nr_devices, int iterations,
+                    libxl_test_json_result *result)
+{
+    GC_INIT(ctx);
+    libxl_domain_config d_config, parsed;
+    libxl__json_buf jb;
+    struct timespec start;
+    char *json = NULL, *check;
+    int i, rc;
+
+    libxl_domain_config_init(&d_config);
+    libxl_domain_config_init(&parsed);
+    libxl__json_buf_init(&jb);
+
+    make_config(gc, &d_config, nr_devices);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        free(json);
+        json = gen_json_yajl(gc,
+                    (libxl__gen_json_callback)&libxl_domain_config_gen_json,
+                    &d_config);
+        if (!json) { rc = ERROR_FAIL; goto out; }
+    }
+    result->ns_gen_yajl = ns_since(&start, iterations);
+    check = json;
+    json = NULL;
+    libxl__ptr_add(gc, check);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        free(json);
+        json = libxl_domain_config_to_json(CTX, &d_config);
+        if (!json) { rc = ERROR_FAIL; goto out; }
+    }
+    result->ns_gen = ns_since(&start, iterations);
+    result->bytes = strlen(json);
+
+    if (strcmp(check, json)) {
+        LOG(ERROR, "JSON generated the old way differs");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        rc = libxl__object_to_json_buf(CTX, &jb, "libxl_domain_config",
+                    (libxl__gen_json_callback)&libxl_domain_config_gen_json,
+                    &d_config);
+        if (rc) goto out;
+    }
+    result->ns_gen_buf = ns_since(&start, iterations);
+
+    if (strcmp(jb.buf, json)) {
+        LOG(ERROR, "JSON generated into a buffer differs");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        libxl_domain_config_dispose(&parsed);
+        libxl_domain_config_init(&parsed);
+        rc = libxl__object_from_json(CTX, "libxl_domain_config",
+                    (libxl__json_parse_callback)&libxl__domain_config_parse_json,
+                    &parsed, json);
+        if (rc) goto out;
+    }
+    result->ns_parse_tree = ns_since(&start, iterations);
+
+    check = libxl_domain_config_to_json(CTX, &parsed);
+    libxl__ptr_add(gc, check);
+    if (!check || strcmp(check, json)) {
+        LOG(ERROR, "JSON does not survive parsing via a tree");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        libxl_domain_config_dispose(&parsed);
+        libxl_domain_config_init(&parsed);
+        rc = libxl_domain_config_from_json(CTX, &parsed, json);
+        if (rc) goto out;
+    }
+    result->ns_parse_sax = ns_since(&start, iterations);
+
+    check = libxl_domain_config_to_json(CTX, &parsed);
+    libxl__ptr_add(gc, check);
+    if (!check || strcmp(check, json)) {
+        LOG(ERROR, "JSON does not survive streaming parse");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    rc = 0;
+
+ out:
+    free(json);
+    libxl__json_buf_dispose(&jb);
+    libxl_domain_config_dispose(&parsed);
+    libxl_domain_config_dispose(&d_config);
+    GC_FREE;
+    return rc;
+}
@@ -0,0 +1,24 @@
+#ifndef TEST_JSON_H
+#define TEST_JSON_H
+
+#include <stdint.h>
+
+typedef struct {
+    size_t bytes;           /* of the JSON for the configuration */
+    uint64_t ns_gen_yajl;   /* copying out of yajl's buffer (the old way) */
+    uint64_t ns_gen;        /* libxl_domain_config_to_json */
+    uint64_t ns_gen_buf;    /* generating into a buffer kept across calls */
+    uint64_t ns_parse_tree; /* via a libxl__json_object tree */
+    uint64_t ns_parse_sax;  /* libxl_domain_config_from_json (streaming) */
+} libxl_test_json_result;
+
+int libxl_test_json(libxl_ctx *ctx, int nr_devices, int iterations,
+                    libxl_test_json_result *result)
+                    LIBXL_EXTERNAL_CALLERS_ONLY;
+/* Makes up a PV domain configuration with nr_devices disks and as many
+ * nics, and converts it to JSON and back iterations times each way,
+ * returning the average time each conversion took.  Returns ERROR_FAIL
+ * if the configuration parsed either way does not convert back to the
+ * same JSON. */
+
+#endif /*TEST_JSON_H*/
@@ -0,0 +1,103 @@
+/*
+ * NUMA placement benchmark
+ *
+ * To run this test:
+ *    ./test_numaplace [iterations]
+ * Success:
+ *    prints, for made-up hosts of increasing size, the time a placement
+ *    search takes and the nodes it picks, and exits 0
+ * Failure:
+ *    crash
+ *
+ * Nodes come in tiers: pairs of nodes share a socket, four make a board
+ * and sixteen a chassis, each tier further away than the one below.
+ * Free memory and the number of vcpus already on each node are random.
+ */
+
+#include "libxl_internal.h"
+
+#include "libxl_test_numaplace.h"
+
+/* Same heuristics as numa_cmpf() in libxl_dom.c */
+static int cmpf(const libxl__numa_candidate *c1,
+                const libxl__numa_candidate *c2)
+{
+    if (c1->nr_vcpus != c2->nr_vcpus)
+        return c1->nr_vcpus - c2->nr_vcpus;
+
+    return c2->free_memkb - c1->free_memkb;
+}
+
+static uint32_t distance(int i, int j)
+{
+    if (i == j) return 10;
+    if (i / 2 == j / 2) return 16;
+    if (i / 4 == j / 4) return 22;
+    if (i / 16 == j / 16) return 32;
+    return 40;
+}
+
+int libxl_test_numaplace(libxl_ctx *ctx, int nr_nodes, int cpus_per_node,
+                         int vcpus, uint32_t memkb, unsigned int seed,
+                         int iterations, libxl_bitmap *nodemap,
+                         uint64_t *ns_per_search)
+{
+    GC_INIT(ctx);
+    libxl__numa_candidate cndt;
+    libxl__numa_node_info *nodes;
+    libxl_numainfo *ninfo;
+    libxl_bitmap suitable;
+    struct timespec start, end;
+    int i, j, found = 0, rc;
+
+    libxl__numa_candidate_init(&cndt);
+    libxl_bitmap_init(&suitable);
+
+    GCNEW_ARRAY(nodes, nr_nodes);
+    GCNEW_ARRAY(ninfo, nr_nodes);
+    for (i = 0; i < nr_nodes; i++) {
+        nodes[i].nr_cpus = cpus_per_node;
+        nodes[i].nr_vcpus = rand_r(&seed) % (2 * cpus_per_node + 1);
+        nodes[i].free_memkb = (4 + rand_r(&seed) % 28) << 20;
+
+        ninfo[i].free = (uint64_t)nodes[i].free_memkb << 10;
+        ninfo[i].num_dists = nr_nodes;
+        GCNEW_ARRAY(ninfo[i].dists, nr_nodes);
+        for (j = 0; j < nr_nodes; j++)
+            ninfo[i].dists[j] = distance(i, j);
+    }
+
+    rc = libxl_bitmap_alloc(CTX, &suitable, nr_nodes);
+    if (rc) goto out;
+    libxl_bitmap_set_any(&suitable);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        libxl__numa_candidate_dispose(&cndt);
+        libxl__numa_candidate_init(&cndt);
+        rc = libxl__numa_candidate_search(gc, ninfo, nodes, nr_nodes,
+                                          &suitable, memkb, vcpus,
+                                          (vcpus + cpus_per_node - 1) /
+                                          cpus_per_node,
+                                          nr_nodes, cmpf, &cndt, &found);
+        if (rc) goto out;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (!found) {
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    *ns_per_search = ((end.tv_sec - start.tv_sec) * 1000000000ULL +
+                      end.tv_nsec - start.tv_nsec) / (iterations ?: 1);
+    rc = libxl_bitmap_alloc(CTX, nodemap, nr_nodes);
+    if (rc) goto out;
+    libxl_bitmap_copy(CTX, nodemap, &cndt.nodemap);
+
+ out:
+    libxl__numa_candidate_dispose(&cndt);
+    libxl_bitmap_dispose(&suitable);
+    GC_FREE;
+    return rc;
+}
@@ -0,0 +1,18 @@
+#ifndef TEST_NUMAPLACE_H
+#define TEST_NUMAPLACE_H
+
+#include <stdint.h>
+
+int libxl_test_numaplace(libxl_ctx *ctx, int nr_nodes, int cpus_per_node,
+                         int vcpus, uint32_t memkb, unsigned int seed,
+                         int iterations, libxl_bitmap *nodemap,
+                         uint64_t *ns_per_search)
+                         LIBXL_EXTERNAL_CALLERS_ONLY;
+/* Makes up a host with nr_nodes nodes of cpus_per_node cpus, some load on
+ * them and tiered node distances (the exact ones depending on seed), and
+ * runs the NUMA placement search for a guest with vcpus vcpus and memkb KB
+ * of memory on it, iterations times.  The chosen nodes are returned in
+ * nodemap (which is allocated by the call), and the average time a search
+ * took in ns_per_search.  Returns ERROR_FAIL if no candidate is found. */
+
+#endif /*TEST_NUMAPLACE_H*/
@@ -0,0 +1,299 @@
+/*
+ * QMP channel benchmark, with a fake device model
+ *
+ * To run this test:
+ *    ./test_qmp [max_commands [domid]]
+ * Success:
+ *    prints the time a QMP command takes, sent on a connection of its
+ *    own or down a libxl__ev_qmp channel, one at a time or pipelined,
+ *    and exits 0
+ * Failure:
+ *    crash
+ *
+ * The fake device model runs in a thread of its own and, like qemu,
+ * serves one client at a time.
+ */
+
+#include "libxl_internal.h"
+
+#include <pthread.h>
+#include <sys/un.h>
+
+#include "libxl_test_qmp.h"
+
+#define FAKE_QMP_BUFFER_SIZE 65536
+
+static const char fake_qmp_greeting[] =
+    "{\"QMP\": {\"version\": {\"qemu\": {\"micro\": 0, \"minor\": 5, "
+    "\"major\": 2}, \"package\": \"\"}, \"capabilities\": []}}\r\n";
+
+typedef struct {
+    char *path;
+    int listen_fd;
+    int stop[2]; /* written to when the server is to stop */
+    pthread_t thread;
+    char in[FAKE_QMP_BUFFER_SIZE], out[FAKE_QMP_BUFFER_SIZE];
+} fake_qmp;
+
+typedef struct {
+    libxl__ao *ao;
+    libxl__ev_qmp qmp;
+    fake_qmp server;
+    int nr_commands, to_send, outstanding;
+    bool pipelined;
+    struct timespec start;
+    uint64_t *ns_per_command;
+    int rc;
+} qmp_bench;
+
+/* Waits for fd to be readable; false if the server is to stop. */
+static bool fake_qmp_wait(fake_qmp *fq, int fd)
+{
+    struct pollfd pfd[2] = {
+        { .fd = fd, .events = POLLIN },
+        { .fd = fq->stop[0], .events = POLLIN },
+    };
+
+    while (poll(pfd, 2, -1) < 0) {
+        if (errno != EINTR)
+            return false;
+    }
+    return !pfd[1].revents;
+}
+
+static bool fake_qmp_write(int fd, const char *buf, size_t len)
+{
+    ssize_t r;
+
+    while (len) {
+        r = write(fd, buf, len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        buf += r;
+        len -= r;
+    }
+    return true;
+}
+
+/* Answers each command received on fd, until the client goes away. */
+static void fake_qmp_serve(fake_qmp *fq, int fd)
+{
+    size_t used = 0, outlen;
+    char *s, *end, *id;
+    ssize_t r;
+
+    if (!fake_qmp_write(fd, fake_qmp_greeting, strlen(fake_qmp_greeting)))
+        return;
+
+    while (used < sizeof(fq->in) - 1 && fake_qmp_wait(fq, fd)) {
+        r = read(fd, fq->in + used, sizeof(fq->in) - 1 - used);
+        if (r <= 0)
+            return;
+        used += r;
+        fq->in[used] = 0;
+
+        outlen = 0;
+        for (s = fq->in; (end = strstr(s, "\r\n")); s = end + 2) {
+            *end = 0;
+            id = strstr(s, "\"id\"");
+            if (id)
+                id += 4 + strspn(id + 4, ": \t\n");
+            outlen += snprintf(fq->out + outlen, sizeof(fq->out) - outlen,
+                               "{\"return\": {}, \"id\": %ld}\r\n",
+                               id ? strtol(id, NULL, 10) : 0L);
+            if (outlen >= sizeof(fq->out) - 64) {
+                if (!fake_qmp_write(fd, fq->out, outlen))
+                    return;
+                outlen = 0;
+            }
+        }
+        used -= s - fq->in;
+        memmove(fq->in, s, used);
+
+        if (!fake_qmp_write(fd, fq->out, outlen))
+            return;
+    }
+}
+
+static void *fake_qmp_thread(void *opaque)
+{
+    fake_qmp *fq = opaque;
+    int fd;
+
+    while (fake_qmp_wait(fq, fq->listen_fd)) {
+        fd = accept(fq->listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        fake_qmp_serve(fq, fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static int fake_qmp_start(libxl__gc *gc, fake_qmp *fq, uint32_t domid)
+{
+    struct sockaddr_un addr;
+    int rc;
+
+    fq->listen_fd = -1;
+    fq->stop[0] = fq->stop[1] = -1;
+    fq->path = GCSPRINTF("%s/qmp-libxl-%d", libxl__run_dir_path(), domid);
+
+    if (!access(fq->path, F_OK)) {
+        LOG(ERROR, "%s exists; domain %u must not be a real one",
+            fq->path, domid);
+        return ERROR_FAIL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, fq->path, sizeof(addr.sun_path) - 1);
+
+    fq->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fq->listen_fd < 0 ||
+        bind(fq->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(fq->listen_fd, 1)) {
+        LOGE(ERROR, "cannot listen on %s", fq->path);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    if (pipe(fq->stop)) {
+        LOGE(ERROR, "pipe failed");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    if (pthread_create(&fq->thread, NULL, fake_qmp_thread, fq)) {
+        LOG(ERROR, "cannot start fake QMP server");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    return 0;
+
+ out:
+    libxl__pipe_close(fq->stop);
+    if (fq->listen_fd >= 0) {
+        close(fq->listen_fd);
+        unlink(fq->path);
+    }
+    return rc;
+}
+
+static void fake_qmp_stop(libxl__gc *gc, fake_qmp *fq)
+{
+    static const char byte = 0;
+
+    if (write(fq->stop[1], &byte, 1) != 1)
+        LOGE(ERROR, "cannot stop fake QMP server");
+    pthread_join(fq->thread, NULL);
+    libxl__pipe_close(fq->stop);
+    close(fq->listen_fd);
+    unlink(fq->path);
+}
+
+static uint64_t ns_since(const struct timespec *start, int n)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start->tv_sec) * 1000000000ULL +
+            end.tv_nsec - start->tv_nsec) / n;
+}
+
+static void bench_complete(libxl__egc *egc, qmp_bench *qb)
+{
+    STATE_AO_GC(qb->ao);
+
+    *qb->ns_per_command = ns_since(&qb->start, qb->nr_commands);
+    libxl__ev_qmp_dispose(gc, &qb->qmp);
+    fake_qmp_stop(gc, &qb->server);
+    libxl__ao_complete(egc, ao, qb->rc);
+}
+
+static void bench_reply(libxl__egc *egc, libxl__ev_qmp *ev,
+                        const libxl__json_object *response,
+                        void *unused, int rc);
+
+static void bench_send(libxl__egc *egc, qmp_bench *qb)
+{
+    int n = qb->pipelined ? qb->to_send : 1;
+    int rc;
+
+    while (n--) {
+        rc = libxl__ev_qmp_send(&qb->qmp, "system_wakeup", NULL,
+                                bench_reply, NULL);
+        if (rc) {
+            qb->rc = rc;
+            qb->to_send = 0;
+            break;
+        }
+        qb->to_send--;
+        qb->outstanding++;
+    }
+
+    if (!qb->outstanding)
+        bench_complete(egc, qb);
+}
+
+static void bench_reply(libxl__egc *egc, libxl__ev_qmp *ev,
+                        const libxl__json_object *response,
+                        void *unused, int rc)
+{
+    qmp_bench *qb = CONTAINER_OF(ev, *qb, qmp);
+
+    qb->outstanding--;
+    if (rc && !qb->rc) {
+        qb->rc = rc;
+        qb->to_send = 0;
+    }
+
+    if (qb->to_send)
+        bench_send(egc, qb);
+    else if (!qb->outstanding)
+        bench_complete(egc, qb);
+}
+
+int libxl_test_qmp(libxl_ctx *ctx, uint32_t domid, int nr_commands, int how,
+                   uint64_t *ns_per_command, libxl_asyncop_how *ao_how)
+{
+    AO_CREATE(ctx, 0, ao_how);
+    qmp_bench *qb;
+    int i, rc;
+
+    GCNEW(qb);
+    qb->ao = ao;
+    qb->nr_commands = nr_commands;
+    qb->to_send = nr_commands;
+    qb->pipelined = how == LIBXL_TEST_QMP_PIPELINED;
+    qb->ns_per_command = ns_per_command;
+    libxl__ev_qmp_init(&qb->qmp);
+    qb->qmp.ao = ao;
+    qb->qmp.domid = domid;
+
+    rc = fake_qmp_start(gc, &qb->server, domid);
+    if (rc) goto out;
+
+    clock_gettime(CLOCK_MONOTONIC, &qb->start);
+
+    if (how == LIBXL_TEST_QMP_CONNECT_EACH) {
+        for (i = 0; i < nr_commands; i++) {
+            if (libxl__qmp_system_wakeup(gc, domid)) {
+                qb->rc = ERROR_FAIL;
+                break;
+            }
+        }
+        bench_complete(egc, qb);
+    } else {
+        bench_send(egc, qb);
+    }
+
+    return AO_INPROGRESS;
+
+ out:
+    return AO_CREATE_FAIL(rc);
+}
@@ -0,0 +1,19 @@
+#ifndef TEST_QMP_H
+#define TEST_QMP_H
+
+#include <stdint.h>
+
+#define LIBXL_TEST_QMP_CONNECT_EACH 0 /* as libxl__qmp_system_wakeup etc. */
+#define LIBXL_TEST_QMP_ONE_BY_ONE   1 /* libxl__ev_qmp, awaiting each reply */
+#define LIBXL_TEST_QMP_PIPELINED    2 /* libxl__ev_qmp, all sent at once */
+
+int libxl_test_qmp(libxl_ctx *ctx, uint32_t domid, int nr_commands, int how,
+                   uint64_t *ns_per_command, libxl_asyncop_how *ao_how)
+                   LIBXL_EXTERNAL_CALLERS_ONLY;
+/* Serves QMP on domid's libxl QMP socket with a fake device model,
+ * which answers every command with an empty return, and sends it
+ * nr_commands commands in the manner given by how.  domid must not be
+ * a real domain; ERROR_FAIL if its QMP socket already exists.  The
+ * average time a command took is returned in ns_per_command. */
+
+#endif /*TEST_QMP_H*/
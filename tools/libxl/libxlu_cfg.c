@@ -36,6 +36,9 @@ XLU_Config *xlu_cfg_init(FILE *report, const char *report_source) {
     if (!cfg->config_source) { free(cfg); return 0; }
 
     cfg->settings= 0;
+    cfg->index= 0;
+    cfg->nbuckets= cfg->nindexed= 0;
+    cfg->chunks= 0;
     return cfg;
 }
 
@@ -131,8 +134,87 @@ int xlu_cfg_readdata(XLU_Config *cfg, const char *data, int length) {
     return ctx.err;
 }
 
+#define CHUNK_SIZE 16384
+
+static void *chunk_alloc(XLU_Config *cfg, size_t sz) {
+    /* Returns 0 with errno set on failure. */
+    XLU_ConfigChunk *chunk= cfg->chunks;
+    void *p;
+
+    sz= (sz + sizeof(chunk->data[0]) - 1) & ~(sizeof(chunk->data[0]) - 1);
+
+    if (!chunk || chunk->size - chunk->used < sz) {
+        size_t size= sz > CHUNK_SIZE ? sz : CHUNK_SIZE;
+
+        chunk= malloc(sizeof(*chunk) + size);
+        if (!chunk) return 0;
+        chunk->used= 0;
+        chunk->size= size;
+
+        if (size > CHUNK_SIZE && cfg->chunks) {
+            /* a big one-off; keep filling the current chunk */
+            chunk->next= cfg->chunks->next;
+            cfg->chunks->next= chunk;
+        } else {
+            chunk->next= cfg->chunks;
+            cfg->chunks= chunk;
+        }
+    }
+
+    p= (char*)chunk->data + chunk->used;
+    chunk->used += sz;
+    return p;
+}
+
+static unsigned name_hash(const char *n) {
+    unsigned h= 5381;
+    while (*n) h= h*33 + (unsigned char)*n++;
+    return h;
+}
+
+static XLU_ConfigSetting **index_slot(const XLU_Config *cfg,
+                                      const char *n, unsigned hash) {
+    /* Returns the link to the setting called n, or the null link
+     * at the end of the bucket if there is none. */
+    XLU_ConfigSetting **slot;
+
+    for (slot= &cfg->index[hash & (cfg->nbuckets-1)];
+         *slot;
+         slot= &(*slot)->hash_next)
+        if ((*slot)->hash == hash && !strcmp((*slot)->name, n))
+            break;
+    return slot;
+}
+
+static int index_grow(XLU_Config *cfg) {
+    XLU_ConfigSetting **old= cfg->index, *set, *set_next;
+    int i, old_nbuckets= cfg->nbuckets;
+
+    if (cfg->nbuckets > INT_MAX / 2 / (int)sizeof(*cfg->index))
+        return ERANGE;
+    cfg->nbuckets= old_nbuckets ? old_nbuckets * 2 : 64;
+    cfg->index= calloc(cfg->nbuckets, sizeof(*cfg->index));
+    if (!cfg->index) {
+        cfg->index= old;
+        cfg->nbuckets= old_nbuckets;
+        return errno;
+    }
+
+    /* The names in the index are distinct, so order does not matter. */
+    for (i= 0; i < old_nbuckets; i++) {
+        for (set= old[i]; set; set= set_next) {
+            set_next= set->hash_next;
+            set->hash_next= cfg->index[set->hash & (cfg->nbuckets-1)];
+            cfg->index[set->hash & (cfg->nbuckets-1)]= set;
+        }
+    }
+    free(old);
+    return 0;
+}
+
 void xlu__cfg_value_free(XLU_ConfigValue *value)
 {
+    /* Only the strings; the rest goes with the chunks. */
     int i;
 
     if (!value) return;
@@ -144,41 +226,38 @@ void xlu__cfg_value_free(XLU_ConfigValue *value)
     case XLU_LIST:
         for (i = 0; i < value->u.list.nvalues; i++)
             xlu__cfg_value_free(value->u.list.values[i]);
-        free(value->u.list.values);
     }
-    free(value);
 }
 
 void xlu__cfg_set_free(XLU_ConfigSetting *set) {
     if (!set) return;
     free(set->name);
     xlu__cfg_value_free(set->value);
-    free(set);
 }
 
 void xlu_cfg_destroy(XLU_Config *cfg) {
-    XLU_ConfigSetting *set, *set_next;
+    XLU_ConfigSetting *set;
+    XLU_ConfigChunk *chunk, *chunk_next;
 
     if (!cfg) return;
     for (set= cfg->settings;
          set;
-         set= set_next) {
-        set_next= set->next;
+         set= set->next)
         xlu__cfg_set_free(set);
+    for (chunk= cfg->chunks;
+         chunk;
+         chunk= chunk_next) {
+        chunk_next= chunk->next;
+        free(chunk);
     }
+    free(cfg->index);
     free(cfg->config_source);
     free(cfg);
 }
 
 static XLU_ConfigSetting *find(const XLU_Config *cfg, const char *n) {
-    XLU_ConfigSetting *set;
-
-    for (set= cfg->settings;
-         set;
-         set= set->next)
-        if (!strcmp(set->name, n))
-            return set;
-    return 0;
+    if (!cfg->nindexed) return 0;
+    return *index_slot(cfg, n, name_hash(n));
 }
 
 static int find_atom(const XLU_Config *cfg, const char *n,
@@ -366,7 +445,7 @@ XLU_ConfigValue *xlu__cfg_string_mk(CfgParseContext *ctx, char *atom,
 
     if (ctx->err) goto x;
 
-    value = malloc(sizeof(*value));
+    value = chunk_alloc(ctx->cfg, sizeof(*value));
     if (!value) goto xe;
     value->type = XLU_STRING;
     value->u.string = atom;
@@ -377,7 +456,6 @@ XLU_ConfigValue *xlu__cfg_string_mk(CfgParseContext *ctx, char *atom,
  xe:
     ctx->err= errno;
  x:
-    free(value);
     free(atom);
     return NULL;
 }
@@ -386,16 +464,16 @@ XLU_ConfigValue *xlu__cfg_list_mk(CfgParseContext *ctx,
                                   XLU_ConfigValue *val,
                                   YYLTYPE *loc)
 {
-    XLU_ConfigValue *value = NULL;
-    XLU_ConfigValue **values = NULL;
+    XLU_ConfigValue *value;
+    XLU_ConfigValue **values;
 
     if (ctx->err) goto x;
 
-    values = malloc(sizeof(*values));
+    values = chunk_alloc(ctx->cfg, sizeof(*values));
     if (!values) goto xe;
     values[0] = val;
 
-    value = malloc(sizeof(*value));
+    value = chunk_alloc(ctx->cfg, sizeof(*value));
     if (!value) goto xe;
     value->type = XLU_LIST;
     value->u.list.nvalues = !!val;
@@ -408,8 +486,6 @@ XLU_ConfigValue *xlu__cfg_list_mk(CfgParseContext *ctx,
  xe:
     ctx->err= errno;
  x:
-    free(value);
-    free(values);
     xlu__cfg_value_free(val);
     return NULL;
 }
@@ -433,14 +509,18 @@ void xlu__cfg_list_append(CfgParseContext *ctx,
             return;
         }
 
+        /* The old array stays in its chunk; with growth by 4 that
+         * wastes at most a third of the final size. */
         new_avalues = list->u.list.avalues * 4;
-        new_values  = realloc(list->u.list.values,
-                              sizeof(*new_values) * new_avalues);
+        new_values  = chunk_alloc(ctx->cfg,
+                                  sizeof(*new_values) * new_avalues);
         if (!new_values) {
             ctx->err = errno;
             xlu__cfg_value_free(val);
             return;
         }
+        memcpy(new_values, list->u.list.values,
+               sizeof(*new_values) * list->u.list.nvalues);
 
         list->u.list.avalues = new_avalues;
         list->u.list.values  = new_values;
@@ -452,21 +532,43 @@ void xlu__cfg_list_append(CfgParseContext *ctx,
 
 void xlu__cfg_set_store(CfgParseContext *ctx, char *name,
                         XLU_ConfigValue *val, int lineno) {
-    XLU_ConfigSetting *set;
+    XLU_Config *cfg= ctx->cfg;
+    XLU_ConfigSetting *set, **slot;
+    int e;
 
     if (ctx->err) return;
 
     assert(name);
-    set = malloc(sizeof(*set));
+    if (cfg->nindexed >= cfg->nbuckets) {
+        e= index_grow(cfg);
+        if (e) { ctx->err= e; goto x; }
+    }
+    set = chunk_alloc(cfg, sizeof(*set));
     if (!set) {
         ctx->err = errno;
-        return;
+        goto x;
     }
     set->name= name;
     set->value = val;
     set->lineno= lineno;
-    set->next= ctx->cfg->settings;
-    ctx->cfg->settings= set;
+    set->hash= name_hash(name);
+    set->next= cfg->settings;
+    cfg->settings= set;
+
+    /* A later assignment hides any earlier one of the same name. */
+    slot= index_slot(cfg, name, set->hash);
+    if (*slot) {
+        set->hash_next= (*slot)->hash_next;
+    } else {
+        set->hash_next= 0;
+        cfg->nindexed++;
+    }
+    *slot= set;
+    return;
+
+ x:
+    free(name);
+    xlu__cfg_value_free(val);
 }
 
 char *xlu__cfgl_strdup(CfgParseContext *ctx, const char *src) {
@@ -51,13 +51,29 @@ struct XLU_ConfigValue {
 
 typedef struct XLU_ConfigSetting { /* transparent */
     struct XLU_ConfigSetting *next;
+    struct XLU_ConfigSetting *hash_next; /* only if latest of its name */
     char *name;
     XLU_ConfigValue *value;
     int lineno;
+    unsigned hash;
 } XLU_ConfigSetting;
 
+/*
+ * Values, settings and list arrays are carved out of chunks which are
+ * only freed, all together, by xlu_cfg_destroy.  Strings are malloc'd
+ * since they are made by the lexer and may be freed by the parser.
+ */
+typedef struct XLU_ConfigChunk {
+    struct XLU_ConfigChunk *next;
+    size_t used, size;
+    union { long long ll; double d; void *p; } data[];
+} XLU_ConfigChunk;
+
 struct XLU_Config {
-    XLU_ConfigSetting *settings;
+    XLU_ConfigSetting *settings; /* latest first */
+    XLU_ConfigSetting **index;   /* hash buckets, latest of each name only */
+    int nbuckets, nindexed;
+    XLU_ConfigChunk *chunks;
     FILE *report;
     char *config_source;
 };
@@ -0,0 +1,148 @@
+/*
+ * Parse throughput of libxlutil config files: a config with n disks,
+ * n vifs and n further top-level settings is parsed, and every
+ * setting and list item is looked up once, as xl would.
+ */
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "test_common.h"
+#include "libxlutil.h"
+
+static char *buf;
+static size_t buf_used, buf_size;
+
+static void buf_printf(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+
+static void buf_printf(const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    for (;;) {
+        va_start(ap, fmt);
+        len = vsnprintf(buf + buf_used, buf_size - buf_used, fmt, ap);
+        va_end(ap);
+        assert(len >= 0);
+        if (buf_used + len < buf_size)
+            break;
+        buf_size = (buf_size + len) * 2;
+        buf = realloc(buf, buf_size);
+        assert(buf);
+    }
+    buf_used += len;
+}
+
+static void make_config(int n)
+{
+    int i;
+
+    buf_used = 0;
+    buf_printf("name = \"bench%d\"\nmemory = 1024\n", n);
+
+    buf_printf("disk = [\n");
+    for (i = 0; i < n; i++)
+        buf_printf("  'phy:/dev/vg/disk%d,xvd%d,w',\n", i, i);
+    buf_printf("]\n");
+
+    buf_printf("vif = [\n");
+    for (i = 0; i < n; i++)
+        buf_printf("  'mac=00:16:3e:00:%02x:%02x,bridge=xenbr0',\n",
+                   (i >> 8) & 0xff, i & 0xff);
+    buf_printf("]\n");
+
+    for (i = 0; i < n; i++)
+        buf_printf("setting_%d = %d\n", i, i);
+}
+
+static unsigned long long ns_since(const struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1000000000ULL
+        + end.tv_nsec - start->tv_nsec;
+}
+
+static void lookup_all(XLU_Config *cfg, int n)
+{
+    XLU_ConfigList *list;
+    const char *item;
+    char name[32];
+    long l;
+    int i, nitems, e;
+
+    e = xlu_cfg_get_long(cfg, "memory", &l, 0);
+    assert(!e && l == 1024);
+
+    e = xlu_cfg_get_list(cfg, "disk", &list, &nitems, 0);
+    assert(!e && nitems == n);
+    for (i = 0; i < nitems; i++) {
+        item = xlu_cfg_get_listitem(list, i);
+        assert(item);
+    }
+
+    e = xlu_cfg_get_list(cfg, "vif", &list, &nitems, 0);
+    assert(!e && nitems == n);
+    for (i = 0; i < nitems; i++) {
+        item = xlu_cfg_get_listitem(list, i);
+        assert(item);
+    }
+
+    for (i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "setting_%d", i);
+        e = xlu_cfg_get_long(cfg, name, &l, 0);
+        assert(!e && l == i);
+    }
+
+    e = xlu_cfg_get_long(cfg, "not_there", &l, 1);
+    assert(e == ESRCH);
+}
+
+int main(int argc, char **argv)
+{
+    int max_entries = argc > 1 ? atoi(argv[1]) : 16384;
+    int iterations = argc > 2 ? atoi(argv[2]) : 20;
+    unsigned long long ns_parse, ns_lookup;
+    struct timespec start;
+    XLU_Config *cfg;
+    int n, it, e;
+
+    printf("%8s %10s %11s %11s %11s\n", "entries", "bytes",
+           "parse us", "lookup us", "MB/s");
+
+    n = 1;
+    do {
+        make_config(n);
+        ns_parse = ns_lookup = 0;
+
+        for (it = 0; it < iterations; it++) {
+            cfg = xlu_cfg_init(stderr, "test_cfgparse");
+            assert(cfg);
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            e = xlu_cfg_readdata(cfg, buf, buf_used);
+            ns_parse += ns_since(&start);
+            assert(!e);
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            lookup_all(cfg, n);
+            ns_lookup += ns_since(&start);
+
+            xlu_cfg_destroy(cfg);
+        }
+
+        printf("%8d %10zu %11.1f %11.1f %11.1f\n", n, buf_used,
+               ns_parse / 1e3 / iterations, ns_lookup / 1e3 / iterations,
+               ns_parse ? buf_used * 1e3 * iterations / ns_parse : 0.0);
+    } while (test_common_next_size(&n, 4, max_entries));
+
+    free(buf);
+    return 0;
+}
@@ -55,3 +55,14 @@ void test_common_afterpoll(void)
     test_common_get_now();
     libxl_osevent_afterpoll(ctx, poll_nfds, poll_fds, now);
 }
+
+bool test_common_next_size(int *n, int factor, int max)
+{
+    if (*n >= max)
+        return false;
+
+    *n = *n ? *n * factor : factor;
+    if (*n > max)
+        *n = max;
+    return true;
+}
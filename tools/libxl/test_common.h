@@ -26,4 +26,9 @@ extern int poll_nfds, poll_nfds_allocd;
 extern struct pollfd *poll_fds;
 extern int poll_timeout;
 
+/* For benchmarks run at growing sizes: moves *n on to *n * factor (or
+ * to factor from 0), but no further than max.  Returns false, leaving *n
+ * alone, once *n has reached max. */
+bool test_common_next_size(int *n, int factor, int max);
+
 #endif /*TEST_COMMON_H*/
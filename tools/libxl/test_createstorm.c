@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "test_common.h"
+#include "libxl_test_createstorm.h"
+
+/* bootloader, build, devices, device model */
+static const int phase_ms[LIBXL_TEST_CREATESTORM_PHASES] = { 50, 10, 100, 150 };
+
+static double storm(int nr_domains, int batch,
+                    const libxl_domain_create_limits *limits,
+                    int peak[LIBXL_TEST_CREATESTORM_PHASES])
+{
+    struct timeval start, end;
+    int i, p, rc;
+
+    gettimeofday(&start, NULL);
+    if (batch) {
+        rc = libxl_test_createstorm(ctx, nr_domains, limits, phase_ms,
+                                    peak, 0);
+        assert(!rc);
+    } else {
+        /* What forking one xl per domain, one at a time, amounts to. */
+        for (i = 0; i < nr_domains; i++) {
+            rc = libxl_test_createstorm(ctx, 1, limits, phase_ms, peak, 0);
+            assert(!rc);
+        }
+    }
+    gettimeofday(&end, NULL);
+
+    for (p = 0; p < LIBXL_TEST_CREATESTORM_PHASES; p++) {
+        const int limit[] = { limits->bootloader, limits->build,
+                              limits->devices, limits->device_model };
+        assert(!limit[p] || peak[p] <= limit[p]);
+    }
+
+    return (end.tv_sec - start.tv_sec) +
+           (end.tv_usec - start.tv_usec) / 1e6;
+}
+
+int main(int argc, char **argv) {
+    static const libxl_domain_create_limits limits[] = {
+        { 0, 0, 0, 0 },
+        { 1, 1, 1, 1 },
+        { 4, 1, 8, 4 },
+        { 16, 1, 16, 16 },
+    };
+    int nr_domains = argc > 1 ? atoi(argv[1]) : 32;
+    int peak[LIBXL_TEST_CREATESTORM_PHASES];
+    int i, nr_serial = nr_domains < 8 ? nr_domains : 8;
+    double t;
+
+    test_common_setup(XTL_PROGRESS);
+
+    printf("phases (ms): bootloader %d, build %d, devices %d,"
+           " device model %d\n",
+           phase_ms[0], phase_ms[1], phase_ms[2], phase_ms[3]);
+    printf("%-10s %-16s %10s %12s  %s\n", "mode", "limits", "domains",
+           "secs/domain", "peak per phase");
+
+    t = storm(nr_serial, 0, &limits[0], peak);
+    printf("%-10s %-16s %10d %12.3f\n", "serial", "-", nr_serial,
+           t / nr_serial);
+
+    for (i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+        char lim[32];
+
+        snprintf(lim, sizeof(lim), "%d/%d/%d/%d",
+                 limits[i].bootloader, limits[i].build,
+                 limits[i].devices, limits[i].device_model);
+        t = storm(nr_domains, 1, &limits[i], peak);
+        printf("%-10s %-16s %10d %12.3f  %d/%d/%d/%d\n", "batch", lim,
+               nr_domains, t / nr_domains, peak[0], peak[1], peak[2],
+               peak[3]);
+    }
+
+    libxl_ctx_free(ctx);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "test_common.h"
+#include "libxl_test_evloop.h"
+
+static xentoollog_logger *logger;
+
+static double evloop(int force_poll, int nr_fds, int nr_timers, int hops)
+{
+    struct timeval start, end;
+    libxl_ctx *evctx;
+    int rc;
+
+    /* The choice of poller is made when the ctx is allocated. */
+    if (force_poll)
+        setenv("LIBXL_EVENT_FORCE_POLL", "1", 1);
+    else
+        unsetenv("LIBXL_EVENT_FORCE_POLL");
+
+    rc = libxl_ctx_alloc(&evctx, LIBXL_VERSION, 0, logger);
+    assert(!rc);
+
+    gettimeofday(&start, NULL);
+    rc = libxl_test_evloop(evctx, nr_fds, nr_timers, hops, 0);
+    assert(!rc);
+    gettimeofday(&end, NULL);
+
+    libxl_ctx_free(evctx);
+
+    return ((end.tv_sec - start.tv_sec) * 1e6 +
+            (end.tv_usec - start.tv_usec)) / hops;
+}
+
+int main(int argc, char **argv)
+{
+    int max_fds = argc > 1 ? atoi(argv[1]) : 400;
+    int max_timers = argc > 2 ? atoi(argv[2]) : 10000;
+    int hops = argc > 3 ? atoi(argv[3]) : 20000;
+    int nr_fds, nr_timers;
+
+    logger = (xentoollog_logger*)
+        xtl_createlogger_stdiostream(stderr, XTL_PROGRESS, 0);
+    assert(logger);
+
+    printf("%8s %8s %14s %14s\n", "fds", "timers", "poll us/iter",
+           "fdset us/iter");
+
+    nr_fds = 1;
+    do {
+        nr_timers = 0;
+        do {
+            printf("%8d %8d %14.2f %14.2f\n", nr_fds, nr_timers,
+                   evloop(1, nr_fds, nr_timers, hops),
+                   evloop(0, nr_fds, nr_timers, hops));
+        } while (test_common_next_size(&nr_timers, 10, max_timers));
+    } while (test_common_next_size(&nr_fds, 4, max_fds));
+
+    return 0;
+}
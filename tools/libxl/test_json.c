@@ -0,0 +1,30 @@
+#include <stdio.h>
+
+#include "test_common.h"
+#include "libxl_test_json.h"
+
+int main(int argc, char **argv)
+{
+    int max_devices = argc > 1 ? atoi(argv[1]) : 1024;
+    int iterations = argc > 2 ? atoi(argv[2]) : 200;
+    libxl_test_json_result r;
+    int nr_devices, rc;
+
+    test_common_setup(XTL_PROGRESS);
+
+    printf("%8s %9s %11s %11s %11s %11s %11s\n", "devices", "bytes",
+           "yajlgen us", "gen us", "genbuf us", "tree us", "stream us");
+
+    nr_devices = 1;
+    do {
+        rc = libxl_test_json(ctx, nr_devices, iterations, &r);
+        assert(!rc);
+
+        printf("%8d %9zu %11.1f %11.1f %11.1f %11.1f %11.1f\n",
+               nr_devices, r.bytes, r.ns_gen_yajl / 1e3,
+               r.ns_gen / 1e3, r.ns_gen_buf / 1e3,
+               r.ns_parse_tree / 1e3, r.ns_parse_sax / 1e3);
+    } while (test_common_next_size(&nr_devices, 4, max_devices));
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+#include <inttypes.h>
+
+#include "test_common.h"
+#include "libxl_utils.h"
+#include "libxl_test_numaplace.h"
+
+int main(int argc, char **argv) {
+    static const int sizes[] = { 2, 4, 8, 16, 32, 64, 128 };
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+    int cpus_per_node = 8;
+    int i, n, rc;
+
+    test_common_setup(XTL_PROGRESS);
+
+    printf("%6s %8s %12s  %s\n", "nodes", "vcpus", "ns/search", "nodes picked");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        /* A guest needing a node and a half, and one needing four. */
+        int vcpus[] = { cpus_per_node * 3 / 2, cpus_per_node * 4 }, v;
+
+        for (v = 0; v < 2; v++) {
+            libxl_bitmap nodemap;
+            uint64_t ns;
+
+            if (vcpus[v] > sizes[i] * cpus_per_node)
+                continue;
+
+            libxl_bitmap_init(&nodemap);
+            rc = libxl_test_numaplace(ctx, sizes[i], cpus_per_node, vcpus[v],
+                                      vcpus[v] << 20, 42, iterations,
+                                      &nodemap, &ns);
+            assert(!rc);
+            assert(libxl_bitmap_count_set(&nodemap) * cpus_per_node
+                   >= vcpus[v]);
+
+            printf("%6d %8d %12"PRIu64" ", sizes[i], vcpus[v], ns);
+            libxl_for_each_set_bit(n, nodemap)
+                printf(" %d", n);
+            printf("\n");
+            libxl_bitmap_dispose(&nodemap);
+        }
+    }
+
+    libxl_ctx_free(ctx);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#include <stdio.h>
+
+#include "test_common.h"
+#include "libxl_test_qmp.h"
+
+int main(int argc, char **argv)
+{
+    int max_commands = argc > 1 ? atoi(argv[1]) : 1000;
+    /* Just below DOMID_FIRST_RESERVED, so unlikely to be in use. */
+    uint32_t domid = argc > 2 ? atoi(argv[2]) : 0x7fef;
+    static const int hows[] = {
+        LIBXL_TEST_QMP_CONNECT_EACH,
+        LIBXL_TEST_QMP_ONE_BY_ONE,
+        LIBXL_TEST_QMP_PIPELINED,
+    };
+    uint64_t ns[3];
+    int nr_commands, i, rc;
+
+    test_common_setup(XTL_PROGRESS);
+
+    printf("%9s %16s %16s %16s\n", "commands", "connect us/cmd",
+           "one-by-one us/cmd", "pipelined us/cmd");
+
+    nr_commands = 1;
+    do {
+        for (i = 0; i < 3; i++) {
+            rc = libxl_test_qmp(ctx, domid, nr_commands, hows[i], &ns[i], 0);
+            assert(!rc);
+        }
+
+        printf("%9d %16.1f %16.1f %16.1f\n", nr_commands,
+               ns[0] / 1e3, ns[1] / 1e3, ns[2] / 1e3);
+    } while (test_common_next_size(&nr_commands, 10, max_commands));
+
+    return 0;
+}
@@ -0,0 +1,480 @@
+/*
+ * xen-dedupd: background page deduplication for HAP guests.
+ *
+ * Guest memory is scanned through read-only foreign mappings at a bounded
+ * rate, and pages are indexed by a hash of their contents.  Pages whose
+ * hash matches an indexed page are nominated for sharing together with it,
+ * a batch at a time.
+ * Nomination makes both pages copy-on-write, so comparing them afterwards
+ * can't miss a guest write.  Pages that really are identical are then
+ * shared in batches, and the hypervisor frees the duplicate.
+ *
+ * The daemon does not listen on the sharing ENOMEM ring, so the host must
+ * keep enough free memory for guests to unshare pages when they write to
+ * them.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xenctrl.h>
+
+#define PAGE_SIZE       4096
+/* Pages mapped and hashed in one go. */
+#define SCAN_CHUNK      256
+/* Slots looked at before an index insertion evicts an existing entry. */
+#define INDEX_PROBE     8
+
+struct index_entry {
+    uint64_t hash;              /* 0 means the slot is free */
+    uint64_t gfn;
+    domid_t  domid;
+};
+
+struct candidate {
+    struct index_entry *src;    /* indexed copy, becomes the shared page */
+    domid_t  domid;             /* newly scanned copy, gets freed */
+    uint64_t gfn;
+};
+
+static xc_interface *xch;
+static struct index_entry *index_tbl;
+static unsigned long index_mask;
+
+static unsigned long rate = 25600;      /* pages per second */
+static unsigned int interval = 60;      /* seconds between passes */
+static unsigned int passes;             /* 0 for no limit */
+static bool verbose;
+
+static struct {
+    unsigned long scanned, candidates, shared, differ, failed;
+} stats;
+
+static volatile sig_atomic_t stop;
+
+static void handle_signal(int sig)
+{
+    stop = 1;
+}
+
+static uint64_t hash_page(const void *page)
+{
+    const uint64_t *p = page;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); i++ )
+    {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    /* Keep 0 free to mark empty index slots. */
+    return h ?: 1;
+}
+
+/*
+ * Find the entry for a hash, or claim a slot for it.  The index is lossy:
+ * when a probe sequence is full, the first slot is evicted, which only
+ * costs a missed sharing opportunity.
+ */
+static struct index_entry *index_lookup(uint64_t hash, bool *found)
+{
+    unsigned long i, slot = hash & index_mask;
+
+    for ( i = 0; i < INDEX_PROBE; i++ )
+    {
+        struct index_entry *e = &index_tbl[(slot + i) & index_mask];
+
+        if ( e->hash == hash )
+        {
+            *found = true;
+            return e;
+        }
+        if ( !e->hash )
+        {
+            *found = false;
+            return e;
+        }
+    }
+
+    *found = false;
+    return &index_tbl[slot];
+}
+
+static void index_set(struct index_entry *e, uint64_t hash,
+                      domid_t domid, uint64_t gfn)
+{
+    e->hash = hash;
+    e->domid = domid;
+    e->gfn = gfn;
+}
+
+/* Map one page of each (domid, gfn) read-only.  Returns NULL on failure. */
+static void *map_pages(domid_t domid, const xen_pfn_t *gfns, int *err,
+                       unsigned int nr)
+{
+    return xc_map_foreign_bulk(xch, domid, PROT_READ, gfns, err, nr);
+}
+
+static int cmp_candidate(const void *a, const void *b)
+{
+    const struct candidate *x = a, *y = b;
+
+    return (int)x->src->domid - (int)y->src->domid;
+}
+
+/* Drop entry i of the batch being built, keeping the rest in order. */
+static void batch_drop(xen_mem_sharing_batch_entry_t *batch,
+                       struct candidate **in_batch, unsigned int i,
+                       unsigned int n)
+{
+    memmove(&batch[i], &batch[i + 1], (n - i - 1) * sizeof(*batch));
+    memmove(&in_batch[i], &in_batch[i + 1], (n - i - 1) * sizeof(*in_batch));
+}
+
+/*
+ * Nominate, verify and share pairs of pages whose indexed copy lives in
+ * source domain sd.  The pairs are shared into the indexed copy, which
+ * stays valid as a source however many pages get shared with it.
+ */
+static void share_group(domid_t sd, domid_t domid, struct candidate *cand,
+                        unsigned int nr)
+{
+    static xen_mem_sharing_batch_entry_t batch[SCAN_CHUNK];
+    struct candidate *in_batch[SCAN_CHUNK];
+    xen_pfn_t gfns[SCAN_CHUNK];
+    int err[2 * SCAN_CHUNK];
+    uint32_t nr_done;
+    unsigned int i, n;
+    void *mine = NULL, *theirs = NULL;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        memset(&batch[i], 0, sizeof(batch[i]));
+        batch[i].source_gfn = cand[i].src->gfn;
+        batch[i].client_domain = domid;
+        batch[i].client_gfn = cand[i].gfn;
+        in_batch[i] = &cand[i];
+    }
+
+    if ( xc_memshr_nominate_batch(xch, sd, batch, nr, &nr_done) )
+    {
+        stats.failed += nr;
+        return;
+    }
+
+    /* Keep the pairs with both sides nominated. */
+    for ( i = 0, n = nr; i < n; )
+    {
+        if ( !batch[i].rc )
+        {
+            i++;
+            continue;
+        }
+        /* The indexed page is gone or busy: index the new one instead. */
+        if ( !batch[i].source_handle )
+            index_set(in_batch[i]->src, in_batch[i]->src->hash,
+                      domid, in_batch[i]->gfn);
+        stats.failed++;
+        batch_drop(batch, in_batch, i, n--);
+    }
+    if ( !n )
+        return;
+    nr = n;
+
+    for ( i = 0; i < n; i++ )
+        gfns[i] = batch[i].source_gfn;
+    theirs = map_pages(sd, gfns, err, n);
+    for ( i = 0; i < n; i++ )
+        gfns[i] = batch[i].client_gfn;
+    mine = map_pages(domid, gfns, err + n, n);
+
+    if ( !theirs || !mine )
+    {
+        stats.failed += n;
+        goto out;
+    }
+
+    /*
+     * Both pages are copy-on-write now.  If they differ here, it is a hash
+     * collision or the page changed before it was nominated.
+     */
+    for ( i = 0; i < nr; i++ )
+    {
+        unsigned int k = i - (nr - n);
+
+        if ( !err[i] && !err[nr + i] &&
+             !memcmp((char *)theirs + i * PAGE_SIZE,
+                     (char *)mine + i * PAGE_SIZE, PAGE_SIZE) )
+            continue;
+
+        stats.differ++;
+        index_set(in_batch[k]->src, in_batch[k]->src->hash,
+                  domid, in_batch[k]->gfn);
+        batch_drop(batch, in_batch, k, n--);
+    }
+
+    if ( n && xc_memshr_share_batch(xch, sd, batch, n, &nr_done) )
+    {
+        fprintf(stderr, "Sharing %u pages of dom%u with dom%u failed: %s\n",
+                n, domid, sd, strerror(errno));
+        stats.failed += n;
+        goto out;
+    }
+
+    if ( n )
+    {
+        stats.shared += nr_done;
+        stats.failed += n - nr_done;
+    }
+
+ out:
+    if ( theirs )
+        munmap(theirs, nr * PAGE_SIZE);
+    if ( mine )
+        munmap(mine, nr * PAGE_SIZE);
+}
+
+/* Share the candidates found in one chunk of domid's memory. */
+static void share_candidates(domid_t domid, struct candidate *cand,
+                             unsigned int nr)
+{
+    unsigned int i, j;
+
+    /* Group by source domain, for one batch of hypercalls per domain. */
+    qsort(cand, nr, sizeof(*cand), cmp_candidate);
+
+    for ( i = 0; i < nr; i = j )
+    {
+        for ( j = i; j < nr && cand[j].src->domid == cand[i].src->domid; j++ )
+            continue;
+        share_group(cand[i].src->domid, domid, &cand[i], j - i);
+    }
+}
+
+/* Sleep as needed to keep the scan at the configured rate. */
+static void throttle(const struct timespec *start, unsigned long scanned)
+{
+    struct timespec now;
+    double ahead;
+
+    if ( !rate )
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ahead = (double)scanned / rate - ((now.tv_sec - start->tv_sec) +
+                                      (now.tv_nsec - start->tv_nsec) / 1e9);
+    if ( ahead > 0 )
+    {
+        struct timespec ts = {
+            .tv_sec = ahead,
+            .tv_nsec = (ahead - (time_t)ahead) * 1e9,
+        };
+
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void scan_domain(domid_t domid, const struct timespec *start)
+{
+    struct candidate cand[SCAN_CHUNK];
+    xen_pfn_t gfns[SCAN_CHUNK], max_gpfn, gfn;
+    int err[SCAN_CHUNK];
+    unsigned int i, n, nr_cand;
+    void *pages;
+
+    if ( xc_domain_maximum_gpfn(xch, domid, &max_gpfn) < 0 )
+        return;
+
+    for ( gfn = 0; gfn <= max_gpfn && !stop; gfn += n )
+    {
+        n = (max_gpfn - gfn + 1 < SCAN_CHUNK) ? max_gpfn - gfn + 1
+                                               : SCAN_CHUNK;
+        for ( i = 0; i < n; i++ )
+            gfns[i] = gfn + i;
+
+        pages = map_pages(domid, gfns, err, n);
+        if ( !pages )
+            continue;
+
+        for ( i = nr_cand = 0; i < n; i++ )
+        {
+            struct index_entry *e;
+            uint64_t hash;
+            bool found;
+
+            if ( err[i] )
+                continue;
+
+            hash = hash_page((char *)pages + i * PAGE_SIZE);
+            e = index_lookup(hash, &found);
+
+            if ( !found )
+                index_set(e, hash, domid, gfns[i]);
+            else if ( e->domid != domid || e->gfn != gfns[i] )
+            {
+                cand[nr_cand].src = e;
+                cand[nr_cand].domid = domid;
+                cand[nr_cand].gfn = gfns[i];
+                nr_cand++;
+            }
+        }
+
+        /* Foreign mappings hold page references, which block nomination. */
+        munmap(pages, n * PAGE_SIZE);
+
+        stats.scanned += n;
+        stats.candidates += nr_cand;
+        share_candidates(domid, cand, nr_cand);
+
+        throttle(start, stats.scanned);
+    }
+}
+
+static void report(unsigned int pass)
+{
+    printf("pass %u: scanned %lu candidates %lu shared %lu differ %lu "
+           "failed %lu, host: saved %ld frames, %ld shared frames\n",
+           pass, stats.scanned, stats.candidates, stats.shared,
+           stats.differ, stats.failed,
+           xc_sharing_freed_pages(xch), xc_sharing_used_frames(xch));
+    fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [domid...]\n"
+            "Deduplicate the memory of the given domains (default: all"
+            " HVM domains).\n\n"
+            "  -r <pages/s>  scan rate, 0 for unlimited (default %lu)\n"
+            "  -i <secs>     delay between passes (default %u)\n"
+            "  -n <passes>   stop after this many passes (default: never)\n"
+            "  -m <entries>  content index size, rounded up to a power of"
+            " two\n"
+            "                (default %lu)\n"
+            "  -v            report on every pass\n",
+            prog, rate, interval, index_mask + 1);
+}
+
+int main(int argc, char **argv)
+{
+    domid_t doms[DOMID_FIRST_RESERVED];
+    unsigned int nr_doms = 0, i, pass;
+    unsigned long entries;
+    bool all;
+    int opt;
+
+    index_mask = (1UL << 20) - 1;
+
+    while ( (opt = getopt(argc, argv, "r:i:n:m:vh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'r':
+            rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            interval = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            passes = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            for ( entries = 1; entries < strtoul(optarg, NULL, 0); )
+                entries <<= 1;
+            index_mask = entries - 1;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    for ( ; optind < argc && nr_doms < DOMID_FIRST_RESERVED; optind++ )
+        doms[nr_doms++] = strtoul(argv[optind], NULL, 0);
+    all = !nr_doms;
+
+    index_tbl = calloc(index_mask + 1, sizeof(*index_tbl));
+    if ( !index_tbl )
+    {
+        perror("Allocating the content index");
+        return 1;
+    }
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+    {
+        perror("Opening the hypervisor interface");
+        return 1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    for ( pass = 1; !stop && (!passes || pass <= passes); pass++ )
+    {
+        struct timespec start;
+
+        if ( all )
+        {
+            xc_dominfo_t info;
+            domid_t next = 1;
+
+            /* Domains come and go: look them up again on every pass. */
+            for ( nr_doms = 0;
+                  xc_domain_getinfo(xch, next, 1, &info) == 1;
+                  next = info.domid + 1 )
+                if ( info.hvm && !info.dying )
+                    doms[nr_doms++] = info.domid;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        memset(&stats, 0, sizeof(stats));
+
+        for ( i = 0; i < nr_doms && !stop; i++ )
+        {
+            if ( xc_memshr_control(xch, doms[i], 1) )
+            {
+                if ( verbose || !all )
+                    fprintf(stderr, "dom%u: cannot enable sharing: %s\n",
+                            doms[i], strerror(errno));
+                continue;
+            }
+            scan_domain(doms[i], &start);
+        }
+
+        if ( verbose || (passes && pass == passes) || stop )
+            report(pass);
+
+        if ( !stop && (!passes || pass < passes) )
+            sleep(interval);
+    }
+
+    xc_interface_close(xch);
+    free(index_tbl);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
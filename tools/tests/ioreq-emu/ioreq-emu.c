@@ -0,0 +1,404 @@
+/*
+ * ioreq-emu.c
+ *
+ * A minimal stand-in device model: registers an MMIO range of an HVM guest
+ * with a secondary IOREQ Server and backs it with plain memory, so that
+ * the cost of the ioreq paths can be measured without qemu in the way.
+ * Synchronous requests and buffered (posted) writes are counted, and the
+ * rates are printed once a second, together with the number of writes
+ * taken per buffered ring notification.
+ *
+ * Point a guest workload (e.g. a loop of MOV or REP STOS to the range) at
+ * the range, once with and once without -p, to compare the synchronous
+ * and posted write paths.
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <xenctrl.h>
+#include <xen/hvm/ioreq.h>
+
+#define MAX_SIZE (16u << 20)
+
+static xc_interface *xch;
+static xc_evtchn *xce;
+static domid_t domid;
+static ioservid_t id;
+static unsigned int nr_vcpus;
+static shared_iopage_t *iopage;
+static buffered_iopage_t *bufpage;
+static evtchn_port_t *vcpu_port;
+static evtchn_port_t buf_port;
+static uint64_t mmio_start, mmio_size;
+static uint8_t *regs;
+static int interrupted;
+
+static struct {
+    unsigned long sync, posted, notifications;
+} stats;
+
+static void close_handler(int sig)
+{
+    interrupted = sig;
+}
+
+static int usage(const char *prog)
+{
+    printf("usage: %s [-p] [-t secs] <domid> <mmio-start> <mmio-size>\n",
+           prog);
+    printf("  -p       mark the range for posted writes\n");
+    printf("  -t secs  stop after this many seconds\n");
+    return 1;
+}
+
+static uint64_t reg_read(uint64_t addr, unsigned int size)
+{
+    uint64_t val = 0;
+
+    if ( addr < mmio_start || addr - mmio_start + size > mmio_size )
+        return ~0ull;
+    memcpy(&val, regs + (addr - mmio_start), size);
+
+    return val;
+}
+
+static void reg_write(uint64_t addr, unsigned int size, uint64_t val)
+{
+    if ( addr < mmio_start || addr - mmio_start + size > mmio_size )
+        return;
+    memcpy(regs + (addr - mmio_start), &val, size);
+}
+
+/* Copy to or from guest memory, one page at a time. */
+static int copy_guest(uint64_t gpa, void *buf, unsigned int len, int to_guest)
+{
+    while ( len )
+    {
+        unsigned int off = gpa & (XC_PAGE_SIZE - 1);
+        unsigned int chunk = XC_PAGE_SIZE - off;
+        uint8_t *page;
+
+        if ( chunk > len )
+            chunk = len;
+
+        page = xc_map_foreign_range(xch, domid, XC_PAGE_SIZE,
+                                    to_guest ? PROT_WRITE : PROT_READ,
+                                    gpa >> XC_PAGE_SHIFT);
+        if ( !page )
+            return -1;
+
+        if ( to_guest )
+            memcpy(page + off, buf, chunk);
+        else
+            memcpy(buf, page + off, chunk);
+        munmap(page, XC_PAGE_SIZE);
+
+        gpa += chunk;
+        buf = (uint8_t *)buf + chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+static void handle_ioreq(ioreq_t *req)
+{
+    uint32_t i;
+    int sign = req->df ? -1 : 1;
+
+    if ( req->type != IOREQ_TYPE_COPY )
+    {
+        if ( req->dir == IOREQ_READ && !req->data_is_ptr )
+            req->data = ~0ull;
+        return;
+    }
+
+    for ( i = 0; i < req->count; i++ )
+    {
+        uint64_t addr = req->addr + sign * (int64_t)i * req->size;
+        uint64_t val;
+
+        if ( !req->data_is_ptr )
+        {
+            if ( req->dir == IOREQ_READ )
+                req->data = reg_read(addr, req->size);
+            else
+                reg_write(addr, req->size, req->data);
+            continue;
+        }
+
+        /* The data lives in guest memory. */
+        if ( req->dir == IOREQ_READ )
+        {
+            val = reg_read(addr, req->size);
+            copy_guest(req->data + sign * (int64_t)i * req->size,
+                       &val, req->size, 1);
+        }
+        else
+        {
+            val = 0;
+            if ( !copy_guest(req->data + sign * (int64_t)i * req->size,
+                             &val, req->size, 0) )
+                reg_write(addr, req->size, val);
+        }
+    }
+}
+
+/* Consume everything in the buffered ring. */
+static void drain_buffered(void)
+{
+    for ( ;; )
+    {
+        uint32_t rp = bufpage->read_pointer, n = 1;
+        buf_ioreq_t *bp;
+        uint64_t addr, data;
+
+        if ( rp == bufpage->write_pointer )
+            break;
+        xen_rmb();
+
+        bp = &bufpage->buf_ioreq[rp % IOREQ_BUFFER_SLOT_NUM];
+        addr = bp->addr;
+        data = bp->data;
+        if ( bp->size == 3 )
+            data |= (uint64_t)bufpage->buf_ioreq[
+                (rp + n++) % IOREQ_BUFFER_SLOT_NUM].data << 32;
+        if ( bp->pad ) /* wide */
+            addr |= (uint64_t)bufpage->buf_ioreq[
+                (rp + n++) % IOREQ_BUFFER_SLOT_NUM].data << 20;
+
+        if ( bp->type == IOREQ_TYPE_COPY && bp->dir == IOREQ_WRITE )
+            reg_write(addr, 1u << bp->size, data);
+        stats.posted++;
+
+        /* Xen may canonicalize the pointers under our feet. */
+        __sync_fetch_and_add(&bufpage->read_pointer, n);
+    }
+}
+
+static void handle_port(evtchn_port_t port)
+{
+    unsigned int v;
+
+    /* Posted writes precede anything synchronous which follows them. */
+    drain_buffered();
+
+    if ( port == buf_port )
+    {
+        stats.notifications++;
+        return;
+    }
+
+    for ( v = 0; v < nr_vcpus; v++ )
+    {
+        ioreq_t *req = &iopage->vcpu_ioreq[v];
+
+        if ( vcpu_port[v] != port || req->state != STATE_IOREQ_READY )
+            continue;
+
+        xen_rmb();
+        req->state = STATE_IOREQ_INPROCESS;
+        handle_ioreq(req);
+        stats.sync++;
+        xen_wmb();
+        req->state = STATE_IORESP_READY;
+        xc_evtchn_notify(xce, port);
+    }
+}
+
+static int bind_ports(void)
+{
+    unsigned int v;
+    int rc;
+
+    vcpu_port = calloc(nr_vcpus, sizeof(*vcpu_port));
+    if ( !vcpu_port )
+        return -1;
+
+    for ( v = 0; v < nr_vcpus; v++ )
+    {
+        rc = xc_evtchn_bind_interdomain(xce, domid,
+                                        iopage->vcpu_ioreq[v].vp_eport);
+        if ( rc < 0 )
+            return -1;
+        vcpu_port[v] = rc;
+    }
+
+    rc = xc_evtchn_bind_interdomain(xce, domid, buf_port);
+    if ( rc < 0 )
+        return -1;
+    buf_port = rc;
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    xc_dominfo_t info;
+    xen_pfn_t ioreq_pfn, bufioreq_pfn;
+    int opt, posted = 0, rc = 1;
+    unsigned int secs = 0, elapsed = 0;
+    struct sigaction act;
+    struct pollfd pfd;
+    time_t last;
+
+    while ( (opt = getopt(argc, argv, "pt:")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'p':
+            posted = 1;
+            break;
+        case 't':
+            secs = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+
+    if ( argc - optind != 3 )
+        return usage(argv[0]);
+
+    domid = strtoul(argv[optind], NULL, 0);
+    mmio_start = strtoull(argv[optind + 1], NULL, 0);
+    mmio_size = strtoull(argv[optind + 2], NULL, 0);
+    if ( !mmio_size || mmio_size > MAX_SIZE )
+    {
+        fprintf(stderr, "MMIO size must be 1 to %u bytes\n", MAX_SIZE);
+        return 1;
+    }
+
+    regs = calloc(1, mmio_size);
+    xch = xc_interface_open(NULL, NULL, 0);
+    xce = xc_evtchn_open(NULL, 0);
+    if ( !regs || !xch || !xce )
+    {
+        perror("setup");
+        return 1;
+    }
+
+    if ( xc_domain_getinfo(xch, domid, 1, &info) != 1 ||
+         info.domid != domid || !info.hvm )
+    {
+        fprintf(stderr, "dom%u is not an HVM guest\n", domid);
+        return 1;
+    }
+    nr_vcpus = info.max_vcpu_id + 1;
+
+    /* Wide buffered requests reach posted ranges above 1MB. */
+    if ( xc_hvm_create_ioreq_server(xch, domid, HVM_IOREQSRV_BUFIOREQ_WIDE,
+                                    &id) &&
+         xc_hvm_create_ioreq_server(xch, domid, HVM_IOREQSRV_BUFIOREQ_ATOMIC,
+                                    &id) )
+    {
+        perror("xc_hvm_create_ioreq_server");
+        return 1;
+    }
+
+    if ( xc_hvm_get_ioreq_server_info(xch, domid, id, &ioreq_pfn,
+                                      &bufioreq_pfn, &buf_port) )
+    {
+        perror("xc_hvm_get_ioreq_server_info");
+        goto out;
+    }
+
+    iopage = xc_map_foreign_range(xch, domid, XC_PAGE_SIZE,
+                                  PROT_READ | PROT_WRITE, ioreq_pfn);
+    bufpage = xc_map_foreign_range(xch, domid, XC_PAGE_SIZE,
+                                   PROT_READ | PROT_WRITE, bufioreq_pfn);
+    if ( !iopage || !bufpage )
+    {
+        perror("map ioreq pages");
+        goto out;
+    }
+
+    if ( xc_hvm_map_io_range_to_ioreq_server(xch, domid, id, 1, mmio_start,
+                                             mmio_start + mmio_size - 1) ||
+         (posted &&
+          xc_hvm_map_posted_range_to_ioreq_server(xch, domid, id, mmio_start,
+                                                  mmio_start + mmio_size - 1)) )
+    {
+        perror("map MMIO range");
+        goto out;
+    }
+
+    if ( xc_hvm_set_ioreq_server_state(xch, domid, id, 1) || bind_ports() )
+    {
+        perror("enable ioreq server");
+        goto out;
+    }
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = close_handler;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+
+    printf("dom%u: emulating %#"PRIx64"+%#"PRIx64", %s writes\n",
+           domid, mmio_start, mmio_size, posted ? "posted" : "synchronous");
+    printf("%6s %12s %12s %12s %10s\n",
+           "secs", "sync/s", "posted/s", "notify/s", "per-notify");
+
+    pfd.fd = xc_evtchn_fd(xce);
+    pfd.events = POLLIN;
+    last = time(NULL);
+
+    while ( !interrupted && (!secs || elapsed < secs) )
+    {
+        time_t now;
+
+        if ( poll(&pfd, 1, 100) > 0 )
+        {
+            int port = xc_evtchn_pending(xce);
+
+            if ( port >= 0 )
+            {
+                xc_evtchn_unmask(xce, port);
+                handle_port(port);
+            }
+        }
+        else
+            drain_buffered();
+
+        now = time(NULL);
+        if ( now != last )
+        {
+            elapsed += now - last;
+            printf("%6u %12lu %12lu %12lu %10.1f\n", elapsed,
+                   stats.sync, stats.posted, stats.notifications,
+                   stats.notifications ?
+                   (double)stats.posted / stats.notifications : 0.0);
+            memset(&stats, 0, sizeof(stats));
+            last = now;
+        }
+    }
+
+    rc = 0;
+
+ out:
+    xc_hvm_set_ioreq_server_state(xch, domid, id, 0);
+    xc_hvm_destroy_ioreq_server(xch, domid, id);
+    if ( iopage )
+        munmap(iopage, XC_PAGE_SIZE);
+    if ( bufpage )
+        munmap(bufpage, XC_PAGE_SIZE);
+    xc_evtchn_close(xce);
+    xc_interface_close(xch);
+    free(vcpu_port);
+    free(regs);
+
+    return rc;
+}
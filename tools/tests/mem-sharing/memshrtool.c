@@ -26,6 +26,8 @@ static int usage(const char* prog)
     printf("  unshare <domid> <gfn>   - Unshare a page by grabbing a writable map.\n");
     printf("  add-to-physmap <domid> <gfn> <source> <source-gfn> <source-handle>\n");
     printf("                          - Populate a page in a domain with a shared page.\n");
+    printf("  range-share <domid> <source> <first-gfn> <last-gfn>\n");
+    printf("                          - Share a gfn range of two paused domains.\n");
     printf("  debug-gfn <domid> <gfn> - Debug a particular domain and gfn.\n");
     printf("  audit                   - Audit the sharing subsytem in Xen.\n");
     return 1;
@@ -157,6 +159,23 @@ int main(int argc, const char** argv)
         source_handle = strtol(argv[6], NULL, 0);
         R(xc_memshr_add_to_physmap(xch, source_domid, source_gfn, source_handle, domid, gfn));
     }
+    else if( !strcasecmp(cmd, "range-share") )
+    {
+        domid_t domid;
+        domid_t source_domid;
+        uint64_t first_gfn, last_gfn, nr_shared;
+
+        if( argc != 6 )
+            return usage(argv[0]);
+
+        domid = strtol(argv[2], NULL, 0);
+        source_domid = strtol(argv[3], NULL, 0);
+        first_gfn = strtoull(argv[4], NULL, 0);
+        last_gfn = strtoull(argv[5], NULL, 0);
+        R(xc_memshr_range_share(xch, source_domid, domid, first_gfn, last_gfn,
+                                &nr_shared));
+        printf("shared = %llu\n", (unsigned long long) nr_shared);
+    }
     else if( !strcasecmp(cmd, "debug-gfn") )
     {
         domid_t domid;
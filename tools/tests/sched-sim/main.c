@@ -0,0 +1,676 @@
+/*
+ * Discrete-event simulator for the Xen vcpu schedulers
+ *
+ * Builds xen/common/sched_credit.c, sched_credit2.c and sched_rt.c
+ * against the environment in sim.h, runs a synthetic (or replayed)
+ * workload on a simulated host, and reports wakeup latencies, fairness,
+ * migrations and lock hold times.  This makes it possible to compare
+ * schedulers, and tunings like sched_credit_tslice_ms, offline.
+ *
+ * Usage: see usage() below, or README.
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License Version 2 (GPLv2)
+ * as published by the Free Software Foundation.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details. <http://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include "sim.h"
+
+#define MAX_DOMAINS 256
+
+static const struct scheduler *const schedulers[] = {
+    &sched_credit_def,
+    &sched_credit2_def,
+    &sched_rtds_def,
+};
+
+/* A class of identical domains, from the command line. */
+struct sim_domain {
+    struct domain *d;
+    unsigned int nr_vcpus;
+    unsigned int weight;
+    unsigned int cap;
+    unsigned int budget_us, period_us;
+    s_time_t run_mean, sleep_mean;  /* sleep_mean == 0: cpu hog */
+    uint64_t runtime;
+};
+
+struct sim_vcpu {
+    struct vcpu *v;
+    struct sim_domain *sd;
+    struct timer burst_timer;       /* end of the current burst */
+    struct timer wake_timer;        /* end of the current sleep */
+    s_time_t remaining;             /* work left in the current burst */
+    s_time_t run_start;
+    s_time_t woken_at;              /* -1 if not waiting to run */
+    int last_cpu;
+    uint64_t runtime, wakeups, migrations;
+};
+
+static struct sim_domain domains[MAX_DOMAINS];
+static unsigned int nr_domains;
+
+/* Replayed events: at time, vcpu needs work more cpu time. */
+struct trace_event {
+    s_time_t time, work;
+    unsigned int dom, vcpu;
+};
+static struct trace_event *trace;
+static unsigned int nr_trace, trace_pos;
+static struct timer trace_timer;
+
+static s_time_t *latencies;
+static size_t nr_latencies, max_latencies;
+
+/*
+ * Deterministic pseudo random numbers (xorshift64*)
+ */
+static uint64_t rnd_state = 0x2545f4914f6cdd1dULL;
+
+static double rnd_uniform(void)
+{
+    rnd_state ^= rnd_state >> 12;
+    rnd_state ^= rnd_state << 25;
+    rnd_state ^= rnd_state >> 27;
+    return ((rnd_state * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / (1ULL << 53));
+}
+
+static s_time_t rnd_exp(s_time_t mean)
+{
+    s_time_t t = -log(1.0 - rnd_uniform()) * mean;
+
+    return t > 0 ? t : 1;
+}
+
+/*
+ * Workload
+ */
+static void record_latency(s_time_t lat)
+{
+    if ( nr_latencies == max_latencies )
+    {
+        max_latencies = max_latencies ? max_latencies * 2 : 65536;
+        latencies = realloc(latencies, max_latencies * sizeof(*latencies));
+        if ( latencies == NULL )
+            BUG();
+    }
+    latencies[nr_latencies++] = lat;
+}
+
+static void vcpu_add_work(struct sim_vcpu *sv, s_time_t work)
+{
+    struct vcpu *v = sv->v;
+
+    if ( test_bit(_VPF_blocked, &v->pause_flags) )
+    {
+        sv->remaining = work;
+        sv->woken_at = NOW();
+        sv->wakeups++;
+        clear_bit(_VPF_blocked, &v->pause_flags);
+        vcpu_wake(v);
+        return;
+    }
+
+    /* Still busy with the previous burst: just make it longer. */
+    sv->remaining += work;
+    if ( active_timer(&sv->burst_timer) )
+        set_timer(&sv->burst_timer, sv->run_start + sv->remaining);
+}
+
+static void wake_timer_fn(void *data)
+{
+    struct sim_vcpu *sv = data;
+
+    vcpu_add_work(sv, rnd_exp(sv->sd->run_mean));
+}
+
+static void burst_timer_fn(void *data)
+{
+    struct sim_vcpu *sv = data;
+    struct vcpu *v = sv->v;
+
+    /* Done with this burst: account for it, and block. */
+    sv->runtime += NOW() - sv->run_start;
+    sv->sd->runtime += NOW() - sv->run_start;
+    sv->run_start = NOW();
+    sv->remaining = 0;
+
+    set_bit(_VPF_blocked, &v->pause_flags);
+    vcpu_sleep_nosync(v);
+
+    if ( trace == NULL )
+    {
+        migrate_timer(&sv->wake_timer, v->processor);
+        set_timer(&sv->wake_timer, NOW() + rnd_exp(sv->sd->sleep_mean));
+    }
+}
+
+static void trace_timer_fn(void *unused)
+{
+    while ( trace_pos < nr_trace && trace[trace_pos].time <= NOW() )
+    {
+        struct trace_event *e = &trace[trace_pos++];
+
+        vcpu_add_work(domains[e->dom].d->vcpu[e->vcpu]->sim, e->work);
+    }
+
+    if ( trace_pos < nr_trace )
+        set_timer(&trace_timer, trace[trace_pos].time);
+}
+
+void sim_vcpu_descheduled(struct vcpu *v, unsigned int cpu)
+{
+    struct sim_vcpu *sv = v->sim;
+    s_time_t ran;
+
+    if ( is_idle_vcpu(v) )
+        return;
+
+    ran = NOW() - sv->run_start;
+    sv->runtime += ran;
+    sv->sd->runtime += ran;
+    if ( sv->remaining != STIME_MAX )
+        sv->remaining -= ran;
+    stop_timer(&sv->burst_timer);
+}
+
+void sim_vcpu_scheduled(struct vcpu *v, unsigned int cpu)
+{
+    struct sim_vcpu *sv = v->sim;
+
+    if ( is_idle_vcpu(v) )
+        return;
+
+    if ( sv->woken_at >= 0 )
+    {
+        record_latency(NOW() - sv->woken_at);
+        sv->woken_at = -1;
+    }
+    if ( sv->last_cpu >= 0 && sv->last_cpu != cpu )
+        sv->migrations++;
+    sv->last_cpu = cpu;
+
+    sv->run_start = NOW();
+    if ( sv->remaining != STIME_MAX )
+    {
+        migrate_timer(&sv->burst_timer, cpu);
+        set_timer(&sv->burst_timer, NOW() + sv->remaining);
+    }
+}
+
+static int setup_domain(domid_t domid, struct sim_domain *sd)
+{
+    struct xen_domctl_scheduler_op op = { 0 };
+    const struct scheduler *ops = sim_scheduler();
+    struct vcpu *v;
+
+    sd->d = sim_domain_create(domid, sd->nr_vcpus);
+    if ( sd->d == NULL )
+        return -1;
+
+    switch ( ops->sched_id )
+    {
+    case XEN_SCHEDULER_CREDIT:
+        op.u.credit.weight = sd->weight;
+        op.u.credit.cap = sd->cap;
+        break;
+    case XEN_SCHEDULER_CREDIT2:
+        op.u.credit2.weight = sd->weight;
+        break;
+    case XEN_SCHEDULER_RTDS:
+        op.u.rtds.budget = sd->budget_us;
+        op.u.rtds.period = sd->period_us;
+        break;
+    }
+    if ( sim_domain_adjust(sd->d, &op) )
+        return -1;
+
+    for_each_vcpu ( sd->d, v )
+    {
+        struct sim_vcpu *sv = xzalloc(struct sim_vcpu);
+
+        if ( sv == NULL )
+            return -1;
+        v->sim = sv;
+        sv->v = v;
+        sv->sd = sd;
+        sv->woken_at = -1;
+        sv->last_cpu = -1;
+        init_timer(&sv->burst_timer, burst_timer_fn, sv, v->processor);
+        init_timer(&sv->wake_timer, wake_timer_fn, sv, v->processor);
+
+        if ( trace != NULL )
+            continue;
+
+        /* Hogs never block; others start at a random point of a sleep. */
+        if ( sd->sleep_mean == 0 )
+        {
+            sv->woken_at = 0;
+            sv->remaining = STIME_MAX;
+            clear_bit(_VPF_blocked, &v->pause_flags);
+            vcpu_wake(v);
+        }
+        else
+            set_timer(&sv->wake_timer, rnd_exp(sd->sleep_mean));
+    }
+
+    return 0;
+}
+
+/*
+ * Topology: sockets x cores x threads, with sockets spread evenly
+ * among nodes.
+ */
+static void setup_topology(unsigned int sockets, unsigned int cores,
+                           unsigned int threads, unsigned int nodes)
+{
+    unsigned int cpu, c2;
+
+    nr_cpu_ids = sockets * cores * threads;
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+    {
+        sim_cpu_socket[cpu] = cpu / (cores * threads);
+        sim_cpu_core[cpu] = (cpu / threads) % cores;
+        sim_cpu_node[cpu] = sim_cpu_socket[cpu] * nodes / sockets;
+        cpumask_set_cpu(cpu, &cpu_online_map);
+        cpumask_set_cpu(cpu, &sim_node_to_cpumask[sim_cpu_node[cpu]]);
+        set_bit(sim_cpu_node[cpu], node_online_map.bits);
+    }
+
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        for ( c2 = 0; c2 < nr_cpu_ids; c2++ )
+        {
+            if ( sim_cpu_socket[c2] != sim_cpu_socket[cpu] )
+                continue;
+            cpumask_set_cpu(c2, per_cpu(cpu_core_mask, cpu));
+            if ( sim_cpu_core[c2] == sim_cpu_core[cpu] )
+                cpumask_set_cpu(c2, per_cpu(cpu_sibling_mask, cpu));
+        }
+}
+
+/*
+ * Parsing of workload descriptions
+ */
+static int parse_domain(const char *spec)
+{
+    struct sim_domain *sd;
+    char *s, *tok, *save = NULL;
+    unsigned int count = 1;
+    int rc = 0;
+
+    if ( nr_domains == MAX_DOMAINS )
+        return -1;
+    sd = &domains[nr_domains];
+    sd->nr_vcpus = 1;
+    sd->weight = 256;
+    sd->budget_us = 4000;
+    sd->period_us = 10000;
+    sd->run_mean = MICROSECS(1000);
+    sd->sleep_mean = MICROSECS(1000);
+
+    s = strdup(spec);
+    for ( tok = strtok_r(s, ",", &save); tok && !rc;
+          tok = strtok_r(NULL, ",", &save) )
+    {
+        char *val = strchr(tok, '=');
+        unsigned long n;
+
+        if ( val == NULL )
+        {
+            rc = -1;
+            break;
+        }
+        *val++ = '\0';
+        n = strtoul(val, NULL, 0);
+
+        if ( !strcmp(tok, "count") )
+            count = n;
+        else if ( !strcmp(tok, "vcpus") )
+            sd->nr_vcpus = n;
+        else if ( !strcmp(tok, "weight") )
+            sd->weight = n;
+        else if ( !strcmp(tok, "cap") )
+            sd->cap = n;
+        else if ( !strcmp(tok, "budget") )
+            sd->budget_us = n;
+        else if ( !strcmp(tok, "period") )
+            sd->period_us = n;
+        else if ( !strcmp(tok, "run") )
+            sd->run_mean = MICROSECS(n);
+        else if ( !strcmp(tok, "sleep") )
+            sd->sleep_mean = MICROSECS(n);
+        else
+            rc = -1;
+    }
+    free(s);
+
+    if ( rc || !sd->nr_vcpus || !count || nr_domains + count > MAX_DOMAINS )
+        return -1;
+    for ( nr_domains++; --count; nr_domains++ )
+        domains[nr_domains] = *sd;
+
+    return 0;
+}
+
+static int cmp_event(const void *a, const void *b)
+{
+    const struct trace_event *x = a, *y = b;
+
+    return (x->time > y->time) - (x->time < y->time);
+}
+
+/*
+ * Trace format: one "<time_us> <domain> <vcpu> <work_us>" record per
+ * line, meaning that at time the vcpu gets work worth of cpu time to
+ * do.  Domains are numbered from 1, in the order of the -D options;
+ * domains and vcpus not described there get the defaults.
+ */
+static int load_trace(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+    unsigned int max = 0, i;
+
+    if ( f == NULL )
+    {
+        perror(path);
+        return -1;
+    }
+
+    while ( fgets(line, sizeof(line), f) )
+    {
+        unsigned long long t, work;
+        unsigned int dom, vcpu;
+
+        if ( line[0] == '#' || line[0] == '\n' )
+            continue;
+        if ( sscanf(line, "%llu %u %u %llu", &t, &dom, &vcpu, &work) != 4 ||
+             dom == 0 || dom > MAX_DOMAINS )
+        {
+            fprintf(stderr, "%s: bad record: %s", path, line);
+            fclose(f);
+            return -1;
+        }
+        if ( nr_trace == max )
+        {
+            max = max ? max * 2 : 4096;
+            trace = realloc(trace, max * sizeof(*trace));
+            if ( trace == NULL )
+                BUG();
+        }
+        trace[nr_trace].time = MICROSECS(t);
+        trace[nr_trace].work = MICROSECS(work);
+        trace[nr_trace].dom = dom - 1;
+        trace[nr_trace].vcpu = vcpu;
+        nr_trace++;
+
+        /* Make room for whatever the trace talks about. */
+        while ( nr_domains < dom )
+            parse_domain("vcpus=1");
+        if ( domains[dom - 1].nr_vcpus <= vcpu )
+            domains[dom - 1].nr_vcpus = vcpu + 1;
+    }
+    fclose(f);
+
+    qsort(trace, nr_trace, sizeof(*trace), cmp_event);
+    for ( i = 0; i < nr_domains; i++ )
+        domains[i].sleep_mean = 1; /* Not a hog: work comes from the trace */
+
+    return 0;
+}
+
+/*
+ * Report
+ */
+static int cmp_stime(const void *a, const void *b)
+{
+    s_time_t x = *(const s_time_t *)a, y = *(const s_time_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double percentile(double p)
+{
+    size_t i;
+
+    if ( nr_latencies == 0 )
+        return 0;
+    i = (size_t)(p / 100.0 * (nr_latencies - 1) + 0.5);
+    return latencies[i] / 1000.0;
+}
+
+static uint64_t lock_hold_percentile(double p)
+{
+    uint64_t total = 0, seen = 0;
+    unsigned int i;
+
+    for ( i = 0; i < SIM_LOG2_BUCKETS; i++ )
+        total += sim_stats.lock_hold_hist[i];
+    for ( i = 0; i < SIM_LOG2_BUCKETS; i++ )
+    {
+        seen += sim_stats.lock_hold_hist[i];
+        if ( seen && seen >= total * p / 100.0 )
+            return 2ULL << i;
+    }
+    return 0;
+}
+
+static void report(s_time_t duration, double wall_ms,
+                   unsigned int sockets, unsigned int cores,
+                   unsigned int threads, unsigned int nodes)
+{
+    const struct scheduler *ops = sim_scheduler();
+    uint64_t migrations = 0, wakeups = 0, busy = 0;
+    double sum = 0, sum2 = 0;
+    unsigned int i, n = 0;
+    struct vcpu *v;
+
+    qsort(latencies, nr_latencies, sizeof(*latencies), cmp_stime);
+
+    printf("Scheduler:        %s (%s)\n", ops->opt_name, ops->name);
+    printf("Host:             %u cpus (%u sockets x %u cores x %u threads, "
+           "%u nodes)\n", nr_cpu_ids, sockets, cores, threads, nodes);
+    printf("Simulated:        %.3f ms in %.3f ms\n",
+           duration / 1e6, wall_ms);
+
+    printf("Per domain:\n");
+    printf("  %5s %5s %6s %10s %8s\n",
+           "domid", "vcpus", "weight", "cpu ms", "cpu %");
+    for ( i = 0; i < nr_domains; i++ )
+    {
+        struct sim_domain *sd = &domains[i];
+
+        printf("  %5u %5u %6u %10.3f %8.2f\n", sd->d->domain_id,
+               sd->nr_vcpus, sd->weight, sd->runtime / 1e6,
+               100.0 * sd->runtime / duration);
+        busy += sd->runtime;
+        for_each_vcpu ( sd->d, v )
+        {
+            migrations += v->sim->migrations;
+            wakeups += v->sim->wakeups;
+        }
+        if ( sd->weight )
+        {
+            double x = (double)sd->runtime / sd->weight;
+
+            sum += x;
+            sum2 += x * x;
+            n++;
+        }
+    }
+
+    printf("Utilization:      %.2f%%\n",
+           100.0 * busy / ((double)duration * nr_cpu_ids));
+    printf("Fairness:         %.4f (Jain's index of cpu time / weight)\n",
+           sum2 ? sum * sum / (n * sum2) : 1.0);
+    printf("Wakeup latency:   %zu samples, us: p50 %.1f p90 %.1f p99 %.1f "
+           "p99.9 %.1f max %.1f\n", nr_latencies,
+           percentile(50), percentile(90), percentile(99), percentile(99.9),
+           percentile(100));
+    printf("Wakeups:          %"PRIu64"\n", wakeups);
+    printf("Migrations:       %"PRIu64"\n", migrations);
+    printf("Context switches: %"PRIu64"\n", sim_stats.context_switches);
+    printf("Schedule calls:   %"PRIu64"\n", sim_stats.schedules);
+    printf("IPIs:             %"PRIu64" (in %"PRIu64" sends)\n",
+           sim_stats.ipis, sim_stats.ipi_sends);
+    printf("Timers fired:     %"PRIu64"\n", sim_stats.timers);
+    printf("Locks:            %"PRIu64" acquired, %"PRIu64" trylock failures\n",
+           sim_stats.lock_acquisitions, sim_stats.lock_trylock_failures);
+    printf("Lock hold (host): ns: mean %.1f p99 <%"PRIu64" max %"PRIu64"\n",
+           sim_stats.lock_acquisitions ?
+           (double)sim_stats.lock_hold_ns / sim_stats.lock_acquisitions : 0,
+           lock_hold_percentile(99), sim_stats.lock_hold_max_ns);
+    printf("Perf counters:\n");
+    sim_perfc_dump(stdout);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+"Usage: %s [options]\n"
+"  -s <sched>    scheduler: credit, credit2 or rtds (default: credit)\n"
+"  -p <S>x<C>x<T> host topology: sockets x cores x threads (default: 2x4x2)\n"
+"  -n <nodes>    number of NUMA nodes (default: one per socket)\n"
+"  -D <spec>     add domain(s), spec is a comma separated list of:\n"
+"                  count=<n>     number of such domains (1)\n"
+"                  vcpus=<n>     vcpus per domain (1)\n"
+"                  weight=<n>    credit/credit2 weight (256)\n"
+"                  cap=<n>       credit cap (0)\n"
+"                  budget=<us>,period=<us> RTDS parameters (4000, 10000)\n"
+"                  run=<us>      mean cpu burst (1000)\n"
+"                  sleep=<us>    mean sleep between bursts, 0 for a cpu\n"
+"                                hog (1000)\n"
+"                (default: -D count=8,vcpus=4)\n"
+"  -f <file>     replay a trace (see README) instead of synthetic bursts\n"
+"  -t <ms>       simulated time (default: 1000)\n"
+"  -r <seed>     random seed\n"
+"  -o <opt=val>  set a Xen boot parameter (e.g. sched_credit_tslice_ms=5)\n"
+"  -O            list the known boot parameters\n"
+"  -d            dump the scheduler state at the end\n"
+"  -v            show the scheduler's printk()s\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *sched = "credit", *trace_file = NULL;
+    unsigned int sockets = 2, cores = 4, threads = 2, nodes = 0, i;
+    s_time_t duration = MILLISECS(1000);
+    struct timespec t0, t1;
+    int c, dump = 0;
+
+    while ( (c = getopt(argc, argv, "s:p:n:D:f:t:r:o:Odvh")) != -1 )
+    {
+        switch ( c )
+        {
+        case 's':
+            sched = optarg;
+            break;
+        case 'p':
+            if ( sscanf(optarg, "%ux%ux%u", &sockets, &cores, &threads) != 3 ||
+                 !sockets || !cores || !threads ||
+                 sockets * cores * threads > NR_CPUS )
+                usage(argv[0]);
+            break;
+        case 'n':
+            nodes = strtoul(optarg, NULL, 0);
+            break;
+        case 'D':
+            if ( parse_domain(optarg) )
+                usage(argv[0]);
+            break;
+        case 'f':
+            trace_file = optarg;
+            break;
+        case 't':
+            duration = MILLISECS(strtoull(optarg, NULL, 0));
+            break;
+        case 'r':
+            rnd_state = strtoull(optarg, NULL, 0) * 0x9e3779b97f4a7c15ULL + 1;
+            break;
+        case 'o':
+            if ( sim_set_param(optarg) )
+            {
+                fprintf(stderr, "Unknown boot parameter: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'O':
+            sim_list_params(stdout);
+            return 0;
+        case 'd':
+            dump = 1;
+            break;
+        case 'v':
+            sim_verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ( nodes == 0 || nodes > sockets )
+        nodes = sockets;
+    setup_topology(sockets, cores, threads, nodes);
+
+    if ( trace_file && load_trace(trace_file) )
+        return 1;
+    if ( nr_domains == 0 )
+        parse_domain("count=8,vcpus=4");
+
+    for ( i = 0; i < ARRAY_SIZE(schedulers); i++ )
+        if ( !strcmp(schedulers[i]->opt_name, sched) )
+            break;
+    if ( i == ARRAY_SIZE(schedulers) )
+        usage(argv[0]);
+    if ( sim_scheduler_init(schedulers[i]) )
+    {
+        fprintf(stderr, "Failed to initialize %s\n", sched);
+        return 1;
+    }
+
+    for ( i = 0; i < nr_domains; i++ )
+        if ( setup_domain(i + 1, &domains[i]) )
+        {
+            fprintf(stderr, "Failed to create domain %u\n", i + 1);
+            return 1;
+        }
+    if ( nr_trace )
+    {
+        init_timer(&trace_timer, trace_timer_fn, NULL, 0);
+        set_timer(&trace_timer, trace[0].time);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    sim_do_softirqs();
+    while ( sim_next_timer() <= duration )
+    {
+        sim_now = sim_next_timer();
+        sim_run_timers();
+        sim_do_softirqs();
+    }
+
+    /* Account for whoever is running at the end. */
+    sim_now = duration;
+    for ( i = 0; i < nr_cpu_ids; i++ )
+        sim_vcpu_descheduled(per_cpu(curr_vcpu, i), i);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    report(duration, (t1.tv_sec - t0.tv_sec) * 1e3 +
+           (t1.tv_nsec - t0.tv_nsec) / 1e6, sockets, cores, threads, nodes);
+    if ( dump )
+        sim_dump();
+
+    return 0;
+}
@@ -0,0 +1,876 @@
+/*
+ * Xen emulation for the userspace scheduler simulator
+ *
+ * Implementation of the environment declared in sim.h, plus a cut down
+ * version of the generic scheduling code from xen/common/schedule.c,
+ * driving the scheduler under test exactly the way the hypervisor does.
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License Version 2 (GPLv2)
+ * as published by the Free Software Foundation.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details. <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+#include "sim.h"
+
+int sim_verbose;
+unsigned int nr_cpu_ids;
+unsigned int sim_cpu;
+s_time_t sim_now;
+int system_state = SYS_STATE_active;
+int sched_smt_power_savings;
+char keyhandler_scratch[1024];
+
+cpumask_t cpu_online_map;
+cpumask_t cpupool_free_cpus;
+struct cpupool *cpupool0;
+nodemask_t node_online_map;
+cpumask_t sim_node_to_cpumask[MAX_NUMNODES];
+unsigned int sim_cpu_core[NR_CPUS], sim_cpu_socket[NR_CPUS],
+    sim_cpu_node[NR_CPUS];
+
+struct vcpu *idle_vcpu[NR_CPUS];
+
+DEFINE_PER_CPU(cpumask_var_t, cpu_sibling_mask);
+DEFINE_PER_CPU(cpumask_var_t, cpu_core_mask);
+DEFINE_PER_CPU(struct schedule_data, schedule_data);
+DEFINE_PER_CPU(struct scheduler *, scheduler);
+DEFINE_PER_CPU(struct cpupool *, cpupool);
+DEFINE_PER_CPU(struct vcpu *, curr_vcpu);
+
+int sched_ratelimit_us = SCHED_DEFAULT_RATELIMIT_US;
+integer_param("sched_ratelimit_us", sched_ratelimit_us);
+
+struct sim_stats sim_stats;
+
+void sim_fatal(const char *file, int line, const char *what)
+{
+    fprintf(stderr, "FATAL at %s:%d (cpu %u, t=%"PRI_stime"ns): %s\n",
+            file, line, sim_cpu, sim_now, what);
+    abort();
+}
+
+/*
+ * Boot parameters
+ */
+static struct sim_param {
+    const char *name;
+    enum sim_param_type type;
+    void *var;
+    size_t size;
+} sim_params[64];
+static unsigned int nr_sim_params;
+
+void sim_register_param(const char *name, enum sim_param_type type,
+                        void *var, size_t size)
+{
+    struct sim_param *p;
+
+    if ( nr_sim_params == ARRAY_SIZE(sim_params) )
+        BUG();
+    p = &sim_params[nr_sim_params++];
+    p->name = name;
+    p->type = type;
+    p->var = var;
+    p->size = size;
+}
+
+int sim_set_param(const char *opt)
+{
+    const char *val = strchr(opt, '=');
+    size_t len = val ? (size_t)(val - opt) : strlen(opt);
+    unsigned int i;
+
+    for ( i = 0; i < nr_sim_params; i++ )
+    {
+        struct sim_param *p = &sim_params[i];
+        long long n;
+
+        if ( strlen(p->name) != len || strncmp(p->name, opt, len) )
+            continue;
+
+        val = val ? val + 1 : "";
+        switch ( p->type )
+        {
+        case SIM_PARAM_BOOL:
+            n = !(!strcmp(val, "0") || !strcmp(val, "no") ||
+                  !strcmp(val, "false") || !strcmp(val, "off"));
+            goto store;
+        case SIM_PARAM_INT:
+            n = strtoll(val, NULL, 0);
+        store:
+            switch ( p->size )
+            {
+            case 1: *(int8_t *)p->var = n; break;
+            case 2: *(int16_t *)p->var = n; break;
+            case 4: *(int32_t *)p->var = n; break;
+            case 8: *(int64_t *)p->var = n; break;
+            default: BUG();
+            }
+            break;
+        case SIM_PARAM_STR:
+            snprintf(p->var, p->size, "%s", val);
+            break;
+        case SIM_PARAM_CUSTOM:
+            ((void (*)(const char *))p->var)(val);
+            break;
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+void sim_list_params(FILE *f)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr_sim_params; i++ )
+        fprintf(f, "  %s\n", sim_params[i].name);
+}
+
+/*
+ * Perf counters, by name
+ */
+static struct {
+    const char *name;
+    uint64_t count;
+} perfc[128];
+static unsigned int nr_perfc;
+
+void sim_perfc_incr(const char *name)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr_perfc; i++ )
+        if ( perfc[i].name == name || !strcmp(perfc[i].name, name) )
+            break;
+    if ( i == nr_perfc )
+    {
+        if ( nr_perfc == ARRAY_SIZE(perfc) )
+            return;
+        perfc[nr_perfc++].name = name;
+    }
+    perfc[i].count++;
+}
+
+void sim_perfc_dump(FILE *f)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr_perfc; i++ )
+        fprintf(f, "  %-32s %12"PRIu64"\n", perfc[i].name, perfc[i].count);
+}
+
+/*
+ * Cpumasks
+ */
+const cpumask_t *cpumask_of(unsigned int cpu)
+{
+    static cpumask_t masks[NR_CPUS];
+
+    cpumask_clear(&masks[cpu]);
+    cpumask_set_cpu(cpu, &masks[cpu]);
+    return &masks[cpu];
+}
+
+int cpumask_scnprintf(char *buf, int len, const cpumask_t *m)
+{
+    int i, n = 0;
+
+    if ( len > 0 )
+        buf[0] = '\0';
+    for ( i = BITS_TO_LONGS(nr_cpu_ids) - 1; i >= 0 && n < len; i-- )
+        n += snprintf(buf + n, len - n, "%0*lx%s", (int)BITS_PER_LONG / 4,
+                      m->bits[i], i ? "," : "");
+    return n;
+}
+
+int cpulist_scnprintf(char *buf, int len, const cpumask_t *m)
+{
+    unsigned int cpu, first;
+    int n = 0;
+
+    if ( len > 0 )
+        buf[0] = '\0';
+    for ( cpu = cpumask_first(m); cpu < nr_cpu_ids && n < len; )
+    {
+        first = cpu;
+        while ( cpumask_test_cpu(cpu + 1, m) && cpu + 1 < nr_cpu_ids )
+            cpu++;
+        n += snprintf(buf + n, len - n, "%s%u", n ? "," : "", first);
+        if ( cpu != first && n < len )
+            n += snprintf(buf + n, len - n, "-%u", cpu);
+        cpu = cpumask_next(cpu, m);
+    }
+    return n;
+}
+
+/*
+ * Spinlocks
+ */
+static uint64_t host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void spin_lock_init(spinlock_t *lock)
+{
+    lock->held = 0;
+}
+
+static void lock_acquired(spinlock_t *lock)
+{
+    lock->held = 1;
+    sim_stats.lock_acquisitions++;
+    lock->acquired_ns = host_ns();
+}
+
+void spin_lock(spinlock_t *lock)
+{
+    if ( lock->held )
+        sim_fatal(__FILE__, __LINE__, "deadlock: spinlock already held");
+    lock_acquired(lock);
+}
+
+int spin_trylock(spinlock_t *lock)
+{
+    if ( lock->held )
+    {
+        sim_stats.lock_trylock_failures++;
+        return 0;
+    }
+    lock_acquired(lock);
+    return 1;
+}
+
+void spin_unlock(spinlock_t *lock)
+{
+    uint64_t held;
+    unsigned int bucket = 0;
+
+    if ( !lock->held )
+        sim_fatal(__FILE__, __LINE__, "releasing a free spinlock");
+    lock->held = 0;
+
+    held = host_ns() - lock->acquired_ns;
+    sim_stats.lock_hold_ns += held;
+    if ( held > sim_stats.lock_hold_max_ns )
+        sim_stats.lock_hold_max_ns = held;
+    while ( held >> (bucket + 1) && bucket < SIM_LOG2_BUCKETS - 1 )
+        bucket++;
+    sim_stats.lock_hold_hist[bucket]++;
+}
+
+/*
+ * Timers: a binary min-heap ordered by expiry time.
+ */
+static struct timer **heap;
+static unsigned int heap_size, heap_limit;
+
+/*
+ * On real hardware, a timer set in the past (e.g., a zero length time
+ * slice) fires right away, but some time elapses anyway.  Model that,
+ * or the simulated time would never move forward.
+ */
+static unsigned int sim_timer_min_ns = 1000;
+integer_param("sim_timer_min_ns", sim_timer_min_ns);
+
+#define HEAP_LESS(a, b) (heap[a]->expires < heap[b]->expires)
+
+static void heap_swap(unsigned int a, unsigned int b)
+{
+    struct timer *t = heap[a];
+
+    heap[a] = heap[b];
+    heap[b] = t;
+    heap[a]->heap_offset = a;
+    heap[b]->heap_offset = b;
+}
+
+static void heap_up(unsigned int pos)
+{
+    while ( pos > 1 && HEAP_LESS(pos, pos / 2) )
+    {
+        heap_swap(pos, pos / 2);
+        pos /= 2;
+    }
+}
+
+static void heap_down(unsigned int pos)
+{
+    for ( ; ; )
+    {
+        unsigned int c = pos * 2;
+
+        if ( c > heap_size )
+            break;
+        if ( c + 1 <= heap_size && HEAP_LESS(c + 1, c) )
+            c++;
+        if ( !HEAP_LESS(c, pos) )
+            break;
+        heap_swap(pos, c);
+        pos = c;
+    }
+}
+
+static void heap_remove(struct timer *timer)
+{
+    unsigned int pos = timer->heap_offset;
+
+    timer->heap_offset = 0;
+    timer->status = TIMER_STATUS_inactive;
+    if ( pos != heap_size )
+    {
+        heap[pos] = heap[heap_size];
+        heap[pos]->heap_offset = pos;
+        heap_size--;
+        heap_up(pos);
+        heap_down(pos);
+    }
+    else
+        heap_size--;
+}
+
+void init_timer(struct timer *timer, void (*function)(void *), void *data,
+                unsigned int cpu)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->function = function;
+    timer->data = data;
+    timer->cpu = cpu;
+    timer->status = TIMER_STATUS_inactive;
+}
+
+void set_timer(struct timer *timer, s_time_t expires)
+{
+    if ( timer->status == TIMER_STATUS_killed )
+        return;
+    ASSERT(timer->status != TIMER_STATUS_invalid);
+
+    if ( active_timer(timer) )
+        heap_remove(timer);
+
+    if ( heap_size + 1 >= heap_limit )
+    {
+        heap_limit = heap_limit ? heap_limit * 2 : 1024;
+        heap = realloc(heap, heap_limit * sizeof(*heap));
+        if ( heap == NULL )
+            BUG();
+    }
+
+    if ( expires < sim_now + sim_timer_min_ns )
+        expires = sim_now + sim_timer_min_ns;
+
+    timer->expires = expires;
+    heap[++heap_size] = timer;
+    timer->heap_offset = heap_size;
+    timer->status = TIMER_STATUS_in_heap;
+    heap_up(heap_size);
+}
+
+void stop_timer(struct timer *timer)
+{
+    if ( active_timer(timer) )
+        heap_remove(timer);
+}
+
+void migrate_timer(struct timer *timer, unsigned int new_cpu)
+{
+    timer->cpu = new_cpu;
+}
+
+void kill_timer(struct timer *timer)
+{
+    stop_timer(timer);
+    timer->status = TIMER_STATUS_killed;
+}
+
+s_time_t sim_next_timer(void)
+{
+    return heap_size ? heap[1]->expires : STIME_MAX;
+}
+
+/*
+ * Run all the timers which are due, each on its own cpu. As in the timer
+ * softirq, the IPIs sent by the handlers which run on a cpu are batched.
+ */
+void sim_run_timers(void)
+{
+    cpumask_t batching;
+    unsigned int cpu;
+
+    cpumask_clear(&batching);
+
+    while ( heap_size && heap[1]->expires <= sim_now )
+    {
+        struct timer *t = heap[1];
+
+        heap_remove(t);
+        sim_cpu = t->cpu;
+        if ( !cpumask_test_and_set_cpu(sim_cpu, &batching) )
+            cpu_raise_softirq_batch_begin();
+        sim_stats.timers++;
+        t->function(t->data);
+    }
+
+    for_each_cpu ( cpu, &batching )
+    {
+        sim_cpu = cpu;
+        cpu_raise_softirq_batch_finish();
+    }
+}
+
+/*
+ * Softirqs.  Raising one on another cpu means sending it an IPI, unless
+ * one is pending already. Within a batch, IPIs are collected, and then
+ * sent all together (which counts as one send).
+ */
+static unsigned long softirq_pending[NR_CPUS];
+static softirq_handler softirq_handlers[NR_SOFTIRQS];
+static unsigned int batching[NR_CPUS];
+static cpumask_t batch_mask[NR_CPUS];
+
+void open_softirq(int nr, softirq_handler handler)
+{
+    softirq_handlers[nr] = handler;
+}
+
+static void send_ipis(const cpumask_t *mask)
+{
+    if ( cpumask_empty(mask) )
+        return;
+    sim_stats.ipis += cpumask_weight(mask);
+    sim_stats.ipi_sends++;
+}
+
+void cpumask_raise_softirq(const cpumask_t *mask, unsigned int nr)
+{
+    unsigned int cpu, this_cpu = smp_processor_id();
+    cpumask_t send_mask, *raise_mask = &send_mask;
+
+    if ( batching[this_cpu] )
+        raise_mask = &batch_mask[this_cpu];
+    else
+        cpumask_clear(&send_mask);
+
+    for_each_cpu ( cpu, mask )
+        if ( !test_and_set_bit(nr, &softirq_pending[cpu]) &&
+             cpu != this_cpu )
+            __cpumask_set_cpu(cpu, raise_mask);
+
+    if ( raise_mask == &send_mask )
+        send_ipis(&send_mask);
+}
+
+void cpu_raise_softirq(unsigned int cpu, unsigned int nr)
+{
+    cpumask_raise_softirq(cpumask_of(cpu), nr);
+}
+
+void cpu_raise_softirq_batch_begin(void)
+{
+    batching[smp_processor_id()]++;
+}
+
+void cpu_raise_softirq_batch_finish(void)
+{
+    unsigned int this_cpu = smp_processor_id();
+
+    ASSERT(batching[this_cpu]);
+    send_ipis(&batch_mask[this_cpu]);
+    cpumask_clear(&batch_mask[this_cpu]);
+    batching[this_cpu]--;
+}
+
+void register_cpu_notifier(struct notifier_block *nb)
+{
+    /* The whole topology is known upfront, no cpu ever comes up late. */
+}
+
+/*
+ * Generic scheduling code, as in xen/common/schedule.c
+ */
+static struct scheduler ops;
+
+#define SCHED_OP(opsptr, fn, ...)                                    \
+         (( (opsptr)->fn != NULL ) ? (opsptr)->fn(opsptr, ##__VA_ARGS__ )  \
+          : (typeof((opsptr)->fn(opsptr, ##__VA_ARGS__)))0 )
+
+static void vcpu_runstate_change(struct vcpu *v, int new_state, s_time_t now)
+{
+    v->runstate.state = new_state;
+    v->runstate.state_entry_time = now;
+}
+
+void vcpu_sleep_nosync(struct vcpu *v)
+{
+    unsigned long flags;
+    spinlock_t *lock = vcpu_schedule_lock_irqsave(v, &flags);
+
+    if ( likely(!vcpu_runnable(v)) )
+    {
+        if ( v->runstate.state == RUNSTATE_runnable )
+            vcpu_runstate_change(v, RUNSTATE_offline, NOW());
+
+        SCHED_OP(&ops, sleep, v);
+    }
+
+    vcpu_schedule_unlock_irqrestore(lock, flags, v);
+}
+
+void vcpu_wake_locked(struct vcpu *v)
+{
+    if ( likely(vcpu_runnable(v)) )
+    {
+        if ( v->runstate.state >= RUNSTATE_blocked )
+            vcpu_runstate_change(v, RUNSTATE_runnable, NOW());
+        SCHED_OP(&ops, wake, v);
+    }
+    else if ( !test_bit(_VPF_blocked, &v->pause_flags) )
+    {
+        if ( v->runstate.state == RUNSTATE_blocked )
+            vcpu_runstate_change(v, RUNSTATE_offline, NOW());
+    }
+}
+
+void vcpu_wake(struct vcpu *v)
+{
+    unsigned long flags;
+    spinlock_t *lock;
+
+    if ( !SCHED_OP(&ops, wake_nolock, v) )
+    {
+        lock = vcpu_schedule_lock_irqsave(v, &flags);
+        vcpu_wake_locked(v);
+        vcpu_schedule_unlock_irqrestore(lock, flags, v);
+    }
+}
+
+void vcpu_pause_nosync(struct vcpu *v)
+{
+    atomic_inc(&v->pause_count);
+    vcpu_sleep_nosync(v);
+}
+
+void vcpu_unpause(struct vcpu *v)
+{
+    if ( atomic_dec_and_test(&v->pause_count) )
+        vcpu_wake(v);
+}
+
+static void sched_spin_lock_double(spinlock_t *lock1, spinlock_t *lock2,
+                                   unsigned long *flags)
+{
+    if ( lock1 == lock2 )
+        spin_lock_irqsave(lock1, *flags);
+    else if ( lock1 < lock2 )
+    {
+        spin_lock_irqsave(lock1, *flags);
+        spin_lock(lock2);
+    }
+    else
+    {
+        spin_lock_irqsave(lock2, *flags);
+        spin_lock(lock1);
+    }
+}
+
+static void sched_spin_unlock_double(spinlock_t *lock1, spinlock_t *lock2,
+                                     unsigned long flags)
+{
+    if ( lock1 != lock2 )
+        spin_unlock(lock2);
+    spin_unlock_irqrestore(lock1, flags);
+}
+
+static void vcpu_migrate(struct vcpu *v)
+{
+    unsigned long flags;
+    unsigned int old_cpu, new_cpu;
+    spinlock_t *old_lock, *new_lock;
+
+    /* Nothing can change under our feet, so one round is enough. */
+    old_cpu = v->processor;
+    old_lock = per_cpu(schedule_data, old_cpu).schedule_lock;
+    spin_lock_irqsave(old_lock, flags);
+    new_cpu = SCHED_OP(&ops, pick_cpu, v);
+    spin_unlock_irqrestore(old_lock, flags);
+
+    new_lock = per_cpu(schedule_data, new_cpu).schedule_lock;
+    sched_spin_lock_double(old_lock, new_lock, &flags);
+
+    if ( v->is_running ||
+         !test_and_clear_bit(_VPF_migrating, &v->pause_flags) )
+    {
+        sched_spin_unlock_double(old_lock, new_lock, flags);
+        return;
+    }
+
+    if ( ops.migrate )
+        SCHED_OP(&ops, migrate, v, new_cpu);
+    else
+        v->processor = new_cpu;
+
+    sched_spin_unlock_double(old_lock, new_lock, flags);
+
+    vcpu_wake(v);
+}
+
+static void context_saved(struct vcpu *prev)
+{
+    prev->is_running = 0;
+
+    SCHED_OP(&ops, context_saved, prev);
+
+    if ( unlikely(test_bit(_VPF_migrating, &prev->pause_flags)) )
+        vcpu_migrate(prev);
+}
+
+static void schedule(void)
+{
+    unsigned int cpu = smp_processor_id();
+    struct vcpu *prev = current, *next;
+    s_time_t now = NOW();
+    struct schedule_data *sd = &this_cpu(schedule_data);
+    struct task_slice next_slice;
+    spinlock_t *lock;
+
+    sim_stats.schedules++;
+
+    lock = pcpu_schedule_lock_irq(cpu);
+
+    stop_timer(&sd->s_timer);
+
+    next_slice = ops.do_schedule(&ops, now, 0);
+    next = next_slice.task;
+    sd->curr = next;
+
+    if ( next_slice.time >= 0 )
+        set_timer(&sd->s_timer, now + next_slice.time);
+
+    if ( prev == next )
+    {
+        pcpu_schedule_unlock_irq(lock, cpu);
+        return;
+    }
+
+    vcpu_runstate_change(
+        prev,
+        (test_bit(_VPF_blocked, &prev->pause_flags) ? RUNSTATE_blocked :
+         (vcpu_runnable(prev) ? RUNSTATE_runnable : RUNSTATE_offline)),
+        now);
+    prev->last_run_time = now;
+
+    ASSERT(next->runstate.state != RUNSTATE_running);
+    vcpu_runstate_change(next, RUNSTATE_running, now);
+
+    ASSERT(!next->is_running);
+    next->is_running = 1;
+
+    pcpu_schedule_unlock_irq(lock, cpu);
+
+    sim_stats.context_switches++;
+
+    /* The context switch proper */
+    this_cpu(curr_vcpu) = next;
+    sim_vcpu_descheduled(prev, cpu);
+    sim_vcpu_scheduled(next, cpu);
+
+    context_saved(prev);
+}
+
+/*
+ * Run the softirqs (the scheduler, mostly) on all the cpus that have been
+ * asked to. Timers are dealt with by sim_run_timers().
+ */
+void sim_do_softirqs(void)
+{
+    unsigned int cpu, nr, rounds = 0;
+    bool_t again;
+
+    do {
+        again = 0;
+        for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        {
+            for ( nr = TIMER_SOFTIRQ + 1; nr < NR_SOFTIRQS; nr++ )
+            {
+                if ( !test_and_clear_bit(nr, &softirq_pending[cpu]) )
+                    continue;
+                sim_cpu = cpu;
+                softirq_handlers[nr]();
+                again = 1;
+                break;
+            }
+        }
+        if ( ++rounds > 1000 * nr_cpu_ids )
+            sim_fatal(__FILE__, __LINE__, "scheduler softirq livelock");
+    } while ( again );
+}
+
+static void s_timer_fn(void *unused)
+{
+    raise_softirq(SCHEDULE_SOFTIRQ);
+}
+
+static int sched_init_vcpu(struct vcpu *v, unsigned int processor)
+{
+    struct domain *d = v->domain;
+
+    v->processor = processor;
+    if ( is_idle_domain(d) )
+        cpumask_copy(v->cpu_hard_affinity, cpumask_of(processor));
+    else
+        cpumask_setall(v->cpu_hard_affinity);
+    cpumask_setall(v->cpu_soft_affinity);
+
+    if ( is_idle_domain(d) )
+    {
+        per_cpu(schedule_data, v->processor).curr = v;
+        per_cpu(curr_vcpu, v->processor) = v;
+        v->is_running = 1;
+        vcpu_runstate_change(v, RUNSTATE_running, NOW());
+    }
+    else
+        vcpu_runstate_change(v, RUNSTATE_offline, NOW());
+
+    v->sched_priv = SCHED_OP(&ops, alloc_vdata, v, d->sched_priv);
+    if ( v->sched_priv == NULL )
+        return -ENOMEM;
+
+    SCHED_OP(&ops, insert_vcpu, v);
+
+    return 0;
+}
+
+static struct vcpu *alloc_vcpu(struct domain *d, unsigned int vcpu_id,
+                               unsigned int cpu)
+{
+    struct vcpu *v = xzalloc(struct vcpu);
+
+    if ( v == NULL )
+        return NULL;
+
+    v->domain = d;
+    v->vcpu_id = vcpu_id;
+    d->vcpu[vcpu_id] = v;
+    if ( vcpu_id != 0 && !is_idle_domain(d) )
+        d->vcpu[vcpu_id - 1]->next_in_list = v;
+
+    /* Guest vcpus start blocked, waiting for their first bit of work. */
+    if ( !is_idle_domain(d) )
+        v->pause_flags = VPF_blocked;
+
+    if ( sched_init_vcpu(v, cpu) )
+    {
+        xfree(v);
+        return NULL;
+    }
+
+    return v;
+}
+
+int sim_scheduler_init(const struct scheduler *sched)
+{
+    static struct domain idle_domain;
+    static struct cpupool pool0;
+    unsigned int cpu;
+
+    open_softirq(SCHEDULE_SOFTIRQ, schedule);
+    if ( sched->global_init && sched->global_init() < 0 )
+        return -1;
+    ops = *sched;
+
+    cpupool0 = &pool0;
+    pool0.sched = &ops;
+    cpumask_copy(pool0.cpu_valid, &cpu_online_map);
+
+    for_each_online_cpu ( cpu )
+    {
+        struct schedule_data *sd = &per_cpu(schedule_data, cpu);
+
+        per_cpu(scheduler, cpu) = &ops;
+        per_cpu(cpupool, cpu) = cpupool0;
+        spin_lock_init(&sd->_lock);
+        sd->schedule_lock = &sd->_lock;
+        init_timer(&sd->s_timer, s_timer_fn, NULL, cpu);
+    }
+
+    if ( SCHED_OP(&ops, init) )
+        return -1;
+
+    idle_domain.domain_id = DOMID_IDLE;
+    idle_domain.vcpu = idle_vcpu;
+    idle_domain.max_vcpus = nr_cpu_ids;
+
+    for_each_online_cpu ( cpu )
+    {
+        struct schedule_data *sd = &per_cpu(schedule_data, cpu);
+
+        if ( alloc_vcpu(&idle_domain, cpu, cpu) == NULL )
+            return -1;
+        if ( ops.alloc_pdata &&
+             (sd->sched_priv = ops.alloc_pdata(&ops, cpu)) == NULL )
+            return -1;
+    }
+
+    return 0;
+}
+
+const struct scheduler *sim_scheduler(void)
+{
+    return &ops;
+}
+
+struct domain *sim_domain_create(domid_t domid, unsigned int nr_vcpus)
+{
+    struct domain *d = xzalloc(struct domain);
+    unsigned int i;
+
+    if ( d == NULL )
+        return NULL;
+    d->domain_id = domid;
+    d->max_vcpus = nr_vcpus;
+    d->cpupool = cpupool0;
+    d->vcpu = xzalloc_array(struct vcpu *, nr_vcpus);
+    if ( d->vcpu == NULL || SCHED_OP(&ops, init_domain, d) )
+        return NULL;
+    cpupool0->n_dom++;
+
+    for ( i = 0; i < nr_vcpus; i++ )
+        if ( alloc_vcpu(d, i, (domid + i) % nr_cpu_ids) == NULL )
+            return NULL;
+
+    return d;
+}
+
+int sim_domain_adjust(struct domain *d, struct xen_domctl_scheduler_op *op)
+{
+    op->sched_id = ops.sched_id;
+    op->cmd = XEN_DOMCTL_SCHEDOP_putinfo;
+    return SCHED_OP(&ops, adjust, d, op);
+}
+
+void sim_dump(void)
+{
+    unsigned int cpu;
+    int verbose = sim_verbose;
+
+    sim_verbose = 1;
+    /* As in schedule_dump(), locking is up to the scheduler. */
+    SCHED_OP(&ops, dump_settings);
+    for_each_online_cpu ( cpu )
+    {
+        printk("CPU[%02d] ", cpu);
+        SCHED_OP(&ops, dump_cpu_state, cpu);
+    }
+    sim_verbose = verbose;
+}
@@ -0,0 +1,712 @@
+/*
+ * Xen emulation for the userspace scheduler simulator
+ *
+ * Just enough of the hypervisor environment (cpumasks, per-cpu data,
+ * spinlocks, timers, softirqs, vcpus and domains) to build
+ * xen/common/sched_*.c unmodified as ordinary userspace code.
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License Version 2 (GPLv2)
+ * as published by the Free Software Foundation.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details. <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SCHED_SIM_H__
+#define __SCHED_SIM_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+
+#include <public/xen.h>
+#include <public/domctl.h>
+#include <public/sysctl.h>
+
+#define NR_CPUS 256
+
+typedef int64_t s_time_t;
+typedef int bool_t;
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define PRI_stime PRId64
+#define STIME_MAX ((s_time_t)((uint64_t)~0ull>>1))
+
+#define SECONDS(_s)     ((s_time_t)((_s)  * 1000000000ULL))
+#define MILLISECS(_ms)  ((s_time_t)((_ms) * 1000000ULL))
+#define MICROSECS(_us)  ((s_time_t)((_us) * 1000ULL))
+
+/*
+ * Compiler and boot time annotations
+ */
+#define __init
+#define __initdata
+#define __read_mostly
+#define __maybe_unused __attribute__((__unused__))
+#define __cacheline_aligned
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+#define min(x, y) ({ typeof(x) _x = (x); typeof(y) _y = (y); \
+                     _x < _y ? _x : _y; })
+#define max(x, y) ({ typeof(x) _x = (x); typeof(y) _y = (y); \
+                     _x > _y ? _x : _y; })
+#define min_t(type, x, y) ({ type _x = (x); type _y = (y); \
+                             _x < _y ? _x : _y; })
+#define max_t(type, x, y) ({ type _x = (x); type _y = (y); \
+                             _x > _y ? _x : _y; })
+
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define do_div(n, base) ({                      \
+    uint32_t __base = (base);                   \
+    uint32_t __rem = (uint64_t)(n) % __base;    \
+    (n) = (uint64_t)(n) / __base;               \
+    __rem;                                      \
+})
+
+#define smp_mb()  __sync_synchronize()
+#define xchg(ptr, v) __atomic_exchange_n(ptr, v, __ATOMIC_SEQ_CST)
+#define cmpxchg(ptr, o, n) ({                                           \
+    __typeof__(*(ptr)) __o = (o);                                       \
+    __atomic_compare_exchange_n(ptr, &__o, n, 0, __ATOMIC_SEQ_CST,      \
+                                __ATOMIC_SEQ_CST);                      \
+    __o;                                                                \
+})
+#define smp_wmb() __sync_synchronize()
+#define smp_rmb() __sync_synchronize()
+#define barrier() __asm__ __volatile__("" : : : "memory")
+#define cpu_relax() barrier()
+
+/*
+ * Diagnostics
+ */
+extern int sim_verbose;
+void sim_fatal(const char *file, int line, const char *what)
+    __attribute__((__noreturn__));
+
+#define printk(fmt, args...) \
+    do { if ( sim_verbose ) printf(fmt, ## args); } while ( 0 )
+#define XENLOG_ERR     "<E>"
+#define XENLOG_WARNING "<W>"
+#define XENLOG_INFO    "<I>"
+#define XENLOG_DEBUG   "<D>"
+#define XENLOG_G_WARNING XENLOG_WARNING
+#define XENLOG_G_INFO    XENLOG_INFO
+#define XENLOG_G_DEBUG   XENLOG_DEBUG
+
+#define BUG() sim_fatal(__FILE__, __LINE__, "BUG")
+#define BUG_ON(p) do { if ( unlikely(p) ) sim_fatal(__FILE__, __LINE__, #p); } while ( 0 )
+#define ASSERT(p) BUG_ON(!(p))
+#define WARN_ON(p) ({ bool_t __w = !!(p);                               \
+    if ( unlikely(__w) )                                                \
+        fprintf(stderr, "WARN_ON(%s) at %s:%d\n", #p, __FILE__, __LINE__); \
+    __w; })
+#define WARN() WARN_ON(1)
+#define panic(fmt, args...) \
+    do { fprintf(stderr, fmt, ## args); BUG(); } while ( 0 )
+
+/*
+ * Boot parameters: registered at startup, so the simulator can set them
+ * from its own command line (e.g. "-o sched_credit_tslice_ms=5").
+ */
+enum sim_param_type { SIM_PARAM_INT, SIM_PARAM_BOOL, SIM_PARAM_STR,
+                      SIM_PARAM_CUSTOM };
+void sim_register_param(const char *name, enum sim_param_type type,
+                        void *var, size_t size);
+
+#define __sim_param(_name, _type, _var, _size)                          \
+    static void __attribute__((__constructor__))                        \
+    __sim_param_##_var(void)                                            \
+    {                                                                   \
+        sim_register_param(_name, _type, (void *)&(_var), _size);       \
+    }
+#define integer_param(_name, _var) \
+    __sim_param(_name, SIM_PARAM_INT, _var, sizeof(_var))
+#define boolean_param(_name, _var) \
+    __sim_param(_name, SIM_PARAM_BOOL, _var, sizeof(_var))
+#define string_param(_name, _var) \
+    __sim_param(_name, SIM_PARAM_STR, _var, sizeof(_var))
+#define custom_param(_name, _fn) \
+    __sim_param(_name, SIM_PARAM_CUSTOM, _fn, 0)
+
+/*
+ * Bitops.  Everything runs on one host thread, so none of these need
+ * to be atomic.
+ */
+#define BITS_PER_LONG (sizeof(long) * 8)
+#define BITS_TO_LONGS(bits) \
+    (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits) \
+    unsigned long name[BITS_TO_LONGS(bits)]
+
+#define __bit_word(nr, addr) (((unsigned long *)(addr))[(nr) / BITS_PER_LONG])
+#define __bit_mask(nr)       (1UL << ((nr) % BITS_PER_LONG))
+
+#define test_bit(nr, addr) \
+    (!!(__bit_word(nr, addr) & __bit_mask(nr)))
+#define set_bit(nr, addr) \
+    ((void)(__bit_word(nr, addr) |= __bit_mask(nr)))
+#define clear_bit(nr, addr) \
+    ((void)(__bit_word(nr, addr) &= ~__bit_mask(nr)))
+#define __set_bit   set_bit
+#define __clear_bit clear_bit
+#define test_and_set_bit(nr, addr) ({                   \
+    int __old = test_bit(nr, addr); set_bit(nr, addr); __old; })
+#define test_and_clear_bit(nr, addr) ({                 \
+    int __old = test_bit(nr, addr); clear_bit(nr, addr); __old; })
+#define __test_and_set_bit   test_and_set_bit
+#define __test_and_clear_bit test_and_clear_bit
+
+typedef struct { int counter; } atomic_t;
+#define ATOMIC_INIT(i)        { (i) }
+#define atomic_read(v)        ((v)->counter)
+#define atomic_set(v, i)      ((v)->counter = (i))
+#define atomic_inc(v)         ((void)((v)->counter++))
+#define atomic_dec(v)         ((void)((v)->counter--))
+#define atomic_add(i, v)      ((void)((v)->counter += (i)))
+#define atomic_sub(i, v)      ((void)((v)->counter -= (i)))
+#define atomic_inc_return(v)  (++(v)->counter)
+#define atomic_dec_and_test(v) (--(v)->counter == 0)
+
+/*
+ * Cpumasks
+ */
+extern unsigned int nr_cpu_ids;
+
+typedef struct cpumask {
+    DECLARE_BITMAP(bits, NR_CPUS);
+} cpumask_t;
+typedef cpumask_t cpumask_var_t[1];
+
+#define cpumask_bits(m) ((m)->bits)
+
+static inline void cpumask_set_cpu(int cpu, cpumask_t *m)
+{
+    set_bit(cpu, m->bits);
+}
+
+static inline void cpumask_clear_cpu(int cpu, cpumask_t *m)
+{
+    clear_bit(cpu, m->bits);
+}
+
+#define __cpumask_set_cpu(cpu, m) cpumask_set_cpu(cpu, m)
+#define __cpumask_clear_cpu(cpu, m) cpumask_clear_cpu(cpu, m)
+#define cpumask_test_cpu(cpu, m) test_bit(cpu, (m)->bits)
+#define cpumask_test_and_set_cpu(cpu, m) test_and_set_bit(cpu, (m)->bits)
+#define cpumask_test_and_clear_cpu(cpu, m) test_and_clear_bit(cpu, (m)->bits)
+
+#define __cpumask_op(_name, _expr)                                      \
+static inline void cpumask_##_name(cpumask_t *d, const cpumask_t *s1,   \
+                                   const cpumask_t *s2)                 \
+{                                                                       \
+    unsigned int i;                                                     \
+    for ( i = 0; i < BITS_TO_LONGS(NR_CPUS); i++ )                      \
+        d->bits[i] = (_expr);                                           \
+}
+__cpumask_op(and,    s1->bits[i] & s2->bits[i])
+__cpumask_op(or,     s1->bits[i] | s2->bits[i])
+__cpumask_op(xor,    s1->bits[i] ^ s2->bits[i])
+__cpumask_op(andnot, s1->bits[i] & ~s2->bits[i])
+#undef __cpumask_op
+
+static inline void cpumask_copy(cpumask_t *d, const cpumask_t *s)
+{
+    *d = *s;
+}
+
+static inline void cpumask_clear(cpumask_t *m)
+{
+    memset(m, 0, sizeof(*m));
+}
+
+static inline void cpumask_setall(cpumask_t *m)
+{
+    unsigned int i;
+
+    cpumask_clear(m);
+    for ( i = 0; i < nr_cpu_ids; i++ )
+        cpumask_set_cpu(i, m);
+}
+
+static inline unsigned int cpumask_next(int n, const cpumask_t *m)
+{
+    for ( n++; n < (int)nr_cpu_ids; n++ )
+        if ( cpumask_test_cpu(n, m) )
+            return n;
+    return nr_cpu_ids;
+}
+
+#define cpumask_first(m) cpumask_next(-1, m)
+
+static inline unsigned int cpumask_last(const cpumask_t *m)
+{
+    int n;
+
+    for ( n = nr_cpu_ids - 1; n >= 0; n-- )
+        if ( cpumask_test_cpu(n, m) )
+            return n;
+    return nr_cpu_ids;
+}
+
+static inline unsigned int cpumask_cycle(int n, const cpumask_t *m)
+{
+    unsigned int nxt = cpumask_next(n, m);
+
+    if ( nxt == nr_cpu_ids )
+        nxt = cpumask_first(m);
+    return nxt;
+}
+
+#define cpumask_any(m) cpumask_first(m)
+
+static inline unsigned int cpumask_weight(const cpumask_t *m)
+{
+    unsigned int i, w = 0;
+
+    for ( i = 0; i < BITS_TO_LONGS(NR_CPUS); i++ )
+        w += __builtin_popcountl(m->bits[i]);
+    return w;
+}
+
+static inline int cpumask_empty(const cpumask_t *m)
+{
+    return cpumask_weight(m) == 0;
+}
+
+static inline int cpumask_full(const cpumask_t *m)
+{
+    return cpumask_weight(m) == nr_cpu_ids;
+}
+
+static inline int cpumask_equal(const cpumask_t *a, const cpumask_t *b)
+{
+    return !memcmp(a, b, sizeof(*a));
+}
+
+static inline int cpumask_intersects(const cpumask_t *a, const cpumask_t *b)
+{
+    unsigned int i;
+
+    for ( i = 0; i < BITS_TO_LONGS(NR_CPUS); i++ )
+        if ( a->bits[i] & b->bits[i] )
+            return 1;
+    return 0;
+}
+
+static inline int cpumask_subset(const cpumask_t *a, const cpumask_t *b)
+{
+    unsigned int i;
+
+    for ( i = 0; i < BITS_TO_LONGS(NR_CPUS); i++ )
+        if ( a->bits[i] & ~b->bits[i] )
+            return 0;
+    return 1;
+}
+
+const cpumask_t *cpumask_of(unsigned int cpu);
+int cpumask_scnprintf(char *buf, int len, const cpumask_t *m);
+int cpulist_scnprintf(char *buf, int len, const cpumask_t *m);
+
+#define for_each_cpu(cpu, m)                    \
+    for ( (cpu) = cpumask_first(m);             \
+          (cpu) < nr_cpu_ids;                   \
+          (cpu) = cpumask_next(cpu, m) )
+
+extern cpumask_t cpu_online_map;
+#define for_each_online_cpu(cpu) for_each_cpu(cpu, &cpu_online_map)
+
+/*
+ * Per-cpu data, and the (simulated) cpu we are running on
+ */
+#define DECLARE_PER_CPU(type, name) extern __typeof__(type) per_cpu__##name[NR_CPUS]
+#define DEFINE_PER_CPU(type, name) __typeof__(type) per_cpu__##name[NR_CPUS]
+#define per_cpu(name, cpu) (per_cpu__##name[cpu])
+#define this_cpu(name) per_cpu(name, smp_processor_id())
+
+extern unsigned int sim_cpu;
+#define smp_processor_id() (sim_cpu)
+
+DECLARE_PER_CPU(cpumask_var_t, cpu_sibling_mask);
+DECLARE_PER_CPU(cpumask_var_t, cpu_core_mask);
+
+/* Not sized dynamically, so these never fail. */
+#define alloc_cpumask_var(m) ({ (void)(m); 1; })
+#define zalloc_cpumask_var(m) ({ cpumask_clear(*(m)); 1; })
+#define free_cpumask_var(m) ((void)(m))
+
+/* Nodes */
+#define MAX_NUMNODES 64
+typedef struct { unsigned long bits[1]; } nodemask_t;
+extern nodemask_t node_online_map;
+extern cpumask_t sim_node_to_cpumask[MAX_NUMNODES];
+#define node_to_cpumask(node) (sim_node_to_cpumask[node])
+
+static inline unsigned int cycle_node(int n, nodemask_t m)
+{
+    unsigned int i;
+
+    for ( i = 1; i <= MAX_NUMNODES; i++ )
+        if ( test_bit((n + i) % MAX_NUMNODES, m.bits) )
+            return (n + i) % MAX_NUMNODES;
+    return MAX_NUMNODES;
+}
+
+extern int sched_smt_power_savings;
+
+/* Simulated topology */
+extern unsigned int sim_cpu_core[NR_CPUS], sim_cpu_socket[NR_CPUS],
+    sim_cpu_node[NR_CPUS];
+#define cpu_to_core(cpu)   (sim_cpu_core[cpu])
+#define cpu_to_socket(cpu) (sim_cpu_socket[cpu])
+#define cpu_to_node(cpu)   (sim_cpu_node[cpu])
+#define XEN_INVALID_SOCKET_ID (~0U)
+#define NUMA_NO_NODE 0xFF
+
+/*
+ * Spinlocks.  There is only one host thread, so a lock that is already
+ * held means a (simulated) deadlock or recursion, which we report.
+ * Hold times are measured in host time, to expose the cost of the code
+ * run under each lock.
+ */
+typedef struct {
+    int held;
+    uint64_t acquired_ns;
+} spinlock_t;
+
+#define SPIN_LOCK_UNLOCKED { 0, 0 }
+#define DEFINE_SPINLOCK(l) spinlock_t l = SPIN_LOCK_UNLOCKED
+
+void spin_lock_init(spinlock_t *lock);
+void spin_lock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+int spin_trylock(spinlock_t *lock);
+#define spin_is_locked(l) ((l)->held)
+#define spin_lock_irq(l) spin_lock(l)
+#define spin_unlock_irq(l) spin_unlock(l)
+#define spin_lock_irqsave(l, f) ((void)((f) = 0), spin_lock(l))
+#define spin_unlock_irqrestore(l, f) ((void)(f), spin_unlock(l))
+
+/* No readers can ever race with a writer here. */
+typedef spinlock_t rwlock_t;
+#define rwlock_init(l) spin_lock_init(l)
+#define read_lock(l) spin_lock(l)
+#define read_unlock(l) spin_unlock(l)
+#define write_lock(l) spin_lock(l)
+#define write_unlock(l) spin_unlock(l)
+#define write_lock_irqsave(l, f) spin_lock_irqsave(l, f)
+#define write_unlock_irqrestore(l, f) spin_unlock_irqrestore(l, f)
+
+/*
+ * Memory allocation
+ */
+#define xmalloc(_type) ((_type *)malloc(sizeof(_type)))
+#define xzalloc(_type) ((_type *)calloc(1, sizeof(_type)))
+#define xmalloc_array(_type, _num) ((_type *)malloc(sizeof(_type) * (_num)))
+#define xzalloc_array(_type, _num) ((_type *)calloc(_num, sizeof(_type)))
+#define xfree(p) free(p)
+
+/*
+ * Lists
+ */
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+    list->next = list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+                              struct list_head *next)
+{
+    next->prev = new;
+    new->next = next;
+    new->prev = prev;
+    prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+    __list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+    __list_add(new, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    entry->next = entry->prev = NULL;
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    INIT_LIST_HEAD(entry);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+    return head->next == head;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+    list_entry((ptr)->next, type, member)
+#define list_for_each(pos, head) \
+    for ( pos = (head)->next; pos != (head); pos = pos->next )
+#define list_for_each_safe(pos, n, head) \
+    for ( pos = (head)->next, n = pos->next; pos != (head); \
+          pos = n, n = pos->next )
+#define list_for_each_entry(pos, head, member)                          \
+    for ( pos = list_entry((head)->next, typeof(*pos), member);         \
+          &pos->member != (head);                                       \
+          pos = list_entry(pos->member.next, typeof(*pos), member) )
+
+/*
+ * Time and timers
+ */
+extern s_time_t sim_now;
+#define NOW() (sim_now)
+
+struct timer {
+    s_time_t expires;
+    void (*function)(void *);
+    void *data;
+    unsigned int cpu;
+    int heap_offset;            /* 0 if inactive */
+#define TIMER_STATUS_invalid  0
+#define TIMER_STATUS_inactive 1
+#define TIMER_STATUS_killed   2
+#define TIMER_STATUS_in_heap  3
+    uint8_t status;
+};
+
+void init_timer(struct timer *timer, void (*function)(void *), void *data,
+                unsigned int cpu);
+void set_timer(struct timer *timer, s_time_t expires);
+void stop_timer(struct timer *timer);
+void migrate_timer(struct timer *timer, unsigned int new_cpu);
+void kill_timer(struct timer *timer);
+#define active_timer(t) ((t)->heap_offset != 0)
+
+/*
+ * Softirqs
+ */
+enum {
+    TIMER_SOFTIRQ = 0,
+    SCHED_WAKE_SOFTIRQ,
+    SCHEDULE_SOFTIRQ,
+    NR_SOFTIRQS
+};
+
+typedef void (*softirq_handler)(void);
+
+void open_softirq(int nr, softirq_handler handler);
+void cpu_raise_softirq(unsigned int cpu, unsigned int nr);
+void cpumask_raise_softirq(const cpumask_t *mask, unsigned int nr);
+void cpu_raise_softirq_batch_begin(void);
+void cpu_raise_softirq_batch_finish(void);
+#define raise_softirq(nr) cpu_raise_softirq(smp_processor_id(), nr)
+
+#define NOTIFY_DONE 0
+#define notifier_from_errno(e) (e)
+#define CPU_STARTING 0
+#define CPU_UP_PREPARE 1
+#define CPU_DEAD 2
+struct notifier_block {
+    int (*notifier_call)(struct notifier_block *, unsigned long, void *);
+};
+void register_cpu_notifier(struct notifier_block *nb);
+
+enum { SYS_STATE_early_boot, SYS_STATE_boot, SYS_STATE_active,
+       SYS_STATE_suspend, SYS_STATE_resume };
+extern int system_state;
+
+/*
+ * Tracing and statistics.  Perf counters are gathered per name, and
+ * shown in the final report.
+ */
+#define TRACE_0D(e)                 ((void)(e))
+#define TRACE_1D(e, ...)            ((void)(e))
+#define TRACE_2D(e, ...)            ((void)(e))
+#define TRACE_3D(e, ...)            ((void)(e))
+#define TRACE_4D(e, ...)            ((void)(e))
+#define TRACE_5D(e, ...)            ((void)(e))
+#define __trace_var(e, c, s, p)     ((void)(e), (void)(p))
+#define trace_var(e, c, s, p)       ((void)(e), (void)(p))
+#define tb_init_done 0
+
+#define TRC_SCHED_CLASS_EVT(_c, _e) (_e)
+
+void sim_perfc_incr(const char *name);
+#define SCHED_STAT_CRANK(x) sim_perfc_incr(#x)
+#define perfc_incr(x) sim_perfc_incr(#x)
+
+extern char keyhandler_scratch[1024];
+
+/*
+ * Guest handles, for the *_cntl hooks.  Nothing is ever copied across
+ * a guest boundary in the simulator.
+ */
+#define copy_to_guest(h, p, n) ((void)(h), (void)(p), 0)
+#define copy_from_guest(p, h, n) ((void)(h), (void)(p), 0)
+#define copy_to_guest_offset(h, o, p, n) ((void)(h), (void)(p), 0)
+#define copy_from_guest_offset(p, h, o, n) ((void)(h), (void)(p), 0)
+#define __copy_to_guest(h, p, n) copy_to_guest(h, p, n)
+#define __copy_from_guest(p, h, n) copy_from_guest(p, h, n)
+#define guest_handle_is_null(h) 1
+
+#define ENOMEM 12
+#define EFAULT 14
+#define EINVAL 22
+#define ERANGE 34
+
+/*
+ * Domains and vcpus
+ */
+#define _VPF_blocked   0
+#define VPF_blocked    (1UL<<_VPF_blocked)
+#define _VPF_down      1
+#define VPF_down       (1UL<<_VPF_down)
+#define _VPF_migrating 3
+#define VPF_migrating  (1UL<<_VPF_migrating)
+
+#define RUNSTATE_running  0
+#define RUNSTATE_runnable 1
+#define RUNSTATE_blocked  2
+#define RUNSTATE_offline  3
+
+struct sim_vcpu;
+
+struct vcpu {
+    int vcpu_id;
+    int processor;
+    struct domain *domain;
+    struct vcpu *next_in_list;
+    void *sched_priv;
+
+    bool_t is_running;
+    bool_t is_urgent;
+    unsigned long pause_flags;
+    atomic_t pause_count;
+
+    s_time_t last_run_time;
+    struct {
+        int state;
+        s_time_t state_entry_time;
+    } runstate;
+
+    cpumask_var_t cpu_hard_affinity;
+    cpumask_var_t cpu_soft_affinity;
+
+    /* Simulator private: workload and statistics. */
+    struct sim_vcpu *sim;
+};
+
+struct domain {
+    domid_t domain_id;
+    unsigned int max_vcpus;
+    struct vcpu **vcpu;
+    void *sched_priv;
+    struct cpupool *cpupool;
+    atomic_t pause_count;
+    struct domain *next_in_list;
+};
+
+#define for_each_vcpu(_d, _v)                   \
+    for ( (_v) = (_d)->vcpu ? (_d)->vcpu[0] : NULL; \
+          (_v) != NULL;                         \
+          (_v) = (_v)->next_in_list )
+
+extern struct vcpu *idle_vcpu[NR_CPUS];
+#define is_idle_domain(d) ((d)->domain_id == DOMID_IDLE)
+#define is_idle_vcpu(v)   (is_idle_domain((v)->domain))
+
+static inline int vcpu_runnable(struct vcpu *v)
+{
+    return !(v->pause_flags |
+             atomic_read(&v->pause_count) |
+             atomic_read(&v->domain->pause_count));
+}
+
+/* The vcpu whose context is loaded on the current (simulated) cpu. */
+DECLARE_PER_CPU(struct vcpu *, curr_vcpu);
+#define current (this_cpu(curr_vcpu))
+
+void vcpu_pause_nosync(struct vcpu *v);
+void vcpu_unpause(struct vcpu *v);
+
+void vcpu_wake(struct vcpu *v);
+void vcpu_sleep_nosync(struct vcpu *v);
+
+/* Provided by sched_credit.c, but normally declared in xen/sched.h. */
+void set_vcpu_migration_delay(unsigned int delay);
+unsigned int get_vcpu_migration_delay(void);
+
+/* Red-black trees come straight from xen/common/rbtree.c. */
+#define EXPORT_SYMBOL(sym)
+#include "rbtree.h"
+
+#include "sched-if.h"
+
+/*
+ * Simulator core (sim.c), used by the workload driver (main.c)
+ */
+#define SIM_LOG2_BUCKETS 48
+
+struct sim_stats {
+    uint64_t schedules, context_switches, timers;
+    uint64_t ipis, ipi_sends;   /* target cpus, and (multicast) sends */
+    uint64_t lock_acquisitions, lock_trylock_failures;
+    uint64_t lock_hold_ns, lock_hold_max_ns;
+    uint64_t lock_hold_hist[SIM_LOG2_BUCKETS]; /* log2(ns) buckets */
+};
+extern struct sim_stats sim_stats;
+
+void sim_perfc_dump(FILE *f);
+int sim_set_param(const char *opt);
+void sim_list_params(FILE *f);
+
+s_time_t sim_next_timer(void);
+void sim_run_timers(void);
+void sim_do_softirqs(void);
+
+int sim_scheduler_init(const struct scheduler *sched);
+const struct scheduler *sim_scheduler(void);
+struct domain *sim_domain_create(domid_t domid, unsigned int nr_vcpus);
+int sim_domain_adjust(struct domain *d, struct xen_domctl_scheduler_op *op);
+void sim_dump(void);
+
+/* Context switch hooks, provided by the workload driver. */
+void sim_vcpu_descheduled(struct vcpu *v, unsigned int cpu);
+void sim_vcpu_scheduled(struct vcpu *v, unsigned int cpu);
+
+#endif /* __SCHED_SIM_H__ */
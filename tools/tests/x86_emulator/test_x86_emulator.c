@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
 #include <xen/xen.h>
 #include <sys/mman.h>
 
@@ -163,6 +164,251 @@ static struct x86_emulate_ops emulops = {
     .get_fpu    = get_fpu,
 };
 
+static struct x86_insn_cache insn_cache;
+
+/*
+ * Accesses seen by the emulator, for checking the decode-free MOV
+ * recognition (used for APIC accesses) against the full emulation.
+ */
+static struct {
+    unsigned int reads, writes, bytes;
+    uint32_t val;
+} mmio;
+
+static int mmio_read(
+    unsigned int seg,
+    unsigned long offset,
+    void *p_data,
+    unsigned int bytes,
+    struct x86_emulate_ctxt *ctxt)
+{
+    mmio.reads++;
+    mmio.bytes = bytes;
+    memset(p_data, 0, bytes);
+    memcpy(p_data, &mmio.val, bytes < 4 ? bytes : 4);
+    return X86EMUL_OKAY;
+}
+
+static int mmio_write(
+    unsigned int seg,
+    unsigned long offset,
+    void *p_data,
+    unsigned int bytes,
+    struct x86_emulate_ctxt *ctxt)
+{
+    mmio.writes++;
+    mmio.bytes = bytes;
+    mmio.val = 0;
+    memcpy(&mmio.val, p_data, bytes < 4 ? bytes : 4);
+    return X86EMUL_OKAY;
+}
+
+static const struct x86_emulate_ops mmio_ops = {
+    .read       = mmio_read,
+    .insn_fetch = fetch,
+    .write      = mmio_write,
+    .cmpxchg    = cmpxchg,
+    .cpuid      = cpuid,
+    .get_fpu    = get_fpu,
+};
+
+static const struct {
+    unsigned int len;
+    uint8_t bytes[MAX_INST_LEN];
+    bool ok, rex;
+} mov_mem32[] = {
+    /* movl %ecx,(%eax) */
+    { 2, { 0x89, 0x08 }, true },
+    /* movl %ebx,0xb0(%eax) */
+    { 6, { 0x89, 0x98, 0xb0, 0x00, 0x00, 0x00 }, true },
+    /* movl 0x300(%eax),%esi */
+    { 6, { 0x8b, 0xb0, 0x00, 0x03, 0x00, 0x00 }, true },
+    /* movl 0x20(%eax),%edi */
+    { 3, { 0x8b, 0x78, 0x20 }, true },
+    /* movl %ecx,0x10(%eax,%edx,4) */
+    { 4, { 0x89, 0x4c, 0x90, 0x10 }, true },
+    /* movl %ds:0x310(,%edx,4),%ebx (SIB, no base) */
+    { 8, { 0x3e, 0x8b, 0x1c, 0x95, 0x10, 0x03, 0x00, 0x00 }, true },
+    /* movl $0,0xb0(%eax) */
+    { 10, { 0xc7, 0x80, 0xb0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+      true },
+    /* movl $0x000c4500,%fs:0x300(%eax,%edx) */
+    { 12, { 0x64, 0xc7, 0x84, 0x10, 0x00, 0x03, 0x00, 0x00,
+            0x00, 0x45, 0x0c, 0x00 }, true },
+    /* movl %r9d,0xb0(%rax) */
+    { 7, { 0x44, 0x89, 0x88, 0xb0, 0x00, 0x00, 0x00 }, true, true },
+    /* movl 0x30(%rax),%r10d */
+    { 4, { 0x44, 0x8b, 0x50, 0x30 }, true, true },
+    /* movw %cx,(%eax) */
+    { 3, { 0x66, 0x89, 0x08 } },
+    /* movl %ecx,(%ax) / (%eax) under an address size override */
+    { 3, { 0x67, 0x89, 0x08 } },
+    /* rep movl %ecx,(%eax) */
+    { 3, { 0xf3, 0x89, 0x08 } },
+    /* movl %ecx,%eax */
+    { 2, { 0x89, 0xc8 } },
+    /* addl %ecx,(%eax) */
+    { 2, { 0x01, 0x08 } },
+    /* movb %cl,(%eax) */
+    { 2, { 0x88, 0x08 } },
+    /* C7 /1 is undefined */
+    { 6, { 0xc7, 0x08, 0x00, 0x00, 0x00, 0x00 } },
+    /* movl 0x300(%eax),%ecx, with the length off by one either way */
+    { 5, { 0x8b, 0x88, 0x00, 0x03, 0x00 } },
+    { 7, { 0x8b, 0x88, 0x00, 0x03, 0x00, 0x00, 0x90 } },
+#ifdef __x86_64__
+    /* movq %rcx,(%rax) */
+    { 3, { 0x48, 0x89, 0x08 } },
+#endif
+};
+
+static int test_mov_mem32(struct x86_emulate_ctxt *ctxt, char *instr,
+                          unsigned int *res)
+{
+    struct cpu_user_regs *regs = ctxt->regs, before;
+    struct x86_mov_mem32 mov;
+    unsigned int i;
+
+    for ( i = 0; i < sizeof(mov_mem32) / sizeof(mov_mem32[0]); i++ )
+    {
+        unsigned int len = mov_mem32[i].len;
+        unsigned long *reg;
+        int rc;
+
+#ifndef __x86_64__
+        if ( mov_mem32[i].rex )
+            continue;
+#endif
+
+        rc = x86_insn_mov_mem32(mov_mem32[i].bytes, len, ctxt->addr_size,
+                                &mov);
+        if ( rc != (mov_mem32[i].ok ? 0 : -1) )
+            return i + 1;
+        if ( rc )
+            continue;
+
+        /* Run the slow path, and check it did what the decode says. */
+        memset(regs, 0, sizeof(*regs));
+        regs->eip = (unsigned long)instr;
+        regs->eflags = 0x200;
+        regs->eax = (unsigned long)res;
+        regs->ecx = 0x11111111;
+        regs->edx = 1;
+        regs->ebx = 0x33333333;
+        regs->esi = 0x66666666;
+        regs->edi = 0x77777777;
+#ifdef __x86_64__
+        regs->r9  = 0x99999999;
+        regs->r10 = 0xaaaaaaaa;
+#endif
+        before = *regs;
+        memcpy(instr, mov_mem32[i].bytes, len);
+        memset(&mmio, 0, sizeof(mmio));
+        mmio.val = 0xfee1dead;
+
+        rc = x86_emulate(ctxt, &mmio_ops);
+        if ( rc != X86EMUL_OKAY || regs->eip != (unsigned long)instr + len ||
+             mmio.bytes != 4 || mmio.reads + mmio.writes != 1 ||
+             mmio.writes != mov.write )
+            return i + 1;
+
+        reg = decode_register(mov.reg, regs, 0);
+        if ( mov.write )
+        {
+            if ( mmio.val != (mov.has_imm ? mov.imm : (uint32_t)*reg) )
+                return i + 1;
+            before.eip = regs->eip;
+        }
+        else
+        {
+            if ( *reg != 0xfee1dead )
+                return i + 1;
+            *(unsigned long *)decode_register(mov.reg, &before, 0) = *reg;
+            before.eip = regs->eip;
+        }
+
+        /* Nothing else may have changed. */
+        if ( memcmp(&before, regs, sizeof(before)) )
+            return i + 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Microbenchmark: emulate a few instructions typical of device polling
+ * loops over and over, with and without the decoded instruction cache.
+ */
+#define BENCH_ITERS 2000000
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(struct x86_emulate_ctxt *ctxt, char *instr, unsigned int *res)
+{
+    static const struct {
+        const char *name;
+        unsigned int len;
+        uint8_t bytes[MAX_INST_LEN];
+    } insns[] = {
+        { "movl %ecx,(%eax)", 2, { 0x89, 0x08 } },
+        { "movl 0x300(%eax),%ecx", 6, { 0x8b, 0x88, 0x00, 0x03, 0x00, 0x00 } },
+        { "movl $1,0x40(%eax,%edx,4)", 8,
+          { 0xc7, 0x44, 0x90, 0x40, 0x01, 0x00, 0x00, 0x00 } },
+        { "orw $0x8000,%fs:0x10(%eax)", 7,
+          { 0x64, 0x66, 0x81, 0x48, 0x10, 0x00, 0x80 } },
+    };
+    struct cpu_user_regs *regs = ctxt->regs;
+    unsigned int i, j, k;
+
+    printf("%-32s %14s %14s %8s\n", "Instruction",
+           "uncached/s", "cached/s", "speedup");
+
+    for ( i = 0; i < sizeof(insns) / sizeof(insns[0]); i++ )
+    {
+        double rate[2];
+
+        memcpy(instr, insns[i].bytes, insns[i].len);
+
+        for ( j = 0; j < 2; j++ )
+        {
+            double start;
+
+            ctxt->insn_cache = j ? &insn_cache : NULL;
+            memset(&insn_cache, 0, sizeof(insn_cache));
+            start = now();
+            for ( k = 0; k < BENCH_ITERS; k++ )
+            {
+                regs->eip = (unsigned long)instr;
+                regs->eax = (unsigned long)res;
+                regs->ecx = 0x12345678;
+                regs->edx = 1;
+                regs->eflags = 0x200;
+                if ( x86_emulate(ctxt, &emulops) != X86EMUL_OKAY ||
+                     regs->eip != (unsigned long)instr + insns[i].len )
+                {
+                    printf("%s: emulation failed\n", insns[i].name);
+                    return 1;
+                }
+            }
+            rate[j] = BENCH_ITERS / (now() - start);
+        }
+
+        printf("%-32s %14.0f %14.0f %7.2fx\n", insns[i].name,
+               rate[0], rate[1], rate[1] / rate[0]);
+    }
+
+    printf("cache: %lu hits, %lu misses\n", insn_cache.hits, insn_cache.misses);
+    ctxt->insn_cache = &insn_cache;
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     struct x86_emulate_ctxt ctxt;
@@ -177,6 +423,8 @@ int main(int argc, char **argv)
 #endif
 
     ctxt.regs = &regs;
+    ctxt.insn_cache = &insn_cache;
+    ctxt.insn_cache_tag = 0;
     ctxt.force_writeback = 0;
     ctxt.addr_size = 8 * sizeof(void *);
     ctxt.sp_size   = 8 * sizeof(void *);
@@ -190,6 +438,9 @@ int main(int argc, char **argv)
     }
     instr = (char *)res + 0x100;
 
+    if ( argc > 1 && !strcmp(argv[1], "-b") )
+        return bench(&ctxt, instr, res);
+
 #ifdef __x86_64__
     asm ("movq %%rsp, %0" : "=g" (sp));
 #else
@@ -529,6 +780,14 @@ int main(int argc, char **argv)
         goto fail;
     printf("okay\n");
 
+    printf("%-40s", "Testing decode-free movl to/from mem...");
+    if ( (rc = test_mov_mem32(&ctxt, instr, res)) != 0 )
+    {
+        printf("failed on entry %d\n", rc - 1);
+        return 1;
+    }
+    printf("okay\n");
+
     printf("%-40s", "Testing daa/das (all inputs)...");
 #ifndef __x86_64__
     /* Bits 0-7: AL; Bit 8: EFLG_AF; Bit 9: EFLG_CF; Bit 10: DAA vs. DAS. */
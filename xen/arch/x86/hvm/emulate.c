@@ -24,6 +24,10 @@
 #include <asm/hvm/svm/svm.h>
 #include <asm/vm_event.h>
 
+/* Cache the decode of recently emulated instructions? */
+static bool_t __read_mostly opt_insn_cache = 1;
+boolean_param("hvm_insn_cache", opt_insn_cache);
+
 static void hvmtrace_io_assist(const ioreq_t *p)
 {
     unsigned int size, event;
@@ -177,6 +181,13 @@ static int hvmemul_do_io(
             rc = hvm_process_io_intercept(&null_handler, &p);
             vio->io_req.state = STATE_IOREQ_NONE;
         }
+        /* Writes to posted ranges needn't wait for the emulator. */
+        else if ( is_mmio && dir == IOREQ_WRITE &&
+                  hvm_send_posted_ioreq(s, &p) == X86EMUL_OKAY )
+        {
+            rc = X86EMUL_OKAY;
+            vio->io_req.state = STATE_IOREQ_NONE;
+        }
         else
         {
             rc = hvm_send_ioreq(s, &p, 0);
@@ -1828,6 +1839,9 @@ void hvm_emulate_prepare(
 {
     hvmemul_ctxt->intr_shadow = hvm_funcs.get_interrupt_shadow(current);
     hvmemul_ctxt->ctxt.regs = regs;
+    hvmemul_ctxt->ctxt.insn_cache = opt_insn_cache ?
+        &current->arch.hvm_vcpu.hvm_io.insn_cache : NULL;
+    hvmemul_ctxt->ctxt.insn_cache_tag = current->arch.hvm_vcpu.guest_cr[3];
     hvmemul_ctxt->ctxt.force_writeback = 1;
     hvmemul_ctxt->seg_reg_accessed = 0;
     hvmemul_ctxt->seg_reg_dirty = 0;
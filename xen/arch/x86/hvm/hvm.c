@@ -32,6 +32,7 @@
 #include <xen/guest_access.h>
 #include <xen/event.h>
 #include <xen/paging.h>
+#include <xen/perfc.h>
 #include <xen/cpu.h>
 #include <xen/wait.h>
 #include <xen/mem_access.h>
@@ -941,6 +942,7 @@ static int hvm_ioreq_server_alloc_rangesets(struct hvm_ioreq_server *s,
                       (i == HVMOP_IO_RANGE_PORT) ? "port" :
                       (i == HVMOP_IO_RANGE_MEMORY) ? "memory" :
                       (i == HVMOP_IO_RANGE_PCI) ? "pci" :
+                      (i == HVMOP_IO_RANGE_POSTED) ? "posted" :
                       "");
         if ( rc )
             goto fail;
@@ -1041,8 +1043,10 @@ static int hvm_ioreq_server_init(struct hvm_ioreq_server *s, struct domain *d,
     if ( rc )
         return rc;
 
-    if ( bufioreq_handling == HVM_IOREQSRV_BUFIOREQ_ATOMIC )
+    if ( bufioreq_handling >= HVM_IOREQSRV_BUFIOREQ_ATOMIC )
         s->bufioreq_atomic = 1;
+    if ( bufioreq_handling == HVM_IOREQSRV_BUFIOREQ_WIDE )
+        s->bufioreq_wide = 1;
 
     rc = hvm_ioreq_server_setup_pages(
              s, is_default, bufioreq_handling != HVM_IOREQSRV_BUFIOREQ_OFF);
@@ -1110,7 +1114,7 @@ static int hvm_create_ioreq_server(struct domain *d, domid_t domid,
     struct hvm_ioreq_server *s;
     int rc;
 
-    if ( bufioreq_handling > HVM_IOREQSRV_BUFIOREQ_ATOMIC )
+    if ( bufioreq_handling > HVM_IOREQSRV_BUFIOREQ_WIDE )
         return -EINVAL;
 
     rc = -ENOMEM;
@@ -1259,6 +1263,7 @@ static int hvm_map_io_range_to_ioreq_server(struct domain *d, ioservid_t id,
             case HVMOP_IO_RANGE_PORT:
             case HVMOP_IO_RANGE_MEMORY:
             case HVMOP_IO_RANGE_PCI:
+            case HVMOP_IO_RANGE_POSTED:
                 r = s->range[type];
                 break;
 
@@ -1310,6 +1315,7 @@ static int hvm_unmap_io_range_from_ioreq_server(struct domain *d, ioservid_t id,
             case HVMOP_IO_RANGE_PORT:
             case HVMOP_IO_RANGE_MEMORY:
             case HVMOP_IO_RANGE_PCI:
+            case HVMOP_IO_RANGE_POSTED:
                 r = s->range[type];
                 break;
 
@@ -2615,17 +2621,82 @@ struct hvm_ioreq_server *hvm_select_ioreq_server(struct domain *d,
     return d->arch.hvm_domain.default_ioreq_server;
 }
 
+/*
+ * Encode an access of <data> at <addr> as buffered ioreq slots.  Returns the
+ * number of slots needed, or 0 if the server can't be sent such an access.
+ */
+static unsigned int hvm_bufioreq_encode(const struct hvm_ioreq_server *s,
+                                        const ioreq_t *p, uint64_t addr,
+                                        uint64_t data, buf_ioreq_t *slots)
+{
+    buf_ioreq_t bp = { .data = data,
+                       .addr = addr,
+                       .type = p->type,
+                       .dir = p->dir,
+                       .size = fls(p->size) - 1 };
+    unsigned int n = 0;
+
+    /* 'addr' is only a 20-bit field, unless the server takes wide ones. */
+    if ( addr > 0xffffful )
+    {
+        if ( !s->bufioreq_wide || (addr >> 52) )
+            return 0;
+        bp.pad = 1; /* wide */
+    }
+
+    slots[n++] = bp;
+
+    /* Eight byte accesses send 64b data. Use two consecutive slots. */
+    if ( p->size == 8 )
+    {
+        bp.data = data >> 32;
+        slots[n++] = bp;
+    }
+
+    if ( bp.pad )
+    {
+        bp.data = addr >> 20;
+        slots[n++] = bp;
+    }
+
+    return n;
+}
+
+/*
+ * Make the slots up to <write_pointer> visible to the emulator and notify
+ * it.  Must be called with the bufioreq lock held.
+ */
+static void hvm_bufioreq_publish(struct hvm_ioreq_server *s,
+                                 buffered_iopage_t *pg,
+                                 uint32_t write_pointer)
+{
+    unsigned int i = 0;
+
+    /* Make the ioreq_t visible /before/ write_pointer. */
+    wmb();
+    pg->ptrs.write_pointer = write_pointer;
+
+    /* Canonicalize read/write pointers to prevent their overflow. */
+    while ( s->bufioreq_atomic && i++ < IOREQ_BUFFER_SLOT_NUM &&
+            pg->ptrs.read_pointer >= IOREQ_BUFFER_SLOT_NUM )
+    {
+        union bufioreq_pointers old = pg->ptrs, new;
+        unsigned int n = old.read_pointer / IOREQ_BUFFER_SLOT_NUM;
+
+        new.read_pointer = old.read_pointer - n * IOREQ_BUFFER_SLOT_NUM;
+        new.write_pointer = old.write_pointer - n * IOREQ_BUFFER_SLOT_NUM;
+        cmpxchg(&pg->ptrs.full, old.full, new.full);
+    }
+
+    notify_via_xen_event_channel(s->domain, s->bufioreq_evtchn);
+}
+
 static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
 {
-    struct domain *d = current->domain;
     struct hvm_ioreq_page *iorp;
     buffered_iopage_t *pg;
-    buf_ioreq_t bp = { .data = p->data,
-                       .addr = p->addr,
-                       .type = p->type,
-                       .dir = p->dir };
-    /* Timeoffset sends 64b data, but no address. Use two consecutive slots. */
-    int qw = 0;
+    buf_ioreq_t slots[3];
+    unsigned int i, n;
 
     /* Ensure buffered_iopage fits in a page */
     BUILD_BUG_ON(sizeof(buffered_iopage_t) > PAGE_SIZE);
@@ -2638,73 +2709,130 @@ static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
 
     /*
      * Return 0 for the cases we can't deal with:
-     *  - 'addr' is only a 20-bit field, so we cannot address beyond 1MB
      *  - we cannot buffer accesses to guest memory buffers, as the guest
      *    may expect the memory buffer to be synchronously accessed
      *  - the count field is usually used with data_is_ptr and since we don't
      *    support data_is_ptr we do not waste space for the count field either
+     *  - addresses the server can't be sent (see hvm_bufioreq_encode())
      */
-    if ( (p->addr > 0xffffful) || p->data_is_ptr || (p->count != 1) )
+    if ( p->data_is_ptr || (p->count != 1) )
         return 0;
 
     switch ( p->size )
     {
-    case 1:
-        bp.size = 0;
-        break;
-    case 2:
-        bp.size = 1;
-        break;
-    case 4:
-        bp.size = 2;
-        break;
-    case 8:
-        bp.size = 3;
-        qw = 1;
+    case 1: case 2: case 4: case 8:
         break;
     default:
         gdprintk(XENLOG_WARNING, "unexpected ioreq size: %u\n", p->size);
         return X86EMUL_UNHANDLEABLE;
     }
 
+    n = hvm_bufioreq_encode(s, p, p->addr, p->data, slots);
+    if ( !n )
+        return 0;
+
     spin_lock(&s->bufioreq_lock);
 
-    if ( (pg->ptrs.write_pointer - pg->ptrs.read_pointer) >=
-         (IOREQ_BUFFER_SLOT_NUM - qw) )
+    if ( (pg->ptrs.write_pointer - pg->ptrs.read_pointer) >
+         (IOREQ_BUFFER_SLOT_NUM - n) )
     {
         /* The queue is full: send the iopacket through the normal path. */
         spin_unlock(&s->bufioreq_lock);
         return X86EMUL_UNHANDLEABLE;
     }
 
-    pg->buf_ioreq[pg->ptrs.write_pointer % IOREQ_BUFFER_SLOT_NUM] = bp;
+    for ( i = 0; i < n; i++ )
+        pg->buf_ioreq[(pg->ptrs.write_pointer + i) % IOREQ_BUFFER_SLOT_NUM] =
+            slots[i];
 
-    if ( qw )
-    {
-        bp.data = p->data >> 32;
-        pg->buf_ioreq[(pg->ptrs.write_pointer+1) % IOREQ_BUFFER_SLOT_NUM] = bp;
-    }
+    hvm_bufioreq_publish(s, pg, pg->ptrs.write_pointer + n);
+    spin_unlock(&s->bufioreq_lock);
 
-    /* Make the ioreq_t visible /before/ write_pointer. */
-    wmb();
-    pg->ptrs.write_pointer += qw ? 2 : 1;
+    return X86EMUL_OKAY;
+}
 
-    /* Canonicalize read/write pointers to prevent their overflow. */
-    while ( s->bufioreq_atomic && qw++ < IOREQ_BUFFER_SLOT_NUM &&
-            pg->ptrs.read_pointer >= IOREQ_BUFFER_SLOT_NUM )
+/*
+ * Most data posted at once for repeated writes read from guest memory.  It
+ * is copied in before taking the buffered ioreq lock, as the copy may need
+ * the p2m lock (e.g. to populate PoD memory).
+ */
+#define POSTED_MAX_DATA 512
+
+/*
+ * Post a write falling within one of the server's posted ranges to the
+ * buffered ring.  All repetitions of a REP write go in as one batch, with
+ * a single notification.  Anything which doesn't fit is left for the
+ * caller to send synchronously, as a whole.
+ */
+int hvm_send_posted_ioreq(struct hvm_ioreq_server *s, const ioreq_t *p)
+{
+    struct rangeset *r = s->range[HVMOP_IO_RANGE_POSTED];
+    buffered_iopage_t *pg = s->bufioreq.va;
+    uint8_t buf[POSTED_MAX_DATA];
+    buf_ioreq_t slots[3];
+    uint64_t first, data = p->data;
+    uint32_t wp;
+    unsigned long i;
+    unsigned int k, n;
+    int rc = X86EMUL_UNHANDLEABLE;
+
+    ASSERT(p->type == IOREQ_TYPE_COPY && p->dir == IOREQ_WRITE);
+
+    /* The default server has no ranges. */
+    if ( !r || !pg )
+        return X86EMUL_UNHANDLEABLE;
+
+    /* REP STOS posts count copies of p->data, each taking a slot at least. */
+    if ( p->data_is_ptr ? p->count * p->size > sizeof(buf)
+                        : p->count > IOREQ_BUFFER_SLOT_NUM )
+        return X86EMUL_UNHANDLEABLE;
+
+    first = p->df ? p->addr - (p->count - 1) * p->size : p->addr;
+    if ( !rangeset_contains_range(r, first,
+                                  first + p->count * p->size - 1) )
+        return X86EMUL_UNHANDLEABLE;
+
+    /* Fetch the data, lowest address first. */
+    if ( p->data_is_ptr &&
+         hvm_copy_from_guest_phys(buf,
+                                  p->df ? p->data - (p->count - 1) * p->size
+                                        : p->data,
+                                  p->count * p->size) != HVMCOPY_okay )
+        return X86EMUL_UNHANDLEABLE;
+
+    spin_lock(&s->bufioreq_lock);
+
+    wp = pg->ptrs.write_pointer;
+    for ( i = 0; i < p->count; i++ )
     {
-        union bufioreq_pointers old = pg->ptrs, new;
-        unsigned int n = old.read_pointer / IOREQ_BUFFER_SLOT_NUM;
+        uint64_t addr = p->df ? p->addr - i * p->size
+                              : p->addr + i * p->size;
 
-        new.read_pointer = old.read_pointer - n * IOREQ_BUFFER_SLOT_NUM;
-        new.write_pointer = old.write_pointer - n * IOREQ_BUFFER_SLOT_NUM;
-        cmpxchg(&pg->ptrs.full, old.full, new.full);
+        if ( p->data_is_ptr )
+        {
+            data = 0;
+            memcpy(&data, &buf[(p->df ? p->count - 1 - i : i) * p->size],
+                   p->size);
+        }
+
+        n = hvm_bufioreq_encode(s, p, addr, data, slots);
+        if ( !n || (wp + n - pg->ptrs.read_pointer) >
+                   IOREQ_BUFFER_SLOT_NUM )
+            goto out;
+
+        for ( k = 0; k < n; k++ )
+            pg->buf_ioreq[wp++ % IOREQ_BUFFER_SLOT_NUM] = slots[k];
     }
 
-    notify_via_xen_event_channel(d, s->bufioreq_evtchn);
+    hvm_bufioreq_publish(s, pg, wp);
+    perfc_incr(ioreq_posted_batches);
+    perfc_add(ioreq_posted_writes, p->count);
+    rc = X86EMUL_OKAY;
+
+ out:
     spin_unlock(&s->bufioreq_lock);
 
-    return X86EMUL_OKAY;
+    return rc;
 }
 
 int hvm_send_ioreq(struct hvm_ioreq_server *s, ioreq_t *proto_p,
@@ -976,6 +976,28 @@ static int vlapic_range(struct vcpu *v, unsigned long addr)
            (offset < PAGE_SIZE);
 }
 
+/*
+ * Aligned 32-bit register access on behalf of a caller which has already
+ * decoded the instruction (the APIC access VM exit fast path).
+ */
+int vlapic_mmio_access(struct vcpu *v, unsigned int offset, bool_t write,
+                       uint32_t *val)
+{
+    unsigned long addr = vlapic_base_address(vcpu_vlapic(v)) + offset, tmp;
+    int rc;
+
+    if ( !vlapic_range(v, addr) || (offset & 3) )
+        return X86EMUL_UNHANDLEABLE;
+
+    if ( write )
+        return vlapic_write(v, addr, 4, *val);
+
+    rc = vlapic_read(v, addr, 4, &tmp);
+    *val = tmp;
+
+    return rc;
+}
+
 static const struct hvm_mmio_ops vlapic_mmio_ops = {
     .check = vlapic_range,
     .read = vlapic_read,
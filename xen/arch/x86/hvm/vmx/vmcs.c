@@ -64,6 +64,7 @@ static unsigned int __read_mostly ple_window = 4096;
 integer_param("ple_window", ple_window);
 
 static bool_t __read_mostly opt_pml_enabled = 0;
+bool_t __read_mostly opt_ept_coalesce = 1;
 
 /*
  * The 'ept' parameter controls functionalities that depend on, or impact the
@@ -87,6 +88,8 @@ static void __init parse_ept_param(char *s)
 
         if ( !strcmp(s, "pml") )
             opt_pml_enabled = val;
+        else if ( !strcmp(s, "coalesce") )
+            opt_ept_coalesce = val;
 
         s = ss + 1;
     } while ( ss );
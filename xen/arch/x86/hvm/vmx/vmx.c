@@ -1997,6 +1997,7 @@ const struct hvm_function_table * __init start_vmx(void)
             vmx_function_table.hap_capabilities |= HVM_HAP_SUPERPAGE_1GB;
 
         setup_ept_dump();
+        setup_ept_coalesce();
     }
 
     if ( !cpu_has_vmx_virtual_intr_delivery )
@@ -2813,6 +2814,67 @@ static int vmx_handle_eoi_write(void)
     return 0;
 }
 
+/*
+ * Decode-free handling of the common 32-bit MOV forms accessing APIC
+ * registers: the exit qualification supplies the register offset and the
+ * direction, the instruction length bounds the fetch, and only the
+ * register operand (or immediate) needs picking out of the instruction.
+ * Anything else is left to handle_mmio().
+ */
+static int vmx_handle_apic_access(void)
+{
+    struct vcpu *curr = current;
+    struct cpu_user_regs *regs = guest_cpu_user_regs();
+    struct segment_register cs, ss;
+    unsigned long exit_qualification, addr;
+    unsigned int len = get_instruction_length(), addr_size, type;
+    uint32_t pfec = PFEC_page_present, val;
+    uint8_t insn[MAX_INST_LEN];
+    struct x86_mov_mem32 mov;
+    unsigned long *reg;
+
+    /* Linear data reads and writes only (not e.g. instruction fetches). */
+    __vmread(EXIT_QUALIFICATION, &exit_qualification);
+    type = (exit_qualification >> 12) & 0xf;
+    if ( type > 1 || (exit_qualification & 3) ||
+         !len || len > MAX_INST_LEN )
+        return 0;
+
+    hvm_get_segment_register(curr, x86_seg_cs, &cs);
+    hvm_get_segment_register(curr, x86_seg_ss, &ss);
+    if ( hvm_long_mode_enabled(curr) && cs.attr.fields.l )
+        addr_size = 64;
+    else if ( cs.attr.fields.db )
+        addr_size = 32;
+    else
+        return 0;
+    if ( ss.attr.fields.dpl == 3 )
+        pfec |= PFEC_user_mode;
+
+    if ( !hvm_virtual_to_linear_addr(x86_seg_cs, &cs, regs->eip, len,
+                                     hvm_access_insn_fetch, addr_size,
+                                     &addr) ||
+         hvm_fetch_from_guest_virt_nofault(insn, addr, len,
+                                           pfec) != HVMCOPY_okay ||
+         x86_insn_mov_mem32(insn, len, addr_size, &mov) ||
+         mov.write != type )
+        return 0;
+
+    reg = decode_register(mov.reg, regs, 0);
+    val = mov.has_imm ? mov.imm : *reg;
+    if ( vlapic_mmio_access(curr, exit_qualification & 0xfff, mov.write,
+                            &val) != X86EMUL_OKAY )
+        return 0;
+    if ( !mov.write )
+        *reg = val;
+
+    perfc_incr(apic_access_fast);
+    update_guest_eip(); /* Safe: APIC data access */
+    HVMTRACE_0D(VLAPIC);
+
+    return 1;
+}
+
 static void vmx_idtv_reinject(unsigned long idtv_info)
 {
 
@@ -3333,7 +3395,8 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
         break;
 
     case EXIT_REASON_APIC_ACCESS:
-        if ( !vmx_handle_eoi_write() && !handle_mmio() )
+        if ( !vmx_handle_eoi_write() && !vmx_handle_apic_access() &&
+             !handle_mmio() )
             hvm_inject_hw_exception(TRAP_gp_fault, 0);
         break;
 
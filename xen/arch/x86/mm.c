@@ -5210,6 +5210,7 @@ int ptwr_do_page_fault(struct vcpu *v, unsigned long addr,
     }
 
     ptwr_ctxt.ctxt.regs = regs;
+    ptwr_ctxt.ctxt.insn_cache = NULL;
     ptwr_ctxt.ctxt.force_writeback = 0;
     ptwr_ctxt.ctxt.addr_size = ptwr_ctxt.ctxt.sp_size =
         is_pv_32bit_domain(d) ? 32 : BITS_PER_LONG;
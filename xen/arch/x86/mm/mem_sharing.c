@@ -1293,6 +1293,162 @@ int relinquish_shared_pages(struct domain *d)
     return rc;
 }
 
+/* Batch entries / range gfns handled between preemption checks. */
+#define SHARING_PREEMPT_BATCH 64
+
+/* Look up the client domain of a sharing op and check it may take part. */
+static int mem_sharing_get_client(struct domain *d, domid_t client,
+                                  int op, struct domain **cd)
+{
+    int rc;
+
+    rc = rcu_lock_live_remote_domain_by_id(client, cd);
+    if ( rc )
+        return rc;
+
+    rc = xsm_mem_sharing_op(XSM_DM_PRIV, d, *cd, op);
+    if ( !rc && !mem_sharing_enabled(*cd) )
+        rc = -EINVAL;
+
+    if ( rc )
+    {
+        rcu_unlock_domain(*cd);
+        *cd = NULL;
+    }
+
+    return rc;
+}
+
+/*
+ * Nominate or share a batch of pairs.  Each pair is tried independently
+ * and gets its own result, so that a handle invalidated by a guest write
+ * since nomination doesn't fail the rest of the batch.  Returns 1 when
+ * preempted, with batch->done recording the progress.
+ */
+static int mem_sharing_batch(struct domain *d,
+                             struct mem_sharing_op_batch *batch, int op)
+{
+    xen_mem_sharing_batch_entry_t ent;
+    struct domain *cd = NULL;
+    unsigned int i;
+    int rc = 0;
+
+    if ( batch->pad || batch->done > batch->nr )
+        return -EINVAL;
+
+    if ( !batch->done )
+        batch->nr_shared = 0;
+
+    for ( i = batch->done; i < batch->nr; i++ )
+    {
+        if ( i > batch->done && !(i % SHARING_PREEMPT_BATCH) &&
+             hypercall_preempt_check() )
+        {
+            rc = 1;
+            break;
+        }
+
+        if ( copy_from_guest_offset(&ent, batch->entries, i, 1) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+
+        /* Batches typically target one client: keep it locked across. */
+        if ( cd && cd->domain_id != ent.client_domain )
+        {
+            rcu_unlock_domain(cd);
+            cd = NULL;
+        }
+
+        ent.rc = 0;
+        if ( !cd )
+            ent.rc = mem_sharing_get_client(d, ent.client_domain, op, &cd);
+
+        if ( !ent.rc &&
+             (XENMEM_SHARING_OP_FIELD_IS_GREF(ent.source_gfn) ||
+              XENMEM_SHARING_OP_FIELD_IS_GREF(ent.client_gfn)) )
+            ent.rc = -EINVAL;
+
+        if ( ent.rc )
+            /* Nothing to do. */;
+        else if ( op == XENMEM_sharing_op_nominate_batch )
+        {
+            ent.rc = mem_sharing_nominate_page(d, ent.source_gfn, 0,
+                                               &ent.source_handle);
+            if ( !ent.rc )
+                ent.rc = mem_sharing_nominate_page(cd, ent.client_gfn, 0,
+                                                   &ent.client_handle);
+            else
+                ent.client_handle = 0;
+        }
+        else
+            ent.rc = mem_sharing_share_pages(d, ent.source_gfn,
+                                             ent.source_handle,
+                                             cd, ent.client_gfn,
+                                             ent.client_handle);
+
+        if ( !ent.rc )
+            batch->nr_shared++;
+
+        if ( copy_to_guest_offset(batch->entries, i, &ent, 1) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+    }
+
+    batch->done = i;
+
+    if ( cd )
+        rcu_unlock_domain(cd);
+
+    return rc;
+}
+
+/*
+ * Share a gfn range between two paused domains.  Individual pages may
+ * legitimately be unsharable and are skipped; only running out of memory
+ * stops the operation.  Returns 1 when preempted, with range->opaque
+ * recording the progress.
+ */
+static int mem_sharing_range_share(struct domain *d, struct domain *cd,
+                                   struct mem_sharing_op_range *range)
+{
+    unsigned long gfn = range->opaque ?: range->first_gfn;
+    shr_handle_t sh, ch;
+    int rc = 0;
+
+    if ( !range->opaque )
+        range->nr_shared = 0;
+
+    while ( gfn <= range->last_gfn )
+    {
+        rc = mem_sharing_nominate_page(d, gfn, 0, &sh);
+        if ( !rc )
+            rc = mem_sharing_nominate_page(cd, gfn, 0, &ch);
+        if ( !rc )
+            rc = mem_sharing_share_pages(d, gfn, sh, cd, gfn, ch);
+
+        if ( rc == -ENOMEM )
+            break;
+        if ( !rc )
+            range->nr_shared++;
+        rc = 0;
+
+        if ( ++gfn <= range->last_gfn && !(gfn % SHARING_PREEMPT_BATCH) &&
+             hypercall_preempt_check() )
+        {
+            rc = 1;
+            break;
+        }
+    }
+
+    range->opaque = gfn;
+
+    return rc;
+}
+
 int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
 {
     int rc;
@@ -1467,6 +1623,52 @@ int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
         }
         break;
 
+        case XENMEM_sharing_op_nominate_batch:
+        case XENMEM_sharing_op_share_batch:
+        {
+            rc = -EINVAL;
+            if ( !mem_sharing_enabled(d) )
+                goto out;
+
+            rc = mem_sharing_batch(d, &mso.u.batch, mso.op);
+            if ( rc > 0 )
+                goto continuation;
+        }
+        break;
+
+        case XENMEM_sharing_op_range_share:
+        {
+            struct domain *cd;
+
+            rc = -EINVAL;
+            if ( mso.u.range.pad[0] || mso.u.range.pad[1] ||
+                 mso.u.range.pad[2] ||
+                 mso.u.range.first_gfn > mso.u.range.last_gfn ||
+                 mso.u.range.last_gfn > domain_get_maximum_gpfn(d) ||
+                 (mso.u.range.opaque &&
+                  (mso.u.range.opaque < mso.u.range.first_gfn ||
+                   mso.u.range.opaque > mso.u.range.last_gfn)) )
+                goto out;
+
+            rc = mem_sharing_get_client(d, mso.u.range.client_domain,
+                                        mso.op, &cd);
+            if ( rc )
+                goto out;
+
+            /* Contents are not compared: neither domain may be running. */
+            if ( !atomic_read(&d->pause_count) ||
+                 !atomic_read(&cd->pause_count) )
+                rc = -EINVAL;
+            else
+                rc = mem_sharing_range_share(d, cd, &mso.u.range);
+
+            rcu_unlock_domain(cd);
+
+            if ( rc > 0 )
+                goto continuation;
+        }
+        break;
+
         case XENMEM_sharing_op_debug_gfn:
         {
             unsigned long gfn = mso.u.debug.u.gfn;
@@ -1492,6 +1694,13 @@ int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
 out:
     rcu_unlock_domain(d);
     return rc;
+
+continuation:
+    rcu_unlock_domain(d);
+    if ( __copy_to_guest(arg, &mso, 1) )
+        return -EFAULT;
+    return hypercall_create_continuation(__HYPERVISOR_memory_op, "lh",
+                                         XENMEM_sharing_op, arg);
 }
 
 int mem_sharing_domctl(struct domain *d, xen_domctl_mem_sharing_op_t *mec)
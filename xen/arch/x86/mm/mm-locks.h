@@ -25,6 +25,7 @@
 #ifndef _MM_LOCKS_H
 #define _MM_LOCKS_H
 
+#include <xen/perfc.h>
 #include <asm/mem_sharing.h>
 
 /* Per-CPU variable for enforcing the lock ordering */
@@ -76,6 +77,20 @@ static inline void _mm_lock(mm_lock_t *l, const char *func, int level, int rec)
     __set_lock_level(level);
 }
 
+/* Not recursive: for callers which may not wait, e.g. debug key handlers. */
+static inline int _mm_trylock(mm_lock_t *l, const char *func, int level)
+{
+    if ( mm_locked_by_me(l) )
+        return 0;
+    __check_lock_level(level);
+    if ( !spin_trylock_recursive(&l->lock) )
+        return 0;
+    l->locker_function = func;
+    l->unlock_level = __get_lock_level();
+    __set_lock_level(level);
+    return 1;
+}
+
 static inline void _mm_enforce_order_lock_pre(int level)
 {
     __check_lock_level(level);
@@ -150,7 +165,9 @@ static inline void mm_read_unlock(mm_rwlock_t *l)
 /* This wrapper uses the line number to express the locking order below */
 #define declare_mm_lock(name)                                                 \
     static inline void mm_lock_##name(mm_lock_t *l, const char *func, int rec)\
-    { _mm_lock(l, func, __LINE__, rec); }
+    { _mm_lock(l, func, __LINE__, rec); }                                     \
+    static inline int mm_trylock_##name(mm_lock_t *l, const char *func)       \
+    { return _mm_trylock(l, func, __LINE__); }
 #define declare_mm_rwlock(name)                                               \
     static inline void mm_write_lock_##name(mm_rwlock_t *l, const char *func) \
     { _mm_write_lock(l, func, __LINE__); }                                    \
@@ -331,9 +348,22 @@ declare_mm_order_constraint(page_alloc)
  * teardowns, etc). */
 
 declare_mm_lock(paging)
-#define paging_lock(d)         mm_lock(paging, &(d)->arch.paging.lock)
+
+/* Count how often the lock is taken, and found held by someone else, to
+ * see how much the domain's vcpus serialise on it. */
+static inline void _paging_lock(mm_lock_t *l, const char *func, int rec)
+{
+    perfc_incr(paging_lock_taken);
+    if ( !mm_locked_by_me(l) && spin_is_locked(&l->lock) )
+        perfc_incr(paging_lock_contended);
+    mm_lock_paging(l, func, rec);
+}
+
+#define paging_lock(d)         _paging_lock(&(d)->arch.paging.lock, __func__, 0)
 #define paging_lock_recursive(d) \
-                    mm_lock_recursive(paging, &(d)->arch.paging.lock)
+                    _paging_lock(&(d)->arch.paging.lock, __func__, 1)
+#define paging_trylock(d) \
+                    mm_trylock_paging(&(d)->arch.paging.lock, __func__)
 #define paging_unlock(d)       mm_unlock(&(d)->arch.paging.lock)
 #define paging_locked_by_me(d) mm_locked_by_me(&(d)->arch.paging.lock)
 
@@ -31,6 +31,7 @@
 #include <asm/hvm/cacheattr.h>
 #include <xen/keyhandler.h>
 #include <xen/softirq.h>
+#include <xen/tasklet.h>
 
 #include "mm-locks.h"
 
@@ -1139,6 +1140,229 @@ static void ept_flush_pml_buffers(struct p2m_domain *p2m)
     vmx_domain_flush_pml_buffers(p2m->domain);
 }
 
+/*
+ * Superpage reconstitution.  Superpages get split by log-dirty tracking,
+ * mem_access, PoD and single page changes, and nothing on those paths
+ * merges them back.  A background pass looks for page tables whose entries
+ * map one aligned, contiguous range of RAM with identical attributes, and
+ * replaces each of them by a single superpage entry.
+ */
+
+/* Delay between passes, and 2M regions examined per domain and pass. */
+#define EPT_COALESCE_INTERVAL   MILLISECS(1000)
+#define EPT_COALESCE_BATCH      512
+/* Tables replaced before the TLB flush which allows freeing them. */
+#define EPT_COALESCE_FLUSH      64
+
+/*
+ * Check whether the table behind entry, at the given level, can be replaced
+ * by a superpage, and build that superpage in *sp if so.
+ */
+static bool_t ept_can_coalesce(struct p2m_domain *p2m, ept_entry_t entry,
+                               unsigned long gfn, unsigned int level,
+                               ept_entry_t *sp)
+{
+    unsigned long trunk = 1UL << ((level - 1) * EPT_TABLE_ORDER);
+    unsigned int order = level * EPT_TABLE_ORDER;
+    ept_entry_t *table, first;
+    unsigned int i;
+    uint8_t ipat = 0;
+    bool_t ok = 0;
+
+    if ( !is_epte_present(&entry) || is_epte_superpage(&entry) ||
+         entry.emt == MTRR_NUM_TYPES || entry.recalc )
+        return 0;
+
+    table = map_domain_page(_mfn(entry.mfn));
+    first = atomic_read_ept_entry(&table[0]);
+
+    /* Only plain RAM: other types get tracked at 4k granularity. */
+    if ( !is_epte_valid(&first) || !is_epte_present(&first) ||
+         (first.sa_p2mt != p2m_ram_rw && first.sa_p2mt != p2m_ram_ro) ||
+         first.emt == MTRR_NUM_TYPES || first.recalc ||
+         is_epte_superpage(&first) != (level > 1) ||
+         (first.mfn & ((1UL << order) - 1)) )
+        goto out;
+
+    for ( i = 1; i < EPT_PAGETABLE_ENTRIES; i++ )
+    {
+        ept_entry_t e = atomic_read_ept_entry(&table[i]);
+
+        if ( e.mfn != first.mfn + i * trunk )
+            goto out;
+
+        /* Apart from the frame and A/D bits, entries must be identical. */
+        e.mfn = first.mfn;
+        e.a = first.a;
+        e.d = first.d;
+        if ( e.epte != first.epte )
+            goto out;
+    }
+
+    /* The memory type has to be uniform across the superpage too. */
+    if ( epte_get_entry_emt(p2m->domain, gfn, _mfn(first.mfn), order,
+                            &ipat, 0) != first.emt ||
+         ipat != first.ipat )
+        goto out;
+
+    *sp = first;
+    sp->sp = 1;
+    ept_p2m_type_to_flags(p2m, sp, sp->sa_p2mt, sp->access);
+    ok = 1;
+
+ out:
+    unmap_domain_page(table);
+    return ok;
+}
+
+/* A table replaced by a superpage, to be freed after the next flush. */
+struct ept_coalesced {
+    ept_entry_t old;
+    unsigned int level;
+};
+
+/*
+ * Walk to the entry mapping gfn at the given level and, if possible, turn
+ * it into a superpage, recording the replaced table in *c (c->old is left
+ * non-present otherwise).  Returns the level the walk stopped at.
+ */
+static unsigned int ept_coalesce_at(struct p2m_domain *p2m,
+                                    unsigned long gfn, unsigned int level,
+                                    struct ept_coalesced *c)
+{
+    struct domain *d = p2m->domain;
+    ept_entry_t *table, sp;
+    unsigned long gfn_remainder = gfn;
+    unsigned int i, index;
+    int rc;
+
+    table = map_domain_page(_mfn(pagetable_get_pfn(p2m_get_pagetable(p2m))));
+
+    for ( i = ept_get_wl(&p2m->ept); i > level; i-- )
+        if ( ept_next_level(p2m, 1, &table, &gfn_remainder, i) !=
+             GUEST_TABLE_NORMAL_PAGE )
+            break;
+
+    c->old.epte = 0;
+    c->level = level;
+    gfn &= ~((1UL << (level * EPT_TABLE_ORDER)) - 1);
+    index = gfn_remainder >> (level * EPT_TABLE_ORDER);
+
+    if ( i == level &&
+         ept_can_coalesce(p2m, atomic_read_ept_entry(&table[index]), gfn,
+                          level, &sp) )
+    {
+        c->old = atomic_read_ept_entry(&table[index]);
+        rc = atomic_write_ept_entry(&table[index], sp, level);
+        ASSERT(rc == 0);
+
+        if ( need_iommu(d) && iommu_hap_pt_share )
+            iommu_pte_flush(d, gfn, &table[index].epte,
+                            level * EPT_TABLE_ORDER, 1);
+
+        p2m->ept.coalesced[level - 1]++;
+    }
+
+    unmap_domain_page(table);
+
+    return i;
+}
+
+static void ept_coalesce_flush(struct p2m_domain *p2m,
+                               struct ept_coalesced *c, unsigned int *nr)
+{
+    unsigned int i;
+
+    if ( !*nr )
+        return;
+
+    /* No TLB may be using the old tables any more when they get freed. */
+    ept_sync_domain(p2m);
+
+    for ( i = 0; i < *nr; i++ )
+        ept_free_entry(p2m, &c[i].old, c[i].level);
+    *nr = 0;
+}
+
+static void ept_coalesce_domain(struct domain *d)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    struct ept_data *ept = &p2m->ept;
+    struct ept_coalesced done[EPT_COALESCE_FLUSH];
+    unsigned int n, level, nr_done = 0;
+    unsigned long gfn;
+
+    p2m_lock(p2m);
+
+    if ( d->is_dying || !pagetable_get_pfn(p2m_get_pagetable(p2m)) )
+        goto out;
+
+    for ( n = 0, gfn = ept->coalesce_gfn; n < EPT_COALESCE_BATCH; n++ )
+    {
+        if ( gfn > p2m->max_mapped_pfn )
+        {
+            gfn = 0;
+            break;
+        }
+
+        level = ept_coalesce_at(p2m, gfn, 1, &done[nr_done]);
+        if ( is_epte_present(&done[nr_done].old) )
+            nr_done++;
+
+        /* After the last 2M of a 1G region, try rebuilding the 1G page. */
+        if ( level == 1 && opt_hap_1gb && hvm_hap_has_1gb(d) &&
+             ((gfn >> EPT_TABLE_ORDER) & (EPT_PAGETABLE_ENTRIES - 1)) ==
+             EPT_PAGETABLE_ENTRIES - 1 )
+        {
+            ept_coalesce_at(p2m, gfn, 2, &done[nr_done]);
+            if ( is_epte_present(&done[nr_done].old) )
+                nr_done++;
+        }
+
+        /* Skip all of what the walk found to be a superpage or unmapped. */
+        gfn = (gfn | ((1UL << (level * EPT_TABLE_ORDER)) - 1)) + 1;
+
+        if ( nr_done > EPT_COALESCE_FLUSH - 2 )
+            ept_coalesce_flush(p2m, done, &nr_done);
+    }
+
+    ept_coalesce_flush(p2m, done, &nr_done);
+    ept->coalesce_gfn = gfn;
+
+ out:
+    p2m_unlock(p2m);
+}
+
+static struct timer ept_coalesce_timer;
+
+static void ept_coalesce_work(unsigned long unused)
+{
+    struct domain *d;
+
+    rcu_read_lock(&domlist_read_lock);
+
+    for_each_domain ( d )
+    {
+        /* Log-dirty mode would only split the superpages again. */
+        if ( !hap_enabled(d) || d->is_dying || paging_mode_log_dirty(d) )
+            continue;
+
+        ept_coalesce_domain(d);
+        process_pending_softirqs();
+    }
+
+    rcu_read_unlock(&domlist_read_lock);
+
+    set_timer(&ept_coalesce_timer, NOW() + EPT_COALESCE_INTERVAL);
+}
+static DECLARE_TASKLET(ept_coalesce_tasklet, ept_coalesce_work, 0);
+
+static void ept_coalesce_timer_fn(void *unused)
+{
+    /* Walking page tables may take a while: do it in vcpu context. */
+    tasklet_schedule(&ept_coalesce_tasklet);
+}
+
 int ept_p2m_init(struct p2m_domain *p2m)
 {
     struct ept_data *ept = &p2m->ept;
@@ -1188,6 +1412,7 @@ static void ept_dump_p2m_table(unsigned char key)
     int ret = 0;
     unsigned long gfn, gfn_remainder;
     unsigned long record_counter = 0;
+    unsigned long nr_pages[3];
     struct p2m_domain *p2m;
     struct ept_data *ept;
     static const char memory_types[8][2] = {
@@ -1208,6 +1433,7 @@ static void ept_dump_p2m_table(unsigned char key)
         p2m = p2m_get_hostp2m(d);
         ept = &p2m->ept;
         printk("\ndomain%d EPT p2m table:\n", d->domain_id);
+        memset(nr_pages, 0, sizeof(nr_pages));
 
         for ( gfn = 0; gfn <= p2m->max_mapped_pfn; gfn += 1UL << order )
         {
@@ -1243,11 +1469,19 @@ static void ept_dump_p2m_table(unsigned char key)
                            ?: ept_entry->emt + '0',
                            c ?: ept_entry->ipat ? '!' : ' ');
 
+                if ( is_epte_present(ept_entry) )
+                    nr_pages[i]++;
+
                 if ( !(record_counter++ % 100) )
                     process_pending_softirqs();
             }
             unmap_domain_page(table);
         }
+
+        printk("domain%d EPT mappings: 4k %lu 2M %lu 1G %lu,"
+               " superpages rebuilt: 2M %lu 1G %lu\n",
+               d->domain_id, nr_pages[0], nr_pages[1], nr_pages[2],
+               ept->coalesced[0], ept->coalesced[1]);
     }
 }
 
@@ -1262,6 +1496,19 @@ void setup_ept_dump(void)
     register_keyhandler('D', &ept_p2m_table);
 }
 
+void __init setup_ept_coalesce(void)
+{
+    /*
+     * Called from start_vmx(), before hvm_enable() fills in hvm_funcs, so
+     * the HAP capabilities have to come from the hardware directly.
+     */
+    if ( !opt_ept_coalesce || !opt_hap_2mb || !cpu_has_vmx_ept_2mb )
+        return;
+
+    init_timer(&ept_coalesce_timer, ept_coalesce_timer_fn, NULL, 0);
+    set_timer(&ept_coalesce_timer, NOW() + EPT_COALESCE_INTERVAL);
+}
+
 /*
  * Local variables:
  * mode: C
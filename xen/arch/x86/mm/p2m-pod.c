@@ -22,6 +22,7 @@
 #include <xen/iommu.h>
 #include <xen/vm_event.h>
 #include <xen/event.h>
+#include <xen/perfc.h>
 #include <public/vm_event.h>
 #include <asm/domain.h>
 #include <asm/page.h>
@@ -379,6 +380,7 @@ p2m_pod_empty_cache(struct domain *d)
 
     /* After this barrier no new PoD activities can happen. */
     BUG_ON(!d->is_dying);
+    tasklet_kill(&p2m->pod.reclaim_tasklet);
     spin_barrier(&p2m->pod.lock.lock);
 
     lock_page_alloc(p2m);
@@ -636,6 +638,29 @@ void p2m_pod_dump_data(struct domain *d)
 
     printk("    PoD entries=%ld cachesize=%ld\n",
            p2m->pod.entry_count, p2m->pod.count);
+    if ( p2m->pod.stats.populates )
+        printk("    PoD populates=%lu avg=%"PRI_stime"ns max=%"PRI_stime"ns"
+               " sweeps=%lu (%"PRI_stime"ns) reclaimed=%lu\n",
+               p2m->pod.stats.populates,
+               p2m->pod.stats.populate_ns / p2m->pod.stats.populates,
+               p2m->pod.stats.populate_max_ns, p2m->pod.stats.sweeps,
+               p2m->pod.stats.sweep_ns, p2m->pod.stats.reclaimed);
+}
+
+/*
+ * Check a whole page for zeroes.  There's no SIMD in the hypervisor, so
+ * OR eight words together and branch once per cache line instead.
+ */
+static bool_t pod_page_is_zero(const unsigned long *p)
+{
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); i += 8 )
+        if ( p[i] | p[i + 1] | p[i + 2] | p[i + 3] |
+             p[i + 4] | p[i + 5] | p[i + 6] | p[i + 7] )
+            return 0;
+
+    return 1;
 }
 
 
@@ -739,14 +764,7 @@ p2m_pod_zero_check_superpage(struct p2m_domain *p2m, unsigned long gfn)
     for ( i=0; i < SUPERPAGE_PAGES; i++ )
     {
         map = map_domain_page(_mfn(mfn_x(mfn0) + i));
-
-        for ( j=0; j<PAGE_SIZE/sizeof(*map); j++ )
-            if( *(map+j) != 0 )
-            {
-                reset = 1;
-                break;
-            }
-
+        reset = !pod_page_is_zero(map);
         unmap_domain_page(map);
 
         if ( reset )
@@ -858,15 +876,13 @@ p2m_pod_zero_check(struct p2m_domain *p2m, unsigned long *gfns, int count)
         if(!map[i])
             continue;
 
-        for ( j=0; j<PAGE_SIZE/sizeof(*map[i]); j++ )
-            if( *(map[i]+j) != 0 )
-                break;
+        j = pod_page_is_zero(map[i]);
 
         unmap_domain_page(map[i]);
 
         /* See comment in p2m_pod_zero_check_superpage() re gnttab
          * check timing.  */
-        if ( j < PAGE_SIZE/sizeof(*map[i]) )
+        if ( !j )
         {
             p2m_set_entry(p2m, gfns[i], mfns[i], PAGE_ORDER_4K,
                 types[i], p2m->default_access);
@@ -971,10 +987,109 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
 
 }
 
-int
-p2m_pod_demand_populate(struct p2m_domain *p2m, unsigned long gfn,
-                        unsigned int order,
-                        p2m_query_t q)
+/*
+ * Background reclaim.  Rather than waiting for the cache to run dry and
+ * sweeping from the faulting vcpu, a tasklet tops the cache up whenever it
+ * drops below a watermark (in pages; 0 disables it).  It only reclaims
+ * whole zeroed superpages, so it never fragments the p2m, and it runs on a
+ * cpu of the domain's node(s), close to the memory it has to read.
+ */
+static unsigned int __read_mostly opt_pod_reclaim_watermark = 2048;
+integer_param("pod_reclaim_watermark", opt_pod_reclaim_watermark);
+
+/* Superpages checked per tasklet run */
+#define POD_RECLAIM_BATCH   64
+/* Pause after a full pass over the p2m which found nothing */
+#define POD_RECLAIM_BACKOFF MILLISECS(100)
+
+static void p2m_pod_reclaim(unsigned long data)
+{
+    struct p2m_domain *p2m = (struct p2m_domain *)data;
+    unsigned long gfn;
+    unsigned int i;
+    int ret;
+
+    perfc_incr(pod_reclaim_runs);
+
+    /* p2m_pod_zero_check_superpage() wants the p2m lock outside the pod lock */
+    p2m_lock(p2m);
+    pod_lock(p2m);
+
+    if ( p2m->domain->is_dying )
+        goto out;
+
+    gfn = p2m->pod.reclaim_super;
+    for ( i = 0; i < POD_RECLAIM_BATCH &&
+                 p2m->pod.count < 2 * opt_pod_reclaim_watermark; i++ )
+    {
+        if ( gfn > p2m->max_mapped_pfn )
+        {
+            if ( !p2m->pod.reclaim_found )
+                p2m->pod.reclaim_idle = NOW() + POD_RECLAIM_BACKOFF;
+            p2m->pod.reclaim_found = 0;
+            gfn = 0;
+            if ( p2m->pod.reclaim_idle )
+                break;
+        }
+
+        ret = p2m_pod_zero_check_superpage(p2m, gfn);
+        if ( ret )
+        {
+            perfc_incr(pod_reclaim_superpages);
+            p2m->pod.reclaim_found += ret;
+            p2m->pod.stats.reclaimed += ret;
+        }
+        gfn += SUPERPAGE_PAGES;
+    }
+    p2m->pod.reclaim_super = gfn;
+
+ out:
+    pod_unlock(p2m);
+    p2m_unlock(p2m);
+}
+
+/* Kick the background reclaimer if the cache is low.  Pod lock held. */
+static void p2m_pod_reclaim_kick(struct p2m_domain *p2m)
+{
+    const struct domain *d = p2m->domain;
+    unsigned int node, cpu = smp_processor_id();
+
+    ASSERT(pod_locked_by_me(p2m));
+
+    /* Only the host p2m's tasklet is killed by p2m_pod_empty_cache(). */
+    if ( !opt_pod_reclaim_watermark || !p2m_is_hostp2m(p2m) ||
+         p2m->pod.count >= opt_pod_reclaim_watermark ||
+         p2m->pod.entry_count <= p2m->pod.count )
+        return;
+
+    if ( p2m->pod.reclaim_idle )
+    {
+        if ( NOW() < p2m->pod.reclaim_idle )
+            return;
+        p2m->pod.reclaim_idle = 0;
+    }
+
+    if ( !node_isset(cpu_to_node(cpu), d->node_affinity) )
+        for_each_node_mask ( node, d->node_affinity )
+            if ( !cpumask_empty(&node_to_cpumask(node)) )
+            {
+                cpu = cpumask_cycle(cpu, &node_to_cpumask(node));
+                break;
+            }
+
+    tasklet_schedule_on_cpu(&p2m->pod.reclaim_tasklet, cpu);
+}
+
+void p2m_pod_init(struct p2m_domain *p2m)
+{
+    tasklet_init(&p2m->pod.reclaim_tasklet, p2m_pod_reclaim,
+                 (unsigned long)p2m);
+}
+
+static int
+pod_demand_populate(struct p2m_domain *p2m, unsigned long gfn,
+                    unsigned int order,
+                    p2m_query_t q)
 {
     struct domain *d = p2m->domain;
     struct page_info *p = NULL; /* Compiler warnings */
@@ -1014,7 +1129,14 @@ p2m_pod_demand_populate(struct p2m_domain *p2m, unsigned long gfn,
     /* Only sweep if we're actually out of memory.  Doing anything else
      * causes unnecessary time and fragmentation of superpages in the p2m. */
     if ( p2m->pod.count == 0 )
+    {
+        s_time_t start = NOW();
+
+        perfc_incr(pod_emergency_sweeps);
         p2m_pod_emergency_sweep(p2m);
+        p2m->pod.stats.sweeps++;
+        p2m->pod.stats.sweep_ns += NOW() - start;
+    }
 
     /* If the sweep failed, give up. */
     if ( p2m->pod.count == 0 )
@@ -1068,6 +1190,8 @@ p2m_pod_demand_populate(struct p2m_domain *p2m, unsigned long gfn,
          && (q & P2M_ALLOC) )
         p2m_pod_check_last_super(p2m, gfn_aligned);
 
+    p2m_pod_reclaim_kick(p2m);
+
     pod_unlock(p2m);
     return 0;
 out_of_memory:
@@ -1108,6 +1232,23 @@ remap_and_retry:
     return 0;
 }
 
+int
+p2m_pod_demand_populate(struct p2m_domain *p2m, unsigned long gfn,
+                        unsigned int order,
+                        p2m_query_t q)
+{
+    s_time_t start = NOW(), t;
+    int rc = pod_demand_populate(p2m, gfn, order, q);
+
+    /* Serialised by the gfn lock held by our caller. */
+    t = NOW() - start;
+    p2m->pod.stats.populates++;
+    p2m->pod.stats.populate_ns += t;
+    if ( t > p2m->pod.stats.populate_max_ns )
+        p2m->pod.stats.populate_max_ns = t;
+
+    return rc;
+}
 
 int
 guest_physmap_mark_populate_on_demand(struct domain *d, unsigned long gfn,
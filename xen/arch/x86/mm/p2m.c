@@ -71,6 +71,7 @@ static int p2m_initialise(struct domain *d, struct p2m_domain *p2m)
     INIT_PAGE_LIST_HEAD(&p2m->pod.single);
 
     p2m->domain = d;
+    p2m_pod_init(p2m);
     p2m->default_access = p2m_access_rwx;
     p2m->p2m_class = p2m_host;
 
@@ -28,6 +28,7 @@
 #include <asm/event.h>
 #include <asm/hvm/nestedhvm.h>
 #include <xen/numa.h>
+#include <xen/vmap.h>
 #include <xsm/xsm.h>
 
 #include "mm-locks.h"
@@ -241,6 +242,25 @@ int paging_log_dirty_enable(struct domain *d, bool_t log_global)
     return ret;
 }
 
+/* Largest dirty ring a toolstack may ask for (8Mb worth of pfns). */
+#define LOGDIRTY_RING_MAX_ENTRIES (1u << 20)
+/* Number of pfns handled per lock hold when draining the dirty ring. */
+#define LOGDIRTY_RING_BATCH       64
+
+static void paging_log_dirty_ring_free(struct domain *d)
+{
+    struct log_dirty_ring *ring = &d->arch.paging.log_dirty.ring;
+    unsigned long *pfns;
+
+    paging_lock(d);
+    pfns = ring->pfns;
+    ring->pfns = NULL;
+    ring->size = 0;
+    paging_unlock(d);
+
+    vfree(pfns);
+}
+
 static int paging_log_dirty_disable(struct domain *d, bool_t resuming)
 {
     int ret = 1;
@@ -260,11 +280,32 @@ static int paging_log_dirty_disable(struct domain *d, bool_t resuming)
     if ( ret == -ERESTART )
         return ret;
 
+    paging_log_dirty_ring_free(d);
+
     domain_unpause(d);
 
     return ret;
 }
 
+/* Record a newly dirtied pfn in the dirty ring, if there is one. */
+static void paging_log_dirty_ring_push(struct domain *d, unsigned long pfn)
+{
+    struct log_dirty_ring *ring = &d->arch.paging.log_dirty.ring;
+
+    ASSERT(paging_locked_by_me(d));
+
+    if ( !ring->pfns || ring->overflow )
+        return;
+
+    if ( ring->prod - ring->cons == ring->size )
+    {
+        ring->overflow = 1;
+        return;
+    }
+
+    ring->pfns[ring->prod++ & (ring->size - 1)] = pfn;
+}
+
 /* Mark a page as dirty, with taking guest pfn as parameter */
 void paging_mark_gfn_dirty(struct domain *d, unsigned long pfn)
 {
@@ -335,6 +376,7 @@ void paging_mark_gfn_dirty(struct domain *d, unsigned long pfn)
                      "marked mfn %" PRI_mfn " (pfn=%lx), dom %d\n",
                      mfn_x(gmfn), pfn, d->domain_id);
         d->arch.paging.log_dirty.dirty_count++;
+        paging_log_dirty_ring_push(d, pfn);
     }
 
 out:
@@ -407,6 +449,180 @@ int paging_mfn_is_dirty(struct domain *d, mfn_t gmfn)
     return rv;
 }
 
+/* Clear a pfn's bit in the log-dirty bitmap.  Returns whether it was set. */
+static int paging_log_dirty_clear_pfn(struct domain *d, unsigned long pfn)
+{
+    mfn_t mfn, *l4, *l3, *l2;
+    unsigned long *l1;
+    int rv;
+
+    ASSERT(paging_locked_by_me(d));
+
+    mfn = d->arch.paging.log_dirty.top;
+    if ( !mfn_valid(mfn) )
+        return 0;
+
+    l4 = map_domain_page(mfn);
+    mfn = l4[L4_LOGDIRTY_IDX(pfn)];
+    unmap_domain_page(l4);
+    if ( !mfn_valid(mfn) )
+        return 0;
+
+    l3 = map_domain_page(mfn);
+    mfn = l3[L3_LOGDIRTY_IDX(pfn)];
+    unmap_domain_page(l3);
+    if ( !mfn_valid(mfn) )
+        return 0;
+
+    l2 = map_domain_page(mfn);
+    mfn = l2[L2_LOGDIRTY_IDX(pfn)];
+    unmap_domain_page(l2);
+    if ( !mfn_valid(mfn) )
+        return 0;
+
+    l1 = map_domain_page(mfn);
+    rv = __test_and_clear_bit(L1_LOGDIRTY_IDX(pfn), l1);
+    unmap_domain_page(l1);
+    return rv;
+}
+
+static int paging_log_dirty_ring_setup(struct domain *d,
+                                       struct xen_domctl_shadow_op *sc)
+{
+    struct log_dirty_ring *ring = &d->arch.paging.log_dirty.ring;
+    unsigned long *pfns = NULL, *old;
+    unsigned int size = 0;
+
+    /*
+     * Cleaning individual pfns relies on being able to write protect them
+     * in the p2m one at a time, which shadow mode can't do cheaply.
+     */
+    if ( !hap_enabled(d) )
+        return -EOPNOTSUPP;
+
+    if ( sc->pages > LOGDIRTY_RING_MAX_ENTRIES )
+        return -EINVAL;
+
+    if ( sc->pages )
+    {
+        if ( !paging_mode_log_dirty(d) )
+            return -EINVAL;
+
+        for ( size = 1; size < sc->pages; size <<= 1 )
+            continue;
+        pfns = vmalloc(size * sizeof(*pfns));
+        if ( !pfns )
+            return -ENOMEM;
+    }
+
+    paging_lock(d);
+
+    old = ring->pfns;
+    ring->pfns = pfns;
+    ring->size = size;
+    ring->prod = ring->cons = 0;
+    /*
+     * Pages already dirty in the bitmap won't be pushed again when next
+     * written, so unless the bitmap is empty the ring only becomes complete
+     * at the next CLEAN.
+     */
+    ring->overflow = !!d->arch.paging.log_dirty.dirty_count;
+
+    paging_unlock(d);
+
+    vfree(old);
+
+    sc->pages = size;
+
+    return 0;
+}
+
+/*
+ * Hand out pfns queued on the dirty ring, clearing them from the bitmap
+ * and write protecting them again so that the next write is logged anew.
+ */
+static int paging_log_dirty_ring_drain(struct domain *d,
+                                       struct xen_domctl_shadow_op *sc)
+{
+    struct log_dirty_ring *ring = &d->arch.paging.log_dirty.ring;
+    uint64_t pfns[LOGDIRTY_RING_BATCH];
+    unsigned long done = 0;
+    unsigned int i, n;
+    int rc = 0;
+
+    if ( !hap_enabled(d) )
+        return -EOPNOTSUPP;
+
+    domain_pause(d);
+
+    /* Pull in dirty GFNs still sitting in PML buffers. */
+    p2m_flush_hardware_cached_dirty(d);
+
+    for ( ; ; )
+    {
+        paging_lock(d);
+
+        if ( !ring->pfns || !paging_mode_log_dirty(d) )
+            rc = -EINVAL;
+        else if ( d->arch.paging.log_dirty.failed_allocs )
+            rc = -ENOMEM;
+        else if ( ring->overflow )
+            rc = -EOVERFLOW;
+
+        for ( n = 0;
+              !rc && n < ARRAY_SIZE(pfns) && done + n < sc->pages &&
+              ring->cons + n != ring->prod;
+              n++ )
+            pfns[n] = ring->pfns[(ring->cons + n) & (ring->size - 1)];
+
+        paging_unlock(d);
+
+        if ( rc || !n )
+            break;
+
+        /*
+         * Copy out before consuming, so a bad buffer doesn't lose pfns.
+         * The domctl lock makes us the only consumer of the ring.
+         */
+        if ( copy_to_guest_offset(sc->dirty_bitmap, done * sizeof(*pfns),
+                                  (uint8_t *)pfns, n * sizeof(*pfns)) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+
+        paging_lock(d);
+        for ( i = 0; i < n; i++ )
+            if ( paging_log_dirty_clear_pfn(d, pfns[i]) &&
+                 d->arch.paging.log_dirty.dirty_count )
+                d->arch.paging.log_dirty.dirty_count--;
+        ring->cons += n;
+        paging_unlock(d);
+
+        /* The p2m lock nests outside the paging lock. */
+        for ( i = 0; i < n; i++ )
+            p2m_change_type_one(d, pfns[i], p2m_ram_rw, p2m_ram_logdirty);
+
+        done += n;
+
+        if ( done < sc->pages && hypercall_preempt_check() )
+            break;
+    }
+
+    if ( done )
+        flush_tlb_mask(d->domain_dirty_cpumask);
+
+    paging_lock(d);
+    sc->stats.fault_count = d->arch.paging.log_dirty.fault_count;
+    sc->stats.dirty_count = ring->prod - ring->cons;
+    paging_unlock(d);
+
+    domain_unpause(d);
+
+    sc->pages = done;
+
+    return rc;
+}
 
 /* Read a domain's log-dirty bitmap and stats.  If the operation is a CLEAN,
  * clear the bitmap and stats as well. */
@@ -448,6 +664,17 @@ static int paging_log_dirty_op(struct domain *d,
 
     clean = (sc->op == XEN_DOMCTL_SHADOW_OP_CLEAN);
 
+    /*
+     * The ring restarts from an empty bitmap.  Doing this before the walk
+     * means a pfn dirtied meanwhile is at worst reported twice.
+     */
+    if ( clean && !d->arch.paging.preempt.dom )
+    {
+        d->arch.paging.log_dirty.ring.prod = 0;
+        d->arch.paging.log_dirty.ring.cons = 0;
+        d->arch.paging.log_dirty.ring.overflow = 0;
+    }
+
     PAGING_DEBUG(LOGDIRTY, "log-dirty %s: dom %u faults=%u dirty=%u\n",
                  (clean) ? "clean" : "peek",
                  d->domain_id,
@@ -745,6 +972,12 @@ int paging_domctl(struct domain *d, xen_domctl_shadow_op_t *sc,
     case XEN_DOMCTL_SHADOW_OP_CLEAN:
     case XEN_DOMCTL_SHADOW_OP_PEEK:
         return paging_log_dirty_op(d, sc, resuming);
+
+    case XEN_DOMCTL_SHADOW_OP_DIRTY_RING_SETUP:
+        return paging_log_dirty_ring_setup(d, sc);
+
+    case XEN_DOMCTL_SHADOW_OP_DIRTY_RING_DRAIN:
+        return paging_log_dirty_ring_drain(d, sc);
     }
 
     /* Here, dispatch domctl to the appropriate paging code */
@@ -823,6 +1056,8 @@ int paging_teardown(struct domain *d)
 /* Call once all of the references to the domain have gone away */
 void paging_final_teardown(struct domain *d)
 {
+    paging_log_dirty_ring_free(d);
+
     if ( hap_enabled(d) )
         hap_final_teardown(d);
     else
@@ -876,6 +1111,9 @@ void paging_dump_domain_info(struct domain *d)
         if ( paging_mode_external(d) )
             printk("external ");
         printk("\n");
+
+        if ( paging_mode_shadow(d) )
+            shadow_dump_hash_stats(d);
     }
 }
 
@@ -43,6 +43,7 @@ DEFINE_PER_CPU(uint32_t,trace_shadow_path_flags);
 static int sh_enable_log_dirty(struct domain *, bool_t log_global);
 static int sh_disable_log_dirty(struct domain *);
 static void sh_clean_dirty_bitmap(struct domain *);
+static void shadow_hash_resize_work(unsigned long data);
 
 /* Set up the shadow-specific parts of a domain struct at start of day.
  * Called for every domain from arch_domain_create() */
@@ -61,6 +62,9 @@ int shadow_domain_init(struct domain *d, unsigned int domcr_flags)
 #endif
     d->arch.paging.shadow.pagetable_dying_op = 0;
 
+    tasklet_init(&d->arch.paging.shadow.hash_resize_tasklet,
+                 shadow_hash_resize_work, (unsigned long)d);
+
     return 0;
 }
 
@@ -370,6 +374,7 @@ const struct x86_emulate_ops *shadow_init_emulation(
     unsigned long addr;
 
     sh_ctxt->ctxt.regs = regs;
+    sh_ctxt->ctxt.insn_cache = NULL;
     sh_ctxt->ctxt.force_writeback = 0;
     sh_ctxt->ctxt.swint_emulate = x86_swint_emulate_none;
 
@@ -1733,18 +1738,30 @@ static unsigned int shadow_get_allocation(struct domain *d)
  * The table itself is an array of pointers to shadows; the shadows are then
  * threaded on a singly-linked list of shadows with the same hash value */
 
-#define SHADOW_HASH_BUCKETS 251
-/* Other possibly useful primes are 509, 1021, 2039, 4093, 8191, 16381 */
+/* The table starts small, and is resized to keep the average chain length
+ * between 1/8 and 2.  Sizes are primes, from the list below. */
+static const unsigned int shadow_hash_sizes[] = {
+    251, 509, 1021, 2039, 4093, 8191, 16381, 32749
+};
+#define SHADOW_HASH_BUCKETS     (shadow_hash_sizes[0])
+#define SHADOW_HASH_MAX_BUCKETS \
+    (shadow_hash_sizes[ARRAY_SIZE(shadow_hash_sizes) - 1])
 
 /* Hash function that takes a gfn or mfn, plus another byte of type info */
 typedef u32 key_t;
-static inline key_t sh_hash(unsigned long n, unsigned int t)
+static inline key_t sh_hash_raw(unsigned long n, unsigned int t)
 {
     unsigned char *p = (unsigned char *)&n;
     key_t k = t;
     int i;
     for ( i = 0; i < sizeof(n) ; i++ ) k = (u32)p[i] + (k<<6) + (k<<16) - k;
-    return k % SHADOW_HASH_BUCKETS;
+    return k;
+}
+
+static inline key_t sh_hash(const struct domain *d, unsigned long n,
+                            unsigned int t)
+{
+    return sh_hash_raw(n, t) % d->arch.paging.shadow.hash_buckets;
 }
 
 #if SHADOW_AUDIT & (SHADOW_AUDIT_HASH|SHADOW_AUDIT_HASH_FULL)
@@ -1770,7 +1787,7 @@ static void sh_hash_audit_bucket(struct domain *d, int bucket)
         /* Wrong page of a multi-page shadow? */
         BUG_ON( !sp->u.sh.head );
         /* Wrong bucket? */
-        BUG_ON( sh_hash(__backpointer(sp), sp->u.sh.type) != bucket );
+        BUG_ON( sh_hash(d, __backpointer(sp), sp->u.sh.type) != bucket );
         /* Duplicate entry? */
         for ( x = next_shadow(sp); x; x = next_shadow(x) )
             BUG_ON( x->v.sh.back == sp->v.sh.back &&
@@ -1835,7 +1852,7 @@ static void sh_hash_audit(struct domain *d)
     if ( !(SHADOW_AUDIT_ENABLE) )
         return;
 
-    for ( i = 0; i < SHADOW_HASH_BUCKETS; i++ )
+    for ( i = 0; i < d->arch.paging.shadow.hash_buckets; i++ )
     {
         sh_hash_audit_bucket(d, i);
     }
@@ -1857,6 +1874,8 @@ static int shadow_hash_alloc(struct domain *d)
     table = xzalloc_array(struct page_info *, SHADOW_HASH_BUCKETS);
     if ( !table ) return 1;
     d->arch.paging.shadow.hash_table = table;
+    d->arch.paging.shadow.hash_buckets = SHADOW_HASH_BUCKETS;
+    d->arch.paging.shadow.hash_entries = 0;
     return 0;
 }
 
@@ -1869,6 +1888,130 @@ static void shadow_hash_teardown(struct domain *d)
 
     xfree(d->arch.paging.shadow.hash_table);
     d->arch.paging.shadow.hash_table = NULL;
+    d->arch.paging.shadow.hash_buckets = 0;
+}
+
+/* Move every entry into @table, which has @buckets empty buckets, and
+ * return the old table. */
+static struct page_info **shadow_hash_rehash(struct domain *d,
+                                             struct page_info **table,
+                                             unsigned int buckets)
+{
+    struct page_info **old = d->arch.paging.shadow.hash_table;
+    struct page_info *sp, *next;
+    unsigned int i, key;
+
+    ASSERT(paging_locked_by_me(d));
+    ASSERT(!d->arch.paging.shadow.hash_walking);
+
+    for ( i = 0; i < d->arch.paging.shadow.hash_buckets; i++ )
+        for ( sp = old[i]; sp; sp = next )
+        {
+            next = next_shadow(sp);
+            key = sh_hash_raw(__backpointer(sp), sp->u.sh.type) % buckets;
+            set_next_shadow(sp, table[key]);
+            table[key] = sp;
+        }
+
+    d->arch.paging.shadow.hash_table = table;
+    d->arch.paging.shadow.hash_buckets = buckets;
+    d->arch.paging.shadow.hash_resizes++;
+
+    perfc_incr(shadow_hash_resizes);
+    sh_hash_audit(d);
+
+    return old;
+}
+
+/* Resize the table to the size asked for by shadow_hash_check_load().  The
+ * new table is allocated without the paging lock held.  Nothing is done if
+ * the allocation fails: the old table stays valid, just slower. */
+static void shadow_hash_resize_work(unsigned long data)
+{
+    struct domain *d = (struct domain *)data;
+    struct page_info **table;
+    unsigned int buckets;
+
+    paging_lock(d);
+    buckets = d->arch.paging.shadow.hash_resize_to;
+    paging_unlock(d);
+
+    table = xzalloc_array(struct page_info *, buckets);
+
+    paging_lock(d);
+    if ( table && d->arch.paging.shadow.hash_table && !d->is_dying &&
+         buckets == d->arch.paging.shadow.hash_resize_to )
+        table = shadow_hash_rehash(d, table, buckets);
+    d->arch.paging.shadow.hash_resize_to = 0;
+    paging_unlock(d);
+
+    xfree(table);
+    put_domain(d);
+}
+
+/* Ask for the table to grow or shrink by one size step if the load calls
+ * for it.  Allocating the new table is left to a tasklet, which holds a
+ * reference to the domain until it has run. */
+static void shadow_hash_check_load(struct domain *d)
+{
+    unsigned int buckets = d->arch.paging.shadow.hash_buckets;
+    unsigned int entries = d->arch.paging.shadow.hash_entries;
+    unsigned int i, target = 0;
+
+    if ( d->arch.paging.shadow.hash_resize_to || d->is_dying )
+        return;
+
+    if ( entries > 2 * buckets && buckets < SHADOW_HASH_MAX_BUCKETS )
+    {
+        for ( i = 0; shadow_hash_sizes[i] <= buckets; i++ )
+            continue;
+        target = shadow_hash_sizes[i];
+    }
+    else if ( entries < buckets / 8 && buckets > SHADOW_HASH_BUCKETS )
+    {
+        for ( i = ARRAY_SIZE(shadow_hash_sizes) - 1;
+              shadow_hash_sizes[i] >= buckets; i-- )
+            continue;
+        target = shadow_hash_sizes[i];
+    }
+
+    if ( !target || !get_domain(d) )
+        return;
+
+    d->arch.paging.shadow.hash_resize_to = target;
+    tasklet_schedule(&d->arch.paging.shadow.hash_resize_tasklet);
+}
+
+/* Print the table's size and occupancy (console 'q' key).  Skipped if the
+ * domain's paging lock is busy, rather than waiting on it. */
+void shadow_dump_hash_stats(struct domain *d)
+{
+    unsigned int i, len, used = 0, longest = 0;
+    struct page_info *sp;
+
+    if ( !paging_trylock(d) )
+    {
+        printk("    shadow hash: paging lock busy\n");
+        return;
+    }
+    if ( d->arch.paging.shadow.hash_table )
+    {
+        for ( i = 0; i < d->arch.paging.shadow.hash_buckets; i++ )
+        {
+            for ( len = 0, sp = d->arch.paging.shadow.hash_table[i]; sp;
+                  sp = next_shadow(sp) )
+                len++;
+            used += !!len;
+            longest = max(longest, len);
+        }
+
+        printk("    shadow hash: %u entries, %u/%u buckets used, "
+               "longest chain %u, %u resizes\n",
+               d->arch.paging.shadow.hash_entries, used,
+               d->arch.paging.shadow.hash_buckets, longest,
+               d->arch.paging.shadow.hash_resizes);
+    }
+    paging_unlock(d);
 }
 
 
@@ -1886,7 +2029,7 @@ mfn_t shadow_hash_lookup(struct domain *d, unsigned long n, unsigned int t)
     sh_hash_audit(d);
 
     perfc_incr(shadow_hash_lookups);
-    key = sh_hash(n, t);
+    key = sh_hash(d, n, t);
     sh_hash_audit_bucket(d, key);
 
     sp = d->arch.paging.shadow.hash_table[key];
@@ -1919,6 +2062,7 @@ mfn_t shadow_hash_lookup(struct domain *d, unsigned long n, unsigned int t)
         }
         prev = sp;
         sp = next_shadow(sp);
+        perfc_incr(shadow_hash_lookup_steps);
     }
 
     perfc_incr(shadow_hash_lookup_miss);
@@ -1939,15 +2083,18 @@ void shadow_hash_insert(struct domain *d, unsigned long n, unsigned int t,
     sh_hash_audit(d);
 
     perfc_incr(shadow_hash_inserts);
-    key = sh_hash(n, t);
+    key = sh_hash(d, n, t);
     sh_hash_audit_bucket(d, key);
 
     /* Insert this shadow at the top of the bucket */
     sp = mfn_to_page(smfn);
     set_next_shadow(sp, d->arch.paging.shadow.hash_table[key]);
     d->arch.paging.shadow.hash_table[key] = sp;
+    d->arch.paging.shadow.hash_entries++;
 
     sh_hash_audit_bucket(d, key);
+
+    shadow_hash_check_load(d);
 }
 
 void shadow_hash_delete(struct domain *d, unsigned long n, unsigned int t,
@@ -1964,7 +2111,7 @@ void shadow_hash_delete(struct domain *d, unsigned long n, unsigned int t,
     sh_hash_audit(d);
 
     perfc_incr(shadow_hash_deletes);
-    key = sh_hash(n, t);
+    key = sh_hash(d, n, t);
     sh_hash_audit_bucket(d, key);
 
     sp = mfn_to_page(smfn);
@@ -1988,8 +2135,11 @@ void shadow_hash_delete(struct domain *d, unsigned long n, unsigned int t,
         }
     }
     set_next_shadow(sp, NULL);
+    d->arch.paging.shadow.hash_entries--;
 
     sh_hash_audit_bucket(d, key);
+
+    shadow_hash_check_load(d);
 }
 
 typedef int (*hash_vcpu_callback_t)(struct vcpu *v, mfn_t smfn, mfn_t other_mfn);
@@ -2021,7 +2171,7 @@ static void hash_vcpu_foreach(struct vcpu *v, unsigned int callback_mask,
     ASSERT(d->arch.paging.shadow.hash_walking == 0);
     d->arch.paging.shadow.hash_walking = 1;
 
-    for ( i = 0; i < SHADOW_HASH_BUCKETS; i++ )
+    for ( i = 0; i < d->arch.paging.shadow.hash_buckets; i++ )
     {
         /* WARNING: This is not safe against changes to the hash table.
          * The callback *must* return non-zero if it has inserted or
@@ -2068,7 +2218,7 @@ static void hash_domain_foreach(struct domain *d,
     ASSERT(d->arch.paging.shadow.hash_walking == 0);
     d->arch.paging.shadow.hash_walking = 1;
 
-    for ( i = 0; i < SHADOW_HASH_BUCKETS; i++ )
+    for ( i = 0; i < d->arch.paging.shadow.hash_buckets; i++ )
     {
         /* WARNING: This is not safe against changes to the hash table.
          * The callback *must* return non-zero if it has inserted or
@@ -1318,6 +1318,89 @@ decode_register(
     return p;
 }
 
+int
+x86_insn_mov_mem32(
+    const uint8_t *insn, unsigned int len, unsigned int addr_size,
+    struct x86_mov_mem32 *mov)
+{
+    unsigned int i = 0, modrm, mod, rm, want;
+    uint8_t rex = 0;
+
+    if ( addr_size != 32 && addr_size != 64 )
+        return -1;
+
+    /* Segment overrides don't matter: the access has happened already. */
+    while ( i < len && (insn[i] == 0x26 || insn[i] == 0x2e ||
+                        insn[i] == 0x36 || insn[i] == 0x3e ||
+                        insn[i] == 0x64 || insn[i] == 0x65) )
+        i++;
+
+    if ( addr_size == 64 && i < len && (insn[i] & 0xf0) == 0x40 )
+        rex = insn[i++];
+    if ( rex & 8 )              /* REX.W: 64-bit operand. */
+        return -1;
+
+    if ( i + 2 > len )
+        return -1;
+    modrm = insn[i + 1];
+    mod = modrm >> 6;
+    rm = modrm & 7;
+
+    switch ( insn[i] )
+    {
+    case 0x89: /* mov r32,m32 */
+    case 0x8b: /* mov m32,r32 */
+        mov->write = insn[i] == 0x89;
+        mov->has_imm = 0;
+        mov->reg = ((modrm >> 3) & 7) | ((rex & 4) << 1);
+        want = 0;
+        break;
+    case 0xc7: /* mov $imm32,m32 */
+        if ( modrm & 0x38 )
+            return -1;
+        mov->write = 1;
+        mov->has_imm = 1;
+        mov->reg = 0;
+        want = 4;
+        break;
+    default:
+        return -1;
+    }
+
+    /* The remaining bytes must be exactly the addressing form plus imm32. */
+    i += 2;
+    switch ( mod )
+    {
+    case 0:
+        if ( rm == 4 )
+        {
+            if ( i >= len )
+                return -1;
+            want += 1 + ((insn[i] & 7) == 5 ? 4 : 0);
+        }
+        else if ( rm == 5 )
+            want += 4;
+        break;
+    case 1:
+        want += 1 + (rm == 4);
+        break;
+    case 2:
+        want += 4 + (rm == 4);
+        break;
+    default:                    /* Register operand: not a memory access. */
+        return -1;
+    }
+
+    if ( i + want != len )
+        return -1;
+
+    if ( mov->has_imm )
+        mov->imm = insn[len - 4] | (insn[len - 3] << 8) |
+                   (insn[len - 2] << 16) | ((uint32_t)insn[len - 1] << 24);
+
+    return 0;
+}
+
 #define decode_segment_failed x86_seg_tr
 static enum x86_segment
 decode_segment(uint8_t modrm_reg)
@@ -1444,6 +1527,75 @@ static int inject_swint(enum x86_swint_type type,
     return ops->inject_hw_exception(fault_type, error_code, ctxt);
 }
 
+/* No base or index register in a ModRM memory operand. */
+#define EA_NONE 0xff
+
+/*
+ * Execution mode, as far as decode depends on it: C4/C5 are LES/LDS in real
+ * and VM86 mode, but may be VEX in protected mode.
+ */
+static uint8_t
+insn_cache_mode(
+    struct x86_emulate_ctxt *ctxt,
+    const struct x86_emulate_ops *ops)
+{
+    if ( !in_protmode(ctxt, ops) )
+        return 0;
+    return ctxt->addr_size == 64 ? 2 : 1;
+}
+
+/*
+ * Look up the instruction at the current CS:rIP in the decoded instruction
+ * cache.  An entry is only returned if the instruction's bytes still match.
+ */
+static int
+insn_cache_lookup(
+    struct x86_emulate_ctxt *ctxt,
+    const struct x86_emulate_ops *ops,
+    uint8_t mode,
+    struct x86_insn_cache_entry **pce)
+{
+    struct x86_insn_cache *cache = ctxt->insn_cache;
+    unsigned long eip = ctxt->regs->eip;
+    uint8_t bytes[MAX_INST_LEN];
+    unsigned int i;
+    int rc;
+
+    *pce = NULL;
+
+    if ( ctxt->addr_size != 64 )
+        eip = (uint32_t)eip;
+
+    for ( i = 0; i < X86_INSN_CACHE_ENTRIES; i++ )
+    {
+        struct x86_insn_cache_entry *ce = &cache->ent[i];
+
+        if ( !ce->len || (ce->eip != ctxt->regs->eip) ||
+             (ce->tag != ctxt->insn_cache_tag) ||
+             (ce->addr_size != ctxt->addr_size) || (ce->mode != mode) )
+            continue;
+
+        rc = ops->insn_fetch(x86_seg_cs, eip, bytes, ce->len, ctxt);
+        if ( rc != X86EMUL_OKAY )
+            return rc;
+
+        if ( memcmp(bytes, ce->bytes, ce->len) )
+        {
+            /* Modified code: reuse the entry. */
+            ce->len = 0;
+            cache->next = i;
+            break;
+        }
+
+        cache->hits++;
+        *pce = ce;
+        return X86EMUL_OKAY;
+    }
+
+    cache->misses++;
+    return X86EMUL_OKAY;
+}
+
 int
 x86_emulate(
     struct x86_emulate_ctxt *ctxt,
@@ -1468,6 +1620,17 @@ x86_emulate(
      * Default is a memory operand relative to segment DS.
      */
     struct operand ea = { .type = OP_MEM, .reg = REG_POISON };
+    /*
+     * A memory operand's address, as computed by ModRM decode: base and
+     * scaled index registers (or EA_NONE), displacement, and whether it is
+     * relative to the next instruction.  Turned into ea.mem.off once the
+     * instruction is decoded.
+     */
+    uint8_t ea_base = EA_NONE, ea_index = EA_NONE, ea_scale = 0;
+    bool_t ea_rip = 0;
+    long ea_disp = 0;
+    struct x86_insn_cache_entry *ce;
+    uint8_t insn_mode = 0;
     ea.mem.seg = x86_seg_ds; /* gcc may reject anon union initializer */
 
     ctxt->retire.byte = 0;
@@ -1481,6 +1644,38 @@ x86_emulate(
 #endif
     }
 
+    if ( ctxt->insn_cache )
+    {
+        insn_mode = insn_cache_mode(ctxt, ops);
+        if ( (rc = insn_cache_lookup(ctxt, ops, insn_mode,
+                                     &ce)) != X86EMUL_OKAY )
+            goto done;
+        if ( ce )
+        {
+            b = ce->b;
+            d = ce->d;
+            twobyte = ce->twobyte;
+            rex_prefix = ce->rex_prefix;
+            vex.pfx = ce->rep_pfx;
+            op_bytes = ce->op_bytes;
+            ad_bytes = ce->ad_bytes;
+            lock_prefix = ce->lock_prefix;
+            override_seg = ce->override_seg;
+            modrm = ce->modrm;
+            modrm_mod = ce->modrm_mod;
+            modrm_reg = ce->modrm_reg;
+            modrm_rm = ce->modrm_rm;
+            ea.mem.seg = ce->ea_seg;
+            ea_base = ce->ea_base;
+            ea_index = ce->ea_index;
+            ea_scale = ce->ea_scale;
+            ea_rip = ce->ea_rip;
+            ea_disp = ce->ea_disp;
+            _regs.eip += ce->len;
+            goto decoded;
+        }
+    }
+
     /* Prefix bytes. */
     for ( ; ; )
     {
@@ -1628,61 +1823,59 @@ x86_emulate(
         modrm_rm  = modrm & 0x07;
 
         if ( modrm_mod == 3 )
-        {
             modrm_rm |= (rex_prefix & 1) << 3;
-            ea.type = OP_REG;
-            ea.reg  = decode_register(
-                modrm_rm, &_regs, (d & ByteOp) && (rex_prefix == 0));
-        }
         else if ( ad_bytes == 2 )
         {
             /* 16-bit ModR/M decode. */
             switch ( modrm_rm )
             {
             case 0:
-                ea.mem.off = _regs.ebx + _regs.esi;
+                ea_base = 3; /* bx */
+                ea_index = 6; /* si */
                 break;
             case 1:
-                ea.mem.off = _regs.ebx + _regs.edi;
+                ea_base = 3; /* bx */
+                ea_index = 7; /* di */
                 break;
             case 2:
                 ea.mem.seg = x86_seg_ss;
-                ea.mem.off = _regs.ebp + _regs.esi;
+                ea_base = 5; /* bp */
+                ea_index = 6; /* si */
                 break;
             case 3:
                 ea.mem.seg = x86_seg_ss;
-                ea.mem.off = _regs.ebp + _regs.edi;
+                ea_base = 5; /* bp */
+                ea_index = 7; /* di */
                 break;
             case 4:
-                ea.mem.off = _regs.esi;
+                ea_base = 6; /* si */
                 break;
             case 5:
-                ea.mem.off = _regs.edi;
+                ea_base = 7; /* di */
                 break;
             case 6:
                 if ( modrm_mod == 0 )
                     break;
                 ea.mem.seg = x86_seg_ss;
-                ea.mem.off = _regs.ebp;
+                ea_base = 5; /* bp */
                 break;
             case 7:
-                ea.mem.off = _regs.ebx;
+                ea_base = 3; /* bx */
                 break;
             }
             switch ( modrm_mod )
             {
             case 0:
                 if ( modrm_rm == 6 )
-                    ea.mem.off = insn_fetch_type(int16_t);
+                    ea_disp = insn_fetch_type(int16_t);
                 break;
             case 1:
-                ea.mem.off += insn_fetch_type(int8_t);
+                ea_disp = insn_fetch_type(int8_t);
                 break;
             case 2:
-                ea.mem.off += insn_fetch_type(int16_t);
+                ea_disp = insn_fetch_type(int16_t);
                 break;
             }
-            ea.mem.off = truncate_ea(ea.mem.off);
         }
         else
         {
@@ -1693,31 +1886,29 @@ x86_emulate(
                 sib_index = ((sib >> 3) & 7) | ((rex_prefix << 2) & 8);
                 sib_base  = (sib & 7) | ((rex_prefix << 3) & 8);
                 if ( sib_index != 4 )
-                    ea.mem.off = *(long*)decode_register(sib_index, &_regs, 0);
-                ea.mem.off <<= (sib >> 6) & 3;
+                    ea_index = sib_index;
+                ea_scale = (sib >> 6) & 3;
                 if ( (modrm_mod == 0) && ((sib_base & 7) == 5) )
-                    ea.mem.off += insn_fetch_type(int32_t);
-                else if ( sib_base == 4 )
+                    ea_disp = insn_fetch_type(int32_t);
+                else
                 {
-                    ea.mem.seg  = x86_seg_ss;
-                    ea.mem.off += _regs.esp;
-                    if ( !twobyte && (b == 0x8f) )
-                        /* POP <rm> computes its EA post increment. */
-                        ea.mem.off += ((mode_64bit() && (op_bytes == 4))
+                    ea_base = sib_base;
+                    if ( sib_base == 4 )
+                    {
+                        ea.mem.seg = x86_seg_ss;
+                        if ( !twobyte && (b == 0x8f) )
+                            /* POP <rm> computes its EA post increment. */
+                            ea_disp = ((mode_64bit() && (op_bytes == 4))
                                        ? 8 : op_bytes);
+                    }
+                    else if ( sib_base == 5 )
+                        ea.mem.seg = x86_seg_ss;
                 }
-                else if ( sib_base == 5 )
-                {
-                    ea.mem.seg  = x86_seg_ss;
-                    ea.mem.off += _regs.ebp;
-                }
-                else
-                    ea.mem.off += *(long*)decode_register(sib_base, &_regs, 0);
             }
             else
             {
                 modrm_rm |= (rex_prefix & 1) << 3;
-                ea.mem.off = *(long *)decode_register(modrm_rm, &_regs, 0);
+                ea_base = modrm_rm;
                 if ( (modrm_rm == 5) && (modrm_mod != 0) )
                     ea.mem.seg = x86_seg_ss;
             }
@@ -1726,32 +1917,97 @@ x86_emulate(
             case 0:
                 if ( (modrm_rm & 7) != 5 )
                     break;
-                ea.mem.off = insn_fetch_type(int32_t);
+                ea_base = EA_NONE;
+                ea_disp = insn_fetch_type(int32_t);
                 if ( !mode_64bit() )
                     break;
                 /* Relative to RIP of next instruction. Argh! */
-                ea.mem.off += _regs.eip;
+                ea_rip = 1;
                 if ( (d & SrcMask) == SrcImm )
-                    ea.mem.off += (d & ByteOp) ? 1 :
+                    ea_disp += (d & ByteOp) ? 1 :
                         ((op_bytes == 8) ? 4 : op_bytes);
                 else if ( (d & SrcMask) == SrcImmByte )
-                    ea.mem.off += 1;
+                    ea_disp += 1;
                 else if ( !twobyte && ((b & 0xfe) == 0xf6) &&
                           ((modrm_reg & 7) <= 1) )
                     /* Special case in Grp3: test has immediate operand. */
-                    ea.mem.off += (d & ByteOp) ? 1
+                    ea_disp += (d & ByteOp) ? 1
                         : ((op_bytes == 8) ? 4 : op_bytes);
                 else if ( twobyte && ((b & 0xf7) == 0xa4) )
                     /* SHLD/SHRD with immediate byte third operand. */
-                    ea.mem.off++;
+                    ea_disp++;
                 break;
             case 1:
-                ea.mem.off += insn_fetch_type(int8_t);
+                ea_disp += insn_fetch_type(int8_t);
                 break;
             case 2:
-                ea.mem.off += insn_fetch_type(int32_t);
+                ea_disp += insn_fetch_type(int32_t);
                 break;
             }
+        }
+    }
+
+    /* Remember the decode, unless it depends on more than the bytes. */
+    if ( ctxt->insn_cache && (vex.opcx == vex_none) )
+    {
+        struct x86_insn_cache *cache = ctxt->insn_cache;
+        unsigned long eip = ctxt->regs->eip;
+        unsigned int len = _regs.eip - ctxt->regs->eip;
+
+        if ( !mode_64bit() )
+            eip = (uint32_t)eip;
+
+        ce = &cache->ent[cache->next++ % X86_INSN_CACHE_ENTRIES];
+        ce->len = 0;
+        if ( ops->insn_fetch(x86_seg_cs, eip, ce->bytes, len,
+                             ctxt) == X86EMUL_OKAY )
+        {
+            ce->tag = ctxt->insn_cache_tag;
+            ce->eip = ctxt->regs->eip;
+            ce->addr_size = ctxt->addr_size;
+            ce->mode = insn_mode;
+            ce->b = b;
+            ce->d = d;
+            ce->twobyte = twobyte;
+            ce->rex_prefix = rex_prefix;
+            ce->rep_pfx = vex.pfx;
+            ce->op_bytes = op_bytes;
+            ce->ad_bytes = ad_bytes;
+            ce->lock_prefix = lock_prefix;
+            ce->override_seg = override_seg;
+            ce->modrm = modrm;
+            ce->modrm_mod = modrm_mod;
+            ce->modrm_reg = modrm_reg;
+            ce->modrm_rm = modrm_rm;
+            ce->ea_seg = ea.mem.seg;
+            ce->ea_base = ea_base;
+            ce->ea_index = ea_index;
+            ce->ea_scale = ea_scale;
+            ce->ea_rip = ea_rip;
+            ce->ea_disp = ea_disp;
+            ce->len = len;
+        }
+    }
+
+ decoded:
+    if ( d & ModRM )
+    {
+        if ( modrm_mod == 3 )
+        {
+            ea.type = OP_REG;
+            ea.reg  = decode_register(
+                modrm_rm, &_regs, (d & ByteOp) && (rex_prefix == 0));
+        }
+        else
+        {
+            ea.mem.off = ea_disp;
+            if ( ea_base != EA_NONE )
+                ea.mem.off += *(long *)decode_register(ea_base, &_regs, 0);
+            if ( ea_index != EA_NONE )
+                ea.mem.off += *(long *)decode_register(ea_index, &_regs, 0)
+                              << ea_scale;
+            if ( ea_rip )
+                ea.mem.off += _regs.eip;
             ea.mem.off = truncate_ea(ea.mem.off);
         }
     }
@@ -404,11 +404,45 @@ struct x86_emulate_ops
 
 struct cpu_user_regs;
 
+/*
+ * Cache of decoded instructions, for callers which emulate the same few
+ * instructions over and over (guest polling loops on emulated MMIO).  An
+ * entry holds the prefix, opcode and ModRM/SIB/displacement decode of an
+ * instruction in register independent form.  It is found by the caller's
+ * address space tag (e.g. CR3), the instruction's address and the execution
+ * mode, and only used if the instruction's bytes, fetched afresh, match.
+ */
+#define X86_INSN_CACHE_ENTRIES 4
+
+struct x86_insn_cache_entry {
+    unsigned long tag, eip;
+    long ea_disp;
+    uint8_t addr_size;
+    uint8_t mode;               /* Real/VM86, protected or 64-bit. */
+    uint8_t len;                /* Bytes decoded; 0 if the entry is unused. */
+    uint8_t bytes[MAX_INST_LEN];
+    uint8_t b, d, twobyte, rex_prefix, rep_pfx;
+    uint8_t op_bytes, ad_bytes, lock_prefix;
+    int8_t override_seg;
+    uint8_t modrm, modrm_mod, modrm_reg, modrm_rm;
+    uint8_t ea_seg, ea_base, ea_index, ea_scale, ea_rip;
+};
+
+struct x86_insn_cache {
+    struct x86_insn_cache_entry ent[X86_INSN_CACHE_ENTRIES];
+    unsigned int next;          /* Entry to replace next. */
+    unsigned long hits, misses;
+};
+
 struct x86_emulate_ctxt
 {
     /* Register state before/after emulation. */
     struct cpu_user_regs *regs;
 
+    /* Decoded instruction cache (optional), and tag for its lookups. */
+    struct x86_insn_cache *insn_cache;
+    unsigned long insn_cache_tag;
+
     /* Default address size in current execution mode (16, 32, or 64). */
     unsigned int addr_size;
 
@@ -463,4 +497,26 @@ void *
 decode_register(
     uint8_t modrm_reg, struct cpu_user_regs *regs, int highbyte_regs);
 
+/*
+ * x86_insn_mov_mem32: Recognise, without a full decode, the plain 32-bit
+ * MOV forms between a register or an immediate and memory (89 /r, 8B /r,
+ * C7 /0), as used for accessing (e.g. local APIC) device registers.
+ * @insn holds the @len bytes of the instruction, @addr_size is the default
+ * address size (32 or 64; 16-bit code isn't handled).  Only segment
+ * overrides and, in 64-bit mode, a REX prefix without REX.W are accepted.
+ * Returns 0 and fills @mov if the bytes are exactly one such instruction,
+ * -1 otherwise.
+ */
+struct x86_mov_mem32 {
+    uint8_t write;              /* Store to memory, else load. */
+    uint8_t reg;                /* GPR, for decode_register(). */
+    uint8_t has_imm;            /* Store of @imm rather than of @reg. */
+    uint32_t imm;
+};
+
+int
+x86_insn_mov_mem32(
+    const uint8_t *insn, unsigned int len, unsigned int addr_size,
+    struct x86_mov_mem32 *mov);
+
 #endif /* __X86_EMULATE_H__ */
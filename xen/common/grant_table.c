@@ -36,6 +36,7 @@
 #include <xen/iommu.h>
 #include <xen/paging.h>
 #include <xen/keyhandler.h>
+#include <xen/perfc.h>
 #include <xen/vmap.h>
 #include <xsm/xsm.h>
 #include <asm/flushtlb.h>
@@ -137,6 +138,13 @@ nr_maptrack_frames(struct grant_table *t)
 
 #define MAPTRACK_TAIL (~0u)
 
+/*
+ * Number of free entries moved to the thief in one go once the maptrack
+ * table is full, so that a VCPU which out-maps its siblings does not have
+ * to scan every other VCPU's free list on each map.
+ */
+#define MAPTRACK_STEAL_BATCH 16
+
 #define SHGNT_PER_PAGE_V1 (PAGE_SIZE / sizeof(grant_entry_v1_t))
 #define shared_entry_v1(t, e) \
     ((t)->shared_v1[(e)/SHGNT_PER_PAGE_V1][(e)%SHGNT_PER_PAGE_V1])
@@ -317,34 +325,73 @@ __get_maptrack_handle(
     return head;
 }
 
+static inline void
+__put_maptrack_handle(
+    struct grant_table *t, struct vcpu *v, int handle)
+{
+    unsigned int prev_tail, cur_tail;
+
+    /* 1. Set entry to be a tail. */
+    maptrack_entry(t, handle).ref = MAPTRACK_TAIL;
+
+    /* 2. Add entry to the tail of the list on the given VCPU. */
+    cur_tail = read_atomic(&v->maptrack_tail);
+    do {
+        prev_tail = cur_tail;
+        cur_tail = cmpxchg(&v->maptrack_tail, prev_tail, handle);
+    } while ( cur_tail != prev_tail );
+
+    /* 3. Update the old tail entry to point to the new entry. */
+    write_atomic(&maptrack_entry(t, prev_tail).ref, handle);
+}
+
 /*
- * Try to "steal" a free maptrack entry from another VCPU.
+ * Try to "steal" free maptrack entries from another VCPU.
  *
- * A stolen entry is transferred to the thief, so the number of
- * entries for each VCPU should tend to the usage pattern.
+ * Stolen entries are transferred to the thief, so the number of
+ * entries for each VCPU should tend to the usage pattern.  Up to
+ * @batch entries are taken from the first victim with any to spare:
+ * the first is returned and the rest are added to the thief's own
+ * free list (which must already be initialised if @batch > 1).
  *
  * To avoid having to atomically count the number of free entries on
  * each VCPU and to avoid two VCPU repeatedly stealing entries from
  * each other, the initial victim VCPU is selected randomly.
  */
 static int steal_maptrack_handle(struct grant_table *t,
-                                 const struct vcpu *curr)
+                                 struct vcpu *curr,
+                                 unsigned int batch)
 {
     const struct domain *currd = curr->domain;
-    unsigned int first, i;
+    unsigned int first, i, n;
+
+    perfc_incr(maptrack_steal);
 
     /* Find an initial victim. */
     first = i = get_random() % currd->max_vcpus;
 
     do {
-        if ( currd->vcpu[i] )
+        struct vcpu *v = currd->vcpu[i];
+
+        if ( v && v != curr )
         {
-            int handle;
+            int handle, extra;
 
-            handle = __get_maptrack_handle(t, currd->vcpu[i]);
+            handle = __get_maptrack_handle(t, v);
             if ( handle != -1 )
             {
                 maptrack_entry(t, handle).vcpu = curr->vcpu_id;
+
+                for ( n = 1; n < batch; n++ )
+                {
+                    extra = __get_maptrack_handle(t, v);
+                    if ( extra == -1 )
+                        break;
+                    maptrack_entry(t, extra).vcpu = curr->vcpu_id;
+                    __put_maptrack_handle(t, curr, extra);
+                }
+                perfc_add(maptrack_stolen, n);
+
                 return handle;
             }
         }
@@ -355,6 +402,7 @@ static int steal_maptrack_handle(struct grant_table *t,
     } while ( i != first );
 
     /* No free handles on any VCPU. */
+    perfc_incr(maptrack_steal_failed);
     return -1;
 }
 
@@ -363,23 +411,10 @@ put_maptrack_handle(
     struct grant_table *t, int handle)
 {
     struct domain *currd = current->domain;
-    struct vcpu *v;
-    unsigned int prev_tail, cur_tail;
-
-    /* 1. Set entry to be a tail. */
-    maptrack_entry(t, handle).ref = MAPTRACK_TAIL;
-
-    /* 2. Add entry to the tail of the list on the original VCPU. */
-    v = currd->vcpu[maptrack_entry(t, handle).vcpu];
-
-    cur_tail = read_atomic(&v->maptrack_tail);
-    do {
-        prev_tail = cur_tail;
-        cur_tail = cmpxchg(&v->maptrack_tail, prev_tail, handle);
-    } while ( cur_tail != prev_tail );
 
-    /* 3. Update the old tail entry to point to the new entry. */
-    write_atomic(&maptrack_entry(t, prev_tail).ref, handle);
+    /* Return the entry to the VCPU which currently owns it. */
+    __put_maptrack_handle(t, currd->vcpu[maptrack_entry(t, handle).vcpu],
+                          handle);
 }
 
 static inline int
@@ -389,16 +424,30 @@ get_maptrack_handle(
     struct vcpu          *curr = current;
     int                   i;
     grant_handle_t        handle;
-    struct grant_mapping *new_mt;
+    struct grant_mapping *new_mt = NULL;
 
     handle = __get_maptrack_handle(lgt, curr);
     if ( likely(handle != -1) )
         return handle;
 
+    /*
+     * Allocate and clear a new frame before taking the maptrack lock, so
+     * that the lock only covers linking it in.  The limit check here is
+     * only a hint (the limit is re-checked below): it avoids allocating a
+     * frame just to free it again once the table is full.
+     */
+    if ( nr_maptrack_frames(lgt) < max_maptrack_frames )
+    {
+        new_mt = alloc_xenheap_page();
+        if ( !new_mt )
+            return -1;
+        clear_page(new_mt);
+    }
+
     spin_lock(&lgt->maptrack_lock);
 
     /*
-     * If we've run out of frames, try stealing an entry from another
+     * If we've run out of frames, try stealing entries from another
      * VCPU (in case the guest isn't mapping across its VCPUs evenly).
      */
     if ( nr_maptrack_frames(lgt) >= max_maptrack_frames )
@@ -409,28 +458,25 @@ get_maptrack_handle(
          */
         spin_unlock(&lgt->maptrack_lock);
 
+        if ( new_mt )
+            free_xenheap_page(new_mt);
+
         /*
          * Uninitialized free list? Steal an extra entry for the tail
          * sentinel.
          */
         if ( curr->maptrack_tail == MAPTRACK_TAIL )
         {
-            handle = steal_maptrack_handle(lgt, curr);
+            handle = steal_maptrack_handle(lgt, curr, 1);
             if ( handle == -1 )
                 return -1;
             curr->maptrack_tail = handle;
             write_atomic(&curr->maptrack_head, handle);
         }
-        return steal_maptrack_handle(lgt, curr);
+        return steal_maptrack_handle(lgt, curr, MAPTRACK_STEAL_BATCH);
     }
 
-    new_mt = alloc_xenheap_page();
-    if ( !new_mt )
-    {
-        spin_unlock(&lgt->maptrack_lock);
-        return -1;
-    }
-    clear_page(new_mt);
+    ASSERT(new_mt);
 
     /*
      * Use the first new entry and add the remaining entries to the
@@ -456,6 +502,8 @@ get_maptrack_handle(
 
     spin_unlock(&lgt->maptrack_lock);
 
+    perfc_incr(maptrack_frames);
+
     return handle;
 }
 
@@ -1041,20 +1089,34 @@ gnttab_map_grant_ref(
     XEN_GUEST_HANDLE_PARAM(gnttab_map_grant_ref_t) uop, unsigned int count)
 {
     int i;
+    long rc = 0;
     struct gnttab_map_grant_ref op;
 
+    iommu_flush_batch_start();
+
     for ( i = 0; i < count; i++ )
     {
-        if (i && hypercall_preempt_check())
-            return i;
+        if ( i && hypercall_preempt_check() )
+        {
+            rc = i;
+            break;
+        }
         if ( unlikely(__copy_from_guest_offset(&op, uop, i, 1)) )
-            return -EFAULT;
+        {
+            rc = -EFAULT;
+            break;
+        }
         __gnttab_map_grant_ref(&op);
         if ( unlikely(__copy_to_guest_offset(uop, i, &op, 1)) )
-            return -EFAULT;
+        {
+            rc = -EFAULT;
+            break;
+        }
     }
 
-    return 0;
+    iommu_flush_batch_finish();
+
+    return rc;
 }
 
 static void
@@ -1327,6 +1389,7 @@ gnttab_unmap_grant_ref(
     {
         c = min(count, (unsigned int)GNTTAB_UNMAP_BATCH_SIZE);
         partial_done = 0;
+        iommu_flush_batch_start();
 
         for ( i = 0; i < c; i++ )
         {
@@ -1339,6 +1402,8 @@ gnttab_unmap_grant_ref(
             guest_handle_add_offset(uop, 1);
         }
 
+        /* Device mappings must be gone too before grants get released. */
+        iommu_flush_batch_finish();
         gnttab_flush_tlb(current->domain);
 
         for ( i = 0; i < partial_done; i++ )
@@ -1354,6 +1419,7 @@ gnttab_unmap_grant_ref(
     return 0;
 
 fault:
+    iommu_flush_batch_finish();
     gnttab_flush_tlb(current->domain);
 
     for ( i = 0; i < partial_done; i++ )
@@ -1390,6 +1456,7 @@ gnttab_unmap_and_replace(
     {
         c = min(count, (unsigned int)GNTTAB_UNMAP_BATCH_SIZE);
         partial_done = 0;
+        iommu_flush_batch_start();
         
         for ( i = 0; i < c; i++ )
         {
@@ -1402,6 +1469,7 @@ gnttab_unmap_and_replace(
             guest_handle_add_offset(uop, 1);
         }
         
+        iommu_flush_batch_finish();
         gnttab_flush_tlb(current->domain);
         
         for ( i = 0; i < partial_done; i++ )
@@ -1417,6 +1485,7 @@ gnttab_unmap_and_replace(
     return 0;
 
 fault:
+    iommu_flush_batch_finish();
     gnttab_flush_tlb(current->domain);
 
     for ( i = 0; i < partial_done; i++ )
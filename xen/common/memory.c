@@ -24,6 +24,7 @@
 #include <xen/numa.h>
 #include <xen/mem_access.h>
 #include <xen/trace.h>
+#include <xen/iommu.h>
 #include <asm/current.h>
 #include <asm/hardirq.h>
 #include <asm/p2m.h>
@@ -836,6 +837,13 @@ long do_memory_op(unsigned long cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
             return start_extent;
         }
 
+        /*
+         * Pages removed by decrease_reservation() are freed right away, so
+         * their IOTLB entries can't wait for the end of a batch.
+         */
+        if ( op != XENMEM_decrease_reservation )
+            iommu_flush_batch_start();
+
         switch ( op )
         {
         case XENMEM_increase_reservation:
@@ -849,6 +857,9 @@ long do_memory_op(unsigned long cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
             break;
         }
 
+        if ( op != XENMEM_decrease_reservation )
+            iommu_flush_batch_finish();
+
         rcu_unlock_domain(d);
 
         rc = args.nr_done;
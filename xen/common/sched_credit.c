@@ -66,6 +66,7 @@
  */
 #define CSCHED_FLAG_VCPU_PARKED    0x0  /* VCPU over capped credits */
 #define CSCHED_FLAG_VCPU_YIELD     0x1  /* VCPU yielding */
+#define CSCHED_FLAG_VCPU_WAKEQ     0x2  /* VCPU on a wake queue */
 
 
 /*
@@ -153,6 +154,8 @@
  */
 static int __read_mostly sched_credit_tslice_ms = CSCHED_DEFAULT_TSLICE_MS;
 integer_param("sched_credit_tslice_ms", sched_credit_tslice_ms);
+static bool_t __read_mostly sched_credit_wake_queue = 1;
+boolean_param("sched_credit_wake_queue", sched_credit_wake_queue);
 
 /*
  * Physical CPU
@@ -189,6 +192,8 @@ struct csched_vcpu {
     s_time_t start_time;   /* When we were scheduled (used for credit) */
     unsigned flags;
     int16_t pri;
+    unsigned int wakeq_cpu;            /* Wake queue we are on... */
+    struct csched_vcpu *wakeq_next;    /* ...and next one in there */
 #ifdef CSCHED_STATS
     struct {
         int credit_last;
@@ -479,16 +484,121 @@ __runq_tickle(unsigned int cpu, struct csched_vcpu *new)
     }
 }
 
+/*
+ * Wake queues.
+ *
+ * Waking up a vcpu of another pcpu means taking that pcpu's runqueue lock
+ * which, during wakeup storms (e.g., from event channel heavy I/O guests),
+ * is contended and bounces around among the wakers. Instead, we push the
+ * vcpu on a lock-free list of its pcpu, and the pcpu itself carries out
+ * the wakeup with its own lock held, either the next time it schedules or
+ * from SCHED_WAKE_SOFTIRQ, whichever comes first. This way, any number of
+ * wakeups to the same pcpu costs at most one IPI, and the tickles issued
+ * while draining a queue are coalesced in as few (multicast) IPIs as
+ * possible.
+ *
+ * The queues do not live in the per-pcpu scheduler data, as a vcpu can be
+ * pushed on a pcpu while that is being moved to another cpupool. Whoever
+ * drains a queue, therefore, does not assume that the vcpus it finds still
+ * belong to the queue's pcpu (if they don't, they are forwarded to their
+ * new one) or to this scheduler.
+ */
+static DEFINE_PER_CPU(struct csched_vcpu *, csched_wakeq);
+
+static void
+__wakeq_push(unsigned int cpu, struct csched_vcpu *svc)
+{
+    struct csched_vcpu *head;
+
+    ASSERT(test_bit(CSCHED_FLAG_VCPU_WAKEQ, &svc->flags));
+
+    svc->wakeq_cpu = cpu;
+    do {
+        head = per_cpu(csched_wakeq, cpu);
+        svc->wakeq_next = head;
+    } while ( cmpxchg(&per_cpu(csched_wakeq, cpu), head, svc) != head );
+
+    cpu_raise_softirq(cpu, SCHED_WAKE_SOFTIRQ);
+}
+
+/* Must be called with cpu's scheduler lock held. */
+static void
+csched_wakeq_drain(unsigned int cpu)
+{
+    struct csched_vcpu *svc, *next;
+
+    if ( per_cpu(csched_wakeq, cpu) == NULL )
+        return;
+
+    SCHED_STAT_CRANK(wake_queue_drain);
+
+    cpu_raise_softirq_batch_begin();
+
+    for ( svc = xchg(&per_cpu(csched_wakeq, cpu), NULL); svc; svc = next )
+    {
+        struct vcpu *vc = svc->vcpu;
+
+        /* As soon as the flag is clear, svc can be pushed somewhere again */
+        next = svc->wakeq_next;
+        clear_bit(CSCHED_FLAG_VCPU_WAKEQ, &svc->flags);
+        smp_mb();
+
+        if ( likely(vc->processor == cpu) )
+            vcpu_wake_locked(vc);
+        else if ( vcpu_runnable(vc) &&
+                  !test_and_set_bit(CSCHED_FLAG_VCPU_WAKEQ, &svc->flags) )
+            __wakeq_push(vc->processor, svc);
+        /*
+         * Else, vc moved while not runnable, and whoever makes it runnable
+         * again will wake it up on its new pcpu.
+         */
+    }
+
+    cpu_raise_softirq_batch_finish();
+}
+
+static void
+csched_wakeq_softirq(void)
+{
+    unsigned int cpu = smp_processor_id();
+    spinlock_t *lock = pcpu_schedule_lock_irq(cpu);
+
+    csched_wakeq_drain(cpu);
+
+    pcpu_schedule_unlock_irq(lock, cpu);
+}
+
+/* Make sure svc is on no wake queue, e.g., before freeing it. */
+static void
+csched_wakeq_flush(struct csched_vcpu *svc)
+{
+    while ( test_bit(CSCHED_FLAG_VCPU_WAKEQ, &svc->flags) )
+    {
+        unsigned int cpu = svc->wakeq_cpu;
+        spinlock_t *lock = pcpu_schedule_lock_irq(cpu);
+
+        csched_wakeq_drain(cpu);
+
+        pcpu_schedule_unlock_irq(lock, cpu);
+    }
+}
+
 static void
 csched_free_pdata(const struct scheduler *ops, void *pcpu, int cpu)
 {
     struct csched_private *prv = CSCHED_PRIV(ops);
     struct csched_pcpu *spc = pcpu;
+    spinlock_t *lock;
     unsigned long flags;
 
     if ( spc == NULL )
         return;
 
+    /* Forward any wakeup still queued here to where the vcpus went. */
+    lock = pcpu_schedule_lock_irqsave(cpu, &flags);
+    csched_wakeq_drain(cpu);
+    pcpu_schedule_unlock_irqrestore(lock, flags, cpu);
+
     spin_lock_irqsave(&prv->lock, flags);
 
     prv->credit -= prv->credits_per_tslice;
@@ -914,6 +1024,8 @@ csched_free_vdata(const struct scheduler *ops, void *priv)
 {
     struct csched_vcpu *svc = priv;
 
+    csched_wakeq_flush(svc);
+
     BUG_ON( !list_empty(&svc->runq_elem) );
 
     xfree(svc);
@@ -1019,6 +1131,34 @@ csched_vcpu_wake(const struct scheduler *ops, struct vcpu *vc)
     __runq_tickle(cpu, svc);
 }
 
+/*
+ * Wakeups of vcpus of remote pcpus go through the pcpu's wake queue. Local
+ * ones, or ones that vcpu_wake_locked() would not turn into an insertion
+ * in the runqueue anyway, are not worth deferring.
+ */
+static int
+csched_vcpu_wake_nolock(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct csched_vcpu * const svc = CSCHED_VCPU(vc);
+    const unsigned int cpu = vc->processor;
+
+    if ( !sched_credit_wake_queue || cpu == smp_processor_id() ||
+         !vcpu_runnable(vc) || curr_on_cpu(cpu) == vc )
+        return 0;
+
+    /* If svc is queued already, that wakeup will find it runnable. */
+    if ( test_and_set_bit(CSCHED_FLAG_VCPU_WAKEQ, &svc->flags) )
+    {
+        SCHED_STAT_CRANK(vcpu_wake_queued_again);
+        return 1;
+    }
+
+    SCHED_STAT_CRANK(vcpu_wake_queued);
+    __wakeq_push(cpu, svc);
+
+    return 1;
+}
+
 static void
 csched_vcpu_yield(const struct scheduler *ops, struct vcpu *vc)
 {
@@ -1630,6 +1770,9 @@ csched_schedule(
     SCHED_STAT_CRANK(schedule);
     CSCHED_VCPU_CHECK(current);
 
+    /* Make sure the pending wakeups are taken into account. */
+    csched_wakeq_drain(cpu);
+
     runtime = now - current->runstate.state_entry_time;
     if ( runtime < 0 ) /* Does this ever happen? */
         runtime = 0;
@@ -1939,6 +2082,13 @@ csched_init(struct scheduler *ops)
     return 0;
 }
 
+static int
+csched_global_init(void)
+{
+    open_softirq(SCHED_WAKE_SOFTIRQ, csched_wakeq_softirq);
+    return 0;
+}
+
 static void
 csched_deinit(const struct scheduler *ops)
 {
@@ -1992,6 +2142,7 @@ const struct scheduler sched_credit_def = {
 
     .sleep          = csched_vcpu_sleep,
     .wake           = csched_vcpu_wake,
+    .wake_nolock    = csched_vcpu_wake_nolock,
     .yield          = csched_vcpu_yield,
 
     .adjust         = csched_dom_cntl,
@@ -2002,6 +2153,7 @@ const struct scheduler sched_credit_def = {
 
     .dump_cpu_state = csched_dump_pcpu,
     .dump_settings  = csched_dump,
+    .global_init    = csched_global_init,
     .init           = csched_init,
     .deinit         = csched_deinit,
     .alloc_vdata    = csched_alloc_vdata,
@@ -83,9 +83,10 @@
  * or equal to zero.  At that point, everyone's credits are "clipped"
  * to a small value, and a fixed credit is added to everyone.
  *
- * The plan is for all cores that share an L2 will share the same
- * runqueue.  At the moment, there is one global runqueue for all
- * cores.
+ * Cpus are grouped into runqueues according to the credit2_runqueue
+ * boot parameter (per core, socket -- the default --, NUMA node, or
+ * one for the whole system).  The load balancer moves vcpus between
+ * runqueues, preferring runqueues on the same NUMA node.
  */
 
 /*
@@ -192,6 +193,52 @@ int opt_underload_balance_tolerance=0;
 integer_param("credit2_balance_under", opt_underload_balance_tolerance);
 int opt_overload_balance_tolerance=-3;
 integer_param("credit2_balance_over", opt_overload_balance_tolerance);
+/*
+ * Extra shift applied to the balancing tolerances (and to the load
+ * difference used to pick a balancing partner) when the two runqueues
+ * live on different NUMA nodes: cross-node moves thrash caches and
+ * memory locality, so they must be worth 2^shift times more.
+ */
+int opt_node_balance_shift=1;
+integer_param("credit2_balance_node_shift", opt_node_balance_shift);
+
+/*
+ * Runqueue organization.
+ *
+ * Pcpus sharing the given topology level share a runqueue (and hence
+ * the runqueue lock).  Smaller runqueues mean less lock contention on
+ * big hosts, at the price of relying more on the load balancer.
+ */
+#define OPT_RUNQUEUE_CORE   0
+#define OPT_RUNQUEUE_SOCKET 1
+#define OPT_RUNQUEUE_NODE   2
+#define OPT_RUNQUEUE_ALL    3
+static const char *const opt_runqueue_str[] = {
+    [OPT_RUNQUEUE_CORE] = "core",
+    [OPT_RUNQUEUE_SOCKET] = "socket",
+    [OPT_RUNQUEUE_NODE] = "node",
+    [OPT_RUNQUEUE_ALL] = "all"
+};
+static int __read_mostly opt_runqueue = OPT_RUNQUEUE_SOCKET;
+
+static void __init parse_credit2_runqueue(const char *s)
+{
+    unsigned int i;
+
+    for ( i = 0; i < ARRAY_SIZE(opt_runqueue_str); i++ )
+    {
+        if ( !strcmp(s, opt_runqueue_str[i]) )
+        {
+            opt_runqueue = i;
+            return;
+        }
+    }
+
+    printk(XENLOG_WARNING "WARNING, unrecognized value of credit2_runqueue "
+           "option '%s', using default (%s)\n", s,
+           opt_runqueue_str[opt_runqueue]);
+}
+custom_param("credit2_runqueue", parse_credit2_runqueue);
 
 /*
  * Per-runqueue data
@@ -291,6 +338,42 @@ static s_time_t c2t(struct csched2_runqueue_data *rqd, s_time_t credit, struct c
     return credit * svc->weight / rqd->max_weight;
 }
 
+/*
+ * Topology helpers
+ */
+static inline bool_t same_node(unsigned int cpua, unsigned int cpub)
+{
+    return cpu_to_node(cpua) == cpu_to_node(cpub);
+}
+
+static inline bool_t same_socket(unsigned int cpua, unsigned int cpub)
+{
+    return cpu_to_socket(cpua) == cpu_to_socket(cpub);
+}
+
+static inline bool_t same_core(unsigned int cpua, unsigned int cpub)
+{
+    return same_socket(cpua, cpub) &&
+           cpu_to_core(cpua) == cpu_to_core(cpub);
+}
+
+/*
+ * Is the other runqueue on a different NUMA node than ours?  All the
+ * cpus of a runqueue are at least as close as the configured runqueue
+ * granularity, so looking at one of them is enough (for "all", there
+ * is only one runqueue, and we never get asked).
+ */
+static bool_t
+rqd_remote_node(const struct csched2_runqueue_data *lrqd,
+                const struct csched2_runqueue_data *orqd)
+{
+    if ( cpumask_empty(&lrqd->active) || cpumask_empty(&orqd->active) )
+        return 0;
+
+    return !same_node(cpumask_first(&lrqd->active),
+                      cpumask_first(&orqd->active));
+}
+
 /*
  * Runqueue related code
  */
@@ -1131,6 +1214,12 @@ choose_cpu(const struct scheduler *ops, struct vcpu *vc)
         else
             continue;
 
+        /* Only leave our node for a runqueue which is at least one
+         * vcpu's worth of load lighter. */
+        if ( opt_node_balance_shift > 0 && rqd != svc->rqd
+             && rqd_remote_node(svc->rqd, rqd) )
+            rqd_avgload += 1ULL << prv->load_window_shift;
+
         if ( rqd_avgload < min_avgload )
         {
             min_avgload = rqd_avgload;
@@ -1248,7 +1337,9 @@ static void balance_load(const struct scheduler *ops, int cpu, s_time_t now)
     
     /*
      * Basic algorithm: Push, pull, or swap.
-     * - Find the runqueue with the furthest load distance
+     * - Find the runqueue with the furthest load distance, where
+     * the distance to runqueues on other NUMA nodes is scaled down
+     * by opt_node_balance_shift (so local imbalances are fixed first)
      * - Find a pair that makes the difference the least (where one
      * on either side may be empty).
      */
@@ -1282,6 +1373,9 @@ retry:
         if ( delta < 0 )
             delta = -delta;
 
+        if ( opt_node_balance_shift > 0 && rqd_remote_node(st.lrqd, st.orqd) )
+            delta >>= opt_node_balance_shift;
+
         if ( delta > st.load_delta )
         {
             st.load_delta = delta;
@@ -1296,11 +1390,12 @@ retry:
     if ( max_delta_rqi == -1 )
         goto out;
 
+    st.orqd = prv->rqd + max_delta_rqi;
+
     {
         s_time_t load_max;
         int cpus_max;
 
-        
         load_max = st.lrqd->b_avgload;
         if ( st.orqd->b_avgload > load_max )
             load_max = st.orqd->b_avgload;
@@ -1321,6 +1416,10 @@ retry:
             if ( st.load_delta < (1ULL<<(prv->load_window_shift+opt_overload_balance_tolerance)) )
                 goto out;
     }
+
+    /* NB: for a runqueue on another node, load_delta has been scaled
+     * down, so the checks above effectively demand an imbalance
+     * 2^opt_node_balance_shift times larger before crossing nodes. */
              
     /* Try to grab the other runqueue lock; if it's been taken in the
      * meantime, try the process over again.  This can't deadlock
@@ -1334,6 +1433,14 @@ retry:
     if ( unlikely(st.orqd->id < 0) )
         goto out_up;
 
+    if ( rqd_remote_node(st.lrqd, st.orqd) )
+        SCHED_STAT_CRANK(balance_remote_node);
+
+    /* consider() works with actual loads; undo the node scaling. */
+    st.load_delta = st.lrqd->b_avgload - st.orqd->b_avgload;
+    if ( st.load_delta < 0 )
+        st.load_delta = -st.load_delta;
+
     /* Look for "swap" which gives the best load average
      * FIXME: O(n^2)! */
 
@@ -1895,9 +2002,11 @@ csched2_dump(const struct scheduler *ops)
     spin_lock_irqsave(&prv->lock, flags);
 
     printk("Active queues: %d\n"
-           "\tdefault-weight     = %d\n",
+           "\tdefault-weight     = %d\n"
+           "\trunqueues          = per-%s\n",
            cpumask_weight(&prv->active_queues),
-           CSCHED2_DEFAULT_WEIGHT);
+           CSCHED2_DEFAULT_WEIGHT,
+           opt_runqueue_str[opt_runqueue]);
     for_each_cpu(i, &prv->active_queues)
     {
         s_time_t fraction;
@@ -1985,6 +2094,44 @@ static void deactivate_runqueue(struct csched2_private *prv, int rqi)
     cpumask_clear_cpu(rqi, &prv->active_queues);
 }
 
+/*
+ * Find the runqueue a cpu belongs to, according to opt_runqueue: the
+ * first active runqueue whose cpus share the relevant topology level
+ * with it, or a free slot to be activated if there is none.
+ */
+static unsigned int
+cpu_to_runqueue(struct csched2_private *prv, unsigned int cpu)
+{
+    unsigned int rqi, free_rqi = nr_cpu_ids;
+
+    for ( rqi = 0; rqi < nr_cpu_ids; rqi++ )
+    {
+        struct csched2_runqueue_data *rqd = prv->rqd + rqi;
+        unsigned int peer_cpu;
+
+        if ( rqd->id == -1 )
+        {
+            if ( free_rqi == nr_cpu_ids )
+                free_rqi = rqi;
+            continue;
+        }
+
+        BUG_ON(cpumask_empty(&rqd->active));
+        peer_cpu = cpumask_first(&rqd->active);
+
+        if ( opt_runqueue == OPT_RUNQUEUE_ALL ||
+             (opt_runqueue == OPT_RUNQUEUE_CORE && same_core(peer_cpu, cpu)) ||
+             (opt_runqueue == OPT_RUNQUEUE_SOCKET && same_socket(peer_cpu, cpu)) ||
+             (opt_runqueue == OPT_RUNQUEUE_NODE && same_node(peer_cpu, cpu)) )
+            return rqi;
+    }
+
+    /* We really expect to be able to assign each cpu to a runqueue. */
+    BUG_ON(free_rqi >= nr_cpu_ids);
+
+    return free_rqi;
+}
+
 static void init_pcpu(const struct scheduler *ops, int cpu)
 {
     unsigned rqi;
@@ -2003,22 +2150,17 @@ static void init_pcpu(const struct scheduler *ops, int cpu)
     }
 
     /* Figure out which runqueue to put it in */
-    rqi = 0;
-
-    /* Figure out which runqueue to put it in */
-    /* NB: cpu 0 doesn't get a STARTING callback, so we hard-code it to runqueue 0. */
-    if ( cpu == 0 )
-        rqi = 0;
-    else
-        rqi = cpu_to_socket(cpu);
-
-    if ( rqi == XEN_INVALID_SOCKET_ID )
+    /* NB: cpu 0 doesn't get a STARTING callback, and is the first one
+     * to come along, so it always ends up activating runqueue 0. */
+    if ( cpu != 0 && cpu_to_socket(cpu) == XEN_INVALID_SOCKET_ID )
     {
         printk("%s: cpu_to_socket(%d) returned %d!\n",
-               __func__, cpu, rqi);
+               __func__, cpu, cpu_to_socket(cpu));
         BUG();
     }
 
+    rqi = cpu_to_runqueue(prv, cpu);
+
     rqd=prv->rqd + rqi;
 
     printk("Adding cpu %d to runqueue %d\n", cpu, rqi);
@@ -2168,6 +2310,8 @@ csched2_init(struct scheduler *ops)
     printk(" load_window_shift: %d\n", opt_load_window_shift);
     printk(" underload_balance_tolerance: %d\n", opt_underload_balance_tolerance);
     printk(" overload_balance_tolerance: %d\n", opt_overload_balance_tolerance);
+    printk(" node_balance_shift: %d\n", opt_node_balance_shift);
+    printk(" runqueues arrangement: per-%s\n", opt_runqueue_str[opt_runqueue]);
 
     if ( opt_load_window_shift < LOADAVG_WINDOW_SHIFT_MIN )
     {
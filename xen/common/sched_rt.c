@@ -26,6 +26,7 @@
 #include <xen/keyhandler.h>
 #include <xen/trace.h>
 #include <xen/guest_access.h>
+#include <xen/rbtree.h>
 
 /*
  * TODO:
@@ -62,6 +63,21 @@
  * The runqueue holds all runnable VCPUs with budget, sorted by deadline;
  * The depletedqueue holds all VCPUs without budget, unsorted;
  *
+ * The runqueue is a red-black tree, so inserting a VCPU costs O(log n)
+ * rather than a walk of the whole queue, and the earliest deadline is
+ * always its leftmost node.
+ *
+ * Replenishment:
+ * Every runnable VCPU (queued or running) also sits in a replenishment
+ * queue, a red-black tree sorted by the time of its next replenishment,
+ * i.e., its current deadline. A single timer per CPU pool is armed for
+ * the earliest of these events. When it fires, the VCPUs whose period
+ * has ended get their budget refilled and their deadline pushed back,
+ * the depleted ones are moved to the runqueue, and the pcpus which
+ * should now run something else are tickled. rt_schedule() therefore
+ * never has to scan the queues looking for VCPUs to replenish, and an
+ * idle pcpu does not need to be woken up periodically to do so.
+ *
  * Note: cpumask and cpupool is supported.
  */
 
@@ -76,6 +92,10 @@
  *
  * The functions involes RunQ and needs to grab locks are:
  *    vcpu_insert, vcpu_remove, context_saved, __runq_insert
+ *
+ * The replenishment timer handler grabs the global lock as well.
+ * Scheduling decisions stay global (that is what makes this global EDF),
+ * so all the pcpus of a pool keep sharing this single lock.
  */
 
 
@@ -87,7 +107,6 @@
 #define RTDS_DEFAULT_BUDGET     (MICROSECS(4000))
 
 #define UPDATE_LIMIT_SHIFT      10
-#define MAX_SCHEDULE            (MILLISECS(1))
 /*
  * Flags
  */
@@ -142,6 +161,8 @@ static cpumask_var_t *_cpumask_scratch;
  */
 static unsigned int nr_rt_ops;
 
+static void repl_timer_handler(void *data);
+
 /*
  * Systme-wide private data, include global RunQueue/DepletedQ
  * Global lock is referenced by schedule_data.schedule_lock from all
@@ -150,8 +171,11 @@ static unsigned int nr_rt_ops;
 struct rt_private {
     spinlock_t lock;            /* the global coarse grand lock */
     struct list_head sdom;      /* list of availalbe domains, used for dump */
-    struct list_head runq;      /* ordered list of runnable vcpus */
+    struct rb_root runq;        /* runnable vcpus, ordered by deadline */
     struct list_head depletedq; /* unordered list of depleted vcpus */
+    struct rb_root replq;       /* replenishment events, ordered by time */
+    struct timer repl_timer;    /* fires at the earliest replenishment */
+    cpumask_t cpus;             /* cpus assigned to this scheduler */
     cpumask_t tickled;          /* cpus been tickled */
 };
 
@@ -159,7 +183,9 @@ struct rt_private {
  * Virtual CPU
  */
 struct rt_vcpu {
-    struct list_head q_elem;    /* on the runq/depletedq list */
+    struct rb_node q_node;      /* on the runq tree */
+    struct list_head q_elem;    /* on the depletedq list */
+    struct rb_node replq_node;  /* on the replenishment queue */
     struct list_head sdom_elem; /* on the domain VCPU list */
 
     /* Up-pointers */
@@ -205,7 +231,7 @@ static inline struct rt_dom *rt_dom(const struct domain *dom)
     return dom->sched_priv;
 }
 
-static inline struct list_head *rt_runq(const struct scheduler *ops)
+static inline struct rb_root *rt_runq(const struct scheduler *ops)
 {
     return &rt_priv(ops)->runq;
 }
@@ -215,13 +241,30 @@ static inline struct list_head *rt_depletedq(const struct scheduler *ops)
     return &rt_priv(ops)->depletedq;
 }
 
+static inline struct rb_root *rt_replq(const struct scheduler *ops)
+{
+    return &rt_priv(ops)->replq;
+}
+
 /*
- * Queue helper functions for runq and depletedq
+ * Queue helper functions for runq, depletedq and replq
  */
+static int
+__vcpu_on_runq(const struct rt_vcpu *svc)
+{
+   return !RB_EMPTY_NODE(&svc->q_node);
+}
+
 static int
 __vcpu_on_q(const struct rt_vcpu *svc)
 {
-   return !list_empty(&svc->q_elem);
+   return __vcpu_on_runq(svc) || !list_empty(&svc->q_elem);
+}
+
+static int
+__vcpu_on_replq(const struct rt_vcpu *svc)
+{
+   return !RB_EMPTY_NODE(&svc->replq_node);
 }
 
 static struct rt_vcpu *
@@ -230,6 +273,18 @@ __q_elem(struct list_head *elem)
     return list_entry(elem, struct rt_vcpu, q_elem);
 }
 
+static struct rt_vcpu *
+__q_node(struct rb_node *node)
+{
+    return rb_entry(node, struct rt_vcpu, q_node);
+}
+
+static struct rt_vcpu *
+__replq_node(struct rb_node *node)
+{
+    return rb_entry(node, struct rt_vcpu, replq_node);
+}
+
 /*
  * Debug related code, dump vcpu/cpu information
  */
@@ -290,7 +345,8 @@ rt_dump_pcpu(const struct scheduler *ops, int cpu)
 static void
 rt_dump(const struct scheduler *ops)
 {
-    struct list_head *iter_sdom, *iter_svc, *runq, *depletedq, *iter;
+    struct list_head *iter_sdom, *iter_svc, *depletedq, *iter;
+    struct rb_node *node;
     struct rt_private *prv = rt_priv(ops);
     struct rt_vcpu *svc;
     struct rt_dom *sdom;
@@ -301,13 +357,12 @@ rt_dump(const struct scheduler *ops)
     if ( list_empty(&prv->sdom) )
         goto out;
 
-    runq = rt_runq(ops);
     depletedq = rt_depletedq(ops);
 
     printk("Global RunQueue info:\n");
-    list_for_each( iter, runq )
+    for ( node = rb_first(rt_runq(ops)); node; node = rb_next(node) )
     {
-        svc = __q_elem(iter);
+        svc = __q_node(node);
         rt_dump_vcpu(ops, svc);
     }
 
@@ -318,6 +373,13 @@ rt_dump(const struct scheduler *ops)
         rt_dump_vcpu(ops, svc);
     }
 
+    printk("Global Replenishment Events info:\n");
+    for ( node = rb_first(rt_replq(ops)); node; node = rb_next(node) )
+    {
+        svc = __replq_node(node);
+        rt_dump_vcpu(ops, svc);
+    }
+
     printk("Domain info:\n");
     list_for_each( iter_sdom, &prv->sdom )
     {
@@ -380,10 +442,47 @@ rt_update_deadline(s_time_t now, struct rt_vcpu *svc)
     return;
 }
 
+/*
+ * Insert node (belonging to svc) in a tree sorted by deadline. Among vcpus
+ * with the same deadline, the one inserted last goes first.
+ * Returns whether node became the first element of the tree.
+ */
+static int
+__deadline_insert(struct rt_vcpu *(*qelem)(struct rb_node *),
+                  struct rt_vcpu *svc, struct rb_node *node,
+                  struct rb_root *root)
+{
+    struct rb_node **link = &root->rb_node;
+    struct rb_node *parent = NULL;
+    int first = 1;
+
+    while ( *link != NULL )
+    {
+        parent = *link;
+        if ( svc->cur_deadline <= qelem(parent)->cur_deadline )
+            link = &parent->rb_left;
+        else
+        {
+            link = &parent->rb_right;
+            first = 0;
+        }
+    }
+
+    rb_link_node(node, parent, link);
+    rb_insert_color(node, root);
+
+    return first;
+}
+
 static inline void
-__q_remove(struct rt_vcpu *svc)
+__q_remove(const struct scheduler *ops, struct rt_vcpu *svc)
 {
-    if ( __vcpu_on_q(svc) )
+    if ( __vcpu_on_runq(svc) )
+    {
+        rb_erase(&svc->q_node, rt_runq(ops));
+        RB_CLEAR_NODE(&svc->q_node);
+    }
+    else if ( __vcpu_on_q(svc) )
         list_del_init(&svc->q_elem);
 }
 
@@ -396,8 +495,6 @@ static void
 __runq_insert(const struct scheduler *ops, struct rt_vcpu *svc)
 {
     struct rt_private *prv = rt_priv(ops);
-    struct list_head *runq = rt_runq(ops);
-    struct list_head *iter;
 
     ASSERT( spin_is_locked(&prv->lock) );
 
@@ -405,19 +502,66 @@ __runq_insert(const struct scheduler *ops, struct rt_vcpu *svc)
 
     /* add svc to runq if svc still has budget */
     if ( svc->cur_budget > 0 )
-    {
-        list_for_each(iter, runq)
-        {
-            struct rt_vcpu * iter_svc = __q_elem(iter);
-            if ( svc->cur_deadline <= iter_svc->cur_deadline )
-                    break;
-         }
-        list_add_tail(&svc->q_elem, iter);
-    }
+        __deadline_insert(__q_node, svc, &svc->q_node, &prv->runq);
     else
-    {
         list_add(&svc->q_elem, &prv->depletedq);
-    }
+}
+
+/*
+ * (Re)program the replenishment timer for the earliest pending event,
+ * or stop it if there are none. Before the first pcpu is assigned to
+ * this scheduler there is no timer yet; rt_alloc_pdata() arms it then.
+ */
+static void
+repl_timer_program(const struct scheduler *ops)
+{
+    struct rt_private *prv = rt_priv(ops);
+    struct rb_node *first = rb_first(&prv->replq);
+
+    if ( prv->repl_timer.status == TIMER_STATUS_invalid )
+        return;
+
+    if ( first != NULL )
+        set_timer(&prv->repl_timer, __replq_node(first)->cur_deadline);
+    else
+        stop_timer(&prv->repl_timer);
+}
+
+/*
+ * Add svc to the replenishment queue, to have its budget refilled at
+ * its current deadline.
+ */
+static void
+__replq_insert(const struct scheduler *ops, struct rt_vcpu *svc)
+{
+    struct rt_private *prv = rt_priv(ops);
+
+    ASSERT( spin_is_locked(&prv->lock) );
+
+    ASSERT( !__vcpu_on_replq(svc) );
+
+    if ( __deadline_insert(__replq_node, svc, &svc->replq_node, &prv->replq) )
+        repl_timer_program(ops);
+}
+
+static void
+__replq_remove(const struct scheduler *ops, struct rt_vcpu *svc)
+{
+    struct rt_private *prv = rt_priv(ops);
+    int was_first;
+
+    ASSERT( spin_is_locked(&prv->lock) );
+
+    if ( !__vcpu_on_replq(svc) )
+        return;
+
+    was_first = rb_first(&prv->replq) == &svc->replq_node;
+    rb_erase(&svc->replq_node, &prv->replq);
+    RB_CLEAR_NODE(&svc->replq_node);
+
+    /* The timer was armed for svc's replenishment: move it along. */
+    if ( was_first )
+        repl_timer_program(ops);
 }
 
 /*
@@ -447,9 +591,11 @@ rt_init(struct scheduler *ops)
 
     spin_lock_init(&prv->lock);
     INIT_LIST_HEAD(&prv->sdom);
-    INIT_LIST_HEAD(&prv->runq);
+    prv->runq = RB_ROOT;
     INIT_LIST_HEAD(&prv->depletedq);
+    prv->replq = RB_ROOT;
 
+    cpumask_clear(&prv->cpus);
     cpumask_clear(&prv->tickled);
 
     ops->sched_data = prv;
@@ -468,6 +614,9 @@ rt_deinit(const struct scheduler *ops)
 
     ASSERT( _cpumask_scratch && nr_rt_ops > 0 );
 
+    if ( prv->repl_timer.status != TIMER_STATUS_invalid )
+        kill_timer(&prv->repl_timer);
+
     if ( (--nr_rt_ops) == 0 )
     {
         xfree(_cpumask_scratch);
@@ -486,8 +635,19 @@ rt_alloc_pdata(const struct scheduler *ops, int cpu)
     struct rt_private *prv = rt_priv(ops);
     unsigned long flags;
 
+    /*
+     * The replenishment timer runs on one of our pcpus. Set it up on the
+     * first one we are given, or on the first one after the last was
+     * taken away from us (in which case the timer has been killed).
+     */
+    if ( prv->repl_timer.status == TIMER_STATUS_invalid ||
+         prv->repl_timer.status == TIMER_STATUS_killed )
+        init_timer(&prv->repl_timer, repl_timer_handler, (void *)ops, cpu);
+
     spin_lock_irqsave(&prv->lock, flags);
     per_cpu(schedule_data, cpu).schedule_lock = &prv->lock;
+    cpumask_set_cpu(cpu, &prv->cpus);
+    repl_timer_program(ops);
     spin_unlock_irqrestore(&prv->lock, flags);
 
     if ( !alloc_cpumask_var(&_cpumask_scratch[cpu]) )
@@ -510,9 +670,25 @@ rt_free_pdata(const struct scheduler *ops, void *pcpu, int cpu)
     ASSERT(sd->schedule_lock == &prv->lock);
     ASSERT(!spin_is_locked(&sd->_lock));
     sd->schedule_lock = &sd->_lock;
+    cpumask_clear_cpu(cpu, &prv->cpus);
 
     spin_unlock_irqrestore(&prv->lock, flags);
 
+    /*
+     * If the replenishment timer was living on this pcpu, move it to
+     * another one of ours, or kill it if this was the last. This can't
+     * happen with the lock held, as the handler may be spinning on it.
+     */
+    if ( prv->repl_timer.cpu == cpu )
+    {
+        unsigned int new_cpu = cpumask_first(&prv->cpus);
+
+        if ( new_cpu >= nr_cpu_ids )
+            kill_timer(&prv->repl_timer);
+        else
+            migrate_timer(&prv->repl_timer, new_cpu);
+    }
+
     free_cpumask_var(_cpumask_scratch[cpu]);
 }
 
@@ -586,7 +762,9 @@ rt_alloc_vdata(const struct scheduler *ops, struct vcpu *vc, void *dd)
     if ( svc == NULL )
         return NULL;
 
+    RB_CLEAR_NODE(&svc->q_node);
     INIT_LIST_HEAD(&svc->q_elem);
+    RB_CLEAR_NODE(&svc->replq_node);
     INIT_LIST_HEAD(&svc->sdom_elem);
     svc->flags = 0U;
     svc->sdom = dd;
@@ -622,16 +800,25 @@ rt_vcpu_insert(const struct scheduler *ops, struct vcpu *vc)
 {
     struct rt_vcpu *svc = rt_vcpu(vc);
     s_time_t now = NOW();
+    spinlock_t *lock;
 
     /* not addlocate idle vcpu to dom vcpu list */
     if ( is_idle_vcpu(vc) )
         return;
 
+    lock = vcpu_schedule_lock_irq(vc);
+
     if ( now >= svc->cur_deadline )
         rt_update_deadline(now, svc);
 
-    if ( !__vcpu_on_q(svc) && vcpu_runnable(vc) && !vc->is_running )
-        __runq_insert(ops, svc);
+    if ( !__vcpu_on_q(svc) && vcpu_runnable(vc) )
+    {
+        __replq_insert(ops, svc);
+        if ( !vc->is_running )
+            __runq_insert(ops, svc);
+    }
+
+    vcpu_schedule_unlock_irq(lock, vc);
 
     /* add rt_vcpu svc to scheduler-specific vcpu list of the dom */
     list_add_tail(&svc->sdom_elem, &svc->sdom->vcpu);
@@ -654,7 +841,8 @@ rt_vcpu_remove(const struct scheduler *ops, struct vcpu *vc)
 
     lock = vcpu_schedule_lock_irq(vc);
     if ( __vcpu_on_q(svc) )
-        __q_remove(svc);
+        __q_remove(ops, svc);
+    __replq_remove(ops, svc);
     vcpu_schedule_unlock_irq(lock, vc);
 
     if ( !is_idle_vcpu(vc) )
@@ -741,16 +929,15 @@ burn_budget(const struct scheduler *ops, struct rt_vcpu *svc, s_time_t now)
 static struct rt_vcpu *
 __runq_pick(const struct scheduler *ops, const cpumask_t *mask)
 {
-    struct list_head *runq = rt_runq(ops);
-    struct list_head *iter;
+    struct rb_node *node;
     struct rt_vcpu *svc = NULL;
     struct rt_vcpu *iter_svc = NULL;
     cpumask_t cpu_common;
     cpumask_t *online;
 
-    list_for_each(iter, runq)
+    for ( node = rb_first(rt_runq(ops)); node; node = rb_next(node) )
     {
-        iter_svc = __q_elem(iter);
+        iter_svc = __q_node(node);
 
         /* mask cpu_hard_affinity & cpupool & mask */
         online = cpupool_scheduler_cpumask(iter_svc->vcpu->domain->cpupool);
@@ -791,44 +978,6 @@ __runq_pick(const struct scheduler *ops, const cpumask_t *mask)
     return svc;
 }
 
-/*
- * Update vcpu's budget and
- * sort runq by insert the modifed vcpu back to runq
- * lock is grabbed before calling this function
- */
-static void
-__repl_update(const struct scheduler *ops, s_time_t now)
-{
-    struct list_head *runq = rt_runq(ops);
-    struct list_head *depletedq = rt_depletedq(ops);
-    struct list_head *iter;
-    struct list_head *tmp;
-    struct rt_vcpu *svc = NULL;
-
-    list_for_each_safe(iter, tmp, runq)
-    {
-        svc = __q_elem(iter);
-        if ( now < svc->cur_deadline )
-            break;
-
-        rt_update_deadline(now, svc);
-        /* reinsert the vcpu if its deadline is updated */
-        __q_remove(svc);
-        __runq_insert(ops, svc);
-    }
-
-    list_for_each_safe(iter, tmp, depletedq)
-    {
-        svc = __q_elem(iter);
-        if ( now >= svc->cur_deadline )
-        {
-            rt_update_deadline(now, svc);
-            __q_remove(svc); /* remove from depleted queue */
-            __runq_insert(ops, svc); /* add to runq */
-        }
-    }
-}
-
 /*
  * schedule function for rt scheduler.
  * The lock is already grabbed in schedule.c, no need to lock here
@@ -848,8 +997,6 @@ rt_schedule(const struct scheduler *ops, s_time_t now, bool_t tasklet_work_sched
     /* burn_budget would return for IDLE VCPU */
     burn_budget(ops, scurr, now);
 
-    __repl_update(ops, now);
-
     if ( tasklet_work_scheduled )
     {
         snext = rt_vcpu(idle_vcpu[cpu]);
@@ -879,7 +1026,7 @@ rt_schedule(const struct scheduler *ops, s_time_t now, bool_t tasklet_work_sched
     {
         if ( snext != scurr )
         {
-            __q_remove(snext);
+            __q_remove(ops, snext);
             set_bit(__RTDS_scheduled, &snext->flags);
         }
         if ( snext->vcpu->processor != cpu )
@@ -889,7 +1036,12 @@ rt_schedule(const struct scheduler *ops, s_time_t now, bool_t tasklet_work_sched
         }
     }
 
-    ret.time = MIN(snext->budget, MAX_SCHEDULE); /* sched quantum */
+    /*
+     * Run snext until it depletes its budget. Replenishments and wakeups
+     * tickle us if something else should run earlier, and an idle pcpu
+     * has nothing to do until that happens.
+     */
+    ret.time = is_idle_vcpu(snext->vcpu) ? -1 : snext->cur_budget;
     ret.task = snext->vcpu;
 
     /* TRACE */
@@ -925,10 +1077,17 @@ rt_vcpu_sleep(const struct scheduler *ops, struct vcpu *vc)
     BUG_ON( is_idle_vcpu(vc) );
     SCHED_STAT_CRANK(vcpu_sleep);
 
+    /*
+     * A running vcpu leaves the replenishment queue once it has been
+     * descheduled, in rt_context_saved().
+     */
     if ( curr_on_cpu(vc->processor) == vc )
         cpu_raise_softirq(vc->processor, SCHEDULE_SOFTIRQ);
     else if ( __vcpu_on_q(svc) )
-        __q_remove(svc);
+    {
+        __q_remove(ops, svc);
+        __replq_remove(ops, svc);
+    }
     else if ( test_bit(__RTDS_delayed_runq_add, &svc->flags) )
         clear_bit(__RTDS_delayed_runq_add, &svc->flags);
 }
@@ -1022,6 +1181,67 @@ out:
     return;
 }
 
+/*
+ * The replenishment timer handler. Refill the budget and move the deadline
+ * of all the vcpus whose period has ended, put the depleted ones back on
+ * the RunQ and tickle the pcpus where this makes a difference.
+ * Finally, program the timer for the next replenishment.
+ */
+static void
+repl_timer_handler(void *data)
+{
+    const struct scheduler *ops = data;
+    struct rt_private *prv = rt_priv(ops);
+    struct rb_node *node;
+    struct rt_vcpu *svc;
+    s_time_t now;
+
+    spin_lock_irq(&prv->lock);
+
+    now = NOW();
+
+    while ( (node = rb_first(&prv->replq)) != NULL )
+    {
+        svc = __replq_node(node);
+        if ( now < svc->cur_deadline )
+            break;
+
+        /* the new deadline is in the future, so we won't see svc again */
+        rb_erase(node, &prv->replq);
+        rt_update_deadline(now, svc);
+        __deadline_insert(__replq_node, svc, node, &prv->replq);
+
+        if ( curr_on_cpu(svc->vcpu->processor) == svc->vcpu )
+        {
+            /*
+             * svc is running, and its new deadline may make it lower in
+             * priority than the first vcpu in the RunQ: if so, tickle.
+             * Also, what it ran so far belongs to the previous period.
+             */
+            svc->last_start = now;
+            node = rb_first(&prv->runq);
+            if ( node != NULL &&
+                 __q_node(node)->cur_deadline < svc->cur_deadline )
+                runq_tickle(ops, __q_node(node));
+        }
+        else if ( __vcpu_on_q(svc) )
+        {
+            /* re-sort it in the RunQ, or move it there from DepletedQ */
+            __q_remove(ops, svc);
+            __runq_insert(ops, svc);
+            runq_tickle(ops, svc);
+        }
+        /*
+         * Otherwise svc is being context switched out, and it will be
+         * put back in the queues by rt_context_saved().
+         */
+    }
+
+    repl_timer_program(ops);
+
+    spin_unlock_irq(&prv->lock);
+}
+
 /*
  * Should always wake up runnable vcpu, put it back to RunQ.
  * Check priority to raise interrupt
@@ -1033,10 +1253,6 @@ rt_vcpu_wake(const struct scheduler *ops, struct vcpu *vc)
 {
     struct rt_vcpu * const svc = rt_vcpu(vc);
     s_time_t now = NOW();
-    struct rt_private *prv = rt_priv(ops);
-    struct rt_vcpu *snext = NULL; /* highest priority on RunQ */
-    struct rt_dom *sdom = NULL;
-    cpumask_t *online;
 
     BUG_ON( is_idle_vcpu(vc) );
 
@@ -1073,31 +1289,24 @@ rt_vcpu_wake(const struct scheduler *ops, struct vcpu *vc)
 
     /* insert svc to runq/depletedq because svc is not in queue now */
     __runq_insert(ops, svc);
+    __replq_insert(ops, svc);
 
-    __repl_update(ops, now);
-
-    ASSERT(!list_empty(&prv->sdom));
-    sdom = list_entry(prv->sdom.next, struct rt_dom, sdom_elem);
-    online = cpupool_scheduler_cpumask(sdom->dom->cpupool);
-    snext = __runq_pick(ops, online); /* pick snext from ALL valid cpus */
-
-    runq_tickle(ops, snext);
+    /* a depleted vcpu is tickled for when it gets replenished */
+    if ( __vcpu_on_runq(svc) )
+        runq_tickle(ops, svc);
 
     return;
 }
 
 /*
  * scurr has finished context switch, insert it back to the RunQ,
- * and then pick the highest priority vcpu from runq to run
+ * and then tickle a pcpu for it, if it should preempt someone.
+ * If it is not runnable any longer, it also stops being replenished.
  */
 static void
 rt_context_saved(const struct scheduler *ops, struct vcpu *vc)
 {
     struct rt_vcpu *svc = rt_vcpu(vc);
-    struct rt_vcpu *snext = NULL;
-    struct rt_dom *sdom = NULL;
-    struct rt_private *prv = rt_priv(ops);
-    cpumask_t *online;
     spinlock_t *lock = vcpu_schedule_lock_irq(vc);
 
     clear_bit(__RTDS_scheduled, &svc->flags);
@@ -1109,15 +1318,11 @@ rt_context_saved(const struct scheduler *ops, struct vcpu *vc)
          likely(vcpu_runnable(vc)) )
     {
         __runq_insert(ops, svc);
-        __repl_update(ops, NOW());
-
-        ASSERT(!list_empty(&prv->sdom));
-        sdom = list_entry(prv->sdom.next, struct rt_dom, sdom_elem);
-        online = cpupool_scheduler_cpumask(sdom->dom->cpupool);
-        snext = __runq_pick(ops, online); /* pick snext from ALL cpus */
-
-        runq_tickle(ops, snext);
+        if ( __vcpu_on_runq(svc) )
+            runq_tickle(ops, svc);
     }
+    else
+        __replq_remove(ops, svc);
 out:
     vcpu_schedule_unlock_irq(lock, vc);
 }
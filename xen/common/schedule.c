@@ -407,11 +407,9 @@ void vcpu_sleep_sync(struct vcpu *v)
     sync_vcpu_execstate(v);
 }
 
-void vcpu_wake(struct vcpu *v)
+/* The caller must hold v's scheduler lock. */
+void vcpu_wake_locked(struct vcpu *v)
 {
-    unsigned long flags;
-    spinlock_t *lock = vcpu_schedule_lock_irqsave(v, &flags);
-
     if ( likely(vcpu_runnable(v)) )
     {
         if ( v->runstate.state >= RUNSTATE_blocked )
@@ -423,8 +421,23 @@ void vcpu_wake(struct vcpu *v)
         if ( v->runstate.state == RUNSTATE_blocked )
             vcpu_runstate_change(v, RUNSTATE_offline, NOW());
     }
+}
 
-    vcpu_schedule_unlock_irqrestore(lock, flags, v);
+void vcpu_wake(struct vcpu *v)
+{
+    unsigned long flags;
+    spinlock_t *lock;
+
+    /*
+     * The scheduler may want to deal with the wakeup without us taking
+     * its lock here, e.g., by handing it over to v's pcpu.
+     */
+    if ( !SCHED_OP(VCPU2OP(v), wake_nolock, v) )
+    {
+        lock = vcpu_schedule_lock_irqsave(v, &flags);
+        vcpu_wake_locked(v);
+        vcpu_schedule_unlock_irqrestore(lock, flags, v);
+    }
 
     TRACE_2D(TRC_SCHED_WAKE, v->domain->domain_id, v->vcpu_id);
 }
@@ -461,6 +461,12 @@ static void timer_softirq_action(void)
 
     now = NOW();
 
+    /*
+     * Expiring timers often wake up vcpus: send the resulting IPIs once,
+     * to all the pcpus involved, after all the handlers have run.
+     */
+    cpu_raise_softirq_batch_begin();
+
     /* Execute ready heap timers. */
     while ( (GET_HEAP_SIZE(heap) != 0) &&
             ((t = heap[1])->expires < now) )
@@ -476,6 +482,8 @@ static void timer_softirq_action(void)
         execute_timer(ts, t);
     }
 
+    cpu_raise_softirq_batch_finish();
+
     /* Try to move timers from linked list to more efficient heap. */
     next = ts->list;
     ts->list = NULL;
@@ -20,6 +20,7 @@
 #include <xen/event.h>
 #include <xen/softirq.h>
 #include <xen/keyhandler.h>
+#include <xen/perfc.h>
 #include <xsm/xsm.h>
 
 static void parse_iommu_param(char *s);
@@ -57,6 +58,13 @@ bool_t __read_mostly amd_iommu_perdev_intremap = 1;
 
 DEFINE_PER_CPU(bool_t, iommu_dont_flush_iotlb);
 
+struct iommu_flush_batch {
+    struct domain *d;               /* domain with a flush pending, if any */
+    unsigned long first_gfn, last_gfn;
+    unsigned int nesting;
+};
+static DEFINE_PER_CPU(struct iommu_flush_batch, iommu_flush_batch);
+
 DEFINE_SPINLOCK(iommu_pt_cleanup_lock);
 PAGE_LIST_HEAD(iommu_pt_cleanup_list);
 static struct tasklet iommu_pt_cleanup_tasklet;
@@ -276,6 +284,59 @@ void iommu_iotlb_flush(struct domain *d, unsigned long gfn, unsigned int page_co
     hd->platform_ops->iotlb_flush(d, gfn, page_count);
 }
 
+static void iommu_flush_batch_issue(struct iommu_flush_batch *b)
+{
+    if ( !b->d )
+        return;
+
+    perfc_incr(iommu_flush_batch_issued);
+    iommu_iotlb_flush(b->d, b->first_gfn, b->last_gfn - b->first_gfn + 1);
+    b->d = NULL;
+}
+
+void iommu_flush_batch_start(void)
+{
+    this_cpu(iommu_flush_batch).nesting++;
+}
+
+void iommu_flush_batch_finish(void)
+{
+    struct iommu_flush_batch *b = &this_cpu(iommu_flush_batch);
+
+    ASSERT(b->nesting);
+    if ( !--b->nesting )
+        iommu_flush_batch_issue(b);
+}
+
+bool_t iommu_flush_batch_add(struct domain *d, unsigned long gfn,
+                             unsigned long page_count)
+{
+    struct iommu_flush_batch *b = &this_cpu(iommu_flush_batch);
+
+    if ( !b->nesting )
+        return 0;
+
+    /* Ranges of different domains can't be merged: flush the older one. */
+    if ( b->d && b->d != d )
+        iommu_flush_batch_issue(b);
+
+    if ( !b->d )
+    {
+        b->d = d;
+        b->first_gfn = gfn;
+        b->last_gfn = gfn + page_count - 1;
+    }
+    else
+    {
+        b->first_gfn = min(b->first_gfn, gfn);
+        b->last_gfn = max(b->last_gfn, gfn + page_count - 1);
+    }
+
+    perfc_incr(iommu_flush_batched);
+
+    return 1;
+}
+
 void iommu_iotlb_flush_all(struct domain *d)
 {
     struct hvm_iommu *hd = domain_hvm_iommu(d);
@@ -583,7 +583,7 @@ static void __intel_iommu_iotlb_flush(struct domain *d, unsigned long gfn,
         if ( iommu_domid == -1 )
             continue;
 
-        if ( page_count > 1 || gfn == -1 )
+        if ( !page_count || gfn == -1 )
         {
             if ( iommu_flush_iotlb_dsi(iommu, iommu_domid,
                         0, flush_dev_iotlb) )
@@ -591,8 +591,18 @@ static void __intel_iommu_iotlb_flush(struct domain *d, unsigned long gfn,
         }
         else
         {
+            /*
+             * Cover the range with one aligned block; PSI falls back to DSI
+             * if that's larger than the hardware's address mask allows.
+             */
+            unsigned long last = gfn + page_count - 1;
+            unsigned int order = 0;
+
+            while ( (gfn >> order) != (last >> order) )
+                order++;
+
             if ( iommu_flush_iotlb_psi(iommu, iommu_domid,
-                        (paddr_t)gfn << PAGE_SHIFT_4K, 0,
+                        (paddr_t)gfn << PAGE_SHIFT_4K, order,
                         !dma_old_pte_present, flush_dev_iotlb) )
                 iommu_flush_write_buffer(iommu);
         }
@@ -639,7 +649,8 @@ static void dma_pte_clear_one(struct domain *domain, u64 addr)
     spin_unlock(&hd->arch.mapping_lock);
     iommu_flush_cache_entry(pte, sizeof(struct dma_pte));
 
-    if ( !this_cpu(iommu_dont_flush_iotlb) )
+    if ( !this_cpu(iommu_dont_flush_iotlb) &&
+         !iommu_flush_batch_add(domain, addr >> PAGE_SHIFT_4K, 1) )
         __intel_iommu_iotlb_flush(domain, addr >> PAGE_SHIFT_4K, 1, 1);
 
     unmap_vtd_domain_page(page);
@@ -1735,7 +1746,9 @@ static int intel_iommu_map_page(
     spin_unlock(&hd->arch.mapping_lock);
     unmap_vtd_domain_page(page);
 
-    if ( !this_cpu(iommu_dont_flush_iotlb) )
+    /* New mappings only need the (cheap) non-present entry flush. */
+    if ( !this_cpu(iommu_dont_flush_iotlb) &&
+         !(dma_pte_present(old) && iommu_flush_batch_add(d, gfn, 1)) )
         __intel_iommu_iotlb_flush(d, gfn, dma_pte_present(old), 1);
 
     return 0;
@@ -1763,6 +1776,9 @@ void iommu_pte_flush(struct domain *d, u64 gfn, u64 *pte,
 
     iommu_flush_cache_entry(pte, sizeof(struct dma_pte));
 
+    if ( present && iommu_flush_batch_add(d, gfn, 1UL << order) )
+        return;
+
     for_each_drhd_unit ( drhd )
     {
         iommu = drhd->iommu;
@@ -106,6 +106,11 @@ struct shadow_domain {
 
     /* Shadow hashtable */
     struct page_info **hash_table;
+    unsigned int hash_buckets;  /* Current size of the table */
+    unsigned int hash_entries;  /* Shadows in the table */
+    unsigned int hash_resizes;
+    unsigned int hash_resize_to; /* Size wanted by a pending resize */
+    struct tasklet hash_resize_tasklet;
     bool_t hash_walking;  /* Some function is walking the hash table */
 
     /* Fast MMIO path heuristic */
@@ -163,6 +168,17 @@ struct hap_domain {
 /************************************************/
 /*       common paging data structure           */
 /************************************************/
+/*
+ * Optional ring of pfns whose log-dirty bit went from clean to dirty, so
+ * that the toolstack can fetch dirty pages without walking the radix tree.
+ */
+struct log_dirty_ring {
+    unsigned long *pfns;
+    unsigned int   size;       /* entries, power of two */
+    unsigned int   prod, cons; /* free running */
+    bool_t         overflow;   /* pfns dropped since the last CLEAN */
+};
+
 struct log_dirty_domain {
     /* log-dirty radix tree to record dirty pages */
     mfn_t          top;
@@ -173,6 +189,9 @@ struct log_dirty_domain {
     unsigned int   fault_count;
     unsigned int   dirty_count;
 
+    /* dirty pfn ring (XEN_DOMCTL_SHADOW_OP_DIRTY_RING_*) */
+    struct log_dirty_ring ring;
+
     /* functions which are paging mode specific */
     int            (*enable_log_dirty   )(struct domain *d, bool_t log_global);
     int            (*disable_log_dirty  )(struct domain *d);
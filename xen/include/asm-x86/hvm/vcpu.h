@@ -28,6 +28,7 @@
 #include <asm/hvm/svm/vmcb.h>
 #include <asm/hvm/svm/nestedsvm.h>
 #include <asm/mtrr.h>
+#include <asm/x86_emulate.h>
 
 enum hvm_io_completion {
     HVMIO_no_completion,
@@ -84,6 +85,9 @@ struct hvm_vcpu_io {
      */
     bool_t mmio_retry;
 
+    /* Decodes of recently emulated instructions. */
+    struct x86_insn_cache insn_cache;
+
     unsigned long msix_unmask_address;
 
     const struct g2m_ioport *g2m_ioport;
@@ -131,6 +131,8 @@ void vlapic_handle_EOI(struct vlapic *vlapic, u8 vector);
 void vlapic_ipi(struct vlapic *vlapic, uint32_t icr_low, uint32_t icr_high);
 
 int vlapic_apicv_write(struct vcpu *v, unsigned int offset);
+int vlapic_mmio_access(struct vcpu *v, unsigned int offset, bool_t write,
+                       uint32_t *val);
 
 struct vlapic *vlapic_lowest_prio(
     struct domain *d, const struct vlapic *source,
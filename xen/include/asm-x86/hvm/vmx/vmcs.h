@@ -68,8 +68,13 @@ struct ept_data {
         u64 eptp;
     };
     cpumask_var_t synced_mask;
+    /* Superpage reconstitution: next gfn to look at, 2M/1G pages rebuilt. */
+    unsigned long coalesce_gfn;
+    unsigned long coalesced[2];
 };
 
+extern bool_t opt_ept_coalesce;
+
 #define _VMX_DOMAIN_PML_ENABLED    0
 #define VMX_DOMAIN_PML_ENABLED     (1ul << _VMX_DOMAIN_PML_ENABLED)
 struct vmx_domain {
@@ -28,6 +28,7 @@
 
 #include <xen/config.h>
 #include <xen/paging.h>
+#include <xen/tasklet.h>
 #include <xen/p2m-common.h>
 #include <asm/mem_sharing.h>
 #include <asm/page.h>    /* for pagetable_t */
@@ -291,7 +292,15 @@ struct p2m_domain {
         long             count,        /* # of pages in cache lists         */
                          entry_count;  /* # of pages in p2m marked pod      */
         unsigned long    reclaim_single; /* Last gpfn of a scan */
+        unsigned long    reclaim_super;  /* Next gpfn of a background scan */
+        unsigned long    reclaim_found;  /* Pages reclaimed this scan pass */
+        s_time_t         reclaim_idle;   /* No background scan before this */
+        struct tasklet   reclaim_tasklet; /* Background reclaimer */
         unsigned long    max_guest;    /* gpfn of max guest demand-populate */
+        struct {                       /* Fault path statistics             */
+            unsigned long populates, sweeps, reclaimed;
+            s_time_t      populate_ns, populate_max_ns, sweep_ns;
+        } stats;
 #define POD_HISTORY_MAX 128
         /* gpfn of last guest superpage demand-populated */
         unsigned long    last_populated[POD_HISTORY_MAX]; 
@@ -573,6 +582,9 @@ int p2m_add_foreign(struct domain *tdom, unsigned long fgfn,
  * Populate-on-demand
  */
 
+/* Set up the PoD state of a p2m */
+void p2m_pod_init(struct p2m_domain *p2m);
+
 /* Dump PoD information about the domain */
 void p2m_pod_dump_data(struct domain *d);
 
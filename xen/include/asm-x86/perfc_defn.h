@@ -75,6 +75,10 @@ PERFCOUNTER(shadow_hash_lookup_miss, "shadow hash misses")
 PERFCOUNTER(shadow_get_shadow_status, "calls to get_shadow_status")
 PERFCOUNTER(shadow_hash_inserts,   "calls to shadow_hash_insert")
 PERFCOUNTER(shadow_hash_deletes,   "calls to shadow_hash_delete")
+PERFCOUNTER(shadow_hash_lookup_steps, "shadow hash chain entries walked")
+PERFCOUNTER(shadow_hash_resizes,   "shadow hash table resizes")
+PERFCOUNTER(paging_lock_taken,     "paging lock acquisitions")
+PERFCOUNTER(paging_lock_contended, "paging lock found held by another cpu")
 PERFCOUNTER(shadow_writeable,      "shadow removes write access")
 PERFCOUNTER(shadow_writeable_h_1,  "shadow writeable: 32b w2k3")
 PERFCOUNTER(shadow_writeable_h_2,  "shadow writeable: 32pae w2k3")
@@ -141,4 +145,13 @@ PERFCOUNTER(realmode_exits,      "vmexits from realmode")
 
 PERFCOUNTER(pauseloop_exits, "vmexits from Pause-Loop Detection")
 
+PERFCOUNTER(ioreq_posted_batches,   "posted ioreq batches")
+PERFCOUNTER(ioreq_posted_writes,    "posted ioreq writes")
+
+PERFCOUNTER(pod_reclaim_runs,       "PoD background reclaim runs")
+PERFCOUNTER(pod_reclaim_superpages, "PoD superpages reclaimed in background")
+PERFCOUNTER(pod_emergency_sweeps,   "PoD emergency sweeps")
+
+PERFCOUNTER(apic_access_fast,       "APIC accesses handled without emulation")
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
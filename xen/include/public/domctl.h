@@ -174,6 +174,22 @@ struct xen_domctl_getpageframeinfo3 {
 #define XEN_DOMCTL_SHADOW_OP_CLEAN       11
  /* Return the bitmap but do not modify internal copy. */
 #define XEN_DOMCTL_SHADOW_OP_PEEK        12
+ /*
+  * Set up a ring recording pfns as they become dirty, for consumers which
+  * only want the dirty pages and not a bitmap of the whole guest.  pages
+  * is the requested number of ring entries (0 tears the ring down).  Only
+  * supported for HAP guests in log-dirty mode.
+  */
+#define XEN_DOMCTL_SHADOW_OP_DIRTY_RING_SETUP 13
+ /*
+  * Fetch up to pages pfns from the dirty ring into dirty_bitmap (treated as
+  * an array of uint64_t) and clean them for the next round.  pages is
+  * updated with the number of pfns returned and stats.dirty_count with the
+  * number still queued.  Fails with -EOVERFLOW if pfns have been dropped
+  * since the last CLEAN, which must then be used instead (and which also
+  * resets the ring).
+  */
+#define XEN_DOMCTL_SHADOW_OP_DIRTY_RING_DRAIN 14
 
 /* Memory allocation accessors. */
 #define XEN_DOMCTL_SHADOW_OP_GET_ALLOCATION   30
@@ -225,7 +241,7 @@ struct xen_domctl_shadow_op {
     /* OP_GET_ALLOCATION / OP_SET_ALLOCATION */
     uint32_t       mb;       /* Shadow memory allocation in MB */
 
-    /* OP_PEEK / OP_CLEAN */
+    /* OP_PEEK / OP_CLEAN / OP_DIRTY_RING_* */
     XEN_GUEST_HANDLE_64(uint8) dirty_bitmap;
     uint64_aligned_t pages; /* Size of buffer. Updated with actual size. */
     struct xen_domctl_shadow_op_stats stats;
@@ -273,6 +273,12 @@ struct xen_hvm_create_ioreq_server {
  * the pointer pair gets read atomically:
  */
 #define HVM_IOREQSRV_BUFIOREQ_ATOMIC 2
+/*
+ * As ATOMIC, and the server understands buffered requests with wide
+ * addresses (see struct buf_ioreq), so that writes to posted ranges
+ * above 1MB can be buffered too:
+ */
+#define HVM_IOREQSRV_BUFIOREQ_WIDE   3
     uint8_t handle_bufioreq; /* IN - should server handle buffered ioreqs */
     ioservid_t id;           /* OUT - server id */
 };
@@ -321,6 +327,14 @@ DEFINE_XEN_GUEST_HANDLE(xen_hvm_get_ioreq_server_info_t);
  *
  * NOTE: unless an emulation request falls entirely within a range mapped
  * by a secondary emulator, it will not be passed to that emulator.
+ *
+ * A fourth type, HVMOP_IO_RANGE_POSTED, marks MMIO ranges (which must also
+ * be mapped as HVMOP_IO_RANGE_MEMORY) whose writes the emulator does not
+ * need to complete synchronously, e.g. doorbells or framebuffers.  Writes
+ * falling entirely within such a range are posted to the buffered ioreq
+ * ring whenever it has room, and the vcpu carries on without waiting.
+ * Repeated writes (REP MOVS/STOS) are posted as a batch with a single
+ * notification.
  */
 #define HVMOP_map_io_range_to_ioreq_server 19
 #define HVMOP_unmap_io_range_from_ioreq_server 20
@@ -331,6 +345,7 @@ struct xen_hvm_io_range {
 # define HVMOP_IO_RANGE_PORT   0 /* I/O port range */
 # define HVMOP_IO_RANGE_MEMORY 1 /* MMIO range */
 # define HVMOP_IO_RANGE_PCI    2 /* PCI segment/bus/dev/func range */
+# define HVMOP_IO_RANGE_POSTED 3 /* MMIO range with posted writes */
     uint64_aligned_t start, end; /* IN - inclusive start and end of range */
 };
 typedef struct xen_hvm_io_range xen_hvm_io_range_t;
@@ -71,9 +71,16 @@ struct shared_iopage {
 };
 typedef struct shared_iopage shared_iopage_t;
 
+/*
+ * Servers created with HVM_IOREQSRV_BUFIOREQ_WIDE may also be sent
+ * buffered requests above 1MB.  Those have <pad> set (it keeps its old
+ * name for existing users of this header), and the slot after the request
+ * (after the high data slot of an 8 byte request) carries address bits
+ * 20-51 in its <data> field.
+ */
 struct buf_ioreq {
     uint8_t  type;   /* I/O type                    */
-    uint8_t  pad:1;
+    uint8_t  pad:1;  /* wide: address continues in a further slot */
     uint8_t  dir:1;  /* 1=read, 0=write             */
     uint8_t  size:2; /* 0=>1, 1=>2, 2=>4, 3=>8. If 8, use two buf_ioreqs */
     uint32_t addr:20;/* physical address            */
@@ -447,6 +447,9 @@ DEFINE_XEN_GUEST_HANDLE(xen_mem_access_op_t);
 #define XENMEM_sharing_op_debug_gref        5
 #define XENMEM_sharing_op_add_physmap       6
 #define XENMEM_sharing_op_audit             7
+#define XENMEM_sharing_op_share_batch       8
+#define XENMEM_sharing_op_nominate_batch    9
+#define XENMEM_sharing_op_range_share       10
 
 #define XENMEM_SHARING_OP_S_HANDLE_INVALID  (-10)
 #define XENMEM_SHARING_OP_C_HANDLE_INVALID  (-9)
@@ -464,6 +467,23 @@ DEFINE_XEN_GUEST_HANDLE(xen_mem_access_op_t);
 #define XENMEM_SHARING_OP_FIELD_GET_GREF(field)        \
     ((field) & (~XENMEM_SHARING_OP_FIELD_IS_GREF_FLAG))
 
+/*
+ * One pair of pages for XENMEM_sharing_op_{nominate,share}_batch.
+ * nominate_batch fills in both handles (0 for a side which could not be
+ * nominated); share_batch takes them.
+ */
+struct xen_mem_sharing_batch_entry {
+    uint64_aligned_t source_gfn;    /* IN: the gfn of the source page */
+    uint64_aligned_t source_handle; /* IN/OUT: handle to the source page */
+    uint64_aligned_t client_gfn;    /* IN: the client gfn */
+    uint64_aligned_t client_handle; /* IN/OUT: handle to the client page */
+    domid_t  client_domain;         /* IN: the client domain id */
+    uint16_t pad;
+    int32_t  rc;                    /* OUT: result for this pair */
+};
+typedef struct xen_mem_sharing_batch_entry xen_mem_sharing_batch_entry_t;
+DEFINE_XEN_GUEST_HANDLE(xen_mem_sharing_batch_entry_t);
+
 struct xen_mem_sharing_op {
     uint8_t     op;     /* XENMEM_sharing_op_* */
     domid_t     domain;
@@ -490,6 +510,30 @@ struct xen_mem_sharing_op {
                 uint32_t gref;     /* IN: gref to debug         */
             } u;
         } debug;
+        struct mem_sharing_op_batch {     /* OP_{NOMINATE,SHARE}_BATCH */
+            /* IN/OUT: pairs to process, each with its own result */
+            XEN_GUEST_HANDLE_64(xen_mem_sharing_batch_entry_t) entries;
+            uint32_t nr;                  /* IN: number of entries */
+            uint32_t nr_shared;           /* OUT: pairs shared/nominated */
+            uint32_t done;                /* Must be 0 (used for
+                                             continuations) */
+            uint32_t pad;                 /* Must be 0 */
+        } batch;
+        /*
+         * Share every gfn in [first_gfn, last_gfn] of the domain with the
+         * same gfn of client_domain, without comparing contents.  Meant
+         * for domains started from the same memory image.  Both domains
+         * must be paused.  Pages which cannot be shared are skipped.
+         */
+        struct mem_sharing_op_range {     /* OP_RANGE_SHARE */
+            uint64_aligned_t first_gfn;   /* IN: first gfn to share */
+            uint64_aligned_t last_gfn;    /* IN: last gfn to share */
+            uint64_aligned_t opaque;      /* Must be 0 (used for
+                                             continuations) */
+            uint64_aligned_t nr_shared;   /* OUT: pages shared */
+            domid_t client_domain;        /* IN: the client domain id */
+            uint16_t pad[3];              /* Must be 0 */
+        } range;
     } u;
 };
 typedef struct xen_mem_sharing_op xen_mem_sharing_op_t;
@@ -197,6 +197,25 @@ void iommu_iotlb_flush_all(struct domain *d);
  */
 DECLARE_PER_CPU(bool_t, iommu_dont_flush_iotlb);
 
+/*
+ * IOTLB flush batching, for operations changing many mappings.  Between
+ * iommu_flush_batch_start() and iommu_flush_batch_finish(), the low level
+ * IOMMU code passes the flushes for entries which were present to
+ * iommu_flush_batch_add() rather than issuing them, and the range they
+ * cover gets flushed (waited for once) when the outermost batch finishes.
+ * iommu_flush_batch_add() returns 0 when no batch is open on this CPU, in
+ * which case the caller flushes as usual.
+ *
+ * The batch must be finished before anything relies on the old mappings
+ * being gone: before the pages get freed or handed back to their owner.
+ * It must also be finished before returning to the guest, e.g. when
+ * creating a continuation.
+ */
+void iommu_flush_batch_start(void);
+void iommu_flush_batch_finish(void);
+bool_t iommu_flush_batch_add(struct domain *d, unsigned long gfn,
+                             unsigned long page_count);
+
 extern struct spinlock iommu_pt_cleanup_lock;
 extern struct page_list_head iommu_pt_cleanup_list;
 
@@ -26,6 +26,9 @@ PERFCOUNTER(vcpu_wake_running,      "sched: vcpu_wake_running")
 PERFCOUNTER(vcpu_wake_onrunq,       "sched: vcpu_wake_onrunq")
 PERFCOUNTER(vcpu_wake_runnable,     "sched: vcpu_wake_runnable")
 PERFCOUNTER(vcpu_wake_not_runnable, "sched: vcpu_wake_not_runnable")
+PERFCOUNTER(vcpu_wake_queued,       "sched: vcpu_wake_queued")
+PERFCOUNTER(vcpu_wake_queued_again, "sched: vcpu_wake_queued_again")
+PERFCOUNTER(wake_queue_drain,       "sched: wake_queue_drain")
 PERFCOUNTER(tickle_idlers_none,     "sched: tickle_idlers_none")
 PERFCOUNTER(tickle_idlers_some,     "sched: tickle_idlers_some")
 PERFCOUNTER(vcpu_check,             "sched: vcpu_check")
@@ -58,6 +61,7 @@ PERFCOUNTER(upd_max_weight_full,    "csched2: update_max_weight_full")
 PERFCOUNTER(migrate_requested,      "csched2: migrate_requested")
 PERFCOUNTER(migrate_on_runq,        "csched2: migrate_on_runq")
 PERFCOUNTER(migrate_no_runq,        "csched2: migrate_no_runq")
+PERFCOUNTER(balance_remote_node,    "csched2: balance_remote_node")
 PERFCOUNTER(runtime_min_timer,      "csched2: runtime_min_timer")
 PERFCOUNTER(runtime_max_timer,      "csched2: runtime_max_timer")
 PERFCOUNTER(migrated,               "csched2: migrated")
@@ -66,4 +70,12 @@ PERFCOUNTER(credit_reset,           "csched2: credit_reset")
 
 PERFCOUNTER(need_flush_tlb_flush,   "PG_need_flush tlb flushes")
 
+PERFCOUNTER(maptrack_frames,        "gnttab: maptrack frames allocated")
+PERFCOUNTER(maptrack_steal,         "gnttab: maptrack steal attempts")
+PERFCOUNTER(maptrack_stolen,        "gnttab: maptrack entries stolen")
+PERFCOUNTER(maptrack_steal_failed,  "gnttab: maptrack steal failed")
+
+PERFCOUNTER(iommu_flush_batched,    "iommu: iotlb flushes batched")
+PERFCOUNTER(iommu_flush_batch_issued, "iommu: batched iotlb flushes issued")
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
@@ -111,6 +111,8 @@ static inline spinlock_t *pcpu_schedule_trylock(unsigned int cpu)
     return NULL;
 }
 
+void vcpu_wake_locked(struct vcpu *v);
+
 struct task_slice {
     struct vcpu *task;
     s_time_t     time;
@@ -145,6 +147,12 @@ struct scheduler {
 
     void         (*sleep)          (const struct scheduler *, struct vcpu *);
     void         (*wake)           (const struct scheduler *, struct vcpu *);
+    /*
+     * Optional, called by vcpu_wake() without holding any lock. Returns
+     * non-zero if the scheduler has taken charge of the wakeup, in which
+     * case it must call vcpu_wake_locked() later, with the vcpu's lock.
+     */
+    int          (*wake_nolock)    (const struct scheduler *, struct vcpu *);
     void         (*yield)          (const struct scheduler *, struct vcpu *);
     void         (*context_saved)  (const struct scheduler *, struct vcpu *);
 
@@ -1360,6 +1360,8 @@ static int flask_shadow_control(struct domain *d, uint32_t op)
     case XEN_DOMCTL_SHADOW_OP_ENABLE_LOGDIRTY:
     case XEN_DOMCTL_SHADOW_OP_PEEK:
     case XEN_DOMCTL_SHADOW_OP_CLEAN:
+    case XEN_DOMCTL_SHADOW_OP_DIRTY_RING_SETUP:
+    case XEN_DOMCTL_SHADOW_OP_DIRTY_RING_DRAIN:
         perm = SHADOW__LOGDIRTY;
         break;
     default: